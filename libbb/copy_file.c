@@ -34,6 +34,12 @@
 #include "libbb.h"
 
 int copy_file(const char *source, const char *dest, int flags)
+{
+	return copy_file_tap(source, dest, flags, NULL, NULL);
+}
+
+int copy_file_tap(const char *source, const char *dest, int flags,
+		  copy_file_tap_t tap, void *arg)
 {
 	struct stat source_stat;
 	struct stat dest_stat;
@@ -173,7 +179,7 @@ int copy_file(const char *source, const char *dest, int flags)
 			goto end;
 		}
 
-		if (copy_file_chunk(sfp, dfp, -1) < 0)
+		if (copy_file_chunk_tap(sfp, dfp, -1, tap, arg) < 0)
 			status = -1;
 
 		if (fclose(dfp) < 0) {
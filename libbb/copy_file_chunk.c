@@ -29,6 +29,14 @@
  * to DST_FILE.  */
 extern int copy_file_chunk(FILE * src_file, FILE * dst_file,
 			   unsigned long long chunksize)
+{
+	return copy_file_chunk_tap(src_file, dst_file, chunksize, NULL, NULL);
+}
+
+/* The same, passing every piece read to tap if it is not NULL. */
+extern int copy_file_chunk_tap(FILE * src_file, FILE * dst_file,
+			       unsigned long long chunksize,
+			       copy_file_tap_t tap, void *arg)
 {
 	size_t nread, nwritten, size;
 	char buffer[BUFSIZ];
@@ -53,6 +61,9 @@ extern int copy_file_chunk(FILE * src_file, FILE * dst_file,
 			return 0;
 		}
 
+		if (tap)
+			tap(buffer, nread, arg);
+
 		nwritten = fwrite(buffer, 1, nread, dst_file);
 
 		if (nwritten != nread) {
@@ -19,17 +19,18 @@
  */
 
 #include <stdio.h>
-#include <signal.h>
-#include <pthread.h>
 
+#include "unzip.h"
+
+/*
+ * Decompresses a gzip stream read either from file or from another
+ * gzip_handle, in process.
+ */
 struct gzip_handle {
 	FILE *file;
 	struct gzip_handle *gzip;
 
-	pid_t pid;
-	int rfd, wfd;
-	struct sigaction pipe_sa;
-	pthread_t thread;
+	struct unzip_ctx *unzip;
 };
 
 int gzip_exec(struct gzip_handle *zh, const char *filename);
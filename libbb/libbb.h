@@ -55,9 +55,17 @@ extern void archive_xread_all(int fd, char *buf, size_t count);
 const char *mode_string(int mode);
 const char *time_string(time_t timeVal);
 
+/* called with the data of a regular file as copy_file_tap() copies it */
+typedef void (*copy_file_tap_t)(const void *buf, size_t len, void *arg);
+
 int copy_file(const char *source, const char *dest, int flags);
+int copy_file_tap(const char *source, const char *dest, int flags,
+		  copy_file_tap_t tap, void *arg);
 int copy_file_chunk(FILE * src_file, FILE * dst_file,
 		    unsigned long long chunksize);
+int copy_file_chunk_tap(FILE * src_file, FILE * dst_file,
+			unsigned long long chunksize,
+			copy_file_tap_t tap, void *arg);
 ssize_t safe_read(int fd, void *buf, size_t count);
 ssize_t full_read(int fd, char *buf, int len);
 
@@ -108,9 +116,28 @@ char *deb_extract(const char *package_filename, FILE * out_stream,
 		  const int extract_function, const char *prefix,
 		  const char *filename, int *err);
 
+/*
+ * Package file of which the outer archive is walked once, on opening:
+ * control.tar.gz is kept in memory and data.tar.gz is found again by its
+ * offset in the decompressed outer archive, without reading its headers.
+ */
+struct ipk {
+	char *filename;
+	char *control;		/* control.tar.gz */
+	size_t control_len;
+	off_t data_offset;	/* of data.tar.gz, -1 if there is none */
+	char *data_names;	/* see ipk_data_names() */
+	size_t data_names_len;
+};
+
+struct ipk *ipk_open(const char *filename);
+void ipk_close(struct ipk *ipk);
+char *ipk_extract(struct ipk *ipk, FILE * out_stream,
+		  const int extract_function, const char *prefix,
+		  const char *filename, int *err);
+const char *ipk_data_names(struct ipk *ipk, size_t *len, int *err);
+
 extern int unzip(FILE * l_in_file, FILE * l_out_file);
-extern int gz_close(int gunzip_pid);
-extern FILE *gz_open(FILE * compressed_file, int *pid);
 
 int make_directory(const char *path, long mode, int flags);
 
@@ -596,3 +596,204 @@ cleanup:
 
 	return output_buffer;
 }
+
+/* walks the outer archive once, see struct ipk */
+struct ipk *ipk_open(const char *filename)
+{
+	struct gzip_handle tar_outer = { };
+	file_header_t *tar_header;
+	struct ipk *ipk;
+	FILE *deb_stream;
+	const char *name;
+	ssize_t len;
+
+	deb_stream = wfopen(filename, "r");
+	if (deb_stream == NULL)
+		return NULL;
+
+	setvbuf(deb_stream, NULL, _IOFBF, 0x8000);
+
+	ipk = xcalloc(1, sizeof(*ipk));
+	ipk->filename = xstrdup(filename);
+	ipk->data_offset = -1;
+
+	tar_outer.file = deb_stream;
+	gzip_exec(&tar_outer, NULL);
+
+	archive_offset = 0;
+	while ((tar_header = get_header_tar(&tar_outer)) != NULL) {
+		name = tar_header->name;
+		if (strncmp(name, "./", 2) == 0)
+			name += 2;
+
+		if (!ipk->control && !strcmp(name, "control.tar.gz")) {
+			ipk->control = xmalloc(tar_header->size + 1);
+			len = gzip_read(&tar_outer, ipk->control,
+					tar_header->size);
+			ipk->control_len = len > 0 ? len : 0;
+			archive_offset += ipk->control_len;
+		} else {
+			if (ipk->data_offset < 0 && !strcmp(name, "data.tar.gz"))
+				ipk->data_offset = archive_offset;
+
+			/* no need to inflate the rest once both are found */
+			if (!ipk->control || ipk->data_offset < 0)
+				seek_forward(&tar_outer, tar_header->size);
+		}
+
+		free_header_tar(tar_header);
+
+		if (ipk->control && ipk->data_offset >= 0)
+			break;
+	}
+
+	gzip_close(&tar_outer);
+
+	return ipk;
+}
+
+void ipk_close(struct ipk *ipk)
+{
+	if (!ipk)
+		return;
+
+	free(ipk->filename);
+	free(ipk->control);
+	free(ipk->data_names);
+	free(ipk);
+}
+
+/*
+ * Sets up tar_inner to decompress the member of ipk selected by
+ * extract_function, from memory or from tar_outer. Returns 1 if the
+ * package has no such member.
+ */
+static int ipk_open_member(struct ipk *ipk, const int extract_function,
+			   struct gzip_handle *tar_outer,
+			   struct gzip_handle *tar_inner)
+{
+	FILE *deb_stream;
+
+	if (extract_function & extract_control_tar_gz) {
+		if (!ipk->control_len)
+			return 1;
+
+		tar_inner->file = fmemopen(ipk->control, ipk->control_len, "r");
+		if (tar_inner->file == NULL) {
+			perror_msg("fmemopen");
+			return -1;
+		}
+	} else if (extract_function & extract_data_tar_gz) {
+		if (ipk->data_offset < 0)
+			return 1;
+
+		deb_stream = wfopen(ipk->filename, "r");
+		if (deb_stream == NULL)
+			return -1;
+
+		setvbuf(deb_stream, NULL, _IOFBF, 0x8000);
+
+		tar_outer->file = deb_stream;
+		gzip_exec(tar_outer, NULL);
+
+		archive_offset = 0;
+		if (seek_forward(tar_outer, ipk->data_offset) != ipk->data_offset) {
+			error_msg("Short read from %s", ipk->filename);
+			return -1;
+		}
+
+		tar_inner->gzip = tar_outer;
+	} else {
+		opkg_msg(ERROR, "Internal error: extract_function=%x\n",
+			 extract_function);
+		return -1;
+	}
+
+	gzip_exec(tar_inner, NULL);
+	archive_offset = 0;
+
+	return 0;
+}
+
+/* like deb_extract(), for a package opened with ipk_open() */
+char *ipk_extract(struct ipk *ipk, FILE * out_stream,
+		  const int extract_function, const char *prefix,
+		  const char *filename, int *err)
+{
+	struct gzip_handle tar_outer = { }, tar_inner = { };
+	const char *file_list[2] = { filename, NULL };
+	char *output_buffer = NULL;
+	int ret;
+
+	*err = 0;
+
+	ret = ipk_open_member(ipk, extract_function, &tar_outer, &tar_inner);
+	if (ret == 0)
+		output_buffer = unarchive(&tar_inner, out_stream,
+					  get_header_tar, free_header_tar,
+					  extract_function, prefix,
+					  filename ? file_list : NULL, err);
+	else if (ret < 0)
+		*err = -1;
+
+	gzip_close(&tar_inner);
+	gzip_close(&tar_outer);
+
+	return output_buffer;
+}
+
+/*
+ * Returns the names of the files in data.tar.gz, as a run of len bytes
+ * of NUL terminated strings. The names are read once and kept with ipk.
+ */
+const char *ipk_data_names(struct ipk *ipk, size_t *len, int *err)
+{
+	struct gzip_handle tar_outer = { }, tar_inner = { };
+	file_header_t *file_entry;
+	size_t n, alloc = 0;
+	int ret;
+
+	*err = 0;
+
+	if (ipk->data_names) {
+		*len = ipk->data_names_len;
+		return ipk->data_names;
+	}
+
+	ret = ipk_open_member(ipk, extract_data_tar_gz, &tar_outer, &tar_inner);
+	if (ret < 0)
+		*err = -1;
+
+	ipk->data_names_len = 0;
+	ipk->data_names = xmalloc(1);
+
+	while (ret == 0 && (file_entry = get_header_tar(&tar_inner)) != NULL) {
+		n = strlen(file_entry->name) + 1;
+
+		if (ipk->data_names_len + n > alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			if (alloc < ipk->data_names_len + n)
+				alloc = ipk->data_names_len + n;
+			ipk->data_names = xrealloc(ipk->data_names, alloc);
+		}
+
+		memcpy(ipk->data_names + ipk->data_names_len,
+		       file_entry->name, n);
+		ipk->data_names_len += n;
+
+		seek_forward(&tar_inner, file_entry->size);
+		free_header_tar(file_entry);
+	}
+
+	gzip_close(&tar_inner);
+	gzip_close(&tar_outer);
+
+	if (*err) {
+		free(ipk->data_names);
+		ipk->data_names = NULL;
+		return NULL;
+	}
+
+	*len = ipk->data_names_len;
+	return ipk->data_names;
+}
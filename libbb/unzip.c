@@ -41,1036 +41,1030 @@
  */
 
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <setjmp.h>
+#include <pthread.h>
 #include "libbb.h"
+#include "unzip.h"
 
-static FILE *in_file, *out_file;
+/*
+ * window size--must be a power of two, and
+ *  at least 32K for zip's deflate method
+ */
+#define WSIZE 0x8000
+
+/*
+ * In push mode a gzip header or the code length tables of a dynamic block
+ * have to fit into the input buffer as a whole.
+ */
+#define INBUFSIZ 0x4000
 
-static unsigned char *window;
-static unsigned long *crc_table = NULL;
+#define HUFF_MAX_BITS 15	/* maximum bit length of any code */
+#define HUFF_MAX_CODES 288	/* maximum number of codes in any set */
 
-static unsigned long crc;	/* shift register contents */
+/* codes up to this length are decoded with a single table lookup */
+#define HUFF_FAST_BITS 10
+#define HUFF_FAST_MASK ((1 << HUFF_FAST_BITS) - 1)
 
 /*
- * window size--must be a power of two, and
- *  at least 32K for zip's deflate method
+ * Decoding table of a canonical Huffman code. fast[] is indexed by the
+ * next HUFF_FAST_BITS input bits and holds (length << 9 | symbol) of the
+ * code they start with, or 0 if that code is longer. Longer codes are
+ * found by comparing the bit reversed input with maxcode[], the first
+ * code past the ones of each length, left aligned to 16 bits.
  */
-static const int WSIZE = 0x8000;
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-static const int BMAX = 16;	/* maximum bit length of any code (16 for explode) */
-static const int N_MAX = 288;	/* maximum number of codes in any set */
-
-static long bytes_out;		/* number of output bytes */
-static unsigned long outcnt;	/* bytes in output buffer */
-
-static unsigned hufts;		/* track memory usage */
-static unsigned long bb;	/* bit buffer */
-static unsigned bk;		/* bits in bit buffer */
-
-typedef struct huft_s {
-	unsigned char e;	/* number of extra bits or operation */
-	unsigned char b;	/* number of bits in this code or subcode */
-	union {
-		unsigned short n;	/* literal, length base, or distance base */
-		struct huft_s *t;	/* pointer to next level of table */
-	} v;
-} huft_t;
-
-static const unsigned short mask_bits[] = {
-	0x0000,
-	0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
-	0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
+struct huff {
+	uint16_t fast[1 << HUFF_FAST_BITS];
+	uint32_t maxcode[HUFF_MAX_BITS + 1];
+	uint16_t firstcode[HUFF_MAX_BITS + 1];
+	uint16_t firstsym[HUFF_MAX_BITS + 1];
+	uint8_t size[HUFF_MAX_CODES];
+	uint16_t value[HUFF_MAX_CODES];
+};
+
+enum unzip_state {
+	UNZIP_HEADER,		/* expecting a gzip member header */
+	UNZIP_BLOCK,		/* expecting a deflate block header */
+	UNZIP_STORED,		/* inside a stored block */
+	UNZIP_CODES,		/* inside a fixed or dynamic Huffman block */
+	UNZIP_TRAILER,		/* expecting the crc and length of a member */
+	UNZIP_DONE,
+	UNZIP_ERROR
+};
+
+/*
+ * All decoder state lives here instead of in globals, so any number of
+ * streams can be inflated at the same time. Output is produced into the
+ * sliding window, which is handed out before it wraps.
+ *
+ * Input is either pulled through read() or pushed with unzip_feed(). In
+ * the latter case the input may end anywhere, so decoding proceeds in
+ * units (a header, a block header with its tables, a single symbol, ...)
+ * which are committed as a whole. A unit running out of input jumps back
+ * to unzip_fill(), which rolls the input back to the last commit until
+ * more is fed.
+ */
+struct unzip_ctx {
+	unzip_read_fn read;
+	unzip_write_fn write;
+	void *priv;
+
+	unsigned char inbuf[INBUFSIZ];
+	size_t inptr, insize;
+	size_t unit_inptr;	/* input position of the last commit */
+	int in_eof;
+	int finishing;		/* push mode: no further input follows */
+	jmp_buf need_input;
+
+	uint64_t bb;		/* bit buffer */
+	unsigned bk;		/* bits in bit buffer */
+
+	unsigned char window[WSIZE];
+	unsigned long outcnt;	/* bytes decoded into the window */
+	unsigned long outptr;	/* bytes of the window handed out */
+	unsigned long crcptr;	/* bytes of the window added to the crc */
+
+	enum unzip_state state;
+	int n_members;
+	int last_block;
+
+	/* resume state of the current block */
+	unsigned long stored_len;
+	struct huff lit, dist;
+	unsigned long copy_len, copy_dist;
+
+	uint32_t crc;
+	unsigned long bytes_out;
+};
+
+static const unsigned short cplens[] = {	/* Copy lengths for literal codes 257..285 */
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char cplext[] = {	/* Extra bits for literal codes 257..285 */
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short cpdist[] = {	/* Copy offsets for distance codes 0..29 */
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const unsigned char cpdext[] = {	/* Extra bits for distance codes */
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 13, 13
 };
 
-//static int error_number = 0;
-/* ========================================================================
- * Signal and error handler.
+/* Order of the bit length code lengths */
+static const unsigned char border[] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*
+ * crc32 of polynomial 0xedb88320, as used by gzip. crc_table[0] is the
+ * classic bytewise table, crc_table[i] advances a byte by i more zero
+ * bytes, so eight input bytes are folded in with eight lookups.
  */
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
 
-static void abort_gzip()
+static void crc_table_init(void)
 {
-	error_msg("gzip aborted\n");
-	_exit(-1);
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+		crc_table[0][i] = c;
+	}
+
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^
+			    crc_table[0][crc_table[j - 1][i] & 0xff];
 }
 
-static void make_crc_table()
+uint32_t unzip_crc32(uint32_t crc, const void *buf, size_t len)
 {
-	unsigned long table_entry;	/* crc shift register */
-	unsigned long poly = 0;	/* polynomial exclusive-or pattern */
-	int i;			/* counter for all possible eight bit values */
-	int k;			/* byte being shifted into crc apparatus */
+	const unsigned char *p = buf;
+	uint32_t lo, hi;
 
-	/* terms of polynomial defining this crc (except x^32): */
-	static int p[] = { 0, 1, 2, 4, 5, 7, 8, 10, 11, 12, 16, 22, 23, 26 };
+	pthread_once(&crc_table_once, crc_table_init);
 
-	/* initial shift register value */
-	crc = 0xffffffffL;
-	crc_table = (unsigned long *)xmalloc(256 * sizeof(unsigned long));
+	crc = ~crc;
 
-	/* Make exclusive-or pattern from polynomial (0xedb88320) */
-	for (i = 0; i < sizeof(p) / sizeof(int); i++)
-		poly |= 1L << (31 - p[i]);
+	while (len >= 8) {
+		lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+		hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
 
-	/* Compute and print table of CRC's, five per line */
-	for (i = 0; i < 256; i++) {
-		table_entry = i;
-		/* The idea to initialize the register with the byte instead of
-		 * zero was stolen from Haruhiko Okumura's ar002
-		 */
-		for (k = 8; k; k--) {
-			table_entry =
-			    table_entry & 1 ? (table_entry >> 1) ^ poly :
-			    table_entry >> 1;
-		}
-		crc_table[i] = table_entry;
+		crc = crc_table[7][lo & 0xff] ^
+		    crc_table[6][(lo >> 8) & 0xff] ^
+		    crc_table[5][(lo >> 16) & 0xff] ^
+		    crc_table[4][lo >> 24] ^
+		    crc_table[3][hi & 0xff] ^
+		    crc_table[2][(hi >> 8) & 0xff] ^
+		    crc_table[1][(hi >> 16) & 0xff] ^
+		    crc_table[0][hi >> 24];
+
+		p += 8;
+		len -= 8;
 	}
+
+	while (len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
 }
 
-/* ===========================================================================
- * Write the output window window[0..outcnt-1] and update crc and bytes_out.
- * (Used for the decompressed data only.)
- */
-static void flush_window(void)
+/* account the window bytes decoded since the last call in the member crc */
+static void unzip_crc_update(struct unzip_ctx *ctx)
 {
-	int n;
+	unsigned long n = ctx->outcnt - ctx->crcptr;
 
-	if (outcnt == 0)
+	if (!n)
 		return;
 
-	for (n = 0; n < outcnt; n++) {
-		crc = crc_table[((int)crc ^ (window[n])) & 0xff] ^ (crc >> 8);
-	}
+	ctx->crc = unzip_crc32(ctx->crc, ctx->window + ctx->crcptr, n);
+	ctx->bytes_out += n;
+	ctx->crcptr = ctx->outcnt;
+}
+
+static void unzip_fail(struct unzip_ctx *ctx, const char *msg)
+{
+	if (ctx->state != UNZIP_ERROR)
+		error_msg("%s", msg);
+
+	ctx->state = UNZIP_ERROR;
+}
+
+/* pull mode: replace the consumed input buffer, returns 0 at the end */
+static int unzip_refill(struct unzip_ctx *ctx)
+{
+	ssize_t len;
+
+	if (!ctx->read || ctx->in_eof)
+		return 0;
 
-	if (fwrite(window, 1, outcnt, out_file) != outcnt) {
-		/*
-		 * The Parent process may not be interested in all the data we have,
-		 * in which case it will rudely close its end of the pipe and
-		 * wait for us to exit.
-		 */
-		if (errno == EPIPE)
-			_exit(EXIT_SUCCESS);
-
-		error_msg("Couldnt write");
-		_exit(EXIT_FAILURE);
+	do {
+		len = ctx->read(ctx->priv, ctx->inbuf, sizeof(ctx->inbuf));
+	} while (len < 0 && errno == EINTR);
+
+	if (len < 0)
+		unzip_fail(ctx, "read error");
+
+	if (len <= 0) {
+		ctx->in_eof = 1;
+		return 0;
 	}
-	bytes_out += (unsigned long)outcnt;
-	outcnt = 0;
+
+	ctx->inptr = ctx->unit_inptr = 0;
+	ctx->insize = len;
+
+	return 1;
 }
 
 /*
- * Free the malloc'ed tables built by huft_build(), which makes a linked
- * list of the tables it made, with the links in a dummy first entry of
- * each table.
- * t: table to free
+ * The current unit needs more input than there is. Unwinds to
+ * unzip_fill(), which either waits for unzip_feed() or fails.
  */
-static int huft_free(huft_t * t)
+static void __attribute__ ((noreturn)) unzip_short(struct unzip_ctx *ctx)
+{
+	if (ctx->read || ctx->finishing)
+		ctx->in_eof = 1;
+
+	longjmp(ctx->need_input, 1);
+}
+
+/* top up the bit buffer with whole bytes, at least n bits are needed */
+static void unzip_more(struct unzip_ctx *ctx, uint64_t * b, unsigned *k,
+		       unsigned n)
 {
-	huft_t *p, *q;
-
-	/* Go through linked list, freeing from the malloced (t[-1]) address. */
-	p = t;
-	while (p != (huft_t *) NULL) {
-		q = (--p)->v.t;
-		free((char *)p);
-		p = q;
+	while (*k <= 56) {
+		if (ctx->inptr == ctx->insize &&
+		    (*k >= n || !unzip_refill(ctx)))
+			break;
+
+		*b |= (uint64_t) ctx->inbuf[ctx->inptr++] << *k;
+		*k += 8;
 	}
-	return 0;
+
+	if (*k < n)
+		unzip_short(ctx);
 }
 
-/* Given a list of code lengths and a maximum table size, make a set of
- * tables to decode that set of codes.  Return zero on success, one if
- * the given code set is incomplete (the tables are still built in this
- * case), two if the input is invalid (all zero length codes or an
- * oversubscribed set of lengths), and three if not enough memory.
- *
- * b:	code lengths in bits (all assumed <= BMAX)
- * n:	number of codes (assumed <= N_MAX)
- * s:	number of simple-valued codes (0..s-1)
- * d:	list of base values for non-simple codes
- * e:	list of extra bits for non-simple codes
- * t:	result: starting table
- * m:	maximum lookup bits, returns actual
+#define NEEDBITS(n) \
+	do { \
+		if (k < (unsigned)(n)) \
+			unzip_more(ctx, &b, &k, (n)); \
+	} while (0)
+
+#define DUMPBITS(n) \
+	do { \
+		b >>= (n); \
+		k -= (n); \
+	} while (0)
+
+#define GETBITS(n) ((unsigned)b & ((1U << (n)) - 1))
+
+/* the input up to here is consumed for good */
+#define COMMIT() \
+	do { \
+		ctx->bb = b; \
+		ctx->bk = k; \
+		ctx->unit_inptr = ctx->inptr; \
+	} while (0)
+
+static unsigned bit_reverse(unsigned v, unsigned bits)
+{
+	v = ((v & 0xaaaa) >> 1) | ((v & 0x5555) << 1);
+	v = ((v & 0xcccc) >> 2) | ((v & 0x3333) << 2);
+	v = ((v & 0xf0f0) >> 4) | ((v & 0x0f0f) << 4);
+	v = ((v & 0xff00) >> 8) | ((v & 0x00ff) << 8);
+
+	return v >> (16 - bits);
+}
+
+/*
+ * Build the decoding table for the n code lengths in lens. Incomplete
+ * codes are accepted, their unused bit patterns fail to decode.
+ * Returns -1 for an over-subscribed set of lengths.
  */
-static int huft_build(unsigned int *b, const unsigned int n,
-		      const unsigned int s, const unsigned short *d,
-		      const unsigned short *e, huft_t ** t, int *m)
+static int huff_build(struct huff *h, const unsigned char *lens, unsigned n)
 {
-	unsigned a;		/* counter for codes of length k */
-	unsigned c[BMAX + 1];	/* bit length count table */
-	unsigned f;		/* i repeats in table every f entries */
-	int g;			/* maximum code length */
-	int h;			/* table level */
-	unsigned i;		/* counter, current code */
-	unsigned j;		/* counter */
-	int k;			/* number of bits in current code */
-	int l;			/* bits per table (returned in m) */
-	unsigned *p;		/* pointer into c[], b[], or v[] */
-	huft_t *q;		/* points to current table */
-	huft_t r;		/* table entry for structure assignment */
-	huft_t *u[BMAX];	/* table stack */
-	unsigned v[N_MAX];	/* values in order of bit length */
-	int w;			/* bits before this table == (l * h) */
-	unsigned x[BMAX + 1];	/* bit offsets, then code stack */
-	unsigned *xp;		/* pointer into x */
-	int y;			/* number of dummy codes added */
-	unsigned z;		/* number of entries in current table */
-
-	/* Generate counts for each bit length */
-	memset((void *)(c), 0, sizeof(c));
-	p = b;
-	i = n;
-	do {
-		c[*p]++;	/* assume all entries <= BMAX */
-		p++;		/* Can't combine with above line (Solaris bug) */
-	} while (--i);
-	if (c[0] == n) {	/* null input--all zero length codes */
-		*t = (huft_t *) NULL;
-		*m = 0;
-		return 0;
+	unsigned count[HUFF_MAX_BITS + 1], next[HUFF_MAX_BITS + 1];
+	unsigned code = 0, sym = 0;
+	unsigned i, j, s;
+
+	memset(count, 0, sizeof(count));
+	memset(h->fast, 0, sizeof(h->fast));
+
+	for (i = 0; i < n; i++)
+		count[lens[i]]++;
+
+	for (s = 1; s <= HUFF_MAX_BITS; s++) {
+		next[s] = code;
+		h->firstcode[s] = code;
+		h->firstsym[s] = sym;
+		code += count[s];
+		if (code > (1U << s))
+			return -1;
+		h->maxcode[s] = code << (16 - s);
+		code <<= 1;
+		sym += count[s];
 	}
 
-	/* Find minimum and maximum length, bound *m by those */
-	l = *m;
-	for (j = 1; j <= BMAX; j++)
-		if (c[j])
-			break;
-	k = j;			/* minimum code length */
-	if ((unsigned)l < j)
-		l = j;
-	for (i = BMAX; i; i--)
-		if (c[i])
-			break;
-	g = i;			/* maximum code length */
-	if ((unsigned)l > i)
-		l = i;
-	*m = l;
-
-	/* Adjust last length count to fill out codes, if needed */
-	for (y = 1 << j; j < i; j++, y <<= 1)
-		if ((y -= c[j]) < 0)
-			return 2;	/* bad input: more codes than bits */
-	if ((y -= c[i]) < 0)
-		return 2;
-	c[i] += y;
-
-	/* Generate starting offsets into the value table for each length */
-	x[1] = j = 0;
-	p = c + 1;
-	xp = x + 2;
-	while (--i) {		/* note that i == g from above */
-		*xp++ = (j += *p++);
+	for (i = 0; i < n; i++) {
+		s = lens[i];
+		if (!s)
+			continue;
+
+		j = next[s] - h->firstcode[s] + h->firstsym[s];
+		h->size[j] = s;
+		h->value[j] = i;
+
+		if (s <= HUFF_FAST_BITS)
+			for (j = bit_reverse(next[s], s);
+			     j < (1 << HUFF_FAST_BITS); j += 1 << s)
+				h->fast[j] = s << 9 | i;
+
+		next[s]++;
 	}
 
-	/* Make a table of values in order of bit lengths */
-	p = b;
-	i = 0;
-	do {
-		if ((j = *p++) != 0)
-			v[x[j]++] = i;
-	} while (++i < n);
-
-	/* Generate the Huffman codes and for each, make the table entries */
-	x[0] = i = 0;		/* first Huffman code is zero */
-	p = v;			/* grab values in bit order */
-	h = -1;			/* no tables yet--level -1 */
-	w = -l;			/* bits decoded == (l * h) */
-	u[0] = (huft_t *) NULL;	/* just to keep compilers happy */
-	q = (huft_t *) NULL;	/* ditto */
-	z = 0;			/* ditto */
-
-	/* go through the bit lengths (k already is bits in shortest code) */
-	for (; k <= g; k++) {
-		a = c[k];
-		while (a--) {
-			/* here i is the Huffman code of length k bits for value *p */
-			/* make tables up to required level */
-			while (k > w + l) {
-				h++;
-				w += l;	/* previous table always l bits */
-
-				/* compute minimum size table less than or equal to l bits */
-				z = (z = g - w) > (unsigned)l ? l : z;	/* upper limit on table size */
-				if ((f = 1 << (j = k - w)) > a + 1) {	/* try a k-w bit table *//* too few codes for k-w bit table */
-					f -= a + 1;	/* deduct codes from patterns left */
-					xp = c + k;
-					while (++j < z) {	/* try smaller tables up to z bits */
-						if ((f <<= 1) <= *++xp)
-							break;	/* enough codes to use up j bits */
-						f -= *xp;	/* else deduct codes from patterns */
-					}
-				}
-				z = 1 << j;	/* table entries for j-bit table */
-
-				/* allocate and link in new table */
-				if ((q =
-				     (huft_t *) xmalloc((z + 1) *
-							sizeof(huft_t))) ==
-				    NULL) {
-					if (h) {
-						huft_free(u[0]);
-					}
-					return 3;	/* not enough memory */
-				}
-				hufts += z + 1;	/* track memory usage */
-				*t = q + 1;	/* link to list for huft_free() */
-				*(t = &(q->v.t)) = NULL;
-				u[h] = ++q;	/* table starts after link */
-
-				/* connect to last table, if there is one */
-				if (h) {
-					x[h] = i;	/* save pattern for backing up */
-					r.b = (unsigned char)l;	/* bits to dump before this table */
-					r.e = (unsigned char)(16 + j);	/* bits in this table */
-					r.v.t = q;	/* pointer to this table */
-					j = i >> (w - l);	/* (get around Turbo C bug) */
-					u[h - 1][j] = r;	/* connect to last table */
-				}
-			}
+	return 0;
+}
 
-			/* set up table entry in r */
-			r.b = (unsigned char)(k - w);
-			if (p >= v + n)
-				r.e = 99;	/* out of values--invalid code */
-			else if (*p < s) {
-				r.e = (unsigned char)(*p < 256 ? 16 : 15);	/* 256 is end-of-block code */
-				r.v.n = (unsigned short)(*p);	/* simple code is just the value */
-				p++;	/* one compiler does not like *p++ */
-			} else {
-				r.e = (unsigned char)e[*p - s];	/* non-simple--look up in lists */
-				r.v.n = d[*p++ - s];
-			}
+/* decode a code longer than HUFF_FAST_BITS, -1 if it is not in the table */
+static int huff_decode_slow(const struct huff *h, uint64_t * b, unsigned *k)
+{
+	unsigned code = bit_reverse((unsigned)*b & 0xffff, 16);
+	unsigned i, s;
 
-			/* fill code-like entries with r */
-			f = 1 << (k - w);
-			for (j = i >> w; j < z; j += f)
-				q[j] = r;
+	for (s = HUFF_FAST_BITS + 1; s <= HUFF_MAX_BITS; s++)
+		if (code < h->maxcode[s])
+			break;
 
-			/* backwards increment the k-bit code i */
-			for (j = 1 << (k - 1); i & j; j >>= 1)
-				i ^= j;
-			i ^= j;
+	if (s > HUFF_MAX_BITS)
+		return -1;
 
-			/* backup over finished tables */
-			while ((i & ((1 << w) - 1)) != x[h]) {
-				h--;	/* don't need to update q */
-				w -= l;
-			}
-		}
-	}
-	/* Return true (1) if we were given an incomplete table */
-	return y != 0 && g != 1;
+	i = (code >> (16 - s)) - h->firstcode[s] + h->firstsym[s];
+	if (i >= HUFF_MAX_CODES || h->size[i] != s)
+		return -1;
+
+	*b >>= s;
+	*k -= s;
+
+	return h->value[i];
 }
 
+#define DECODE(h, sym) \
+	do { \
+		unsigned _e; \
+		NEEDBITS(HUFF_MAX_BITS); \
+		_e = (h)->fast[b & HUFF_FAST_MASK]; \
+		if (_e) { \
+			DUMPBITS(_e >> 9); \
+			(sym) = _e & 0x1ff; \
+		} else { \
+			(sym) = huff_decode_slow((h), &b, &k); \
+		} \
+	} while (0)
+
 /*
- * inflate (decompress) the codes in a deflated (compressed) block.
- * Return an error code or zero if it all goes ok.
- *
- * tl, td: literal/length and distance decoder tables
- * bl, bd: number of bits decoded by tl[] and td[]
+ * Inflate the codes of a fixed or dynamic block until the end of block
+ * or until the window is full. Returns 0 at the end of the block, 1 if
+ * the window is full and -1 on invalid data. A copy crossing the end of
+ * the window is remembered in copy_len and copy_dist and finished by the
+ * next call.
  */
-static int inflate_codes(huft_t * tl, huft_t * td, int bl, int bd)
+static int inflate_codes(struct unzip_ctx *ctx)
 {
-	unsigned long e;	/* table entry flag/number of extra bits */
+	const struct huff *lit = &ctx->lit, *dist = &ctx->dist;
+	unsigned char *window = ctx->window;
+	uint64_t b = ctx->bb;	/* bit buffer */
+	unsigned k = ctx->bk;	/* number of bits in bit buffer */
+	unsigned long w = ctx->outcnt;	/* current window position */
 	unsigned long n, d;	/* length and index for copy */
-	unsigned long w;	/* current window position */
-	huft_t *t;		/* pointer to table entry */
-	unsigned ml, md;	/* masks for bl and bd bits */
-	unsigned long b;	/* bit buffer */
-	unsigned k;		/* number of bits in bit buffer */
-
-	/* make local copies of globals */
-	b = bb;			/* initialize bit buffer */
-	k = bk;
-	w = outcnt;		/* initialize window position */
-
-	/* inflate the coded data */
-	ml = mask_bits[bl];	/* precompute masks for speed */
-	md = mask_bits[bd];
-	for (;;) {		/* do until end of block */
-		while (k < (unsigned)bl) {
-			b |= ((unsigned long)fgetc(in_file)) << k;
-			k += 8;
+	unsigned long e;
+	int sym, ret = 1;
+
+	n = ctx->copy_len;
+	d = ctx->copy_dist;
+	ctx->copy_len = 0;
+
+	while (1) {
+		/* finish the copy in progress */
+		while (n && w < WSIZE) {
+			e = WSIZE - ((d &= WSIZE - 1) > w ? d : w);
+			if (e > n)
+				e = n;
+			n -= e;
+			if (w - d >= e) {	/* (this test assumes unsigned comparison) */
+				memcpy(window + w, window + d, e);
+				w += e;
+				d += e;
+			} else	/* do it slow to avoid memcpy() overlap */
+				do {
+					window[w++] = window[d++];
+				} while (--e);
 		}
-		if ((e = (t = tl + ((unsigned)b & ml))->e) > 16)
-			do {
-				if (e == 99) {
-					return 1;
-				}
-				b >>= t->b;
-				k -= t->b;
-				e -= 16;
-				while (k < e) {
-					b |= ((unsigned long)fgetc(in_file)) <<
-					    k;
-					k += 8;
-				}
-			} while ((e =
-				  (t =
-				   t->v.t + ((unsigned)b & mask_bits[e]))->e) >
-				 16);
-		b >>= t->b;
-		k -= t->b;
-		if (e == 16) {	/* then it's a literal */
-			window[w++] = (unsigned char)t->v.n;
-			if (w == WSIZE) {
-				outcnt = (w), flush_window();
-				w = 0;
-			}
-		} else {	/* it's an EOB or a length */
 
-			/* exit if end of block */
-			if (e == 15) {
-				break;
-			}
+		if (w == WSIZE) {
+			ctx->copy_len = n;
+			ctx->copy_dist = d;
+			break;
+		}
 
-			/* get length of block to copy */
-			while (k < e) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
-			n = t->v.n + ((unsigned)b & mask_bits[e]);
-			b >>= e;
-			k -= e;
-
-			/* decode distance of block to copy */
-			while (k < (unsigned)bd) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
+		/* every symbol is a unit of its own */
+		ctx->outcnt = w;
+		COMMIT();
 
-			if ((e = (t = td + ((unsigned)b & md))->e) > 16)
-				do {
-					if (e == 99)
-						return 1;
-					b >>= t->b;
-					k -= t->b;
-					e -= 16;
-					while (k < e) {
-						b |= ((unsigned long)
-						      fgetc(in_file)) << k;
-						k += 8;
-					}
-				} while ((e =
-					  (t =
-					   t->v.t +
-					   ((unsigned)b & mask_bits[e]))->e) >
-					 16);
-			b >>= t->b;
-			k -= t->b;
-			while (k < e) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
-			d = w - t->v.n - ((unsigned)b & mask_bits[e]);
-			b >>= e;
-			k -= e;
-
-			/* do the copy */
-			do {
-				n -= (e =
-				      (e =
-				       WSIZE - ((d &= WSIZE - 1) > w ? d : w)) >
-				      n ? n : e);
-#if !defined(NOMEMCPY) && !defined(DEBUG)
-				if (w - d >= e) {	/* (this test assumes unsigned comparison) */
-					memcpy(window + w, window + d, e);
-					w += e;
-					d += e;
-				} else	/* do it slow to avoid memcpy() overlap */
-#endif /* !NOMEMCPY */
-					do {
-						window[w++] = window[d++];
-					} while (--e);
-				if (w == WSIZE) {
-					outcnt = (w), flush_window();
-					w = 0;
-				}
-			} while (n);
+		DECODE(lit, sym);
+
+		if ((unsigned)sym < 256) {
+			window[w++] = sym;
+			continue;
 		}
+
+		if (sym == 256) {	/* end of block */
+			ret = 0;
+			break;
+		}
+
+		/* get length of block to copy */
+		sym -= 257;
+		if ((unsigned)sym >= sizeof(cplens) / sizeof(cplens[0]))
+			return -1;
+		e = cplext[sym];
+		NEEDBITS(e);
+		n = cplens[sym] + GETBITS(e);
+		DUMPBITS(e);
+
+		/* decode distance of block to copy */
+		DECODE(dist, sym);
+		if ((unsigned)sym >= sizeof(cpdist) / sizeof(cpdist[0]))
+			return -1;
+		e = cpdext[sym];
+		NEEDBITS(e);
+		d = w - cpdist[sym] - GETBITS(e);
+		DUMPBITS(e);
 	}
 
-	/* restore the globals from the locals */
-	outcnt = w;		/* restore global window pointer */
-	bb = b;			/* restore global bit buffer */
-	bk = k;
+	ctx->outcnt = w;
+	COMMIT();
 
-	/* done */
-	return 0;
+	return ret;
 }
 
-/*
- * decompress an inflated block
- * e: last block flag
- *
- * GLOBAL VARIABLES: bb, kk,
- */
-static int inflate_block(int *e)
+/* read the code lengths of a dynamic block and build its tables */
+static int inflate_dynamic_tables(struct unzip_ctx *ctx, uint64_t * pb,
+				  unsigned *pk)
 {
-	unsigned t;		/* block type */
-	unsigned long b;	/* bit buffer */
-	unsigned k;		/* number of bits in bit buffer */
-	static unsigned short cplens[] = {	/* Copy lengths for literal codes 257..285 */
-		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0
-	};
-	/* note: see note #13 above about the 258 in this list. */
-	static unsigned short cplext[] = {	/* Extra bits for literal codes 257..285 */
-		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 99, 99
-	};			/* 99==invalid */
-	static unsigned short cpdist[] = {	/* Copy offsets for distance codes 0..29 */
-		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-		8193, 12289, 16385, 24577
-	};
-	static unsigned short cpdext[] = {	/* Extra bits for distance codes */
-		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-		7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-		12, 12, 13, 13
-	};
-
-	/* make local bit buffer */
-	b = bb;
-	k = bk;
-
-	/* read in last block bit */
-	while (k < 1) {
-		b |= ((unsigned long)fgetc(in_file)) << k;
-		k += 8;
-	}
-	*e = (int)b & 1;
-	b >>= 1;
-	k -= 1;
-
-	/* read in block type */
-	while (k < 2) {
-		b |= ((unsigned long)fgetc(in_file)) << k;
-		k += 8;
+	unsigned char lens[286 + 30];	/* literal/length and distance code lengths */
+	unsigned char bl_lens[19];	/* bit length code lengths */
+	struct huff *bl = &ctx->dist;	/* until the distance codes are known */
+	uint64_t b = *pb;
+	unsigned k = *pk;
+	unsigned nl, nd, nb;	/* number of codes of each kind */
+	unsigned i, rep, len;
+	int sym;
+
+	/* read in table lengths */
+	NEEDBITS(14);
+	nl = 257 + GETBITS(5);
+	DUMPBITS(5);
+	nd = 1 + GETBITS(5);
+	DUMPBITS(5);
+	nb = 4 + GETBITS(4);
+	DUMPBITS(4);
+
+	if (nl > 286 || nd > 30)
+		return -1;
+
+	/* read in bit-length-code lengths */
+	memset(bl_lens, 0, sizeof(bl_lens));
+	for (i = 0; i < nb; i++) {
+		NEEDBITS(3);
+		bl_lens[border[i]] = GETBITS(3);
+		DUMPBITS(3);
 	}
-	t = (unsigned)b & 3;
-	b >>= 2;
-	k -= 2;
 
-	/* restore the global bit buffer */
-	bb = b;
-	bk = k;
+	if (huff_build(bl, bl_lens, sizeof(bl_lens)))
+		return -1;
+
+	/* read in literal and distance code lengths */
+	for (i = 0; i < nl + nd; i += rep) {
+		DECODE(bl, sym);
 
-	/* inflate that block type */
-	switch (t) {
-	case 0:		/* Inflate stored */
-		{
-			unsigned long n;	/* number of bytes in block */
-			unsigned long w;	/* current window position */
-			unsigned long b_stored;	/* bit buffer */
-			unsigned long k_stored;	/* number of bits in bit buffer */
-
-			/* make local copies of globals */
-			b_stored = bb;	/* initialize bit buffer */
-			k_stored = bk;
-			w = outcnt;	/* initialize window position */
-
-			/* go to byte boundary */
-			n = k_stored & 7;
-			b_stored >>= n;
-			k_stored -= n;
-
-			/* get the length and its complement */
-			while (k_stored < 16) {
-				b_stored |=
-				    ((unsigned long)fgetc(in_file)) << k_stored;
-				k_stored += 8;
-			}
-			n = ((unsigned)b_stored & 0xffff);
-			b_stored >>= 16;
-			k_stored -= 16;
-			while (k_stored < 16) {
-				b_stored |=
-				    ((unsigned long)fgetc(in_file)) << k_stored;
-				k_stored += 8;
-			}
-			if (n != (unsigned)((~b_stored) & 0xffff)) {
-				return 1;	/* error in compressed data */
-			}
-			b_stored >>= 16;
-			k_stored -= 16;
-
-			/* read and output the compressed data */
-			while (n--) {
-				while (k_stored < 8) {
-					b_stored |=
-					    ((unsigned long)fgetc(in_file)) <<
-					    k_stored;
-					k_stored += 8;
-				}
-				window[w++] = (unsigned char)b_stored;
-				if (w == (unsigned long)WSIZE) {
-					outcnt = (w), flush_window();
-					w = 0;
-				}
-				b_stored >>= 8;
-				k_stored -= 8;
-			}
+		if (sym < 0)
+			return -1;
 
-			/* restore the globals from the locals */
-			outcnt = w;	/* restore global window pointer */
-			bb = b_stored;	/* restore global bit buffer */
-			bk = k_stored;
-			return 0;
+		if (sym < 16) {
+			lens[i] = sym;
+			rep = 1;
+			continue;
 		}
-	case 1:		/* Inflate fixed
-				 * decompress an inflated type 1 (fixed Huffman codes) block.  We should
-				 * either replace this with a custom decoder, or at least precompute the
-				 * Huffman tables.
-				 */
-		{
-			int i;	/* temporary variable */
-			huft_t *tl;	/* literal/length code table */
-			huft_t *td;	/* distance code table */
-			int bl;	/* lookup bits for tl */
-			int bd;	/* lookup bits for td */
-			unsigned int l[288];	/* length list for huft_build */
-
-			/* set up literal table */
-			for (i = 0; i < 144; i++) {
-				l[i] = 8;
-			}
-			for (; i < 256; i++) {
-				l[i] = 9;
-			}
-			for (; i < 280; i++) {
-				l[i] = 7;
-			}
-			for (; i < 288; i++) {	/* make a complete, but wrong code set */
-				l[i] = 8;
-			}
-			bl = 7;
-			if ((i =
-			     huft_build(l, 288, 257, cplens, cplext, &tl,
-					&bl)) != 0) {
-				return i;
-			}
 
-			/* set up distance table */
-			for (i = 0; i < 30; i++) {	/* make an incomplete code set */
-				l[i] = 5;
-			}
-			bd = 5;
-			if ((i =
-			     huft_build(l, 30, 0, cpdist, cpdext, &td,
-					&bd)) > 1) {
-				huft_free(tl);
-				return i;
-			}
+		if (sym == 16) {	/* repeat last length 3 to 6 times */
+			if (!i)
+				return -1;
+			NEEDBITS(2);
+			rep = 3 + GETBITS(2);
+			DUMPBITS(2);
+			len = lens[i - 1];
+		} else if (sym == 17) {	/* 3 to 10 zero length codes */
+			NEEDBITS(3);
+			rep = 3 + GETBITS(3);
+			DUMPBITS(3);
+			len = 0;
+		} else {	/* 11 to 138 zero length codes */
+			NEEDBITS(7);
+			rep = 11 + GETBITS(7);
+			DUMPBITS(7);
+			len = 0;
+		}
 
-			/* decompress until an end-of-block code */
-			if (inflate_codes(tl, td, bl, bd)) {
-				huft_free(tl);
-				huft_free(td);
-				return 1;
-			}
+		if (i + rep > nl + nd)
+			return -1;
 
-			/* free the decoding tables, return */
-			huft_free(tl);
-			huft_free(td);
-			return 0;
-		}
-	case 2:		/* Inflate dynamic */
-		{
-			/* Tables for deflate from PKZIP's appnote.txt. */
-			static unsigned border[] = {	/* Order of the bit length code lengths */
-				16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3,
-				    13, 2, 14, 1, 15
-			};
-			int dbits = 6;	/* bits in base distance lookup table */
-			int lbits = 9;	/* bits in base literal/length lookup table */
-
-			int i;	/* temporary variables */
-			unsigned j;
-			unsigned l;	/* last length */
-			unsigned m;	/* mask for bit lengths table */
-			unsigned n;	/* number of lengths to get */
-			huft_t *tl;	/* literal/length code table */
-			huft_t *td;	/* distance code table */
-			int bl;	/* lookup bits for tl */
-			int bd;	/* lookup bits for td */
-			unsigned nb;	/* number of bit length codes */
-			unsigned nl;	/* number of literal/length codes */
-			unsigned nd;	/* number of distance codes */
-
-			unsigned ll[286 + 30];	/* literal/length and distance code lengths */
-			unsigned long b_dynamic;	/* bit buffer */
-			unsigned k_dynamic;	/* number of bits in bit buffer */
-
-			/* make local bit buffer */
-			b_dynamic = bb;
-			k_dynamic = bk;
-
-			/* read in table lengths */
-			while (k_dynamic < 5) {
-				b_dynamic |=
-				    ((unsigned long)fgetc(in_file)) <<
-				    k_dynamic;
-				k_dynamic += 8;
-			}
-			nl = 257 + ((unsigned)b_dynamic & 0x1f);	/* number of literal/length codes */
-			b_dynamic >>= 5;
-			k_dynamic -= 5;
-			while (k_dynamic < 5) {
-				b_dynamic |=
-				    ((unsigned long)fgetc(in_file)) <<
-				    k_dynamic;
-				k_dynamic += 8;
-			}
-			nd = 1 + ((unsigned)b_dynamic & 0x1f);	/* number of distance codes */
-			b_dynamic >>= 5;
-			k_dynamic -= 5;
-			while (k_dynamic < 4) {
-				b_dynamic |=
-				    ((unsigned long)fgetc(in_file)) <<
-				    k_dynamic;
-				k_dynamic += 8;
-			}
-			nb = 4 + ((unsigned)b_dynamic & 0xf);	/* number of bit length codes */
-			b_dynamic >>= 4;
-			k_dynamic -= 4;
-			if (nl > 286 || nd > 30) {
-				return 1;	/* bad lengths */
-			}
+		memset(lens + i, len, rep);
+	}
 
-			/* read in bit-length-code lengths */
-			for (j = 0; j < nb; j++) {
-				while (k_dynamic < 3) {
-					b_dynamic |=
-					    ((unsigned long)fgetc(in_file)) <<
-					    k_dynamic;
-					k_dynamic += 8;
-				}
-				ll[border[j]] = (unsigned)b_dynamic & 7;
-				b_dynamic >>= 3;
-				k_dynamic -= 3;
-			}
-			for (; j < 19; j++) {
-				ll[border[j]] = 0;
-			}
+	/* a block without an end of block code cannot end */
+	if (!lens[256])
+		return -1;
 
-			/* build decoding table for trees--single level, 7 bit lookup */
-			bl = 7;
-			if ((i =
-			     huft_build(ll, 19, 19, NULL, NULL, &tl,
-					&bl)) != 0) {
-				if (i == 1) {
-					huft_free(tl);
-				}
-				return i;	/* incomplete code set */
-			}
+	if (huff_build(&ctx->lit, lens, nl) ||
+	    huff_build(&ctx->dist, lens + nl, nd))
+		return -1;
 
-			/* read in literal and distance code lengths */
-			n = nl + nd;
-			m = mask_bits[bl];
-			i = l = 0;
-			while ((unsigned)i < n) {
-				while (k_dynamic < (unsigned)bl) {
-					b_dynamic |=
-					    ((unsigned long)fgetc(in_file)) <<
-					    k_dynamic;
-					k_dynamic += 8;
-				}
-				j = (td = tl + ((unsigned)b_dynamic & m))->b;
-				b_dynamic >>= j;
-				k_dynamic -= j;
-				j = td->v.n;
-				if (j < 16) {	/* length of code in bits (0..15) */
-					ll[i++] = l = j;	/* save last length in l */
-				} else if (j == 16) {	/* repeat last length 3 to 6 times */
-					while (k_dynamic < 2) {
-						b_dynamic |=
-						    ((unsigned long)
-						     fgetc(in_file)) <<
-						    k_dynamic;
-						k_dynamic += 8;
-					}
-					j = 3 + ((unsigned)b_dynamic & 3);
-					b_dynamic >>= 2;
-					k_dynamic -= 2;
-					if ((unsigned)i + j > n) {
-						return 1;
-					}
-					while (j--) {
-						ll[i++] = l;
-					}
-				} else if (j == 17) {	/* 3 to 10 zero length codes */
-					while (k_dynamic < 3) {
-						b_dynamic |=
-						    ((unsigned long)
-						     fgetc(in_file)) <<
-						    k_dynamic;
-						k_dynamic += 8;
-					}
-					j = 3 + ((unsigned)b_dynamic & 7);
-					b_dynamic >>= 3;
-					k_dynamic -= 3;
-					if ((unsigned)i + j > n) {
-						return 1;
-					}
-					while (j--) {
-						ll[i++] = 0;
-					}
-					l = 0;
-				} else {	/* j == 18: 11 to 138 zero length codes */
-					while (k_dynamic < 7) {
-						b_dynamic |=
-						    ((unsigned long)
-						     fgetc(in_file)) <<
-						    k_dynamic;
-						k_dynamic += 8;
-					}
-					j = 11 + ((unsigned)b_dynamic & 0x7f);
-					b_dynamic >>= 7;
-					k_dynamic -= 7;
-					if ((unsigned)i + j > n) {
-						return 1;
-					}
-					while (j--) {
-						ll[i++] = 0;
-					}
-					l = 0;
-				}
-			}
+	*pb = b;
+	*pk = k;
 
-			/* free decoding table for trees */
-			huft_free(tl);
-
-			/* restore the global bit buffer */
-			bb = b_dynamic;
-			bk = k_dynamic;
-
-			/* build the decoding tables for literal/length and distance codes */
-			bl = lbits;
-			if ((i =
-			     huft_build(ll, nl, 257, cplens, cplext, &tl,
-					&bl)) != 0) {
-				if (i == 1) {
-					error_msg("Incomplete literal tree");
-					huft_free(tl);
-				}
-				return i;	/* incomplete code set */
-			}
-			bd = dbits;
-			if ((i =
-			     huft_build(ll + nl, nd, 0, cpdist, cpdext, &td,
-					&bd)) != 0) {
-				if (i == 1) {
-					error_msg("incomplete distance tree");
-					huft_free(td);
-				}
-				huft_free(tl);
-				return i;	/* incomplete code set */
-			}
+	return 0;
+}
 
-			/* decompress until an end-of-block code */
-			if (inflate_codes(tl, td, bl, bd)) {
-				huft_free(tl);
-				huft_free(td);
-				return 1;
-			}
+static void inflate_fixed_tables(struct unzip_ctx *ctx)
+{
+	unsigned char lens[HUFF_MAX_CODES];
 
-			/* free the decoding tables, return */
-			huft_free(tl);
-			huft_free(td);
-			return 0;
-		}
+	memset(lens, 8, 144);
+	memset(lens + 144, 9, 256 - 144);
+	memset(lens + 256, 7, 280 - 256);
+	memset(lens + 280, 8, HUFF_MAX_CODES - 280);
+	huff_build(&ctx->lit, lens, HUFF_MAX_CODES);
+
+	memset(lens, 5, 30);
+	huff_build(&ctx->dist, lens, 30);
+}
+
+/* read the header of the next deflate block and prepare to inflate it */
+static void inflate_block(struct unzip_ctx *ctx)
+{
+	uint64_t b = ctx->bb;
+	unsigned k = ctx->bk;
+	unsigned t;		/* block type */
+
+	/* read in last block bit and block type */
+	NEEDBITS(3);
+	ctx->last_block = GETBITS(1);
+	t = GETBITS(3) >> 1;
+	DUMPBITS(3);
+
+	switch (t) {
+	case 0:		/* stored */
+		/* go to byte boundary */
+		DUMPBITS(k & 7);
+
+		/* get the length and its complement */
+		NEEDBITS(32);
+		ctx->stored_len = GETBITS(16);
+		if (ctx->stored_len != ((~(unsigned)b >> 16) & 0xffff))
+			goto err;
+		DUMPBITS(32);
+		ctx->state = UNZIP_STORED;
+		break;
+	case 1:		/* fixed Huffman codes */
+		inflate_fixed_tables(ctx);
+		ctx->state = UNZIP_CODES;
+		break;
+	case 2:		/* dynamic Huffman codes */
+		if (inflate_dynamic_tables(ctx, &b, &k))
+			goto err;
+		ctx->state = UNZIP_CODES;
+		break;
 	default:
-		/* bad block type */
-		return 2;
+		goto err;
 	}
+
+	COMMIT();
+	return;
+
+err:
+	unzip_fail(ctx, "invalid compressed data--format violated");
 }
 
-/*
- * decompress an inflated entry
- *
- * GLOBAL VARIABLES: outcnt, bk, bb, hufts, inptr
- */
-static int inflate()
+static void inflate_stored(struct unzip_ctx *ctx)
 {
-	int e;			/* last block flag */
-	int r;			/* result code */
-	unsigned h = 0;		/* maximum struct huft's malloc'ed */
+	uint64_t b = ctx->bb;
+	unsigned k = ctx->bk;
+	size_t n;
+
+	/* bytes still held in the bit buffer */
+	while (ctx->stored_len && k >= 8 && ctx->outcnt < WSIZE) {
+		ctx->window[ctx->outcnt++] = (unsigned char)b;
+		DUMPBITS(8);
+		ctx->stored_len--;
+	}
 
-	/* initialize window, bit buffer */
-	outcnt = 0;
-	bk = 0;
-	bb = 0;
+	while (ctx->stored_len && ctx->outcnt < WSIZE) {
+		if (ctx->inptr == ctx->insize && !unzip_refill(ctx))
+			break;
 
-	/* decompress until the last block */
-	do {
-		hufts = 0;
-		if ((r = inflate_block(&e)) != 0) {
-			return r;
-		}
-		if (hufts > h) {
-			h = hufts;
-		}
-	} while (!e);
+		n = ctx->insize - ctx->inptr;
+		if (n > ctx->stored_len)
+			n = ctx->stored_len;
+		if (n > WSIZE - ctx->outcnt)
+			n = WSIZE - ctx->outcnt;
 
-	/* Undo too much lookahead.  The next read will be byte aligned so we
-	 * can discard unused bits in the last meaningful byte.  */
-	while (bk >= 8) {
-		bk -= 8;
-		ungetc((bb << bk), in_file);
+		memcpy(ctx->window + ctx->outcnt, ctx->inbuf + ctx->inptr, n);
+		ctx->inptr += n;
+		ctx->outcnt += n;
+		ctx->stored_len -= n;
 	}
 
-	/* flush out window */
-	flush_window();
-
-	/* return success */
-	return 0;
+	COMMIT();
 }
 
-/* ===========================================================================
- * Unzip in to out.  This routine works on both gzip and pkzip files.
- *
- * IN assertions: the buffer inbuf contains already the beginning of
- *   the compressed data, from offsets inptr to insize-1 included.
- *   The magic header has already been checked. The output buffer is cleared.
- * in, out: input and output file descriptors
+/*
+ * Reads a gzip member header. Returns 1 if there is no further member,
+ * which is an error for the first one.
  */
-extern int unzip(FILE * l_in_file, FILE * l_out_file)
+static int unzip_header(struct unzip_ctx *ctx)
 {
 	const int extra_field = 0x04;	/* bit 2 set: extra field present */
 	const int orig_name = 0x08;	/* bit 3 set: original file name present */
 	const int comment = 0x10;	/* bit 4 set: file comment present */
-	unsigned char buf[8];	/* extended local header */
-	unsigned char flags;	/* compression flags */
-	char magic[2];		/* magic header */
-	int method;
-	typedef void (*sig_type) (int);
-	int exit_code = 0;	/* program exit code */
-	int i;
-
-	in_file = l_in_file;
-	out_file = l_out_file;
-
-	if (signal(SIGINT, SIG_IGN) != SIG_IGN) {
-		(void)signal(SIGINT, (sig_type) abort_gzip);
-	}
-#ifdef SIGTERM
-//      if (signal(SIGTERM, SIG_IGN) != SIG_IGN) {
-//              (void) signal(SIGTERM, (sig_type) abort_gzip);
-//      }
-#endif
-#ifdef SIGHUP
-	if (signal(SIGHUP, SIG_IGN) != SIG_IGN) {
-		(void)signal(SIGHUP, (sig_type) abort_gzip);
-	}
-#endif
+	const int header_crc = 0x02;	/* bit 1 set: header crc present */
+	uint64_t b = ctx->bb;
+	unsigned k = ctx->bk;
+	unsigned flags;		/* compression flags */
+	unsigned n;
 
-	signal(SIGPIPE, SIG_IGN);
+	/* members start on a byte boundary */
+	DUMPBITS(k & 7);
 
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	window =
-	    xmalloc((size_t) (((2L * WSIZE) + 1L) * sizeof(unsigned char)));
-	outcnt = 0;
-	bytes_out = 0L;
+	if (!k && ctx->inptr == ctx->insize && !unzip_refill(ctx)) {
+		if (ctx->n_members && (ctx->read || ctx->finishing))
+			return 1;
 
-	magic[0] = fgetc(in_file);
-	magic[1] = fgetc(in_file);
+		unzip_short(ctx);
+	}
 
 	/* Magic header for gzip files, 1F 8B = \037\213 */
-	if (memcmp(magic, "\037\213", 2) != 0) {
-		error_msg("Invalid gzip magic");
-		return EXIT_FAILURE;
-	}
+	NEEDBITS(16);
+	if (GETBITS(16) != 0x8b1f) {
+		/* like gzip, ignore trailing garbage after a member */
+		if (ctx->n_members)
+			return 1;
 
-	method = (int)fgetc(in_file);
-	if (method != 8) {
-		error_msg("unknown method %d -- get newer version of gzip",
-			  method);
-		exit_code = 1;
+		unzip_fail(ctx, "Invalid gzip magic");
 		return -1;
 	}
+	DUMPBITS(16);
 
-	flags = (unsigned char)fgetc(in_file);
+	NEEDBITS(16);
+	if (GETBITS(8) != 8) {
+		unzip_fail(ctx, "unknown method -- get newer version of gzip");
+		return -1;
+	}
+	flags = GETBITS(16) >> 8;
+	DUMPBITS(16);
 
 	/* Ignore time stamp(4), extra flags(1), OS type(1) */
-	for (i = 0; i < 6; i++)
-		fgetc(in_file);
+	NEEDBITS(48);
+	DUMPBITS(48);
 
-	if ((flags & extra_field) != 0) {
-		size_t extra;
-		extra = fgetc(in_file);
-		extra += fgetc(in_file) << 8;
+	if (flags & extra_field) {
+		NEEDBITS(16);
+		n = GETBITS(16);
+		DUMPBITS(16);
 
-		for (i = 0; i < extra; i++)
-			fgetc(in_file);
+		while (n--) {
+			NEEDBITS(8);
+			DUMPBITS(8);
+		}
 	}
 
 	/* Discard original name if any */
-	if ((flags & orig_name) != 0) {
-		while (fgetc(in_file) != 0) ;	/* null */
-	}
+	if (flags & orig_name)
+		do {
+			NEEDBITS(8);
+			n = GETBITS(8);
+			DUMPBITS(8);
+		} while (n);
 
 	/* Discard file comment if any */
-	if ((flags & comment) != 0) {
-		while (fgetc(in_file) != 0) ;	/* null */
+	if (flags & comment)
+		do {
+			NEEDBITS(8);
+			n = GETBITS(8);
+			DUMPBITS(8);
+		} while (n);
+
+	if (flags & header_crc) {
+		NEEDBITS(16);
+		DUMPBITS(16);
 	}
 
-	if (method < 0) {
-		return (exit_code);
-	}
+	COMMIT();
 
-	make_crc_table();
+	ctx->n_members++;
+	ctx->crc = 0;
+	ctx->bytes_out = 0;
 
-	/* Decompress */
-	if (method == 8) {
+	return 0;
+}
 
-		int res = inflate();
+static void unzip_trailer(struct unzip_ctx *ctx)
+{
+	uint64_t b = ctx->bb;
+	unsigned k = ctx->bk;
+	uint32_t crc, len;
 
-		if (res == 3) {
-			perror_msg("inflate");
-			exit_code = 1;
-		} else if (res != 0) {
-			error_msg("invalid compressed data--format violated");
-			exit_code = 1;
-		}
+	/* the deflate data ends on a bit boundary */
+	DUMPBITS(k & 7);
 
-	} else {
-		error_msg("internal error, invalid method");
-		exit_code = 1;
-	}
+	NEEDBITS(32);
+	crc = (uint32_t) b;
+	DUMPBITS(32);
+
+	NEEDBITS(32);
+	len = (uint32_t) b;
+	DUMPBITS(32);
 
-	/* Get the crc and original length
-	 * crc32  (see algorithm.doc)
-	 * uncompressed input size modulo 2^32
-	 */
-	fread(buf, 1, 8, in_file);
+	COMMIT();
 
 	/* Validate decompression - crc */
-	if (!exit_code
-	    && (unsigned int)((buf[0] | (buf[1] << 8)) |
-			      ((buf[2] | (buf[3] << 8)) << 16)) !=
-	    (crc ^ 0xffffffffL)) {
-		error_msg("invalid compressed data--crc error");
-		exit_code = 1;
+	if (crc != ctx->crc) {
+		unzip_fail(ctx, "invalid compressed data--crc error");
+		return;
 	}
+
 	/* Validate decompression - size */
-	if (!exit_code
-	    && ((buf[4] | (buf[5] << 8)) | ((buf[6] | (buf[7] << 8)) << 16)) !=
-	    (unsigned long)bytes_out) {
-		error_msg("invalid compressed data--length error");
-		exit_code = 1;
+	if (len != (uint32_t) ctx->bytes_out) {
+		unzip_fail(ctx, "invalid compressed data--length error");
+		return;
+	}
+
+	ctx->state = UNZIP_HEADER;
+}
+
+/*
+ * Inflates until the window is full or the stream ended, and accounts
+ * the new window contents in the member crc. Returns 1 if decoding
+ * stopped early because unzip_feed() has to supply more input.
+ */
+static int unzip_fill(struct unzip_ctx *ctx)
+{
+	int ret = 0;
+
+	if (setjmp(ctx->need_input)) {
+		/* drop the partially decoded unit */
+		ctx->inptr = ctx->unit_inptr;
+
+		if (ctx->in_eof)
+			unzip_fail(ctx, "unexpected end of file");
+
+		unzip_crc_update(ctx);
+		return 1;
+	}
+
+	while (ctx->outcnt < WSIZE) {
+		switch (ctx->state) {
+		case UNZIP_HEADER:
+			ret = unzip_header(ctx);
+			if (ret == 1)
+				ctx->state = UNZIP_DONE;
+			else if (ret == 0)
+				ctx->state = UNZIP_BLOCK;
+			break;
+		case UNZIP_BLOCK:
+			inflate_block(ctx);
+			break;
+		case UNZIP_STORED:
+			inflate_stored(ctx);
+			if (!ctx->stored_len)
+				ctx->state = ctx->last_block ?
+				    UNZIP_TRAILER : UNZIP_BLOCK;
+			else if (ctx->outcnt < WSIZE)
+				unzip_short(ctx);
+			break;
+		case UNZIP_CODES:
+			ret = inflate_codes(ctx);
+			if (ret < 0)
+				unzip_fail(ctx, "invalid compressed data--format violated");
+			else if (ret == 0)
+				ctx->state = ctx->last_block ?
+				    UNZIP_TRAILER : UNZIP_BLOCK;
+			break;
+		case UNZIP_TRAILER:
+			unzip_crc_update(ctx);
+			unzip_trailer(ctx);
+			break;
+		default:
+			goto out;
+		}
+	}
+
+out:
+	unzip_crc_update(ctx);
+
+	return 0;
+}
+
+static struct unzip_ctx *unzip_ctx_new(void)
+{
+	struct unzip_ctx *ctx = xmalloc(sizeof(*ctx));
+
+	/* the window is left uninitialized, it is only read once written */
+	memset(ctx, 0, offsetof(struct unzip_ctx, window));
+	memset(&ctx->outcnt, 0,
+	       sizeof(*ctx) - offsetof(struct unzip_ctx, outcnt));
+
+	ctx->state = UNZIP_HEADER;
+
+	return ctx;
+}
+
+struct unzip_ctx *unzip_open(unzip_read_fn read, void *priv)
+{
+	struct unzip_ctx *ctx = unzip_ctx_new();
+
+	ctx->read = read;
+	ctx->priv = priv;
+
+	return ctx;
+}
+
+ssize_t unzip_read(struct unzip_ctx *ctx, void *buf, size_t len)
+{
+	size_t n, total = 0;
+
+	while (total < len) {
+		if (ctx->outptr < ctx->outcnt) {
+			n = ctx->outcnt - ctx->outptr;
+			if (n > len - total)
+				n = len - total;
+			memcpy((char *)buf + total, ctx->window + ctx->outptr, n);
+			ctx->outptr += n;
+			total += n;
+			continue;
+		}
+
+		if (ctx->state == UNZIP_DONE)
+			break;
+
+		if (ctx->state == UNZIP_ERROR)
+			return total ? total : -1;
+
+		/* everything handed out, the window can wrap */
+		if (ctx->outcnt == WSIZE)
+			ctx->outcnt = ctx->outptr = ctx->crcptr = 0;
+
+		unzip_fill(ctx);
+	}
+
+	return total;
+}
+
+int unzip_close(struct unzip_ctx *ctx)
+{
+	int ret;
+
+	if (!ctx)
+		return -1;
+
+	ret = (ctx->state == UNZIP_DONE) ? 0 : -1;
+	free(ctx);
+
+	return ret;
+}
+
+struct unzip_ctx *unzip_init(unzip_write_fn write, void *priv)
+{
+	struct unzip_ctx *ctx = unzip_ctx_new();
+
+	ctx->write = write;
+	ctx->priv = priv;
+
+	return ctx;
+}
+
+/* inflate the buffered input and pass everything decoded to write() */
+static int unzip_drain(struct unzip_ctx *ctx)
+{
+	int starved;
+
+	do {
+		if (ctx->outcnt == WSIZE)
+			ctx->outcnt = ctx->outptr = ctx->crcptr = 0;
+
+		starved = unzip_fill(ctx);
+
+		if (ctx->outptr < ctx->outcnt) {
+			if (ctx->write(ctx->priv, ctx->window + ctx->outptr,
+				       ctx->outcnt - ctx->outptr) < 0) {
+				ctx->state = UNZIP_ERROR;
+				return -1;
+			}
+			ctx->outptr = ctx->outcnt;
+		}
+	} while (!starved && ctx->state != UNZIP_DONE &&
+		 ctx->state != UNZIP_ERROR);
+
+	return (ctx->state == UNZIP_ERROR) ? -1 : 0;
+}
+
+int unzip_feed(struct unzip_ctx *ctx, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	size_t n;
+
+	while (len > 0) {
+		/* like gzip, ignore trailing garbage after a member */
+		if (ctx->state == UNZIP_DONE)
+			return 0;
+
+		if (ctx->state == UNZIP_ERROR)
+			return -1;
+
+		/* keep the input of the unit waiting for more */
+		if (ctx->inptr) {
+			ctx->insize -= ctx->inptr;
+			memmove(ctx->inbuf, ctx->inbuf + ctx->inptr, ctx->insize);
+			ctx->inptr = ctx->unit_inptr = 0;
+		}
+
+		n = sizeof(ctx->inbuf) - ctx->insize;
+		if (!n) {
+			unzip_fail(ctx, "invalid compressed data--header too long");
+			return -1;
+		}
+
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->inbuf + ctx->insize, p, n);
+		ctx->insize += n;
+		p += n;
+		len -= n;
+
+		if (unzip_drain(ctx))
+			return -1;
 	}
 
-	free(window);
-	free(crc_table);
+	return (ctx->state == UNZIP_ERROR) ? -1 : 0;
+}
+
+int unzip_finish(struct unzip_ctx *ctx)
+{
+	int ret;
+
+	ctx->finishing = 1;
+
+	if (ctx->state != UNZIP_DONE && ctx->state != UNZIP_ERROR)
+		unzip_drain(ctx);
+
+	ret = (ctx->state == UNZIP_DONE) ? 0 : -1;
+	free(ctx);
 
-	window = NULL;
-	crc_table = NULL;
+	return ret;
+}
+
+static ssize_t unzip_file_read(void *priv, void *buf, size_t len)
+{
+	size_t n = fread(buf, 1, len, (FILE *) priv);
+
+	if (!n && ferror((FILE *) priv))
+		return -1;
+
+	return n;
+}
+
+/* ===========================================================================
+ * Unzip in to out.  This routine works on gzip files, including ones
+ * made of several members.
+ * in, out: input and output file descriptors
+ */
+extern int unzip(FILE * l_in_file, FILE * l_out_file)
+{
+	struct unzip_ctx *ctx = unzip_open(unzip_file_read, l_in_file);
+	char buf[4096];
+	ssize_t len;
+	int exit_code = 0;
+
+	while ((len = unzip_read(ctx, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, len, l_out_file) != len) {
+			if (errno != EPIPE)
+				error_msg("Couldnt write");
+			exit_code = 1;
+			break;
+		}
+	}
+
+	if (unzip_close(ctx) && !exit_code)
+		exit_code = 1;
 
 	return exit_code;
 }
@@ -0,0 +1,50 @@
+/*
+ *  Streaming gzip decompression.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ */
+
+#ifndef __UNZIP_H__
+#define __UNZIP_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * Inflater for gzip streams, which may consist of several members. Each
+ * stream has its own context, so streams can be decoded concurrently.
+ *
+ * Input is either pulled by unzip_read() through a read callback, or
+ * pushed in pieces of any size with unzip_feed(), which passes the
+ * decoded data on to a write callback as it becomes available.
+ * unzip_close() and unzip_finish() free the context and return 0 if the
+ * stream was complete and intact.
+ */
+
+struct unzip_ctx;
+
+/* supplies compressed input, returns 0 at the end and -1 on error */
+typedef ssize_t (*unzip_read_fn) (void *priv, void *buf, size_t len);
+
+/* consumes decoded output, returns -1 on error */
+typedef ssize_t (*unzip_write_fn) (void *priv, const void *buf, size_t len);
+
+struct unzip_ctx *unzip_open(unzip_read_fn read, void *priv);
+ssize_t unzip_read(struct unzip_ctx *ctx, void *buf, size_t len);
+int unzip_close(struct unzip_ctx *ctx);
+
+struct unzip_ctx *unzip_init(unzip_write_fn write, void *priv);
+int unzip_feed(struct unzip_ctx *ctx, const void *buf, size_t len);
+int unzip_finish(struct unzip_ctx *ctx);
+
+uint32_t unzip_crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,114 @@
+/* arena.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "libbb/libbb.h"
+
+#define ARENA_CHUNK_SIZE	32768
+#define ARENA_ALIGN		16
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static void *arena_carve(struct arena *a, size_t len)
+{
+	struct arena_chunk *chunk = a->chunks;
+	void *p;
+
+	if (chunk == NULL || chunk->size - chunk->used < len) {
+		size_t size = ARENA_CHUNK_SIZE;
+
+		if (len > size)
+			size = len;
+
+		chunk = xmalloc(sizeof(*chunk) + size);
+		chunk->next = a->chunks;
+		chunk->size = size;
+		chunk->used = 0;
+		a->chunks = chunk;
+		a->n_bytes += sizeof(*chunk) + size;
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += len;
+
+	return p;
+}
+
+void *arena_alloc(struct arena *a)
+{
+	size_t len = (a->obj_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	void *p;
+
+	if (a->free_list) {
+		p = a->free_list;
+		a->free_list = *(void **)p;
+	} else {
+		p = arena_carve(a, len);
+	}
+
+	if (++a->n_live > a->max_live)
+		a->max_live = a->n_live;
+
+	return memset(p, 0, a->obj_size);
+}
+
+void arena_free(struct arena *a, void *p)
+{
+	if (!p)
+		return;
+
+	*(void **)p = a->free_list;
+	a->free_list = p;
+	a->n_live--;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = arena_carve(a, len);
+
+	if (++a->n_live > a->max_live)
+		a->max_live = a->n_live;
+
+	return memcpy(p, s, len);
+}
+
+void arena_destroy(struct arena *a)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = a->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	a->chunks = NULL;
+	a->free_list = NULL;
+	a->n_live = 0;
+	a->n_bytes = 0;
+}
+
+void arena_print_stats(struct arena *a)
+{
+	printf("arena: %s, %zu bytes\n"
+	       "\tobj_size=%zu, n_live=%lu, max_live=%lu\n",
+	       a->name, a->n_bytes, a->obj_size, a->n_live, a->max_live);
+}
@@ -0,0 +1,49 @@
+/* arena.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Chunked allocator for objects that live as long as the package
+ * database. Memory is carved out of large chunks and only returned to
+ * the system by arena_destroy(). Arenas created with a non zero
+ * obj_size hand out objects of that size and recycle the ones passed
+ * to arena_free(); arenas with obj_size 0 only support arena_strdup().
+ */
+
+struct arena_chunk;
+
+struct arena {
+	const char *name;
+	size_t obj_size;
+	struct arena_chunk *chunks;
+	void *free_list;
+
+	/* high-water marks */
+	unsigned long n_live;
+	unsigned long max_live;
+	size_t n_bytes;
+};
+
+#define ARENA_INIT(name, obj_size) { name, obj_size, NULL, NULL, 0, 0, 0 }
+
+void *arena_alloc(struct arena *a);
+void arena_free(struct arena *a, void *p);
+char *arena_strdup(struct arena *a, const char *s);
+void arena_destroy(struct arena *a);
+void arena_print_stats(struct arena *a);
+
+#endif
@@ -17,12 +17,250 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "opkg_message.h"
 #include "conffile.h"
 #include "file_util.h"
+#include "hash_table.h"
 #include "sprintf_alloc.h"
 #include "opkg_conf.h"
+#include "libbb/libbb.h"
+
+/*
+ * The last checksum computed for each conffile, kept in
+ * <opkg_dir>/conffiles.sums of the default destination. A checksum is
+ * reused while the device, inode, size, mtime and ctime of the file are
+ * still those it was computed for. Each line is
+ *
+ *   dev ino size mtime.nsec ctime.nsec checksum path
+ */
+#define CONFFILE_SUMS_HEADER	"# opkg conffile checksums 1"
+
+struct conffile_sum {
+	unsigned long long dev;
+	unsigned long long ino;
+	long long size;
+	struct timespec mtime;
+	struct timespec ctime;
+	char chksum[65];
+};
+
+static struct {
+	int loaded;
+	int dirty;
+	char *file_name;
+	hash_table_t sums;	/* root file name -> struct conffile_sum */
+} conffile_sums;
+
+static void conffile_sum_fill(struct conffile_sum *sum, const struct stat *st)
+{
+	sum->dev = st->st_dev;
+	sum->ino = st->st_ino;
+	sum->size = st->st_size;
+	sum->mtime = st->st_mtim;
+	sum->ctime = st->st_ctim;
+}
+
+static int conffile_sum_match(const struct conffile_sum *sum,
+			      const struct stat *st)
+{
+	return sum->dev == (unsigned long long)st->st_dev
+	    && sum->ino == (unsigned long long)st->st_ino
+	    && sum->size == (long long)st->st_size
+	    && sum->mtime.tv_sec == st->st_mtim.tv_sec
+	    && sum->mtime.tv_nsec == st->st_mtim.tv_nsec
+	    && sum->ctime.tv_sec == st->st_ctim.tv_sec
+	    && sum->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static void conffile_sums_load(void)
+{
+	struct conffile_sum sum, *s;
+	long long mtime, ctime;
+	long mtime_nsec, ctime_nsec;
+	char *line;
+	FILE *fp;
+	int n;
+
+	conffile_sums.loaded = 1;
+	hash_table_init("conffile-sums", &conffile_sums.sums, 64);
+
+	if (!conf->default_dest)
+		return;
+
+	sprintf_alloc(&conffile_sums.file_name, "%s/conffiles.sums",
+		      conf->default_dest->opkg_dir);
+
+	fp = fopen(conffile_sums.file_name, "r");
+	if (!fp)
+		return;
+
+	line = file_read_line_alloc(fp);
+	if (!line || strcmp(line, CONFFILE_SUMS_HEADER)) {
+		/* written by something else, start over */
+		conffile_sums.dirty = 1;
+		free(line);
+		fclose(fp);
+		return;
+	}
+	free(line);
+
+	while ((line = file_read_line_alloc(fp))) {
+		n = 0;
+		if (sscanf(line, "%llu %llu %lld %lld.%ld %lld.%ld %64s %n",
+			   &sum.dev, &sum.ino, &sum.size, &mtime, &mtime_nsec,
+			   &ctime, &ctime_nsec, sum.chksum, &n) != 8 || !n
+		    || !line[n]) {
+			conffile_sums.dirty = 1;
+			free(line);
+			continue;
+		}
+
+		sum.mtime.tv_sec = mtime;
+		sum.mtime.tv_nsec = mtime_nsec;
+		sum.ctime.tv_sec = ctime;
+		sum.ctime.tv_nsec = ctime_nsec;
+
+		s = xmalloc(sizeof(*s));
+		*s = sum;
+		free(hash_table_get(&conffile_sums.sums, line + n));
+		hash_table_insert(&conffile_sums.sums, line + n, s);
+		free(line);
+	}
+
+	fclose(fp);
+}
+
+static void conffile_sum_write(const char *key, void *entry, void *data)
+{
+	struct conffile_sum *sum = entry;
+
+	fprintf(data, "%llu %llu %lld %lld.%09ld %lld.%09ld %s %s\n",
+		sum->dev, sum->ino, sum->size,
+		(long long)sum->mtime.tv_sec, (long)sum->mtime.tv_nsec,
+		(long long)sum->ctime.tv_sec, (long)sum->ctime.tv_nsec,
+		sum->chksum, key);
+}
+
+/*
+ * The checksum of root_filename, from the cache if the file was not
+ * changed since it was computed. sha256 selects the kind of checksum.
+ */
+static char *conffile_chksum_alloc(const char *root_filename, int sha256)
+{
+	struct conffile_sum *sum;
+	struct stat st;
+	char *chksum;
+
+	if (!conffile_sums.loaded)
+		conffile_sums_load();
+
+	sum = hash_table_get(&conffile_sums.sums, root_filename);
+
+	if (stat(root_filename, &st)) {
+		if (sum) {
+			hash_table_remove(&conffile_sums.sums, root_filename);
+			free(sum);
+			conffile_sums.dirty = 1;
+		}
+		st.st_mode = 0;
+	}
+
+	if (sum && S_ISREG(st.st_mode) && conffile_sum_match(sum, &st)
+	    && strlen(sum->chksum) == (sha256 ? 64 : 32))
+		return xstrdup(sum->chksum);
+
+	if (sha256)
+		chksum = file_sha256sum_alloc(root_filename);
+	else
+		chksum = file_md5sum_alloc(root_filename);
+
+	/*
+	 * A file written within the timestamp granularity of the file
+	 * system could change again without its mtime changing.
+	 */
+	if (!chksum || !S_ISREG(st.st_mode)
+	    || st.st_mtim.tv_sec >= time(NULL) - 1
+	    || st.st_ctim.tv_sec >= time(NULL) - 1)
+		return chksum;
+
+	if (!sum) {
+		sum = xmalloc(sizeof(*sum));
+		hash_table_insert(&conffile_sums.sums, root_filename, sum);
+	}
+
+	conffile_sum_fill(sum, &st);
+	strcpy(sum->chksum, chksum);
+	conffile_sums.dirty = 1;
+
+	return chksum;
+}
+
+/*
+ * Writes the checksum cache if it changed. It is only a cache, so it is
+ * silently left alone where it cannot be written.
+ */
+int conffile_sums_save(void)
+{
+	char *tmp_file;
+	FILE *fp;
+	int ret = 0;
+
+	if (!conffile_sums.dirty || !conffile_sums.file_name || conf->noaction
+	    || access(conf->default_dest->opkg_dir, W_OK))
+		return 0;
+
+	sprintf_alloc(&tmp_file, "%s.tmp", conffile_sums.file_name);
+
+	fp = fopen(tmp_file, "w");
+	if (!fp) {
+		opkg_perror(ERROR, "Failed to open %s", tmp_file);
+		free(tmp_file);
+		return -1;
+	}
+
+	fprintf(fp, "%s\n", CONFFILE_SUMS_HEADER);
+	hash_table_foreach(&conffile_sums.sums, conffile_sum_write, fp);
+
+	if (fclose(fp)) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		ret = -1;
+	}
+
+	if (!ret && rename(tmp_file, conffile_sums.file_name)) {
+		opkg_perror(ERROR, "Failed to rename %s to %s",
+			    tmp_file, conffile_sums.file_name);
+		ret = -1;
+	}
+
+	if (ret)
+		unlink(tmp_file);
+	else
+		conffile_sums.dirty = 0;
+
+	free(tmp_file);
+
+	return ret;
+}
+
+static void conffile_sum_free(const char *key, void *entry, void *data)
+{
+	free(entry);
+}
+
+void conffile_sums_free(void)
+{
+	if (!conffile_sums.loaded)
+		return;
+
+	hash_table_foreach(&conffile_sums.sums, conffile_sum_free, NULL);
+	hash_table_deinit(&conffile_sums.sums);
+	free(conffile_sums.file_name);
+	memset(&conffile_sums, 0, sizeof(conffile_sums));
+}
 
 int conffile_init(conffile_t * conffile, const char *file_name,
 		  const char *md5sum)
@@ -50,11 +288,8 @@ int conffile_has_been_modified(conffile_t * conffile)
 
 	root_filename = root_filename_alloc(filename);
 
-	if (conffile->value && strlen(conffile->value) > 33) {
-		chksum = file_sha256sum_alloc(root_filename);
-	} else {
-		chksum = file_md5sum_alloc(root_filename);
-	}
+	chksum = conffile_chksum_alloc(root_filename,
+				       strlen(conffile->value) > 33);
 
 	if (chksum && (ret = strcmp(chksum, conffile->value))) {
 		opkg_msg(INFO, "Conffile %s:\n\told chk=%s\n\tnew chk=%s\n",
@@ -25,5 +25,7 @@ int conffile_init(conffile_t * conffile, const char *file_name,
 		  const char *md5sum);
 void conffile_deinit(conffile_t * conffile);
 int conffile_has_been_modified(conffile_t * conffile);
+int conffile_sums_save(void);
+void conffile_sums_free(void);
 
 #endif
@@ -0,0 +1,104 @@
+/* digest.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "digest.h"
+#include "opkg_message.h"
+
+#define DIGEST_BUF_SIZE	65536
+
+static void digest_hex(char *hex, const unsigned char *bin, size_t len)
+{
+	static const char bin2hex[16] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hex[i * 2] = bin2hex[bin[i] >> 4];
+		hex[i * 2 + 1] = bin2hex[bin[i] & 0xf];
+	}
+	hex[len * 2] = '\0';
+}
+
+void digest_init(struct digest *d, int want)
+{
+	memset(d, 0, sizeof(*d));
+	d->want = want;
+
+	if (want & DIGEST_MD5)
+		md5_begin(&d->md5);
+	if (want & DIGEST_SHA256)
+		sha256_init_ctx(&d->sha256);
+}
+
+void digest_update(struct digest *d, const void *buf, size_t len)
+{
+	d->size += len;
+
+	if (d->want & DIGEST_MD5)
+		md5_hash(buf, len, &d->md5);
+	if (d->want & DIGEST_SHA256)
+		sha256_process_bytes(buf, len, &d->sha256);
+}
+
+void digest_final(struct digest *d)
+{
+	uint32_t bin[8];
+
+	if (d->want & DIGEST_MD5) {
+		md5_end(bin, &d->md5);
+		digest_hex(d->md5_hex, (unsigned char *)bin, 16);
+	}
+	if (d->want & DIGEST_SHA256) {
+		sha256_finish_ctx(&d->sha256, bin);
+		digest_hex(d->sha256_hex, (unsigned char *)bin, 32);
+	}
+}
+
+/* Feeds the rest of fp to d and finalizes it, -1 on a read error. */
+int digest_stream(struct digest *d, FILE * fp)
+{
+	static char buf[DIGEST_BUF_SIZE];
+	size_t n;
+
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		digest_update(d, buf, n);
+
+	if (ferror(fp))
+		return -1;
+
+	digest_final(d);
+
+	return 0;
+}
+
+int digest_file(struct digest *d, const char *file_name)
+{
+	FILE *fp;
+	int err;
+
+	fp = fopen(file_name, "r");
+	if (!fp) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		return -1;
+	}
+
+	err = digest_stream(d, fp);
+	if (err)
+		opkg_perror(ERROR, "Failed to read %s", file_name);
+
+	fclose(fp);
+
+	return err;
+}
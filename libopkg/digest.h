@@ -0,0 +1,49 @@
+/* digest.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <libubox/md5.h>
+
+#include "sha256.h"
+
+/*
+ * MD5 and SHA-256 of the same data, computed side by side so a file is
+ * read once whatever checksums it is verified against. The data can be
+ * fed in as it is read, copied or downloaded; digest_final() then fills
+ * in the hex strings of the wanted sums.
+ */
+
+#define DIGEST_MD5	1
+#define DIGEST_SHA256	2
+
+struct digest {
+	int want;
+	uint64_t size;
+	md5_ctx_t md5;
+	struct sha256_ctx sha256;
+	char md5_hex[33];
+	char sha256_hex[65];
+};
+
+void digest_init(struct digest *d, int want);
+void digest_update(struct digest *d, const void *buf, size_t len);
+void digest_final(struct digest *d);
+
+int digest_stream(struct digest *d, FILE * fp);
+int digest_file(struct digest *d, const char *file_name);
+
+#endif
@@ -0,0 +1,1012 @@
+/* file_index.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_index.h"
+#include "hash_table.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "pkg_hash.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/* a list read or written during this run */
+struct file_list {
+	struct file_index_stat st;
+	size_t len;
+	char lines[];
+};
+
+struct file_index {
+	void *map;
+	size_t map_len;
+	int map_alloced;	/* built in memory rather than mapped */
+	const struct file_index_record *recs;
+	uint32_t n_recs;
+	const char *data;
+	const struct file_index_path *paths;
+	const struct file_index_path *rpaths;
+	uint32_t n_paths;
+
+	/* package name -> struct file_list */
+	hash_table_t lists;
+	int dirty;
+};
+
+static char *file_index_file_name(pkg_dest_t *dest)
+{
+	char *file_name;
+
+	sprintf_alloc(&file_name, "%s/files.idx", dest->opkg_dir);
+
+	return file_name;
+}
+
+static char *list_file_name(pkg_t *pkg)
+{
+	char *file_name;
+
+	sprintf_alloc(&file_name, "%s/%s.list", pkg->dest->info_dir, pkg->name);
+
+	return file_name;
+}
+
+static void file_index_stat_fill(struct file_index_stat *fst,
+				 const struct stat *st)
+{
+	memset(fst, 0, sizeof(*fst));
+	fst->size = st->st_size;
+	fst->ino = st->st_ino;
+	fst->mtime = st->st_mtim.tv_sec;
+	fst->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/*
+ * Checks that every offset in the mapping is in bounds and that the
+ * records are sorted, so lookups need no checks.
+ */
+static int file_index_validate(const void *map, size_t size)
+{
+	const struct file_index_header *hdr = map;
+	const struct file_index_record *recs;
+	const struct file_index_path *paths, *p;
+	const char *data;
+	uint64_t expect;
+	uint32_t i;
+
+	if (size < sizeof(*hdr)
+	    || memcmp(hdr->magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC))
+	    || hdr->version != FILE_INDEX_VERSION
+	    || hdr->byte_order != FILE_INDEX_BYTE_ORDER)
+		return -1;
+
+	expect = sizeof(*hdr)
+	    + (uint64_t)hdr->n_records * sizeof(*recs)
+	    + hdr->data_len
+	    + 2 * (uint64_t)hdr->n_paths * sizeof(*paths);
+
+	if (expect != size || hdr->data_len % 8)
+		return -1;
+
+	recs = (const void *)(hdr + 1);
+	data = (const char *)(recs + hdr->n_records);
+
+	if (hdr->data_len && data[hdr->data_len - 1] != '\0')
+		return -1;
+
+	for (i = 0; i < hdr->n_records; i++) {
+		if (recs[i].name >= hdr->data_len
+		    || recs[i].lines > hdr->data_len
+		    || recs[i].lines_len > hdr->data_len - recs[i].lines)
+			return -1;
+
+		if (recs[i].lines_len
+		    && data[recs[i].lines + recs[i].lines_len - 1] != '\0')
+			return -1;
+
+		if (i && strcmp(data + recs[i - 1].name, data + recs[i].name) >= 0)
+			return -1;
+	}
+
+	paths = (const void *)(data + hdr->data_len);
+
+	for (i = 0; i < 2 * hdr->n_paths; i++) {
+		p = &paths[i];
+		if (p->rec >= hdr->n_records
+		    || p->line < recs[p->rec].lines
+		    || p->line >= recs[p->rec].lines + recs[p->rec].lines_len
+		    || (p->line > recs[p->rec].lines && data[p->line - 1] != '\0')
+		    || p->len != strlen(data + p->line))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void file_list_free(const char *key, void *entry, void *data)
+{
+	free(entry);
+}
+
+/* Makes idx use the index at map, which is valid, dropping the lists
+   read or written before. */
+static void file_index_adopt(struct file_index *idx, void *map, size_t len,
+			     int alloced)
+{
+	const struct file_index_header *hdr = map;
+
+	if (idx->map_alloced)
+		free(idx->map);
+	else if (idx->map)
+		munmap(idx->map, idx->map_len);
+
+	hash_table_foreach(&idx->lists, file_list_free, NULL);
+	hash_table_deinit(&idx->lists);
+	hash_table_init("file-index", &idx->lists, 64);
+	idx->dirty = 0;
+
+	idx->map = map;
+	idx->map_len = len;
+	idx->map_alloced = alloced;
+	idx->n_recs = hdr->n_records;
+	idx->recs = (const void *)(hdr + 1);
+	idx->data = (const char *)(idx->recs + hdr->n_records);
+	idx->n_paths = hdr->n_paths;
+	idx->paths = (const void *)(idx->data + hdr->data_len);
+	idx->rpaths = idx->paths + hdr->n_paths;
+}
+
+static struct file_index *file_index_get(pkg_dest_t *dest)
+{
+	struct file_index *idx;
+	struct stat st;
+	char *file_name;
+	void *map;
+	int fd;
+
+	if (dest->file_index)
+		return dest->file_index;
+
+	idx = xcalloc(1, sizeof(*idx));
+	hash_table_init("file-index", &idx->lists, 64);
+	dest->file_index = idx;
+
+	file_name = file_index_file_name(dest);
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		free(file_name);
+		return idx;
+	}
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		free(file_name);
+		return idx;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		free(file_name);
+		return idx;
+	}
+
+	if (file_index_validate(map, st.st_size)) {
+		opkg_msg(DEBUG, "Ignoring broken file index %s.\n", file_name);
+		munmap(map, st.st_size);
+		free(file_name);
+		return idx;
+	}
+
+	free(file_name);
+	file_index_adopt(idx, map, st.st_size, 0);
+
+	return idx;
+}
+
+static const struct file_index_record *file_index_find(struct file_index *idx,
+						       const char *name)
+{
+	uint32_t lo = 0, hi = idx->n_recs, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(name, idx->data + idx->recs[mid].name);
+		if (cmp == 0)
+			return &idx->recs[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* Splits the text of list into lines, in place; it has room for a NUL
+   to end the last line with. */
+static void file_list_split(struct file_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->len; i++)
+		if (list->lines[i] == '\n')
+			list->lines[i] = '\0';
+
+	if (list->len && list->lines[list->len - 1] != '\0')
+		list->lines[list->len++] = '\0';
+}
+
+/* the lines of a .list file, each NUL terminated */
+static struct file_list *file_list_new(const char *text, size_t len,
+				       const struct file_index_stat *st)
+{
+	struct file_list *list;
+
+	list = xmalloc(sizeof(*list) + len + 1);
+	list->st = *st;
+	list->len = len;
+	memcpy(list->lines, text, len);
+	file_list_split(list);
+
+	return list;
+}
+
+static void file_index_put(struct file_index *idx, const char *name,
+			   struct file_list *list)
+{
+	free(hash_table_get(&idx->lists, name));
+
+	if (list)
+		hash_table_insert(&idx->lists, name, list);
+	else
+		hash_table_remove(&idx->lists, name);
+
+	idx->dirty = 1;
+}
+
+static struct file_list *file_list_read(pkg_t *pkg)
+{
+	struct file_list *list;
+	struct stat st;
+	char *file_name;
+	size_t alloc;
+	ssize_t n;
+	int fd;
+
+	file_name = list_file_name(pkg);
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		if (fd >= 0)
+			close(fd);
+		free(file_name);
+		return NULL;
+	}
+
+	/* read straight into the list, keeping a byte for the last NUL and
+	   one for the read that finds the end of the file */
+	alloc = st.st_size + 2;
+	list = xmalloc(sizeof(*list) + alloc);
+	list->len = 0;
+
+	do {
+		if (list->len + 1 == alloc) {
+			alloc *= 2;
+			list = xrealloc(list, sizeof(*list) + alloc);
+		}
+
+		n = read(fd, list->lines + list->len, alloc - 1 - list->len);
+		if (n > 0)
+			list->len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	if (n < 0)
+		opkg_perror(ERROR, "Failed to read %s", file_name);
+
+	close(fd);
+	free(file_name);
+
+	file_list_split(list);
+	file_index_stat_fill(&list->st, &st);
+
+	/* not worth recording what could not be read */
+	if (n < 0)
+		memset(&list->st, 0, sizeof(list->st));
+
+	return list;
+}
+
+/* the name of an installed file as pkg_get_installed_files() has it */
+static const char *installed_file_name(const char *line, size_t n,
+				       char **buf, size_t *alloc)
+{
+	size_t rootdirlen;
+
+	if (!conf->offline_root)
+		return line;
+
+	/* already contains root_dir as header -> ABSOLUTE */
+	rootdirlen = strlen(conf->offline_root);
+	if (!strncmp(conf->offline_root, line, rootdirlen))
+		return line;
+
+	if (rootdirlen + n + 1 > *alloc) {
+		*alloc = 2 * (rootdirlen + n + 1);
+		*buf = xrealloc(*buf, *alloc);
+	}
+
+	memcpy(*buf, conf->offline_root, rootdirlen);
+	memcpy(*buf + rootdirlen, line, n + 1);
+
+	return *buf;
+}
+
+/*
+ * Marks pkg as the owner of each file of a list, as the lines of the
+ * .list file were given to file_hash_set_file_owner() before.
+ */
+static void file_index_replay(pkg_t *pkg, const char *lines, size_t len)
+{
+	const char *line, *end = lines + len;
+	size_t n, alloc = 0;
+	char *buf = NULL;
+
+	for (line = lines; line < end; line += n + 1) {
+		n = strlen(line);
+		if (n)
+			file_hash_set_file_owner(installed_file_name(line, n,
+								     &buf,
+								     &alloc),
+						 pkg);
+	}
+
+	free(buf);
+}
+
+/*
+ * Finds the lines of the .list file of pkg, in the index where it is up
+ * to date and in the file itself otherwise. *rec is set if they are those
+ * of a record, and nothing is found if the list cannot be read. Returns
+ * -1 if pkg has no .list file to go by.
+ */
+static int file_index_lines(pkg_t *pkg, const char **lines, size_t *len,
+			    const struct file_index_record **rec)
+{
+	struct file_index_stat fst;
+	struct file_index *idx;
+	struct file_list *list;
+	struct stat st;
+	char *file_name;
+
+	*lines = "";
+	*len = 0;
+	*rec = NULL;
+
+	if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL)
+		return -1;
+
+	idx = file_index_get(pkg->dest);
+
+	list = hash_table_get(&idx->lists, pkg->name);
+	if (list) {
+		*lines = list->lines;
+		*len = list->len;
+		return 0;
+	}
+
+	*rec = file_index_find(idx, pkg->name);
+	if (*rec) {
+		file_name = list_file_name(pkg);
+		if (stat(file_name, &st) == 0) {
+			file_index_stat_fill(&fst, &st);
+			if (!memcmp(&fst, &(*rec)->st, sizeof(fst))) {
+				free(file_name);
+				*lines = idx->data + (*rec)->lines;
+				*len = (*rec)->lines_len;
+				return 0;
+			}
+		}
+		free(file_name);
+		*rec = NULL;
+	}
+
+	opkg_msg(DEBUG, "Reading file list of %s.\n", pkg->name);
+
+	list = file_list_read(pkg);
+	if (!list)
+		return 0;
+
+	file_index_put(idx, pkg->name, list);
+	*lines = list->lines;
+	*len = list->len;
+
+	return 0;
+}
+
+/*
+ * Marks pkg as the owner of its installed files, from the index where it
+ * is up to date and from its .list file otherwise. Returns -1 if pkg has
+ * no .list file to go by.
+ */
+int file_index_set_file_owners(pkg_t *pkg)
+{
+	const struct file_index_record *rec;
+	const char *lines;
+	size_t len;
+
+	if (file_index_lines(pkg, &lines, &len, &rec))
+		return -1;
+
+	file_index_replay(pkg, lines, len);
+
+	return 0;
+}
+
+/*
+ * Finds the lines of the .list file of pkg for pkg_get_installed_files(),
+ * each NUL terminated. They are valid until the index is next saved.
+ */
+int file_index_get_lines(pkg_t *pkg, const char **lines, size_t *len)
+{
+	const struct file_index_record *rec;
+
+	return file_index_lines(pkg, lines, len, &rec);
+}
+
+/* Records text as just written to the .list file of pkg. */
+void file_index_update(pkg_t *pkg, const char *text, size_t len)
+{
+	struct file_index_stat fst;
+	struct stat st;
+	char *file_name;
+
+	if (pkg->dest == NULL)
+		return;
+
+	file_name = list_file_name(pkg);
+	if (stat(file_name, &st)) {
+		free(file_name);
+		file_index_remove(pkg);
+		return;
+	}
+	free(file_name);
+
+	file_index_stat_fill(&fst, &st);
+	file_index_put(file_index_get(pkg->dest), pkg->name,
+		       file_list_new(text, len, &fst));
+}
+
+/* Forgets the list of pkg, whose .list file is gone. */
+void file_index_remove(pkg_t *pkg)
+{
+	if (pkg->dest == NULL)
+		return;
+
+	file_index_put(file_index_get(pkg->dest), pkg->name, NULL);
+}
+
+/* the lines file_index_build() lays out, NULL if there are none */
+static const char *file_index_build_lines(struct file_index *idx, pkg_t *pkg,
+					  size_t *len,
+					  struct file_index_stat *st)
+{
+	const struct file_index_record *rec;
+	struct file_list *list;
+
+	list = hash_table_get(&idx->lists, pkg->name);
+	if (list) {
+		*len = list->len;
+		*st = list->st;
+		return list->lines;
+	}
+
+	rec = file_index_find(idx, pkg->name);
+	if (rec) {
+		*len = rec->lines_len;
+		*st = rec->st;
+		return idx->data + rec->lines;
+	}
+
+	return NULL;
+}
+
+static const char *path_sort_data;
+
+static int path_compare(const void *p1, const void *p2)
+{
+	const struct file_index_path *a = p1, *b = p2;
+	int cmp;
+
+	cmp = strcmp(path_sort_data + a->line, path_sort_data + b->line);
+	if (cmp)
+		return cmp;
+
+	return (a->line > b->line) - (a->line < b->line);
+}
+
+/* compares up to n bytes of s and t from their ends backwards */
+static int rcmpn(const char *s, size_t slen, const char *t, size_t tlen,
+		 size_t n)
+{
+	size_t k;
+	int d;
+
+	for (k = 0; k < n; k++) {
+		if (k == slen || k == tlen)
+			return (k < slen) - (k < tlen);
+
+		d = (unsigned char)s[slen - 1 - k] - (unsigned char)t[tlen - 1 - k];
+		if (d)
+			return d;
+	}
+
+	return 0;
+}
+
+static int rpath_compare(const void *p1, const void *p2)
+{
+	const struct file_index_path *a = p1, *b = p2;
+	int cmp;
+
+	cmp = rcmpn(path_sort_data + a->line, a->len,
+		    path_sort_data + b->line, b->len, SIZE_MAX);
+	if (cmp)
+		return cmp;
+
+	return (a->line > b->line) - (a->line < b->line);
+}
+
+/*
+ * Lays out the index of dest in memory with a record for each package of
+ * installed, which is sorted by name, that has its lines in idx.
+ */
+static void *file_index_build(pkg_dest_t *dest, pkg_vec_t *installed,
+			      int with_paths, size_t *size)
+{
+	struct file_index *idx = dest->file_index;
+	struct file_index_header *hdr;
+	struct file_index_record *recs;
+	struct file_index_path *paths;
+	struct file_index_stat st;
+	const char *prev = NULL, *lines, *line;
+	size_t len, n;
+	uint64_t data_len = 0;
+	uint32_t n_recs = 0, n_paths = 0, r;
+	char *image, *data;
+	pkg_t *pkg;
+	int i;
+
+	for (i = 0; i < installed->len; i++) {
+		pkg = installed->pkgs[i];
+		if (pkg->dest != dest || (prev && !strcmp(prev, pkg->name)))
+			continue;
+		prev = pkg->name;
+
+		lines = file_index_build_lines(idx, pkg, &len, &st);
+		if (!lines)
+			continue;
+
+		n_recs++;
+		data_len += strlen(pkg->name) + 1 + len;
+
+		for (n = 0; with_paths && n < len; n++)
+			n_paths += !lines[n];
+	}
+
+	data_len = (data_len + 7) & ~(uint64_t)7;
+
+	*size = sizeof(*hdr) + n_recs * sizeof(*recs) + data_len
+	    + 2 * (size_t)n_paths * sizeof(*paths);
+	image = xcalloc(1, *size);
+
+	hdr = (void *)image;
+	memcpy(hdr->magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC));
+	hdr->version = FILE_INDEX_VERSION;
+	hdr->byte_order = FILE_INDEX_BYTE_ORDER;
+	hdr->n_records = n_recs;
+	hdr->n_paths = n_paths;
+	hdr->data_len = data_len;
+
+	recs = (void *)(hdr + 1);
+	data = (char *)(recs + n_recs);
+	paths = (void *)(data + data_len);
+
+	/* installed is sorted by name, the records are laid out in order */
+	prev = NULL;
+	data_len = 0;
+	r = 0;
+	n_paths = 0;
+	for (i = 0; i < installed->len; i++) {
+		pkg = installed->pkgs[i];
+		if (pkg->dest != dest || (prev && !strcmp(prev, pkg->name)))
+			continue;
+		prev = pkg->name;
+
+		lines = file_index_build_lines(idx, pkg, &len, &st);
+		if (!lines)
+			continue;
+
+		recs[r].name = data_len;
+		n = strlen(pkg->name) + 1;
+		memcpy(data + data_len, pkg->name, n);
+		data_len += n;
+
+		recs[r].lines = data_len;
+		recs[r].lines_len = len;
+		recs[r].st = st;
+		memcpy(data + data_len, lines, len);
+
+		for (line = data + data_len; with_paths && line < data + data_len + len;
+		     line += n + 1) {
+			n = strlen(line);
+			paths[n_paths].rec = r;
+			paths[n_paths].len = n;
+			paths[n_paths].line = line - data;
+			n_paths++;
+		}
+
+		data_len += len;
+		r++;
+	}
+
+	if (n_paths) {
+		memcpy(paths + n_paths, paths, n_paths * sizeof(*paths));
+		path_sort_data = data;
+		qsort(paths, n_paths, sizeof(*paths), path_compare);
+		qsort(paths + n_paths, n_paths, sizeof(*paths), rpath_compare);
+	}
+
+	return image;
+}
+
+static int file_index_store(pkg_dest_t *dest, const void *image, size_t size)
+{
+	char *file_name, *tmp_file;
+	FILE *fp;
+	int ret = 0;
+
+	file_name = file_index_file_name(dest);
+	sprintf_alloc(&tmp_file, "%s.tmp", file_name);
+
+	fp = fopen(tmp_file, "w");
+	if (!fp) {
+		opkg_perror(ERROR, "Failed to open %s", tmp_file);
+		free(tmp_file);
+		free(file_name);
+		return -1;
+	}
+
+	if (fwrite(image, size, 1, fp) != 1) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		ret = -1;
+	}
+
+	if (fclose(fp) && !ret) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		ret = -1;
+	}
+
+	if (!ret && rename(tmp_file, file_name)) {
+		opkg_perror(ERROR, "Failed to rename %s to %s",
+			    tmp_file, file_name);
+		ret = -1;
+	}
+
+	if (ret)
+		unlink(tmp_file);
+
+	free(tmp_file);
+	free(file_name);
+
+	return ret;
+}
+
+static int file_index_writable(pkg_dest_t *dest)
+{
+	/* just a cache, not worth complaining about */
+	return !conf->noaction && !access(dest->opkg_dir, W_OK);
+}
+
+static pkg_vec_t *installed_by_name(void)
+{
+	pkg_vec_t *installed = pkg_vec_alloc();
+
+	pkg_hash_fetch_all_installed(installed);
+	pkg_vec_sort(installed, pkg_name_version_and_architecture_compare);
+
+	return installed;
+}
+
+/*
+ * Rewrites the index of dest from what idx has, and uses the result from
+ * then on even if it could not be written.
+ */
+static int file_index_rebuild(pkg_dest_t *dest, pkg_vec_t *installed,
+			      int with_paths)
+{
+	void *image;
+	size_t size;
+	int ret = 0;
+
+	image = file_index_build(dest, installed, with_paths, &size);
+
+	if (file_index_writable(dest))
+		ret = file_index_store(dest, image, size);
+
+	file_index_adopt(dest->file_index, image, size, 1);
+
+	return ret;
+}
+
+/*
+ * Rewrites the index of every destination whose lists were read or
+ * written, keeping the records of the other installed packages. The
+ * paths are left for the next search to sort.
+ */
+int file_index_save(void)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_vec_t *installed = NULL;
+	pkg_dest_t *dest;
+	int ret = 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+
+		if (!dest->file_index || !dest->file_index->dirty
+		    || !file_index_writable(dest))
+			continue;
+
+		if (!installed)
+			installed = installed_by_name();
+
+		if (file_index_rebuild(dest, installed, 0))
+			ret = -1;
+	}
+
+	if (installed)
+		pkg_vec_free(installed);
+
+	return ret;
+}
+
+/* the length of the literal start of a glob pattern */
+static size_t glob_prefix_len(const char *pattern)
+{
+	return strcspn(pattern, "*?[\\");
+}
+
+/* the length of the literal end of a glob pattern */
+static size_t glob_suffix_len(const char *pattern)
+{
+	size_t len = strlen(pattern), n = 0;
+
+	while (n < len && !strchr("*?[]\\", pattern[len - 1 - n]))
+		n++;
+
+	return n;
+}
+
+/* the paths starting with the first plen bytes of prefix */
+static void path_range(struct file_index *idx, const char *prefix,
+		       size_t plen, uint32_t *first, uint32_t *last)
+{
+	uint32_t lo, hi, mid;
+
+	for (lo = 0, hi = idx->n_paths; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(idx->data + idx->paths[mid].line, prefix, plen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+
+	for (hi = idx->n_paths; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(idx->data + idx->paths[mid].line, prefix, plen) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*last = lo;
+}
+
+/* the paths ending with the last slen bytes of suffix */
+static void rpath_range(struct file_index *idx, const char *suffix,
+			size_t slen, uint32_t *first, uint32_t *last)
+{
+	const struct file_index_path *p;
+	uint32_t lo, hi, mid;
+
+	for (lo = 0, hi = idx->n_paths; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		p = &idx->rpaths[mid];
+		if (rcmpn(idx->data + p->line, p->len, suffix, slen, slen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+
+	for (hi = idx->n_paths; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		p = &idx->rpaths[mid];
+		if (rcmpn(idx->data + p->line, p->len, suffix, slen, slen) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*last = lo;
+}
+
+/*
+ * Counts the lines of each record of idx that match pattern, only trying
+ * those that start with its literal start or end with its literal end,
+ * whichever there are fewer of.
+ */
+static void file_index_match(struct file_index *idx, const char *pattern,
+			     size_t plen, size_t slen, unsigned int *rec_hits)
+{
+	const struct file_index_path *paths = idx->paths;
+	uint32_t first, last, rfirst, rlast, k;
+
+	path_range(idx, pattern, plen, &first, &last);
+
+	if (slen) {
+		rpath_range(idx, pattern + strlen(pattern) - slen, slen,
+			    &rfirst, &rlast);
+		if (!plen || rlast - rfirst < last - first) {
+			paths = idx->rpaths;
+			first = rfirst;
+			last = rlast;
+		}
+	}
+
+	for (k = first; k < last; k++)
+		if (fnmatch(pattern, idx->data + paths[k].line, 0) == 0)
+			rec_hits[paths[k].rec]++;
+}
+
+static int scan_lines(const char *pattern, const char *lines, size_t len)
+{
+	const char *line, *end = lines + len;
+	size_t n, alloc = 0;
+	char *buf = NULL;
+	int hits = 0;
+
+	for (line = lines; line < end; line += n + 1) {
+		n = strlen(line);
+		if (fnmatch(pattern, installed_file_name(line, n, &buf, &alloc),
+			    conf->nocase) == 0)
+			hits++;
+	}
+
+	free(buf);
+
+	return hits;
+}
+
+/*
+ * Counts the installed files of each of pkgs that match pattern as
+ * fnmatch() does, into hits, or sets hits to -1 for packages that have no
+ * list to search.
+ */
+int file_index_search(pkg_vec_t *pkgs, const char *pattern, int *hits)
+{
+	const struct file_index_record **recs;
+	const char *lines;
+	pkg_dest_list_elt_t *iter;
+	pkg_vec_t *installed = NULL;
+	unsigned int *rec_hits;
+	struct file_index *idx;
+	size_t plen, slen, len;
+	pkg_dest_t *dest;
+	int i;
+
+	plen = glob_prefix_len(pattern);
+	slen = glob_suffix_len(pattern);
+
+	/* the sorted paths are of the lines as they are in the lists */
+	if (conf->nocase || conf->offline_root)
+		plen = slen = 0;
+
+	recs = xcalloc(pkgs->len + 1, sizeof(*recs));
+
+	for (i = 0; i < pkgs->len; i++)
+		hits[i] = file_index_lines(pkgs->pkgs[i], &lines, &len, &recs[i]);
+
+	if (plen || slen) {
+		list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+			dest = (pkg_dest_t *) iter->data;
+			idx = dest->file_index;
+
+			if (!idx || (!idx->dirty && idx->n_paths))
+				continue;
+
+			if (!installed)
+				installed = installed_by_name();
+
+			file_index_rebuild(dest, installed, 1);
+		}
+
+		if (installed)
+			pkg_vec_free(installed);
+	}
+
+	for (i = 0; i < pkgs->len; i++) {
+		if (hits[i] < 0)
+			continue;
+
+		file_index_lines(pkgs->pkgs[i], &lines, &len, &recs[i]);
+		hits[i] = 0;
+
+		if (!(plen || slen) || !recs[i])
+			hits[i] = scan_lines(pattern, lines, len);
+	}
+
+	if (plen || slen) {
+		list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+			dest = (pkg_dest_t *) iter->data;
+			idx = dest->file_index;
+
+			if (!idx || !idx->n_paths)
+				continue;
+
+			rec_hits = xcalloc(idx->n_recs + 1, sizeof(*rec_hits));
+			file_index_match(idx, pattern, plen, slen, rec_hits);
+
+			for (i = 0; i < pkgs->len; i++)
+				if (hits[i] >= 0 && recs[i]
+				    && pkgs->pkgs[i]->dest == dest)
+					hits[i] = rec_hits[recs[i] - idx->recs];
+
+			free(rec_hits);
+		}
+	}
+
+	free(recs);
+
+	return 0;
+}
+
+void file_index_free(pkg_dest_t *dest)
+{
+	struct file_index *idx = dest->file_index;
+
+	if (!idx)
+		return;
+
+	if (idx->map_alloced)
+		free(idx->map);
+	else if (idx->map)
+		munmap(idx->map, idx->map_len);
+
+	hash_table_foreach(&idx->lists, file_list_free, NULL);
+	hash_table_deinit(&idx->lists);
+	free(idx);
+
+	dest->file_index = NULL;
+}
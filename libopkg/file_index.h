@@ -0,0 +1,81 @@
+/* file_index.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <stdint.h>
+
+#include "pkg.h"
+#include "pkg_dest.h"
+
+/*
+ * Copy of the info_dir/<pkg>.list files of a destination, kept in
+ * <opkg_dir>/files.idx so the file owner hash can be filled from one
+ * mmapped file instead of reading every list. The copy of a list is
+ * only used while the size, mtime and inode of the list are those
+ * recorded with it, else the list is read and the index rewritten.
+ *
+ * Layout: header, records[n_records] sorted by name, data[data_len],
+ * paths[n_paths], rpaths[n_paths]. Names are NUL terminated strings in
+ * data, and the lines of a list are stored as a run of NUL terminated
+ * strings; data is padded to a multiple of 8 bytes. All integers are in
+ * host byte order; an index of different byte order is treated as stale.
+ *
+ * The path arrays are only written by "opkg search", which needs them:
+ * every line of every list, sorted by its bytes and by its bytes read
+ * backwards, for looking up what starts and what ends with a string.
+ */
+
+#define FILE_INDEX_MAGIC	"OPKGFIX"
+#define FILE_INDEX_VERSION	2
+#define FILE_INDEX_BYTE_ORDER	0x01020304
+
+struct file_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t n_records;
+	uint32_t n_paths;
+	uint64_t data_len;
+};
+
+struct file_index_stat {
+	uint64_t size;
+	uint64_t ino;
+	int64_t mtime;
+	int64_t mtime_nsec;
+};
+
+struct file_index_record {
+	uint64_t name;
+	uint64_t lines;
+	uint64_t lines_len;
+	struct file_index_stat st;
+};
+
+struct file_index_path {
+	uint32_t rec;
+	uint32_t len;
+	uint64_t line;
+};
+
+int file_index_set_file_owners(pkg_t * pkg);
+int file_index_get_lines(pkg_t * pkg, const char **lines, size_t * len);
+int file_index_search(pkg_vec_t * pkgs, const char *pattern, int *hits);
+void file_index_update(pkg_t * pkg, const char *text, size_t len);
+void file_index_remove(pkg_t * pkg);
+int file_index_save(void);
+void file_index_free(pkg_dest_t * dest);
+
+#endif
@@ -29,6 +29,7 @@
 #include "libbb/libbb.h"
 
 #include "sha256.h"
+#include "digest.h"
 
 int file_exists(const char *file_name)
 {
@@ -117,6 +118,31 @@ int file_copy(const char *src, const char *dest)
 	return err;
 }
 
+static void file_copy_digest_tap(const void *buf, size_t len, void *arg)
+{
+	digest_update(arg, buf, len);
+}
+
+/*
+ * file_copy() feeding the data to d on the way, so it is not read again
+ * to be verified. d is finalized on success; it only covers the data if
+ * src is a regular file.
+ */
+int file_copy_digest(const char *src, const char *dest, struct digest *d)
+{
+	int err;
+
+	err = copy_file_tap(src, dest,
+			    FILEUTILS_FORCE | FILEUTILS_PRESERVE_STATUS,
+			    file_copy_digest_tap, d);
+	if (err)
+		opkg_msg(ERROR, "Failed to copy file %s to %s.\n", src, dest);
+	else
+		digest_final(d);
+
+	return err;
+}
+
 int file_mkdir_hier(const char *path, long mode)
 {
 	return make_directory(path, mode, FILEUTILS_RECUR);
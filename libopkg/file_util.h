@@ -18,11 +18,14 @@
 #ifndef FILE_UTIL_H
 #define FILE_UTIL_H
 
+struct digest;
+
 int file_exists(const char *file_name);
 int file_is_dir(const char *file_name);
 char *file_read_line_alloc(FILE * file);
 int file_move(const char *src, const char *dest);
 int file_copy(const char *src, const char *dest);
+int file_copy_digest(const char *src, const char *dest, struct digest *d);
 int file_mkdir_hier(const char *path, long mode);
 char *file_md5sum_alloc(const char *file_name);
 char *file_sha256sum_alloc(const char *file_name);
@@ -22,25 +22,157 @@
 #include "opkg_message.h"
 #include "libbb/libbb.h"
 
-static unsigned long djb2_hash(const unsigned char *str)
+#define HASH_MIN_BUCKETS	16
+#define HASH_KEY_BLOCK_SIZE	16384
+#define HASH_PROBE_HIST_LEN	16
+
+struct hash_key_block {
+	struct hash_key_block *next;
+	unsigned int size;
+	unsigned int used;
+	char data[];
+};
+
+/* FNV-1a with a final avalanche so the low bits are usable as an index */
+static unsigned int hash_string(const char *str)
 {
-	unsigned long hash = 5381;
-	int c;
-	while ((c = *str++))
-		hash = ((hash << 5) + hash) + c;	/* hash * 33 + c */
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned int hash = 2166136261u;
+
+	while (*p) {
+		hash ^= *p++;
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
 	return hash;
 }
 
-static int hash_index(hash_table_t * hash, const char *key)
+static char *hash_key_store(hash_table_t * hash, const char *key)
+{
+	struct hash_key_block *block = hash->keys;
+	unsigned int len = strlen(key) + 1;
+	char *p;
+
+	if (block == NULL || block->size - block->used < len) {
+		unsigned int size = HASH_KEY_BLOCK_SIZE;
+
+		if (len > size)
+			size = len;
+
+		block = xmalloc(sizeof(*block) + size);
+		block->next = hash->keys;
+		block->size = size;
+		block->used = 0;
+		hash->keys = block;
+	}
+
+	p = block->data + block->used;
+	memcpy(p, key, len);
+	block->used += len;
+	hash->n_key_bytes += len;
+
+	return p;
+}
+
+static void hash_key_blocks_free(struct hash_key_block *block)
 {
-	return djb2_hash((const unsigned char *)key) % hash->n_buckets;
+	struct hash_key_block *next;
+
+	while (block) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
 }
 
 /*
- * this is an open table keyed by strings
+ * Places an entry whose key is known not to be in the table yet, taking
+ * over the slots of entries that are closer to their home slot.
+ */
+static void hash_place(hash_table_t * hash, hash_entry_t entry)
+{
+	unsigned int mask = hash->n_buckets - 1;
+	unsigned int ndx = entry.hash & mask;
+	hash_entry_t tmp;
+
+	entry.dist = 1;
+
+	while (hash->entries[ndx].dist) {
+		if (hash->entries[ndx].dist < entry.dist) {
+			tmp = hash->entries[ndx];
+			hash->entries[ndx] = entry;
+			entry = tmp;
+		}
+		ndx = (ndx + 1) & mask;
+		entry.dist++;
+	}
+
+	hash->entries[ndx] = entry;
+}
+
+static void hash_resize(hash_table_t * hash, unsigned int n_buckets)
+{
+	hash_entry_t *old = hash->entries;
+	unsigned int i, old_n_buckets = hash->n_buckets;
+	struct hash_key_block *old_keys = NULL;
+
+	hash->entries = xcalloc(n_buckets, sizeof(hash_entry_t));
+	hash->n_buckets = n_buckets;
+	hash->n_resizes++;
+
+	/* drop the storage of removed keys once it outweighs the live ones */
+	if (hash->n_dead_key_bytes > hash->n_key_bytes - hash->n_dead_key_bytes) {
+		old_keys = hash->keys;
+		hash->keys = NULL;
+		hash->n_key_bytes = 0;
+		hash->n_dead_key_bytes = 0;
+	}
+
+	for (i = 0; i < old_n_buckets; i++) {
+		if (!old[i].dist)
+			continue;
+		if (old_keys)
+			old[i].key = hash_key_store(hash, old[i].key);
+		hash_place(hash, old[i]);
+	}
+
+	hash_key_blocks_free(old_keys);
+	free(old);
+}
+
+static hash_entry_t *hash_lookup(hash_table_t * hash, const char *key,
+				 unsigned int h)
+{
+	unsigned int mask = hash->n_buckets - 1;
+	unsigned int ndx = h & mask;
+	unsigned int dist = 1;
+	hash_entry_t *entry;
+
+	while (1) {
+		entry = hash->entries + ndx;
+		if (entry->dist < dist)
+			return NULL;
+		if (entry->hash == h && strcmp(entry->key, key) == 0)
+			return entry;
+		ndx = (ndx + 1) & mask;
+		dist++;
+	}
+}
+
+/*
+ * this is an open table keyed by strings, len is a hint for the number
+ * of elements; the table grows as needed
  */
 void hash_table_init(const char *name, hash_table_t * hash, int len)
 {
+	unsigned int n_buckets = HASH_MIN_BUCKETS;
+
 	if (hash->entries != NULL) {
 		opkg_msg(ERROR, "Internal error: non empty hash table.\n");
 		return;
@@ -48,146 +180,142 @@ void hash_table_init(const char *name, hash_table_t * hash, int len)
 
 	memset(hash, 0, sizeof(hash_table_t));
 
+	while (len > 0 && n_buckets - n_buckets / 8 < (unsigned int)len)
+		n_buckets <<= 1;
+
 	hash->name = name;
-	hash->n_buckets = len;
+	hash->n_buckets = n_buckets;
 	hash->entries = xcalloc(hash->n_buckets, sizeof(hash_entry_t));
 }
 
 void hash_print_stats(hash_table_t * hash)
 {
+	unsigned int hist[HASH_PROBE_HIST_LEN];
+	unsigned int i, max_probe_len = 0, total_probe_len = 0;
+
+	memset(hist, 0, sizeof(hist));
+
+	for (i = 0; i < hash->n_buckets; i++) {
+		unsigned int dist = hash->entries[i].dist;
+
+		if (!dist)
+			continue;
+		if (dist > max_probe_len)
+			max_probe_len = dist;
+		total_probe_len += dist;
+		hist[(dist < HASH_PROBE_HIST_LEN ? dist : HASH_PROBE_HIST_LEN) -
+		     1]++;
+	}
+
 	printf("hash_table: %s, %d bytes\n"
-	       "\tn_buckets=%d, n_elements=%d, n_collisions=%d\n"
-	       "\tmax_bucket_len=%d, n_used_buckets=%d, ave_bucket_len=%.2f\n"
+	       "\tn_buckets=%d, n_elements=%d, load=%.2f, n_resizes=%d\n"
+	       "\tkey_bytes=%d, dead_key_bytes=%d\n"
+	       "\tmax_probe_len=%d, ave_probe_len=%.2f\n"
 	       "\tn_hits=%d, n_misses=%d\n",
 	       hash->name,
 	       hash->n_buckets * (int)sizeof(hash_entry_t),
 	       hash->n_buckets,
 	       hash->n_elements,
-	       hash->n_collisions,
-	       hash->max_bucket_len,
-	       hash->n_used_buckets,
-	       (hash->n_used_buckets ?
-		((float)hash->n_elements) / hash->n_used_buckets : 0.0f),
+	       (hash->n_buckets ?
+		((float)hash->n_elements) / hash->n_buckets : 0.0f),
+	       hash->n_resizes,
+	       hash->n_key_bytes, hash->n_dead_key_bytes,
+	       max_probe_len,
+	       (hash->n_elements ?
+		((float)total_probe_len) / hash->n_elements : 0.0f),
 	       hash->n_hits, hash->n_misses);
+
+	printf("\tprobe_len histogram:");
+	for (i = 0; i < HASH_PROBE_HIST_LEN && i < max_probe_len; i++)
+		printf(" %d%s=%d", i + 1,
+		       i == HASH_PROBE_HIST_LEN - 1 ? "+" : "", hist[i]);
+	printf("\n");
 }
 
 void hash_table_deinit(hash_table_t * hash)
 {
-	int i;
 	if (!hash)
 		return;
 
-	/* free the reminaing entries */
-	for (i = 0; i < hash->n_buckets; i++) {
-		hash_entry_t *hash_entry = (hash->entries + i);
-		free(hash_entry->key);
-		/* skip the first entry as this is part of the array */
-		hash_entry = hash_entry->next;
-		while (hash_entry) {
-			hash_entry_t *old = hash_entry;
-			hash_entry = hash_entry->next;
-			free(old->key);
-			free(old);
-		}
-	}
-
 	free(hash->entries);
+	hash_key_blocks_free(hash->keys);
 
 	hash->entries = NULL;
+	hash->keys = NULL;
 	hash->n_buckets = 0;
+	hash->n_elements = 0;
+	hash->n_key_bytes = 0;
+	hash->n_dead_key_bytes = 0;
 }
 
 void *hash_table_get(hash_table_t * hash, const char *key)
 {
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	while (hash_entry) {
-		if (hash_entry->key) {
-			if (strcmp(key, hash_entry->key) == 0) {
-				hash->n_hits++;
-				return hash_entry->data;
-			}
-		}
-		hash_entry = hash_entry->next;
+	hash_entry_t *hash_entry = hash_lookup(hash, key, hash_string(key));
+
+	if (hash_entry) {
+		hash->n_hits++;
+		return hash_entry->data;
 	}
+
 	hash->n_misses++;
 	return NULL;
 }
 
 int hash_table_insert(hash_table_t * hash, const char *key, void *value)
 {
-	int bucket_len = 0;
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	if (hash_entry->key) {
-		if (strcmp(hash_entry->key, key) == 0) {
-			/* alread in table, update the value */
-			hash_entry->data = value;
-			return 0;
-		} else {
-			/*
-			 * if this is a collision, we have to go to the end of the ll,
-			 * then add a new entry
-			 * before we can hook up the value
-			 */
-			while (hash_entry->next) {
-				hash_entry = hash_entry->next;
-				if (strcmp(hash_entry->key, key) == 0) {
-					hash_entry->data = value;
-					return 0;
-				}
-				bucket_len++;
-			}
-			hash_entry->next = xcalloc(1, sizeof(hash_entry_t));
-			hash_entry = hash_entry->next;
-			hash_entry->next = NULL;
-
-			hash->n_collisions++;
-			if (++bucket_len > hash->max_bucket_len)
-				hash->max_bucket_len = bucket_len;
-		}
-	} else
-		hash->n_used_buckets++;
+	unsigned int h = hash_string(key);
+	hash_entry_t *hash_entry = hash_lookup(hash, key, h);
+	hash_entry_t entry;
+
+	if (hash_entry) {
+		/* alread in table, update the value */
+		hash_entry->data = value;
+		return 0;
+	}
+
+	/* keep the load factor below 7/8 */
+	if (hash->n_elements + 1 > hash->n_buckets - hash->n_buckets / 8)
+		hash_resize(hash, hash->n_buckets * 2);
 
+	entry.key = hash_key_store(hash, key);
+	entry.data = value;
+	entry.hash = h;
+	hash_place(hash, entry);
 	hash->n_elements++;
-	hash_entry->key = xstrdup(key);
-	hash_entry->data = value;
 
 	return 0;
 }
 
 int hash_table_remove(hash_table_t * hash, const char *key)
 {
-	int ndx = hash_index(hash, key);
-	hash_entry_t *hash_entry = hash->entries + ndx;
-	hash_entry_t *next_entry = NULL, *last_entry = NULL;
-	while (hash_entry) {
-		if (hash_entry->key) {
-			if (strcmp(key, hash_entry->key) == 0) {
-				free(hash_entry->key);
-				if (last_entry) {
-					last_entry->next = hash_entry->next;
-					free(hash_entry);
-				} else {
-					next_entry = hash_entry->next;
-					if (next_entry) {
-						memmove(hash_entry, next_entry,
-							sizeof(hash_entry_t));
-						free(next_entry);
-					} else {
-						memset(hash_entry, 0,
-						       sizeof(hash_entry_t));
-					}
-				}
-				return 1;
-			}
-		}
-		last_entry = hash_entry;
-		hash_entry = hash_entry->next;
+	unsigned int mask = hash->n_buckets - 1;
+	hash_entry_t *hash_entry = hash_lookup(hash, key, hash_string(key));
+	unsigned int ndx, next;
+
+	if (!hash_entry)
+		return 0;
+
+	hash->n_dead_key_bytes += strlen(hash_entry->key) + 1;
+	hash->n_elements--;
+
+	/* shift the following entries of the cluster back by one slot */
+	ndx = hash_entry - hash->entries;
+	while (1) {
+		next = (ndx + 1) & mask;
+		if (hash->entries[next].dist <= 1)
+			break;
+		hash->entries[ndx] = hash->entries[next];
+		hash->entries[ndx].dist--;
+		ndx = next;
 	}
-	return 0;
+	memset(hash->entries + ndx, 0, sizeof(hash_entry_t));
+
+	return 1;
 }
 
+/*
+ * f must not insert into or remove from the table being iterated.
+ */
 void hash_table_foreach(hash_table_t * hash,
 			void (*f) (const char *key, void *entry, void *data),
 			void *data)
@@ -198,10 +326,7 @@ void hash_table_foreach(hash_table_t * hash,
 
 	for (i = 0; i < hash->n_buckets; i++) {
 		hash_entry_t *hash_entry = (hash->entries + i);
-		do {
-			if (hash_entry->key) {
-				f(hash_entry->key, hash_entry->data, data);
-			}
-		} while ((hash_entry = hash_entry->next));
+		if (hash_entry->dist)
+			f(hash_entry->key, hash_entry->data, data);
 	}
 }
@@ -21,22 +21,32 @@
 typedef struct hash_entry hash_entry_t;
 typedef struct hash_table hash_table_t;
 
+/*
+ * Open addressing with Robin Hood probing. dist is the distance of the
+ * entry from its home slot plus one, so a zero dist marks an empty slot.
+ */
 struct hash_entry {
 	char *key;
 	void *data;
-	struct hash_entry *next;
+	unsigned int hash;
+	unsigned int dist;
 };
 
+struct hash_key_block;
+
 struct hash_table {
 	const char *name;
 	hash_entry_t *entries;
 	unsigned int n_buckets;
 	unsigned int n_elements;
 
+	/* keys are copied into blocks owned by the table */
+	struct hash_key_block *keys;
+	unsigned int n_key_bytes;
+	unsigned int n_dead_key_bytes;
+
 	/* useful stats */
-	unsigned int n_used_buckets;
-	unsigned int n_collisions;
-	unsigned int max_bucket_len;
+	unsigned int n_resizes;
 	unsigned int n_hits, n_misses;
 };
 
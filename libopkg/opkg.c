@@ -27,6 +27,7 @@
 #include "opkg_download.h"
 #include "opkg_remove.h"
 #include "opkg_upgrade.h"
+#include "pkg_index.h"
 
 #include "sprintf_alloc.h"
 #include "file_util.h"
@@ -201,13 +202,11 @@ opkg_install_package(const char *package_name,
 		     void *user_data)
 {
 	int err;
-	char *stripped_filename, *local_filename;
 	opkg_progress_data_t pdata;
 	pkg_t *old, *new;
 	pkg_vec_t *deps, *all;
 	int i;
 	char **unresolved = NULL;
-	const char *filename;
 
 	opkg_assert(package_name != NULL);
 
@@ -238,7 +237,7 @@ opkg_install_package(const char *package_name,
 	/* find dependancies and download them */
 	deps = pkg_vec_alloc();
 	/* this function does not return the original package, so we insert it later */
-	pkg_hash_fetch_unsatisfied_dependencies(new, deps, &unresolved, 0);
+	pkg_hash_fetch_unsatisfied_dependencies(new, deps, &unresolved);
 	if (unresolved) {
 		char **tmp = unresolved;
 		opkg_msg(ERROR, "Couldn't satisfy the following dependencies"
@@ -258,46 +257,10 @@ opkg_install_package(const char *package_name,
 	pkg_vec_insert(deps, new);
 
 	/* download package and dependencies */
-	for (i = 0; i < deps->len; i++) {
-		pkg_t *pkg;
-		char *url, *urlencoded_path;
-
-		pkg = deps->pkgs[i];
-		if (pkg_get_string(pkg, PKG_LOCAL_FILENAME))
-			continue;
-
-		pdata.pkg = pkg;
-		pdata.action = OPKG_DOWNLOAD;
-
-		if (pkg->src == NULL) {
-			opkg_msg(ERROR, "Package %s not available from any "
-				 "configured src\n", package_name);
-			return -1;
-		}
-
-		filename = pkg_get_string(pkg, PKG_FILENAME);
-		urlencoded_path = urlencode_path(filename);
-		sprintf_alloc(&url, "%s/%s", pkg->src->value, urlencoded_path);
-		free(urlencoded_path);
-
-		/* Get the filename part, without any directory */
-		stripped_filename = strrchr(filename, '/');
-		if (!stripped_filename)
-			stripped_filename = (char *)filename;
-
-		sprintf_alloc(&local_filename, "%s/%s", conf->tmp_dir,
-			      stripped_filename);
-
-		pkg_set_string(pkg, PKG_LOCAL_FILENAME, local_filename);
-
-		err = opkg_download(url, local_filename, 0);
-		free(url);
-
-		if (err) {
-			pkg_vec_free(deps);
-			return -1;
-		}
-
+	err = opkg_download_pkgs(deps, conf->tmp_dir);
+	if (err) {
+		pkg_vec_free(deps);
+		return -1;
 	}
 	pkg_vec_free(deps);
 
@@ -526,6 +489,7 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 
 	list_for_each_entry(iter, &conf->pkg_src_list.head, node) {
 		char *url, *list_file_name = NULL;
+		int list_ok;
 
 		src = (pkg_src_t *) iter->data;
 
@@ -537,6 +501,9 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 		if (opkg_download(url, list_file_name, 0)) {
 			opkg_msg(ERROR, "Couldn't retrieve %s\n", url);
 			result = -1;
+			list_ok = 0;
+		} else {
+			list_ok = 1;
 		}
 		free(url);
 
@@ -558,6 +525,7 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 			err = opkg_download(url, sig_file_name, 0);
 			if (err) {
 				opkg_msg(ERROR, "Couldn't retrieve %s\n", url);
+				list_ok = list_ok && conf->force_signature;
 			} else {
 				int err;
 				err = opkg_verify_file(list_file_name,
@@ -570,6 +538,8 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 					opkg_msg(ERROR, "Signature check "
 						 "failed for %s",
 						 list_file_name);
+					list_ok = list_ok &&
+					    conf->force_signature;
 				}
 			}
 			free(sig_file_name);
@@ -580,6 +550,9 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 			 " has not been enabled in this build\n",
 			 list_file_name);
 #endif
+		/* only a list which is kept is worth an index */
+		if (list_ok)
+			pkg_index_update(list_file_name, src);
 		free(list_file_name);
 
 		sources_done++;
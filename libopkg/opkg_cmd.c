@@ -27,10 +27,13 @@
 #include "opkg_message.h"
 #include "pkg.h"
 #include "pkg_dest.h"
+#include "pkg_graph.h"
 #include "pkg_parse.h"
+#include "pkg_index.h"
 #include "sprintf_alloc.h"
 #include "pkg.h"
 #include "file_util.h"
+#include "file_index.h"
 #include "libbb/libbb.h"
 #include "opkg_utils.h"
 #include "opkg_defines.h"
@@ -94,15 +97,224 @@ static void sigint_handler(int sig)
 	exit(128 + sig);
 }
 
+/*
+ * Each source is updated by a job going through these steps, with up to
+ * conf->download_jobs sources at the same time. A step either finishes
+ * right away or has a download or the verify program the update loop
+ * waits for.
+ */
+enum update_step {
+	UPDATE_LIST,		/* download Packages(.gz) */
+	UPDATE_SIG,		/* download Packages.sig */
+	UPDATE_VERIFY,		/* check the signature */
+	UPDATE_DONE
+};
+
+struct update_job {
+	pkg_src_t *src;
+	enum update_step step;
+	char *url;
+	char *list_file_name;
+	char *sig_file_name;
+	char *tmp_file_name;
+	int list_error;
+	int downloading;
+	struct opkg_download_stream stream;
+	pid_t verify_pid;	/* of the running verify program */
+};
+
+/*
+ * Starts the current step of job. Returns 1 if it already finished,
+ * with its result in *res, or 0 if job->stream or job->verify_pid has to
+ * be waited for.
+ */
+static int update_step_start(struct update_job *job, const char *tmp_dir,
+			     int *res)
+{
+	pkg_src_t *src = job->src;
+	const char *dest;
+
+	switch (job->step) {
+	case UPDATE_LIST:
+		sprintf_alloc(&job->url, "%s/%s", src->value,
+			      src->gzip ? "Packages.gz" : "Packages");
+		dest = job->list_file_name;
+		break;
+	case UPDATE_SIG:
+		/* download detached signitures to verify the package lists */
+		sprintf_alloc(&job->url, "%s/%s", src->value, "Packages.sig");
+		dest = job->sig_file_name;
+		break;
+	case UPDATE_VERIFY:
+		job->verify_pid = opkg_verify_file_start(job->list_file_name,
+							 job->sig_file_name);
+		if (job->verify_pid > 0)
+			return 0;
+		*res = job->verify_pid;
+		job->verify_pid = 0;
+		return 1;
+	default:
+		*res = 0;
+		return 1;
+	}
+
+	if (!strncmp(job->url, "file:", 5)) {
+		*res = opkg_download(job->url, dest, 0);
+		return 1;
+	}
+
+	opkg_msg(NOTICE, "Downloading %s\n", job->url);
+
+	sprintf_alloc(&job->tmp_file_name, "%s/%s%s", tmp_dir, src->name,
+		      job->step == UPDATE_SIG ? ".sig" : "");
+
+	if (!opkg_download_stream_start(&job->stream, job->url,
+					job->tmp_file_name, 0)) {
+		job->downloading = 1;
+		return 0;
+	}
+
+	*res = -1;
+	return 1;
+}
+
+static int update_bad_signature(struct update_job *job)
+{
+	if (!conf->force_signature) {
+		/* The signature was wrong so delete it */
+		opkg_msg(NOTICE, "Remove wrong Signature file.\n");
+		unlink(job->sig_file_name);
+		unlink(job->list_file_name);
+	}
+	/* We shouldn't unlink the signature ! */
+	// unlink (job->sig_file_name);
+
+	return UPDATE_DONE;
+}
+
+/*
+ * Completes the current step of job with its result and picks the next
+ * one. Returns the number of failures to account.
+ */
+static int update_step_done(struct update_job *job, int res)
+{
+	const char *dest = (job->step == UPDATE_SIG) ?
+	    job->sig_file_name : job->list_file_name;
+	int failures = 0;
+
+	/* a download in the background still has to be moved in place */
+	if (job->downloading)
+		res = opkg_download_stream_finish(&job->stream, dest);
+	job->downloading = 0;
+
+	switch (job->step) {
+	case UPDATE_LIST:
+		if (res) {
+			failures++;
+			job->list_error = 1;
+			opkg_msg(NOTICE,
+				 "*** Failed to download the package list from %s\n\n",
+				 job->url);
+			job->step = UPDATE_DONE;
+			break;
+		}
+
+		opkg_msg(NOTICE, "Updated list of available packages in %s\n",
+			 job->list_file_name);
+#if defined(HAVE_USIGN)
+		job->step = conf->check_signature ? UPDATE_SIG : UPDATE_DONE;
+#else
+		job->step = UPDATE_DONE;
+#endif
+		break;
+	case UPDATE_SIG:
+		if (res) {
+			failures++;
+			opkg_msg(NOTICE, "Signature file download failed "
+				 "for %s.\n", job->src->name);
+			job->step = update_bad_signature(job);
+		} else {
+			job->step = UPDATE_VERIFY;
+		}
+		break;
+	case UPDATE_VERIFY:
+		if (res == 0) {
+			opkg_msg(NOTICE, "Signature check passed for %s.\n",
+				 job->src->name);
+			job->step = UPDATE_DONE;
+		} else {
+			opkg_msg(NOTICE, "Signature check failed for %s.\n",
+				 job->src->name);
+			job->step = update_bad_signature(job);
+		}
+		break;
+	default:
+		break;
+	}
+
+	free(job->url);
+	free(job->tmp_file_name);
+	job->url = job->tmp_file_name = NULL;
+
+	if (job->step == UPDATE_DONE && !job->list_error &&
+	    file_exists(job->list_file_name))
+		pkg_index_update(job->list_file_name, job->src);
+
+	return failures;
+}
+
+/*
+ * Feeds the result of the current step of job and starts the following
+ * ones until one of them has to run in the background or the job is done.
+ */
+static int update_job_run(struct update_job *job, const char *tmp_dir,
+			  int res)
+{
+	int failures = 0;
+
+	do {
+		failures += update_step_done(job, res);
+	} while (job->step != UPDATE_DONE &&
+		 update_step_start(job, tmp_dir, &res));
+
+	return failures;
+}
+
+/*
+ * Ends the step job is running in the background, when the update has to
+ * give up on it. A list that was not verified is removed as if its
+ * signature was wrong.
+ */
+static void update_job_abort(struct update_job *job)
+{
+	if (job->downloading)
+		opkg_download_stream_abort(&job->stream);
+	job->downloading = 0;
+
+	if (job->verify_pid)
+		xsystem_wait(conf->verify_program, job->verify_pid);
+	job->verify_pid = 0;
+
+	if (job->step == UPDATE_SIG || job->step == UPDATE_VERIFY)
+		update_bad_signature(job);
+	job->step = UPDATE_DONE;
+
+	free(job->url);
+	free(job->tmp_file_name);
+	job->url = job->tmp_file_name = NULL;
+}
+
 static int opkg_update_cmd(int argc, char **argv)
 {
 	char *tmp;
 	int err;
 	int failures;
-	int pkglist_dl_error;
+	int i, n_jobs, next, running, res;
 	char *lists_dir;
 	pkg_src_list_elt_t *iter;
-	pkg_src_t *src;
+	struct update_job *jobs, *job, **waiting;
+	struct opkg_download_stream **streams;
+	int n, *ready, verifying, pause = 1;
 
 	sprintf_alloc(&lists_dir, "%s",
 		      conf->restrict_to_default_dest ? conf->default_dest->
@@ -130,83 +342,107 @@ static int opkg_update_cmd(int argc, char **argv)
 		return -1;
 	}
 
+	n_jobs = 0;
+	for (iter = void_list_first(&conf->pkg_src_list); iter;
+	     iter = void_list_next(&conf->pkg_src_list, iter))
+		n_jobs++;
+
+	jobs = xcalloc(n_jobs ? n_jobs : 1, sizeof(*jobs));
+
+	i = 0;
 	for (iter = void_list_first(&conf->pkg_src_list); iter;
 	     iter = void_list_next(&conf->pkg_src_list, iter)) {
-		char *url, *list_file_name;
+		job = &jobs[i++];
+		job->src = (pkg_src_t *) iter->data;
+		job->step = UPDATE_LIST;
+		sprintf_alloc(&job->list_file_name, "%s/%s", lists_dir,
+			      job->src->name);
+		/* Put the signature in the right place */
+		sprintf_alloc(&job->sig_file_name, "%s/%s.sig", lists_dir,
+			      job->src->name);
+	}
 
-		src = (pkg_src_t *) iter->data;
+	streams = xcalloc(n_jobs ? n_jobs : 1, sizeof(*streams));
+	waiting = xcalloc(n_jobs ? n_jobs : 1, sizeof(*waiting));
+	ready = xcalloc(n_jobs ? n_jobs : 1, sizeof(*ready));
+
+	next = 0;
+	running = 0;
+	while (next < n_jobs || running) {
+		/* keep up to download_jobs sources in flight */
+		while (next < n_jobs && running < conf->download_jobs) {
+			job = &jobs[next++];
+			if (update_step_start(job, tmp, &res))
+				failures += update_job_run(job, tmp, res);
+			if (job->step != UPDATE_DONE)
+				running++;
+		}
 
-		sprintf_alloc(&url, "%s/%s", src->value,
-			      src->gzip ? "Packages.gz" : "Packages");
+		if (!running)
+			break;
 
-		sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
-		pkglist_dl_error = 0;
-		if (opkg_download(url, list_file_name, 0)) {
-			failures++;
-			pkglist_dl_error = 1;
-			opkg_msg(NOTICE,
-				 "*** Failed to download the package list from %s\n\n",
-				 url);
-		} else {
-			opkg_msg(NOTICE,
-				 "Updated list of available packages in %s\n",
-				 list_file_name);
+		n = 0;
+		verifying = 0;
+		for (job = jobs; job < jobs + next; job++) {
+			verifying |= !!job->verify_pid;
+			if (!job->downloading)
+				continue;
+			waiting[n] = job;
+			streams[n++] = &job->stream;
 		}
-		free(url);
-#if defined(HAVE_USIGN)
-		if (pkglist_dl_error == 0 && conf->check_signature) {
-			/* download detached signitures to verify the package lists */
-			/* get the url for the sig file */
-			sprintf_alloc(&url, "%s/%s", src->value,
-				      "Packages.sig");
-
-			/* create temporary file for it */
-			char *tmp_file_name;
-
-			/* Put the signature in the right place */
-			sprintf_alloc(&tmp_file_name, "%s/%s.sig", lists_dir,
-				      src->name);
-
-			err = opkg_download(url, tmp_file_name, 0);
-			if (err) {
-				failures++;
-				opkg_msg(NOTICE,
-					 "Signature file download failed.\n");
-			} else {
-				err =
-				    opkg_verify_file(list_file_name,
-						     tmp_file_name);
-				if (err == 0)
-					opkg_msg(NOTICE,
-						 "Signature check passed.\n");
-				else
-					opkg_msg(NOTICE,
-						 "Signature check failed.\n");
-			}
-			if (err && !conf->force_signature) {
-				/* The signature was wrong so delete it */
-				opkg_msg(NOTICE,
-					 "Remove wrong Signature file.\n");
-				unlink(tmp_file_name);
-				unlink(list_file_name);
-			}
-			/* We shouldn't unlink the signature ! */
-			// unlink (tmp_file_name);
-			free(tmp_file_name);
-			free(url);
+
+		/* the verify programs are reaped by pid, looking after them
+		 * with a pause growing from 1ms to 32ms */
+		if (opkg_download_streams_wait(streams, n, ready,
+					       verifying ? pause : -1)) {
+			for (job = jobs; job < jobs + next; job++)
+				if (job->step != UPDATE_DONE)
+					update_job_abort(job);
+			failures += running;
+			break;
+		}
+		if (verifying && pause < 32)
+			pause *= 2;
+
+		for (i = 0; i < n; i++) {
+			job = waiting[i];
+			if (!ready[i] || opkg_download_stream_read(&job->stream))
+				continue;
+
+			failures += update_job_run(job, tmp, 0);
+			if (job->step == UPDATE_DONE)
+				running--;
+		}
+
+		for (job = jobs; job < jobs + next; job++) {
+			if (!job->verify_pid ||
+			    !xsystem_reap(conf->verify_program, job->verify_pid,
+					  &res))
+				continue;
+
+			job->verify_pid = 0;
+			pause = 1;
+			failures += update_job_run(job, tmp, res ? -1 : 0);
+			if (job->step == UPDATE_DONE)
+				running--;
 		}
-#else
-		// Do nothing
-#endif
-		free(list_file_name);
 	}
+
+	free(ready);
+	free(waiting);
+	free(streams);
+
+	for (i = 0; i < n_jobs; i++) {
+		free(jobs[i].list_file_name);
+		free(jobs[i].sig_file_name);
+	}
+	free(jobs);
 	rmdir(tmp);
 	free(tmp);
 	free(lists_dir);
 
 	return failures;
 }
-
 struct opkg_intercept {
 	char *oldpath;
 	char *statedir;
@@ -288,104 +524,312 @@ static int opkg_finalize_intercepts(opkg_intercept_t ctx)
 	return err;
 }
 
-/* For package pkg do the following: If it is already visited, return. If not,
-   add it in visited list and recurse to its deps. Finally, add it to ordered
-   list.
-   pkg_vec all contains all available packages in repos.
-   pkg_vec visited contains packages already visited by this function, and is
-   used to end recursion and avoid an infinite loop on graph cycles.
-   pkg_vec ordered will finally contain the ordered set of packages.
-*/
-static int
-opkg_recurse_pkgs_in_order(pkg_t * pkg, pkg_vec_t * all,
-			   pkg_vec_t * visited, pkg_vec_t * ordered)
+/* The installed or unpacked package a dependency on apkg is configured
+   after: that of the first provider having one. */
+static pkg_t *opkg_configure_provider(abstract_pkg_t * apkg)
 {
-	int j, k, l, m;
-	pkg_t *dep;
-	compound_depend_t *compound_depend;
-	depend_t **possible_satisfiers;
-	abstract_pkg_t *abpkg;
-	abstract_pkg_t **dependents;
-
-	/* If it's just an available package, that is, not installed and not even
-	   unpacked, skip it */
-	/* XXX: This is probably an overkill, since a state_status != SS_UNPACKED
-	   would do here. However, if there is an intermediate node (pkg) that is
-	   configured and installed between two unpacked packages, the latter
-	   won't be properly reordered, unless all installed/unpacked pkgs are
-	   checked */
-	if (pkg->state_status == SS_NOT_INSTALLED)
-		return 0;
+	abstract_pkg_vec_t *providers = apkg->provided_by;
+	pkg_vec_t *pkgs;
+	int i, j;
+
+	for (i = 0; providers && i < providers->len; i++) {
+		pkgs = providers->pkgs[i]->pkgs;
+		for (j = 0; pkgs && j < pkgs->len; j++)
+			if (pkgs->pkgs[j]->state_status != SS_NOT_INSTALLED)
+				return pkgs->pkgs[j];
+	}
 
-	/* If the  package has already been visited (by this function), skip it */
-	for (j = 0; j < visited->len; j++)
-		if (!strcmp(visited->pkgs[j]->name, pkg->name)) {
-			opkg_msg(DEBUG, "pkg %s already visited, skipping.\n",
-				 pkg->name);
-			return 0;
+	return NULL;
+}
+
+/*
+ * Puts the installed and unpacked packages of all into ordered, each after
+ * the packages its dependencies are satisfied by, by a depth first search
+ * from every one of them in turn. Only one package of a name is visited,
+ * and a dependency cycle is broken where the search entered it. Returns
+ * the position of every package in ordered by graph_id, -1 if it is not.
+ */
+static int *opkg_order_pkgs(const struct pkg_graph *g, pkg_vec_t * all,
+			    pkg_vec_t * ordered)
+{
+	struct {
+		pkg_t *pkg;
+		unsigned int edge;
+	} *stack;
+	const struct pkg_graph_edge *e;
+	char *visited;
+	int *pos;
+	unsigned int i, depth;
+	pkg_t *pkg, *dep;
+
+	stack = xcalloc(g->n_apkgs + 1, sizeof(*stack));
+	visited = xcalloc(g->n_apkgs + 1, sizeof(char));
+	pos = xcalloc(g->n_pkgs + 1, sizeof(int));
+
+	for (i = 0; i < g->n_pkgs; i++)
+		pos[i] = -1;
+
+	for (i = 0; i < all->len; i++) {
+		pkg = all->pkgs[i];
+
+		/* XXX: This is probably an overkill, since a state_status !=
+		   SS_UNPACKED would do here. However, if there is an
+		   intermediate node (pkg) that is configured and installed
+		   between two unpacked packages, the latter won't be properly
+		   reordered, unless all installed/unpacked pkgs are checked */
+		if (pkg->state_status == SS_NOT_INSTALLED
+		    || visited[pkg->parent->graph_id])
+			continue;
+
+		visited[pkg->parent->graph_id] = 1;
+		stack[0].pkg = pkg;
+		stack[0].edge = g->edge_idx[pkg->graph_id];
+		depth = 1;
+
+		while (depth) {
+			pkg = stack[depth - 1].pkg;
+			dep = NULL;
+
+			while (stack[depth - 1].edge < g->edge_idx[pkg->graph_id + 1]) {
+				e = &g->edges[stack[depth - 1].edge++];
+				if (e->type == CONFLICTS)
+					continue;
+
+				dep = opkg_configure_provider(g->apkgs[e->to]);
+				if (dep && !visited[dep->parent->graph_id])
+					break;
+				dep = NULL;
+			}
+
+			if (dep) {
+				opkg_msg(DEBUG, "Descending on pkg %s.\n",
+					 dep->name);
+				visited[dep->parent->graph_id] = 1;
+				stack[depth].pkg = dep;
+				stack[depth].edge = g->edge_idx[dep->graph_id];
+				depth++;
+				continue;
+			}
+
+			/* all its dependencies are in ordered now */
+			pos[pkg->graph_id] = ordered->len;
+			pkg_vec_insert(ordered, pkg);
+			depth--;
 		}
+	}
 
-	pkg_vec_insert(visited, pkg);
-
-	opkg_msg(DEBUG, "pkg %s.\n", pkg->name);
-
-	/* Iterate over all the dependencies of pkg. For each one, find a package
-	   that is either installed or unpacked and satisfies this dependency.
-	   (there should only be one such package per dependency installed or
-	   unpacked). Then recurse to the dependency package */
-	for (compound_depend = pkg_get_ptr(pkg, PKG_DEPENDS); compound_depend && compound_depend->type; compound_depend++) {
-		possible_satisfiers = compound_depend->possibilities;
-		for (k = 0; k < compound_depend->possibility_count; k++) {
-			abpkg = possible_satisfiers[k]->pkg;
-			dependents = abpkg->provided_by->pkgs;
-			l = 0;
-			if (dependents != NULL)
-				while (l < abpkg->provided_by->len
-				       && dependents[l] != NULL) {
-					opkg_msg(DEBUG,
-						 "Descending on pkg %s.\n",
-						 dependents[l]->name);
-
-					/* find whether dependent l is installed or unpacked,
-					 * and then find which package in the list satisfies it */
-					for (m = 0; m < all->len; m++) {
-						dep = all->pkgs[m];
-						if (dep->state_status !=
-						    SS_NOT_INSTALLED)
-							if (!strcmp
-							    (dep->name,
-							     dependents[l]->
-							     name)) {
-								opkg_recurse_pkgs_in_order
-								    (dep, all,
-								     visited,
-								     ordered);
-								/* Stop the outer loop */
-								l = abpkg->
-								    provided_by->
-								    len;
-								/* break from the inner loop */
-								break;
-							}
-					}
-					l++;
-				}
+	free(visited);
+	free(stack);
+
+	return pos;
+}
+
+/* Links every package of ordered to those ordered after it that depend on
+   it, counting the links into succ_idx and waiting if succ is NULL. */
+static void opkg_link_configure_deps(const struct pkg_graph *g,
+				     pkg_vec_t * ordered, const int *pos,
+				     unsigned int *succ_idx,
+				     unsigned int *succ,
+				     unsigned int *waiting)
+{
+	const struct pkg_graph_edge *e;
+	unsigned int u, i;
+	pkg_t *pkg, *dep;
+	int v;
+
+	for (u = 0; u < ordered->len; u++) {
+		pkg = ordered->pkgs[u];
+
+		for (i = g->edge_idx[pkg->graph_id];
+		     i < g->edge_idx[pkg->graph_id + 1]; i++) {
+			e = &g->edges[i];
+			if (e->type == CONFLICTS)
+				continue;
+
+			dep = opkg_configure_provider(g->apkgs[e->to]);
+			if (!dep)
+				continue;
+
+			/* a link back would be part of a cycle */
+			v = pos[dep->graph_id];
+			if (v < 0 || v >= u)
+				continue;
+
+			if (succ) {
+				succ[succ_idx[v]++] = u;
+			} else {
+				succ_idx[v + 1]++;
+				waiting[u]++;
+			}
 		}
 	}
+}
 
-	/* When all recursions from this node down, are over, and all
-	   dependencies have been added in proper order in the ordered array, add
-	   also the package pkg to ordered array */
-	pkg_vec_insert(ordered, pkg);
+static void opkg_configured(pkg_t * pkg)
+{
+	pkg->state_status = SS_INSTALLED;
+	pkg->parent->state_status = SS_INSTALLED;
+	pkg->state_flag &= ~SF_PREFER;
+	opkg_state_changed++;
+}
 
-	return 0;
+static int opkg_configure_wanted(pkg_t * pkg, const char *pkg_name)
+{
+	if (pkg_name && fnmatch(pkg_name, pkg->name, conf->nocase))
+		return 0;
 
+	return pkg->state_status == SS_UNPACKED;
 }
 
-static int opkg_configure_packages(char *pkg_name)
+struct configure_job {
+	unsigned int node;
+	pid_t pid;
+};
+
+static void opkg_configure_sigchld(int sig)
+{
+}
+
+/*
+ * Waits for one of the running postinst scripts and returns its index in
+ * jobs, with what xsystem_wait() returned for it in *res. Only the pids
+ * of jobs are waited for: SIGCHLD is blocked while they are checked and
+ * sigsuspend() sleeps until the next child exits.
+ */
+static int opkg_configure_reap(const struct configure_job *jobs,
+			       int running, int *res)
 {
-	pkg_vec_t *all, *ordered, *visited;
+	struct sigaction sa, old_sa;
+	sigset_t mask, old_mask, wait_mask;
 	int i;
+
+	/* SIGCHLD is discarded while it is not handled */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = opkg_configure_sigchld;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, &old_sa);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+	wait_mask = old_mask;
+	sigdelset(&wait_mask, SIGCHLD);
+
+	for (;;) {
+		for (i = 0; i < running; i++)
+			if (xsystem_reap("/bin/sh", jobs[i].pid, res))
+				goto out;
+
+		sigsuspend(&wait_mask);
+	}
+
+out:
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	sigaction(SIGCHLD, &old_sa, NULL);
+
+	return i;
+}
+
+/*
+ * Configures the packages of ordered like the sequential loop does, but
+ * running up to conf->configure_jobs postinst scripts at the same time.
+ * A package is only started once the packages it was ordered after are
+ * done with, configured or not.
+ */
+static int opkg_configure_parallel(const struct pkg_graph *g,
+				   pkg_vec_t * ordered, const int *pos,
+				   const char *pkg_name)
+{
+	unsigned int n = ordered->len;
+	unsigned int *succ_idx, *succ, *fill, *waiting, *queue;
+	unsigned int u, i, head, tail;
+	struct configure_job *jobs;
+	int running, r, err = 0;
+	pkg_t *pkg;
+	pid_t pid;
+
+	succ_idx = xcalloc(n + 1, sizeof(unsigned int));
+	waiting = xcalloc(n + 1, sizeof(unsigned int));
+	opkg_link_configure_deps(g, ordered, pos, succ_idx, NULL, waiting);
+
+	fill = xcalloc(n + 1, sizeof(unsigned int));
+	for (u = 0; u < n; u++) {
+		succ_idx[u + 1] += succ_idx[u];
+		fill[u] = succ_idx[u];
+	}
+	succ = xcalloc(succ_idx[n] + 1, sizeof(unsigned int));
+	opkg_link_configure_deps(g, ordered, pos, fill, succ, NULL);
+	free(fill);
+
+	/* packages are started in the order they became ready */
+	queue = xcalloc(n + 1, sizeof(unsigned int));
+	head = tail = 0;
+	for (u = 0; u < n; u++)
+		if (!waiting[u])
+			queue[tail++] = u;
+
+	jobs = xcalloc(conf->configure_jobs, sizeof(*jobs));
+	running = 0;
+
+	while (head < tail || running) {
+		while (head < tail && running < conf->configure_jobs) {
+			u = queue[head++];
+			pkg = ordered->pkgs[u];
+			pid = 0;
+
+			if (opkg_configure_wanted(pkg, pkg_name)) {
+				opkg_msg(NOTICE, "Configuring %s.\n", pkg->name);
+				r = opkg_configure_start(pkg, &pid);
+				if (!pid && r == 0)
+					opkg_configured(pkg);
+				else if (!pid)
+					err = -1;
+			}
+
+			if (pid) {
+				jobs[running].node = u;
+				jobs[running].pid = pid;
+				running++;
+				continue;
+			}
+
+			for (i = succ_idx[u]; i < succ_idx[u + 1]; i++)
+				if (!--waiting[succ[i]])
+					queue[tail++] = succ[i];
+		}
+
+		if (!running)
+			break;
+
+		i = opkg_configure_reap(jobs, running, &r);
+		u = jobs[i].node;
+		jobs[i] = jobs[--running];
+		pkg = ordered->pkgs[u];
+
+		if (opkg_configure_finish(pkg, r) == 0)
+			opkg_configured(pkg);
+		else
+			err = -1;
+
+		for (i = succ_idx[u]; i < succ_idx[u + 1]; i++)
+			if (!--waiting[succ[i]])
+				queue[tail++] = succ[i];
+	}
+
+	free(jobs);
+	free(queue);
+	free(succ);
+	free(waiting);
+	free(succ_idx);
+
+	return err;
+}
+
+static int opkg_configure_packages(char *pkg_name)
+{
+	const struct pkg_graph *g;
+	pkg_vec_t *all, *ordered;
+	int i, *pos;
 	pkg_t *pkg;
 	opkg_intercept_t ic;
 	int r, err = 0;
@@ -399,12 +843,9 @@ static int opkg_configure_packages(char *pkg_name)
 	/* Reorder pkgs in order to be configured according to the Depends: tag
 	   order */
 	opkg_msg(INFO, "Reordering packages before configuring them...\n");
+	g = pkg_graph_get();
 	ordered = pkg_vec_alloc();
-	visited = pkg_vec_alloc();
-	for (i = 0; i < all->len; i++) {
-		pkg = all->pkgs[i];
-		opkg_recurse_pkgs_in_order(pkg, all, visited, ordered);
-	}
+	pos = opkg_order_pkgs(g, all, ordered);
 
 	ic = opkg_prep_intercepts();
 	if (ic == NULL) {
@@ -412,23 +853,21 @@ static int opkg_configure_packages(char *pkg_name)
 		goto error;
 	}
 
-	for (i = 0; i < ordered->len; i++) {
-		pkg = ordered->pkgs[i];
+	if (conf->configure_jobs > 1) {
+		err = opkg_configure_parallel(g, ordered, pos, pkg_name);
+	} else {
+		for (i = 0; i < ordered->len; i++) {
+			pkg = ordered->pkgs[i];
 
-		if (pkg_name && fnmatch(pkg_name, pkg->name, conf->nocase))
-			continue;
+			if (!opkg_configure_wanted(pkg, pkg_name))
+				continue;
 
-		if (pkg->state_status == SS_UNPACKED) {
 			opkg_msg(NOTICE, "Configuring %s.\n", pkg->name);
 			r = opkg_configure(pkg);
-			if (r == 0) {
-				pkg->state_status = SS_INSTALLED;
-				pkg->parent->state_status = SS_INSTALLED;
-				pkg->state_flag &= ~SF_PREFER;
-				opkg_state_changed++;
-			} else {
+			if (r == 0)
+				opkg_configured(pkg);
+			else
 				err = -1;
-			}
 		}
 	}
 
@@ -438,7 +877,7 @@ static int opkg_configure_packages(char *pkg_name)
 error:
 	pkg_vec_free(all);
 	pkg_vec_free(ordered);
-	pkg_vec_free(visited);
+	free(pos);
 
 	return err;
 }
@@ -450,6 +889,7 @@ static int opkg_install_cmd(int argc, char **argv)
 	int i;
 	char *arg;
 	int err = 0;
+	struct opkg_transaction *t;
 
 	signal(SIGINT, sigint_handler);
 
@@ -477,13 +917,16 @@ static int opkg_install_cmd(int argc, char **argv)
 
 	pkg_info_preinstall_check();
 
-	for (i = 0; i < argc; i++) {
-		arg = argv[i];
-		if (opkg_install_by_name(arg)) {
-			opkg_msg(ERROR, "Cannot install package %s.\n", arg);
+	t = opkg_transaction_new();
+
+	for (i = 0; i < argc; i++)
+		if (opkg_transaction_add_name(t, argv[i]))
 			err = -1;
-		}
-	}
+
+	if (opkg_transaction_run(t))
+		err = -1;
+
+	opkg_transaction_free(t);
 
 	if (opkg_configure_packages(NULL))
 		err = -1;
@@ -498,6 +941,7 @@ static int opkg_upgrade_cmd(int argc, char **argv)
 	int i;
 	pkg_t *pkg;
 	int err = 0;
+	struct opkg_transaction *t;
 
 	signal(SIGINT, sigint_handler);
 
@@ -510,6 +954,8 @@ static int opkg_upgrade_cmd(int argc, char **argv)
 		}
 		pkg_info_preinstall_check();
 
+		t = opkg_transaction_new();
+
 		for (i = 0; i < argc; i++) {
 			char *arg = argv[i];
 			if (conf->restrict_to_default_dest) {
@@ -529,13 +975,19 @@ static int opkg_upgrade_cmd(int argc, char **argv)
 				pkg = pkg_hash_fetch_installed_by_name(argv[i]);
 			}
 			if (pkg) {
-				if (opkg_upgrade_pkg(pkg))
-					err = -1;
+				pkg = opkg_upgrade_candidate(pkg);
+				if (pkg)
+					opkg_transaction_add(t, pkg, 1);
 			} else {
-				if (opkg_install_by_name(arg))
+				if (opkg_transaction_add_name(t, arg))
 					err = -1;
 			}
 		}
+
+		if (opkg_transaction_run(t))
+			err = -1;
+
+		opkg_transaction_free(t);
 	}
 
 	if (opkg_configure_packages(NULL))
@@ -641,8 +1093,7 @@ static void opkg_list_find_cmd_cb(pkg_t *pkg, void *priv)
 	}
 
 out:
-	pkg_deinit(pkg);
-	free(pkg);
+	pkg_free(pkg);
 	free(version);
 }
 
@@ -970,8 +1421,9 @@ static int opkg_flag_cmd(int argc, char **argv)
 static int opkg_files_cmd(int argc, char **argv)
 {
 	pkg_t *pkg;
-	str_list_t *files;
-	str_list_elt_t *iter;
+	path_list_t *files;
+	const char *file;
+	size_t pos;
 	char *pkg_version;
 
 	if (argc < 1) {
@@ -991,9 +1443,9 @@ static int opkg_files_cmd(int argc, char **argv)
 	    ("Package %s (%s) is installed on %s and has the following files:\n",
 	     pkg->name, pkg_version, pkg->dest->name);
 
-	for (iter = str_list_first(files); iter;
-	     iter = str_list_next(files, iter))
-		printf("%s\n", (char *)iter->data);
+	for (file = path_list_first(files, &pos); file;
+	     file = path_list_next(files, &pos))
+		printf("%s\n", file);
 
 	free(pkg_version);
 	pkg_free_installed_files(pkg);
@@ -1042,18 +1494,32 @@ static int opkg_depends_cmd(int argc, char **argv)
 	return 0;
 }
 
-static int pkg_mark_provides(pkg_t * pkg)
+/*
+ * Marks pkg and what it provides, and queues the available packages with a
+ * relation of type to any of those to be looked at (again).
+ */
+static void pkg_mark_provides(const struct pkg_graph *g, pkg_t * pkg,
+			      enum depend_type type, const int *avail,
+			      char *pending)
 {
-	abstract_pkg_t **provider = pkg_get_ptr(pkg, PKG_PROVIDES);
+	const struct pkg_graph_edge *e;
+	abstract_pkg_t *apkg;
+	unsigned int i, j;
 
 	pkg->parent->state_flag |= SF_MARKED;
 
-	while (provider && *provider) {
-		(*provider)->state_flag |= SF_MARKED;
-		provider++;
-	}
+	for (i = g->provides_idx[pkg->graph_id];
+	     i < g->provides_idx[pkg->graph_id + 1]; i++) {
+		apkg = g->apkgs[g->provides[i]];
+		apkg->state_flag |= SF_MARKED;
 
-	return 0;
+		for (j = g->rdep_idx[apkg->graph_id];
+		     j < g->rdep_idx[apkg->graph_id + 1]; j++) {
+			e = &g->edges[g->rdeps[j]];
+			if (e->type == type && avail[e->from] >= 0)
+				pending[avail[e->from]] = 1;
+		}
+	}
 }
 
 enum what_field_type {
@@ -1069,12 +1535,15 @@ static int
 opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 				int argc, char **argv)
 {
+	const struct pkg_graph *g;
+	const struct pkg_graph_edge *e, *end;
 	depend_t *possibility;
-	compound_depend_t *cdep, *deps;
 	pkg_vec_t *available_pkgs;
 	pkg_t *pkg;
-	int i, j, l;
+	int i, j;
 	int changed;
+	int *avail;
+	char *pending;
 	const char *rel_str = NULL;
 	char *ver;
 
@@ -1102,6 +1571,19 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 	else
 		pkg_hash_fetch_all_installed(available_pkgs);
 
+	/* where the packages of the graph are in available_pkgs, if at all */
+	g = pkg_graph_get();
+	avail = xmalloc((g->n_pkgs + 1) * sizeof(int));
+	for (i = 0; i < g->n_pkgs; i++)
+		avail[i] = -1;
+	for (i = 0; i < available_pkgs->len; i++)
+		avail[available_pkgs->pkgs[i]->graph_id] = i;
+
+	/* the first pass looks at every package, later ones only at those
+	 * with a relation to something marked since */
+	pending = xmalloc(available_pkgs->len + 1);
+	memset(pending, 1, available_pkgs->len + 1);
+
 	/* mark the root set */
 	pkg_vec_clear_marks(available_pkgs);
 	opkg_msg(NOTICE, "Root set:\n");
@@ -1112,7 +1594,7 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 		pkg = available_pkgs->pkgs[i];
 		if (pkg->state_flag & SF_MARKED) {
 			/* mark the parent (abstract) package */
-			pkg_mark_provides(pkg);
+			pkg_mark_provides(g, pkg, what_field_type, avail, pending);
 			opkg_msg(NOTICE, "  %s\n", pkg->name);
 		}
 	}
@@ -1122,67 +1604,63 @@ opkg_what_depends_conflicts_cmd(enum depend_type what_field_type, int recursive,
 		changed = 0;
 
 		for (j = 0; j < available_pkgs->len; j++) {
+			if (!pending[j])
+				continue;
 
+			pending[j] = 0;
 			pkg = available_pkgs->pkgs[j];
-			/*
-			count = ((what_field_type == CONFLICTS)
-				 ? pkg->conflicts_count
-				 : pkg->pre_depends_count +
-				 pkg->depends_count +
-				 pkg->recommends_count + pkg->suggests_count);
-				 */
 
 			/* skip this package if it is already marked */
 			if (pkg->parent->state_flag & SF_MARKED)
 				continue;
 
-			deps = pkg_get_ptr(pkg, (what_field_type == CONFLICTS) ? PKG_CONFLICTS : PKG_DEPENDS);
+			e = g->edges + g->edge_idx[pkg->graph_id];
+			end = g->edges + g->edge_idx[pkg->graph_id + 1];
 
-			for (cdep = deps; cdep && cdep->type; cdep++) {
-				if (what_field_type != cdep->type)
+			for (; e < end; e++) {
+				if (what_field_type != e->type)
 					continue;
 
-				for (l = 0; l < cdep->possibility_count; l++) {
-					possibility = cdep->possibilities[l];
+				possibility = e->depend;
 
-					if ((possibility->pkg->state_flag
-					     & SF_MARKED)
-					    != SF_MARKED)
-						continue;
+				if ((possibility->pkg->state_flag
+				     & SF_MARKED)
+				    != SF_MARKED)
+					continue;
 
-					/* mark the depending package so we
-					 * won't visit it again */
-					pkg->state_flag |= SF_MARKED;
-					pkg_mark_provides(pkg);
-					changed++;
-
-					ver = pkg_version_str_alloc(pkg);
-					opkg_msg(NOTICE, "\t%s %s\t%s %s",
-						 pkg->name,
-						 ver,
-						 rel_str,
-						 possibility->pkg->name);
-					free(ver);
-					if (possibility->version) {
-						opkg_msg(NOTICE, " (%s%s)",
-							 constraint_to_str
-							 (possibility->
-							  constraint),
-							 possibility->version);
-					}
-					if (!pkg_dependence_satisfiable
-					    (possibility))
-						opkg_msg(NOTICE,
-							 " unsatisfiable");
-					opkg_message(NOTICE, "\n");
-					goto next_package;
+				/* mark the depending package so we
+				 * won't visit it again */
+				pkg->state_flag |= SF_MARKED;
+				pkg_mark_provides(g, pkg, what_field_type,
+						  avail, pending);
+				changed++;
+
+				ver = pkg_version_str_alloc(pkg);
+				opkg_msg(NOTICE, "\t%s %s\t%s %s",
+					 pkg->name,
+					 ver,
+					 rel_str,
+					 possibility->pkg->name);
+				free(ver);
+				if (possibility->version) {
+					opkg_msg(NOTICE, " (%s%s)",
+						 constraint_to_str
+						 (possibility->
+						  constraint),
+						 possibility->version);
 				}
+				if (!pkg_dependence_satisfiable
+				    (possibility))
+					opkg_msg(NOTICE,
+						 " unsatisfiable");
+				opkg_message(NOTICE, "\n");
+				break;
 			}
-next_package:
-			;
 		}
 	} while (changed && recursive);
 
+	free(pending);
+	free(avail);
 	pkg_vec_free(available_pkgs);
 
 	return 0;
@@ -1277,9 +1755,10 @@ static int opkg_search_cmd(int argc, char **argv)
 
 	pkg_vec_t *installed;
 	pkg_t *pkg;
-	str_list_t *installed_files;
-	str_list_elt_t *iter;
-	char *installed_file;
+	path_list_t *installed_files;
+	const char *installed_file;
+	size_t pos;
+	int *hits;
 
 	if (argc < 1) {
 		return -1;
@@ -1289,14 +1768,23 @@ static int opkg_search_cmd(int argc, char **argv)
 	pkg_hash_fetch_all_installed(installed);
 	pkg_vec_sort(installed, pkg_compare_names);
 
+	hits = xcalloc(installed->len + 1, sizeof(*hits));
+	file_index_search(installed, argv[0], hits);
+
 	for (i = 0; i < installed->len; i++) {
 		pkg = installed->pkgs[i];
 
+		if (hits[i] >= 0) {
+			while (hits[i]--)
+				print_pkg(pkg);
+			continue;
+		}
+
 		installed_files = pkg_get_installed_files(pkg);
 
-		for (iter = str_list_first(installed_files); iter;
-		     iter = str_list_next(installed_files, iter)) {
-			installed_file = (char *)iter->data;
+		for (installed_file = path_list_first(installed_files, &pos);
+		     installed_file;
+		     installed_file = path_list_next(installed_files, &pos)) {
 			if (fnmatch(argv[0], installed_file, conf->nocase) == 0)
 				print_pkg(pkg);
 		}
@@ -1304,6 +1792,7 @@ static int opkg_search_cmd(int argc, char **argv)
 		pkg_free_installed_files(pkg);
 	}
 
+	free(hits);
 	pkg_vec_free(installed);
 
 	return 0;
@@ -1321,10 +1810,8 @@ static int opkg_compare_versions_cmd(int argc, char **argv)
 		parse_version(p1, argv[0]);
 		parse_version(p2, argv[2]);
 		rc = pkg_version_satisfied(p1, p2, argv[1]);
-		pkg_deinit(p1);
-		pkg_deinit(p2);
-		free(p1);
-		free(p2);
+		pkg_free(p1);
+		pkg_free(p2);
 		return rc ? 0 : 1;
 	} else {
 		opkg_msg(ERROR,
@@ -1345,6 +1832,11 @@ static int opkg_print_architecture_cmd(int argc, char **argv)
 	return 0;
 }
 
+static int opkg_compact_status_cmd(int argc, char **argv)
+{
+	return opkg_conf_compact_status_files();
+}
+
 /* XXX: CLEANUP: The usage strings should be incorporated into this
    array for easier maintenance */
 static opkg_cmd_t cmds[] = {
@@ -1370,6 +1862,8 @@ static opkg_cmd_t cmds[] = {
 	 PFM_DESCRIPTION | PFM_SOURCE},
 	{"status", 0, (opkg_cmd_fun_t) opkg_status_cmd,
 	 PFM_DESCRIPTION | PFM_SOURCE},
+	{"compact-status", 0, (opkg_cmd_fun_t) opkg_compact_status_cmd,
+	 PFM_DESCRIPTION | PFM_SOURCE},
 	{"install", 1, (opkg_cmd_fun_t) opkg_install_cmd,
 	 PFM_DESCRIPTION | PFM_SOURCE},
 	{"remove", 1, (opkg_cmd_fun_t) opkg_remove_cmd,
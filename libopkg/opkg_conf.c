@@ -26,11 +26,16 @@
 #include "opkg_conf.h"
 #include "pkg_vec.h"
 #include "pkg.h"
+#include "pkg_hash.h"
 #include "xregex.h"
 #include "sprintf_alloc.h"
 #include "opkg_message.h"
 #include "file_util.h"
 #include "opkg_defines.h"
+#include "status_journal.h"
+#include "str_pool.h"
+#include "conffile.h"
+#include "opkg_transport.h"
 #include "libbb/libbb.h"
 
 static int lock_fd;
@@ -63,6 +68,8 @@ opkg_option_t options[] = {
 	{"test", OPKG_OPT_TYPE_BOOL, &_conf.noaction},
 	{"noaction", OPKG_OPT_TYPE_BOOL, &_conf.noaction},
 	{"download_only", OPKG_OPT_TYPE_BOOL, &_conf.download_only},
+	{"download_jobs", OPKG_OPT_TYPE_INT, &_conf.download_jobs},
+	{"configure_jobs", OPKG_OPT_TYPE_INT, &_conf.configure_jobs},
 	{"nodeps", OPKG_OPT_TYPE_BOOL, &_conf.nodeps},
 	{"nocase", OPKG_OPT_TYPE_BOOL, &_conf.nocase},
 	{"offline_root", OPKG_OPT_TYPE_STRING, &_conf.offline_root},
@@ -71,8 +78,10 @@ opkg_option_t options[] = {
 	{"proxy_user", OPKG_OPT_TYPE_STRING, &_conf.proxy_user},
 	{"query-all", OPKG_OPT_TYPE_BOOL, &_conf.query_all},
 	{"size", OPKG_OPT_TYPE_BOOL, &_conf.size},
+	{"status_journal", OPKG_OPT_TYPE_BOOL, &_conf.status_journal},
 	{"strip_abi", OPKG_OPT_TYPE_BOOL, &_conf.strip_abi},
 	{"tmp_dir", OPKG_OPT_TYPE_STRING, &_conf.tmp_dir},
+	{"transport", OPKG_OPT_TYPE_STRING, &_conf.transport},
 	{"verbosity", OPKG_OPT_TYPE_INT, &_conf.verbosity},
 	{"verify_program", OPKG_OPT_TYPE_STRING, &_conf.verify_program},
 	{NULL, 0, NULL}
@@ -343,7 +352,7 @@ err0:
 	return err;
 }
 
-int opkg_conf_write_status_files(void)
+static int write_status_files_full(void)
 {
 	pkg_dest_list_elt_t *iter;
 	pkg_dest_t *dest;
@@ -351,9 +360,6 @@ int opkg_conf_write_status_files(void)
 	pkg_t *pkg;
 	int i, ret = 0;
 
-	if (conf->noaction)
-		return 0;
-
 	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
 		dest = (pkg_dest_t *) iter->data;
 
@@ -370,14 +376,8 @@ int opkg_conf_write_status_files(void)
 
 	for (i = 0; i < all->len; i++) {
 		pkg = all->pkgs[i];
-		/* We don't need most uninstalled packages in the status file */
-		if (pkg->state_status == SS_NOT_INSTALLED
-		    && (pkg->state_want == SW_UNKNOWN
-			|| (pkg->state_want == SW_DEINSTALL
-			    && pkg->state_flag != SF_HOLD)
-			|| pkg->state_want == SW_PURGE)) {
+		if (!pkg_status_is_recorded(pkg))
 			continue;
-		}
 		if (pkg->dest == NULL) {
 			opkg_msg(ERROR,
 				 "Internal error: package %s has a NULL dest\n",
@@ -397,11 +397,44 @@ int opkg_conf_write_status_files(void)
 				    dest->status_file_name);
 			ret = -1;
 		}
+		dest->status_fp = NULL;
 	}
 
+	if (!ret)
+		status_journal_reset();
+
 	return ret;
 }
 
+int opkg_conf_write_status_files(void)
+{
+	int ret;
+
+	if (conf->noaction)
+		return 0;
+
+	if (conf->status_journal) {
+		ret = status_journal_write();
+		if (ret <= 0)
+			return ret;
+
+		opkg_msg(INFO, "Merging status journal.\n");
+	}
+
+	return write_status_files_full();
+}
+
+/*
+ * Rewrites the plain text status files and drops their journals.
+ */
+int opkg_conf_compact_status_files(void)
+{
+	if (conf->noaction)
+		return 0;
+
+	return write_status_files_full();
+}
+
 char *root_filename_alloc(char *filename)
 {
 	char *root_filename;
@@ -538,6 +571,12 @@ int opkg_conf_load(void)
 	if (conf->verify_program == NULL)
 		conf->verify_program = xstrdup(OPKG_CONF_DEFAULT_VERIFY_PROGRAM);
 
+	if (conf->download_jobs <= 0)
+		conf->download_jobs = OPKG_CONF_DEFAULT_DOWNLOAD_JOBS;
+
+	if (conf->configure_jobs <= 0)
+		conf->configure_jobs = OPKG_CONF_DEFAULT_CONFIGURE_JOBS;
+
 	if (conf->offline_root) {
 		sprintf_alloc(&tmp, "%s/%s", conf->offline_root,
 			      conf->lists_dir);
@@ -570,7 +609,7 @@ err4:
 	free(conf->lists_dir);
 
 	pkg_hash_deinit();
-	hash_table_deinit(&conf->file_hash);
+	file_hash_deinit();
 	hash_table_deinit(&conf->obs_file_hash);
 
 	if (rmdir(conf->tmp_dir) == -1)
@@ -630,6 +669,10 @@ void opkg_conf_deinit(void)
 	if (conf->conf_file)
 		free(conf->conf_file);
 
+	conffile_sums_save();
+	conffile_sums_free();
+	opkg_transport_cleanup();
+
 	pkg_src_list_deinit(&conf->pkg_src_list);
 	pkg_dest_list_deinit(&conf->pkg_dest_list);
 	nv_pair_list_deinit(&conf->arch_list);
@@ -645,13 +688,15 @@ void opkg_conf_deinit(void)
 	}
 
 	if (conf->verbosity >= DEBUG) {
-		hash_print_stats(&conf->pkg_hash);
+		pkg_hash_print_stats();
 		hash_print_stats(&conf->file_hash);
 		hash_print_stats(&conf->obs_file_hash);
+		str_pool_print_stats();
 	}
 
 	pkg_hash_deinit();
-	hash_table_deinit(&conf->file_hash);
+	str_pool_deinit();
+	file_hash_deinit();
 	hash_table_deinit(&conf->obs_file_hash);
 
 	if (lock_fd != -1) {
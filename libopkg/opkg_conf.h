@@ -43,6 +43,9 @@ extern opkg_conf_t *conf;
 
 #define OPKG_CONF_DEFAULT_HASH_LEN 1024
 
+#define OPKG_CONF_DEFAULT_DOWNLOAD_JOBS 4
+#define OPKG_CONF_DEFAULT_CONFIGURE_JOBS 1
+
 struct opkg_conf {
 	pkg_src_list_t pkg_src_list;
 	pkg_dest_list_t pkg_dest_list;
@@ -89,9 +92,13 @@ struct opkg_conf {
 	char *verify_program;
 	int noaction;
 	int size;
+	int status_journal;
 	int strip_abi;
 	int download_only;
+	int download_jobs;	/* parallel package downloads */
+	int configure_jobs;	/* parallel postinst scripts */
 	char *cache;
+	char *transport;	/* "wget" to fetch everything through wget */
 
 	/* proxy options */
 	char *http_proxy;
@@ -129,6 +136,7 @@ int opkg_conf_load(void);
 void opkg_conf_deinit(void);
 
 int opkg_conf_write_status_files(void);
+int opkg_conf_compact_status_files(void);
 char *root_filename_alloc(char *filename);
 
 #endif
@@ -22,8 +22,26 @@
 #include "opkg_message.h"
 #include "opkg_cmd.h"
 #include "pkg_alternatives.h"
+#include "xsystem.h"
 
-int opkg_configure(pkg_t * pkg)
+static int opkg_configure_done(pkg_t * pkg, int err)
+{
+	if (err) {
+		opkg_msg(ERROR, "%s.postinst returned %d.\n", pkg->name, err);
+		return err;
+	}
+
+	pkg_alternatives_update(pkg);
+
+	return 0;
+}
+
+/*
+ * Starts configuring pkg. If its postinst script is running, *pid is set
+ * to it and opkg_configure_finish() completes the job once it exited.
+ * Otherwise *pid is 0 and pkg is configured already, as the result says.
+ */
+int opkg_configure_start(pkg_t * pkg, pid_t * pid)
 {
 	int err;
 
@@ -33,13 +51,28 @@ int opkg_configure(pkg_t * pkg)
 	/* DPKG_INCOMPATIBILITY:
 	   dpkg actually includes a version number to this script call */
 
-	err = pkg_run_script(pkg, "postinst", "configure");
-	if (err) {
-		opkg_msg(ERROR, "%s.postinst returned %d.\n", pkg->name, err);
-		return err;
-	}
-
-	pkg_alternatives_update(pkg);
+	err = pkg_start_script(pkg, "postinst", "configure", pid);
+	if (err || !*pid)
+		return opkg_configure_done(pkg, err);
 
 	return 0;
 }
+
+/* status is what xsystem_wait() returned for the postinst script */
+int opkg_configure_finish(pkg_t * pkg, int status)
+{
+	return opkg_configure_done(pkg,
+				   pkg_finish_script(pkg, "postinst", status));
+}
+
+int opkg_configure(pkg_t * pkg)
+{
+	pid_t pid;
+	int err;
+
+	err = opkg_configure_start(pkg, &pid);
+	if (!pid)
+		return err;
+
+	return opkg_configure_finish(pkg, xsystem_wait("/bin/sh", pid));
+}
@@ -21,5 +21,7 @@
 #include "pkg.h"
 
 int opkg_configure(pkg_t * pkg);
+int opkg_configure_start(pkg_t * pkg, pid_t * pid);
+int opkg_configure_finish(pkg_t * pkg, int status);
 
 #endif
@@ -20,6 +20,9 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "opkg_download.h"
 #include "opkg_message.h"
@@ -27,6 +30,7 @@
 #include "sprintf_alloc.h"
 #include "xsystem.h"
 #include "file_util.h"
+#include "digest.h"
 #include "opkg_defines.h"
 #include "libbb/libbb.h"
 
@@ -35,13 +39,96 @@ static int str_starts_with(const char *str, const char *prefix)
 	return (strncmp(str, prefix, strlen(prefix)) == 0);
 }
 
+/*
+ * Digest of the local file of a package, kept with the package so the
+ * file is not read again while it is still the one that was hashed.
+ */
+struct local_digest {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct digest digest;
+};
+
+static int opkg_digest_want(pkg_t *pkg)
+{
+	int want = 0;
+
+	if (pkg_get_md5(pkg))
+		want |= DIGEST_MD5;
+	if (pkg_get_sha256(pkg))
+		want |= DIGEST_SHA256;
+
+	return want;
+}
+
+static int local_digest_match(const struct local_digest *ld,
+			      const struct stat *st)
+{
+	return ld->dev == st->st_dev && ld->ino == st->st_ino
+	    && ld->size == st->st_size
+	    && ld->mtime.tv_sec == st->st_mtim.tv_sec
+	    && ld->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void local_digest_set(pkg_t *pkg, const struct stat *st,
+			     const struct digest *d)
+{
+	struct local_digest *ld = pkg_get_ptr(pkg, PKG_LOCAL_DIGEST);
+
+	if (!ld)
+		ld = pkg_set_ptr(pkg, PKG_LOCAL_DIGEST, xmalloc(sizeof(*ld)));
+
+	ld->dev = st->st_dev;
+	ld->ino = st->st_ino;
+	ld->size = st->st_size;
+	ld->mtime = st->st_mtim;
+	ld->digest = *d;
+}
+
+/* Remembers d as the digest of filename, which was just written from it. */
+static void opkg_digest_record(pkg_t *pkg, const char *filename,
+			       const struct digest *d)
+{
+	struct stat st;
+
+	if (lstat(filename, &st) || !S_ISREG(st.st_mode)
+	    || (uint64_t)st.st_size != d->size)
+		return;
+
+	local_digest_set(pkg, &st, d);
+}
+
+static int opkg_verify_digest(pkg_t *pkg, const struct digest *d)
+{
+	char *pkg_md5, *pkg_sha256;
+
+	pkg_md5 = pkg_get_md5(pkg);
+	if (pkg_md5 && (d->want & DIGEST_MD5)
+	    && strcmp(d->md5_hex, pkg_md5)) {
+		opkg_msg(INFO, "Package %s md5sum mismatch.\n", pkg->name);
+		return -1;
+	}
+
+	pkg_sha256 = pkg_get_sha256(pkg);
+	if (pkg_sha256 && (d->want & DIGEST_SHA256)
+	    && strcmp(d->sha256_hex, pkg_sha256)) {
+		opkg_msg(INFO, "Package %s sha256sum mismatch.\n", pkg->name);
+		return -1;
+	}
+
+	return 0;
+}
+
 int opkg_verify_integrity(pkg_t *pkg, const char *filename)
 {
 	int err = 0;
-	char *file_md5, *pkg_md5;
-	char *file_sha256, *pkg_sha256;
 	struct stat pkg_stat;
 	long long int pkg_expected_size;
+	struct local_digest *ld;
+	struct digest d;
+	int want;
 
 	/* Check file size */
 	err = lstat(filename, &pkg_stat);
@@ -58,208 +145,296 @@ int opkg_verify_integrity(pkg_t *pkg, const char *filename)
 		opkg_msg(INFO,
 			 "Package size mismatch: %s is %lld bytes, expecting %lld bytes\n",
 			 pkg->name, (long long int)pkg_stat.st_size, pkg_expected_size);
-		err = -1;
-		goto out;
+		return -1;
 	}
 
-	/* Check for md5 values */
-	pkg_md5 = pkg_get_md5(pkg);
-	if (pkg_md5) {
-		file_md5 = file_md5sum_alloc(filename);
-		if (file_md5 && strcmp(file_md5, pkg_md5)) {
-			opkg_msg(INFO, "Package %s md5sum mismatch.\n",
-				 pkg->name);
-			err = -1;
-			free(file_md5);
-			goto out;
-		}
-		if (file_md5)
-			free(file_md5);
-	}
+	want = opkg_digest_want(pkg);
+	if (!want)
+		return 0;
 
-	/* Check for sha256 value */
-	pkg_sha256 = pkg_get_sha256(pkg);
-	if (pkg_sha256) {
-		file_sha256 = file_sha256sum_alloc(filename);
-		if (file_sha256 && strcmp(file_sha256, pkg_sha256)) {
-			opkg_msg(INFO, "Package %s sha256sum mismatch.\n",
-				 pkg->name);
-			err = -1;
-			free(file_sha256);
-			goto out;
-		}
-		if (file_sha256)
-			free(file_sha256);
+	/* both sums in one read, unless the file was hashed as it was written */
+	ld = pkg_get_ptr(pkg, PKG_LOCAL_DIGEST);
+	if (ld && local_digest_match(ld, &pkg_stat)
+	    && (ld->digest.want & want) == want)
+		return opkg_verify_digest(pkg, &ld->digest);
+
+	digest_init(&d, want);
+	if (digest_file(&d, filename)) {
+		opkg_msg(ERROR, "Could't compute checksums for %s.\n",
+			 filename);
+		return 0;
 	}
 
-out:
-	return err;
+	local_digest_set(pkg, &pkg_stat, &d);
+
+	return opkg_verify_digest(pkg, &d);
 }
 
-int
-opkg_download(const char *src, const char *dest_file_name,
-              const short hide_error)
+/* where src is put while it is downloaded */
+static char *opkg_download_tmp_name(const char *src)
 {
-	int err = 0;
-
 	char *src_basec = xstrdup(src);
-	char *src_base = basename(src_basec);
 	char *tmp_file_location;
 
-	opkg_msg(NOTICE, "Downloading %s\n", src);
+	sprintf_alloc(&tmp_file_location, "%s/%s", conf->tmp_dir,
+		      basename(src_basec));
+	free(src_basec);
 
-	if (str_starts_with(src, "file:")) {
-		char *file_src = urldecode_path(src + 5);
-		opkg_msg(INFO, "Copying %s to %s...", file_src, dest_file_name);
-		err = file_copy(file_src, dest_file_name);
-		opkg_msg(INFO, "Done.\n");
-		free(src_basec);
-		free(file_src);
-		return err;
+	return tmp_file_location;
+}
+
+static long long opkg_download_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int opkg_download_stream_start(struct opkg_download_stream *s,
+			       const char *src, const char *tmp_file_name,
+			       int want)
+{
+	const struct opkg_transport *transport = opkg_transport_for(src);
+
+	memset(s, 0, sizeof(*s));
+	s->src = src;
+	s->tmp_file_location = tmp_file_name ? xstrdup(tmp_file_name) :
+	    opkg_download_tmp_name(src);
+	digest_init(&s->digest, want);
+
+	if (unlink(s->tmp_file_location) && errno != ENOENT) {
+		opkg_perror(ERROR, "Failed to unlink %s", s->tmp_file_location);
+		goto err;
 	}
 
-	sprintf_alloc(&tmp_file_location, "%s/%s", conf->tmp_dir, src_base);
-	free(src_basec);
-	err = unlink(tmp_file_location);
-	if (err && errno != ENOENT) {
-		opkg_perror(ERROR, "Failed to unlink %s", tmp_file_location);
-		free(tmp_file_location);
-		return -1;
+	s->fp = fopen(s->tmp_file_location, "w");
+	if (!s->fp) {
+		opkg_perror(ERROR, "Failed to open %s", s->tmp_file_location);
+		goto err;
 	}
 
-	if (conf->http_proxy) {
-		opkg_msg(DEBUG,
-			 "Setting environment variable: http_proxy = %s.\n",
-			 conf->http_proxy);
-		setenv("http_proxy", conf->http_proxy, 1);
+	s->transfer = transport->start(src);
+	if (!s->transfer) {
+		opkg_msg(ERROR, "Failed to download %s.\n", src);
+		fclose(s->fp);
+		s->fp = NULL;
+		unlink(s->tmp_file_location);
+		goto err;
 	}
-	if (conf->https_proxy) {
-		opkg_msg(DEBUG,
-			 "Setting environment variable: https_proxy = %s.\n",
-			 conf->https_proxy);
-		setenv("https_proxy", conf->https_proxy, 1);
+
+	s->deadline = opkg_download_now() + opkg_transport_timeout();
+
+	return 0;
+
+err:
+	free(s->tmp_file_location);
+	s->tmp_file_location = NULL;
+	return -1;
+}
+
+int opkg_download_stream_read(struct opkg_download_stream *s)
+{
+	char buf[65536];
+	size_t n;
+	int more;
+
+	more = s->transfer->transport->read(s->transfer, buf, sizeof(buf), &n);
+	s->deadline = opkg_download_now() + opkg_transport_timeout();
+
+	/* keep reading after an error, so the transfer can finish */
+	if (!n || s->err)
+		return more;
+
+	if (fwrite(buf, 1, n, s->fp) != n) {
+		opkg_perror(ERROR, "Failed to write %s", s->tmp_file_location);
+		s->err = -1;
+		return more;
 	}
-	if (conf->ftp_proxy) {
-		opkg_msg(DEBUG,
-			 "Setting environment variable: ftp_proxy = %s.\n",
-			 conf->ftp_proxy);
-		setenv("ftp_proxy", conf->ftp_proxy, 1);
+
+	digest_update(&s->digest, buf, n);
+
+	return more;
+}
+
+int opkg_download_streams_wait(struct opkg_download_stream **streams, int n,
+			       int *ready, int max_timeout)
+{
+	struct pollfd *fds;
+	long long now = opkg_download_now(), left;
+	int timeout = -1, i, ret;
+
+	fds = xcalloc(n ? n : 1, sizeof(*fds));
+
+	for (i = 0; i < n; i++) {
+		fds[i].fd = streams[i]->transfer->fd;
+		fds[i].events = POLLIN;
+		ready[i] = 0;
+
+		if (!streams[i]->transfer->transport->expire)
+			continue;
+
+		left = streams[i]->deadline - now;
+		if (left < 0)
+			left = 0;
+		if (timeout < 0 || left < timeout)
+			timeout = left;
 	}
-	if (conf->no_proxy) {
-		opkg_msg(DEBUG,
-			 "Setting environment variable: no_proxy = %s.\n",
-			 conf->no_proxy);
-		setenv("no_proxy", conf->no_proxy, 1);
+
+	if (max_timeout >= 0 && (timeout < 0 || max_timeout < timeout))
+		timeout = max_timeout;
+
+	ret = poll(fds, n, timeout);
+	if (ret == -1) {
+		free(fds);
+		if (errno == EINTR)
+			return 0;
+		opkg_perror(ERROR, "Failed to wait for downloads");
+		return -1;
 	}
 
-	{
-		int res;
-		const char *argv[11];
-		int i = 0;
+	now = opkg_download_now();
 
-		argv[i++] = "wget";
-		argv[i++] = "-q";
-		if (conf->no_check_certificate) {
-			argv[i++] = "--no-check-certificate";
-		}
-		if (conf->http_timeout) {
-			argv[i++] = "--timeout";
-			argv[i++] = conf->http_timeout;
-		}
-		if (conf->http_proxy || conf->https_proxy || conf->ftp_proxy) {
-			argv[i++] = "-Y";
-			argv[i++] = "on";
+	for (i = 0; i < n; i++) {
+		struct opkg_transfer *t = streams[i]->transfer;
+
+		if (fds[i].revents) {
+			ready[i] = 1;
+		} else if (t->transport->expire &&
+			   now >= streams[i]->deadline) {
+			t->transport->expire(t);
+			ready[i] = 1;
 		}
-		argv[i++] = "-O";
-		argv[i++] = tmp_file_location;
-		argv[i++] = src;
-		argv[i++] = NULL;
-		res = xsystem(argv);
+	}
+
+	free(fds);
+
+	return 0;
+}
+
+int opkg_download_stream_finish(struct opkg_download_stream *s,
+				const char *dest_file_name)
+{
+	const char *name = s->transfer->transport->name;
+	int res, err;
+
+	res = s->transfer->transport->finish(s->transfer);
+	s->transfer = NULL;
 
-		if (res) {
+	if (fclose(s->fp) && !s->err) {
+		opkg_perror(ERROR, "Failed to write %s", s->tmp_file_location);
+		s->err = -1;
+	}
+	s->fp = NULL;
+
+	if (res) {
+		opkg_msg(ERROR, "Failed to download %s, %s returned %d.\n",
+			 s->src, name, res);
+		if (res == 4)
 			opkg_msg(ERROR,
-				 "Failed to download %s, wget returned %d.\n",
-				 src, res);
-			if (res == 4)
-				opkg_msg(ERROR,
-					 "Check your network settings and connectivity.\n\n");
-			free(tmp_file_location);
-			return -1;
-		}
+				 "Check your network settings and connectivity.\n\n");
+		err = -1;
+	} else {
+		err = s->err;
 	}
 
-	err = file_move(tmp_file_location, dest_file_name);
+	if (err)
+		unlink(s->tmp_file_location);
+	else
+		err = file_move(s->tmp_file_location, dest_file_name);
+
+	free(s->tmp_file_location);
+	s->tmp_file_location = NULL;
 
-	free(tmp_file_location);
+	if (!err)
+		digest_final(&s->digest);
 
 	return err;
 }
 
-static char* get_cache_filename(const char *dest_file_name)
+void opkg_download_stream_abort(struct opkg_download_stream *s)
 {
-	char *cache_name;
-	char *filename = strrchr(dest_file_name, '/');
-	if (filename)
-		cache_name = xstrdup(filename + 1);	// strip leading '/'
-	else
-		cache_name = xstrdup(dest_file_name);
-	return cache_name;
+	s->transfer->transport->finish(s->transfer);
+	s->transfer = NULL;
+
+	fclose(s->fp);
+	s->fp = NULL;
+
+	unlink(s->tmp_file_location);
+	free(s->tmp_file_location);
+	s->tmp_file_location = NULL;
 }
 
-static int
-opkg_download_cache(const char *src, const char *dest_file_name)
+/* Waits for the transfer of s to be over. */
+static void opkg_download_stream_complete(struct opkg_download_stream *s)
 {
-	char *cache_name, *cache_location;
+	int ready;
+
+	do {
+		if (opkg_download_streams_wait(&s, 1, &ready, -1))
+			break;
+	} while (!ready || opkg_download_stream_read(s));
+}
+
+int
+opkg_download(const char *src, const char *dest_file_name,
+              const short hide_error)
+{
+	struct opkg_download_stream s;
 	int err = 0;
 
-	if (!conf->cache || str_starts_with(src, "file:")) {
-		err = opkg_download(src, dest_file_name, 0);
-		goto out1;
-	}
+	opkg_msg(NOTICE, "Downloading %s\n", src);
 
-	if (!file_is_dir(conf->cache)) {
-		opkg_msg(ERROR, "%s is not a directory.\n", conf->cache);
-		err = 1;
-		goto out1;
+	if (str_starts_with(src, "file:")) {
+		char *file_src = urldecode_path(src + 5);
+		opkg_msg(INFO, "Copying %s to %s...", file_src, dest_file_name);
+		err = file_copy(file_src, dest_file_name);
+		opkg_msg(INFO, "Done.\n");
+		free(file_src);
+		return err;
 	}
 
-	cache_name = get_cache_filename(dest_file_name);
-	sprintf_alloc(&cache_location, "%s/%s", conf->cache, cache_name);
-	if (file_exists(cache_location))
-		opkg_msg(NOTICE, "Copying %s.\n", cache_location);
-	else {
-		err = opkg_download(src, cache_location, 0);
-		if (err) {
-			(void)unlink(cache_location);
-			goto out2;
-		}
-	}
+	if (opkg_download_stream_start(&s, src, NULL, 0))
+		return -1;
 
-	err = file_copy(cache_location, dest_file_name);
+	opkg_download_stream_complete(&s);
 
-out2:
-	free(cache_location);
-	free(cache_name);
-out1:
-	return err;
+	return opkg_download_stream_finish(&s, dest_file_name);
 }
 
-int opkg_download_pkg(pkg_t * pkg, const char *dir)
+static char *get_cache_location(const char *dest_file_name)
+{
+	char *cache_location;
+	char *filename = strrchr(dest_file_name, '/');
+
+	if (filename)
+		filename++;	// strip leading '/'
+	else
+		filename = (char *)dest_file_name;
+
+	sprintf_alloc(&cache_location, "%s/%s", conf->cache, filename);
+
+	return cache_location;
+}
+
+/*
+ * Returns the url of pkg in its feed and the name it gets in dir, or
+ * NULL if it cannot be downloaded.
+ */
+static char *opkg_pkg_url(pkg_t * pkg, const char *dir,
+			  char **local_filename)
 {
-	int err;
 	char *url;
-	char *local_filename;
 	char *stripped_filename;
 	char *urlencoded_path;
 	char *filename;
-	char *cache_name;
-	char *cache_location;
 
 	if (pkg->src == NULL) {
 		opkg_msg(ERROR,
 			 "Package %s is not available from any configured src.\n",
 			 pkg->name);
-		return -1;
+		return NULL;
 	}
 
 	filename = pkg_get_string(pkg, PKG_FILENAME);
@@ -268,7 +443,7 @@ int opkg_download_pkg(pkg_t * pkg, const char *dir)
 		opkg_msg(ERROR,
 			 "Package %s does not have a valid filename field.\n",
 			 pkg->name);
-		return -1;
+		return NULL;
 	}
 
 	urlencoded_path = urlencode_path(filename);
@@ -284,30 +459,291 @@ int opkg_download_pkg(pkg_t * pkg, const char *dir)
 	if (!stripped_filename)
 		stripped_filename = filename;
 
-	sprintf_alloc(&local_filename, "%s/%s", dir, stripped_filename);
-	pkg_set_string(pkg, PKG_LOCAL_FILENAME, local_filename);
-
-	/* Invalidate/remove cached package if it has an incorrect checksum. */
-	if (conf->cache) {
-		cache_name = get_cache_filename(local_filename);
-		sprintf_alloc(&cache_location, "%s/%s", conf->cache, cache_name);
-		free(cache_name);
-		if (file_exists(cache_location)) {
-			err = opkg_verify_integrity(pkg, cache_location);
-			if (err) {
-				opkg_msg(NOTICE,
-					 "Removing %s from cache because it has incorrect checksum.\n",
-					 pkg->name);
-				unlink(cache_location);
+	sprintf_alloc(local_filename, "%s/%s", dir, stripped_filename);
+
+	return url;
+}
+
+/*
+ * Copies the file of pkg to local_filename if it can be had without the
+ * network: from a file: url or from the cache. The data is hashed as it
+ * is copied. A cached copy which does not match the package index is
+ * removed from the cache. Returns 1 if the file has to be downloaded.
+ */
+static int opkg_download_local(pkg_t *pkg, const char *url,
+			       const char *local_filename,
+			       const char *cache_location)
+{
+	struct digest d;
+	char *file_src;
+	int err;
+
+	digest_init(&d, opkg_digest_want(pkg));
+
+	if (str_starts_with(url, "file:")) {
+		opkg_msg(NOTICE, "Downloading %s\n", url);
+		file_src = urldecode_path(url + 5);
+		opkg_msg(INFO, "Copying %s to %s...", file_src, local_filename);
+		err = file_copy_digest(file_src, local_filename, &d);
+		opkg_msg(INFO, "Done.\n");
+		free(file_src);
+		if (!err)
+			opkg_digest_record(pkg, local_filename, &d);
+		return err;
+	}
+
+	if (!cache_location || !file_exists(cache_location))
+		return 1;
+
+	opkg_msg(NOTICE, "Copying %s.\n", cache_location);
+	if (file_copy_digest(cache_location, local_filename, &d))
+		return -1;
+
+	opkg_digest_record(pkg, local_filename, &d);
+	if (!opkg_verify_integrity(pkg, local_filename))
+		return 0;
+
+	opkg_msg(NOTICE,
+		 "Removing %s from cache because it has incorrect checksum.\n",
+		 pkg->name);
+	unlink(cache_location);
+	unlink(local_filename);
+
+	return 1;
+}
+
+struct download_job {
+	pkg_t *pkg;
+	char *url;
+	char *local_filename;
+	char *cache_location;	/* NULL without a cache */
+	struct opkg_download_stream stream;
+};
+
+/* Fills in the cache location of job, -1 if the cache is unusable. */
+static int download_job_cache(struct download_job *job)
+{
+	if (!conf->cache || str_starts_with(job->url, "file:"))
+		return 0;
+
+	if (!file_is_dir(conf->cache)) {
+		opkg_msg(ERROR, "%s is not a directory.\n", conf->cache);
+		return -1;
+	}
+
+	job->cache_location = get_cache_location(job->local_filename);
+
+	return 0;
+}
+
+static int download_job_start(struct download_job *job)
+{
+	opkg_msg(NOTICE, "Downloading %s\n", job->url);
+
+	return opkg_download_stream_start(&job->stream, job->url, NULL,
+					  opkg_digest_want(job->pkg));
+}
+
+/* move the download in place and remember its digest */
+static int download_job_store(struct download_job *job)
+{
+	pkg_t *pkg = job->pkg;
+	int err;
+
+	if (job->cache_location) {
+		err = opkg_download_stream_finish(&job->stream,
+						  job->cache_location);
+		if (!err)
+			err = file_copy(job->cache_location,
+					job->local_filename);
+		else
+			(void)unlink(job->cache_location);
+	} else {
+		err = opkg_download_stream_finish(&job->stream,
+						  job->local_filename);
+	}
+
+	if (err)
+		return -1;
+
+	opkg_digest_record(pkg, job->local_filename, &job->stream.digest);
+
+	return 0;
+}
+
+/* store the download and check it against the package index */
+static int download_job_finish(struct download_job *job)
+{
+	pkg_t *pkg = job->pkg;
+
+	if (download_job_store(job))
+		return -1;
+
+	pkg_set_string(pkg, PKG_LOCAL_FILENAME, job->local_filename);
+
+	/* the installation decides whether to go ahead anyway */
+	if (opkg_verify_integrity(pkg, job->local_filename)) {
+		opkg_msg(NOTICE, "Downloaded %s has a checksum or size "
+			 "mismatch.\n", pkg->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void download_job_free(struct download_job *job)
+{
+	free(job->url);
+	free(job->local_filename);
+	free(job->cache_location);
+}
+
+int opkg_download_pkg(pkg_t * pkg, const char *dir)
+{
+	struct download_job job = { .pkg = pkg };
+	int err;
+
+	job.url = opkg_pkg_url(pkg, dir, &job.local_filename);
+	if (!job.url)
+		return -1;
+
+	pkg_set_string(pkg, PKG_LOCAL_FILENAME, job.local_filename);
+
+	err = download_job_cache(&job);
+	if (err)
+		goto out;
+
+	err = opkg_download_local(pkg, job.url, job.local_filename,
+				  job.cache_location);
+	if (err != 1)
+		goto out;
+
+	err = download_job_start(&job);
+	if (err) {
+		if (job.cache_location)
+			(void)unlink(job.cache_location);
+		goto out;
+	}
+
+	opkg_download_stream_complete(&job.stream);
+
+	err = download_job_store(&job);
+
+out:
+	download_job_free(&job);
+
+	return err;
+}
+
+/*
+ * Downloads all packages of pkgs into dir which do not have a local file
+ * yet, running up to conf->download_jobs transfers at the same time.
+ * Every file is hashed as it arrives and verified as soon as it is
+ * complete. Packages which failed to download are reported and keep no
+ * local file name. Returns -1 if any package failed.
+ */
+int opkg_download_pkgs(pkg_vec_t * pkgs, const char *dir)
+{
+	struct download_job *jobs, *job, **waiting;
+	struct opkg_download_stream **streams;
+	int n_jobs = 0, next = 0, running = 0, failed = 0;
+	int i, n, err, *ready;
+
+	jobs = xcalloc(pkgs->len ? pkgs->len : 1, sizeof(*jobs));
+
+	for (i = 0; i < pkgs->len; i++) {
+		pkg_t *pkg = pkgs->pkgs[i];
+
+		if (pkg_get_string(pkg, PKG_LOCAL_FILENAME))
+			continue;
+
+		job = &jobs[n_jobs];
+		job->pkg = pkg;
+		job->url = opkg_pkg_url(pkg, dir, &job->local_filename);
+		if (!job->url) {
+			failed++;
+			continue;
+		}
+
+		if (download_job_cache(job)) {
+			download_job_free(job);
+			memset(job, 0, sizeof(*job));
+			failed++;
+			continue;
+		}
+
+		/* local copies do not need to wait for the network */
+		err = opkg_download_local(pkg, job->url, job->local_filename,
+					  job->cache_location);
+		if (err == 1) {
+			n_jobs++;
+			continue;
+		}
+
+		if (err) {
+			opkg_msg(ERROR, "Failed to download %s.\n", pkg->name);
+			failed++;
+		} else {
+			pkg_set_string(pkg, PKG_LOCAL_FILENAME,
+				       job->local_filename);
+		}
+		download_job_free(job);
+		memset(job, 0, sizeof(*job));
+	}
+
+	streams = xcalloc(n_jobs ? n_jobs : 1, sizeof(*streams));
+	waiting = xcalloc(n_jobs ? n_jobs : 1, sizeof(*waiting));
+	ready = xcalloc(n_jobs ? n_jobs : 1, sizeof(*ready));
+
+	while (next < n_jobs || running) {
+		while (next < n_jobs && running < conf->download_jobs) {
+			job = &jobs[next++];
+			if (download_job_start(job)) {
+				opkg_msg(ERROR, "Failed to download %s.\n",
+					 job->pkg->name);
+				failed++;
+			} else {
+				running++;
 			}
 		}
-		free(cache_location);
+
+		if (!running)
+			break;
+
+		n = 0;
+		for (job = jobs; job < jobs + next; job++) {
+			if (!job->stream.transfer)
+				continue;
+			waiting[n] = job;
+			streams[n++] = &job->stream;
+		}
+
+		if (opkg_download_streams_wait(streams, n, ready, -1)) {
+			for (i = 0; i < n; i++)
+				opkg_download_stream_abort(streams[i]);
+			failed += running;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			job = waiting[i];
+			if (!ready[i] || opkg_download_stream_read(&job->stream))
+				continue;
+
+			running--;
+			if (download_job_finish(job))
+				failed++;
+		}
 	}
 
-	err = opkg_download_cache(url, local_filename);
-	free(url);
+	free(ready);
+	free(waiting);
+	free(streams);
+	for (i = 0; i < n_jobs; i++)
+		download_job_free(&jobs[i]);
+	free(jobs);
 
-	return err;
+	return failed ? -1 : 0;
 }
 
 /*
@@ -358,8 +794,7 @@ int opkg_prepare_url_for_install(const char *url, char **namep)
 			ab_pkg->state_flag |= SF_NEED_DETAIL;
 		}
 
-		pkg_deinit(pkg);
-		free(pkg);
+		pkg_free(pkg);
 		return 0;
 	}
 
@@ -374,13 +809,13 @@ int opkg_prepare_url_for_install(const char *url, char **namep)
 	return 0;
 }
 
-int opkg_verify_file(char *text_file, char *sig_file)
+pid_t opkg_verify_file_start(char *text_file, char *sig_file)
 {
 #if defined HAVE_USIGN
 	const char *argv[] = { conf->verify_program, "verify", sig_file,
 	                       text_file, NULL };
 
-	return xsystem(argv) ? -1 : 0;
+	return xsystem_start(argv);
 #else
 	/* mute `unused variable' warnings. */
 	(void)sig_file;
@@ -389,3 +824,14 @@ int opkg_verify_file(char *text_file, char *sig_file)
 	return 0;
 #endif
 }
+
+int opkg_verify_file(char *text_file, char *sig_file)
+{
+	pid_t pid;
+
+	pid = opkg_verify_file_start(text_file, sig_file);
+	if (pid <= 0)
+		return pid;
+
+	return xsystem_wait(conf->verify_program, pid) ? -1 : 0;
+}
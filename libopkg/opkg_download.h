@@ -18,16 +18,64 @@
 #ifndef OPKG_DOWNLOAD_H
 #define OPKG_DOWNLOAD_H
 
+#include <stdio.h>
+#include <sys/types.h>
+
 #include "pkg.h"
+#include "digest.h"
+#include "opkg_transport.h"
 
 int opkg_verify_integrity(pkg_t *pkg, const char *filename);
 int opkg_download(const char *src, const char *dest_file_name,
                   const short hide_error);
+
+/*
+ * A download in the background, stored in a temporary file and hashed
+ * with the checksums in want as it arrives. Once read() returned 0,
+ * finish() moves the file to its destination and fills in the digest.
+ * tmp_file_name must be unique among the running downloads; if it is
+ * NULL the file is named after src in the temporary directory.
+ */
+struct opkg_download_stream {
+	const char *src;
+	char *tmp_file_location;
+	FILE *fp;
+	int err;
+	struct opkg_transfer *transfer;	/* NULL unless running */
+	long long deadline;	/* for data to arrive, in ms */
+	struct digest digest;
+};
+
+int opkg_download_stream_start(struct opkg_download_stream *s,
+			       const char *src, const char *tmp_file_name,
+			       int want);
+int opkg_download_stream_read(struct opkg_download_stream *s);
+int opkg_download_stream_finish(struct opkg_download_stream *s,
+				const char *dest_file_name);
+/* ends a running stream early and removes what it has downloaded */
+void opkg_download_stream_abort(struct opkg_download_stream *s);
+/*
+ * Waits for any of n running streams to have data, setting ready[i] for
+ * those which can be read without blocking. Transfers which timed out
+ * are ended and reported as ready. Unless max_timeout is -1, returns
+ * after max_timeout ms at the latest, for the caller to look after
+ * other children. Returns -1 if waiting failed.
+ */
+int opkg_download_streams_wait(struct opkg_download_stream **streams, int n,
+			       int *ready, int max_timeout);
+
 int opkg_download_pkg(pkg_t * pkg, const char *dir);
+int opkg_download_pkgs(pkg_vec_t * pkgs, const char *dir);
 /*
  * Downloads file from url, installs in package database, return package name.
  */
 int opkg_prepare_url_for_install(const char *url, char **namep);
 
 int opkg_verify_file(char *text_file, char *sig_file);
+/*
+ * Starts what opkg_verify_file() runs without waiting for it. Returns its
+ * pid, to be taken with xsystem_reap() or xsystem_wait(), 0 if there is
+ * nothing to run or -1 if it could not be started.
+ */
+pid_t opkg_verify_file_start(char *text_file, char *sig_file);
 #endif
@@ -0,0 +1,775 @@
+/* opkg_http.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * A small HTTP/1.1 client for feeds served over plain http. Connections
+ * are kept open after a response and handed to the next request for the
+ * same server, so a run of downloads from one mirror costs one name
+ * lookup and one TCP handshake instead of one wget process per file.
+ * Redirects to anything but http:// are passed on to wget.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "opkg_transport.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+#define HTTP_BUF_SIZE		16384
+#define HTTP_MAX_REDIRECTS	5
+/* idle connections kept for later requests */
+#define HTTP_MAX_IDLE		8
+
+enum http_state {
+	HTTP_STATUS,		/* status line */
+	HTTP_HEADER,		/* header lines */
+	HTTP_BODY,		/* body with a known length, or up to EOF */
+	HTTP_CHUNK_SIZE,	/* size line of a chunk */
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_END,		/* the line break after the data */
+	HTTP_TRAILER,		/* trailer lines after the last chunk */
+	HTTP_DONE
+};
+
+struct http_conn {
+	struct http_conn *next;
+	char *key;		/* host:port */
+	int fd;
+};
+
+static struct http_conn *http_idle;
+static int http_n_idle;
+
+struct http_transfer {
+	struct opkg_transfer t;
+	char *url;
+	char *host;
+	char *port;
+	char *path;
+	char *key;
+	/* the connection served an earlier request, it may have been closed
+	   by the server meanwhile */
+	int reused;
+	int redirects;
+
+	enum http_state state;
+	int status;
+	int keep_alive;
+	int chunked;
+	int discard;		/* the body is not handed over */
+	int got_data;		/* some of the response arrived */
+	long long left;		/* of the body or chunk, -1 up to EOF */
+	char *location;
+
+	int done;
+	int res;
+	struct opkg_transfer *delegate;	/* wget, after a redirect */
+
+	size_t len;
+	char buf[HTTP_BUF_SIZE];
+};
+
+static int http_parse_url(struct http_transfer *h, const char *url)
+{
+	const char *auth = url + strlen("http://");
+	const char *end, *port = NULL, *host_end;
+	size_t auth_len;
+
+	free(h->url);
+	free(h->host);
+	free(h->port);
+	free(h->path);
+	free(h->key);
+	h->url = xstrdup(url);
+	h->host = h->port = h->path = h->key = NULL;
+
+	auth_len = strcspn(auth, "/?#");
+	end = auth + auth_len;
+
+	if (*auth == '[') {
+		host_end = memchr(auth, ']', auth_len);
+		if (!host_end)
+			goto bad;
+		h->host = xstrndup(auth + 1, host_end - auth - 1);
+		if (host_end + 1 < end) {
+			if (host_end[1] != ':')
+				goto bad;
+			port = host_end + 2;
+		}
+	} else {
+		host_end = memchr(auth, ':', auth_len);
+		if (host_end)
+			port = host_end + 1;
+		else
+			host_end = end;
+		h->host = xstrndup(auth, host_end - auth);
+	}
+
+	if (!*h->host)
+		goto bad;
+
+	if (port && port < end)
+		h->port = xstrndup(port, end - port);
+	else
+		h->port = xstrdup("80");
+
+	if (*end == '/')
+		h->path = xstrndup(end, strcspn(end, "#"));
+	else if (*end == '?')
+		sprintf_alloc(&h->path, "/%.*s", (int)strcspn(end, "#"), end);
+	else
+		h->path = xstrdup("/");
+
+	sprintf_alloc(&h->key, "%s:%s", h->host, h->port);
+
+	return 0;
+
+bad:
+	opkg_msg(ERROR, "Invalid url %s.\n", url);
+	return -1;
+}
+
+/* the target of a redirect, relative to the url of h */
+static char *http_resolve(struct http_transfer *h, const char *location)
+{
+	char *url;
+	const char *slash;
+
+	if (strstr(location, "://"))
+		return xstrdup(location);
+
+	if (location[0] == '/' && location[1] == '/') {
+		sprintf_alloc(&url, "http:%s", location);
+		return url;
+	}
+
+	if (location[0] == '/') {
+		sprintf_alloc(&url, "http://%.*s%s",
+			      (int)strcspn(h->url + strlen("http://"), "/?#"),
+			      h->url + strlen("http://"), location);
+		return url;
+	}
+
+	slash = strrchr(h->url, '/');
+	sprintf_alloc(&url, "%.*s/%s", (int)(slash - h->url), h->url, location);
+
+	return url;
+}
+
+static void http_conn_close(struct http_conn *c)
+{
+	close(c->fd);
+	free(c->key);
+	free(c);
+}
+
+/* an idle connection to key, if the server did not close it meanwhile */
+static int http_conn_get(const char *key)
+{
+	struct http_conn **pc, *c;
+	struct pollfd pfd;
+	int fd;
+
+	for (pc = &http_idle; (c = *pc); pc = &c->next) {
+		if (strcmp(c->key, key))
+			continue;
+
+		*pc = c->next;
+		http_n_idle--;
+
+		/* an idle connection has nothing to read but EOF */
+		pfd.fd = c->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) != 0) {
+			http_conn_close(c);
+			return -1;
+		}
+
+		fd = c->fd;
+		free(c->key);
+		free(c);
+
+		return fd;
+	}
+
+	return -1;
+}
+
+static void http_conn_put(const char *key, int fd)
+{
+	struct http_conn *c, **pc;
+
+	if (http_n_idle >= HTTP_MAX_IDLE) {
+		/* drop the oldest */
+		for (pc = &http_idle; (*pc)->next; pc = &(*pc)->next) ;
+		http_conn_close(*pc);
+		*pc = NULL;
+		http_n_idle--;
+	}
+
+	c = xcalloc(1, sizeof(*c));
+	c->key = xstrdup(key);
+	c->fd = fd;
+	c->next = http_idle;
+	http_idle = c;
+	http_n_idle++;
+}
+
+static int http_connect(struct http_transfer *h)
+{
+	struct addrinfo hints, *res, *ai;
+	struct timeval tv;
+	int timeout = opkg_transport_timeout();
+	int fd = -1, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	err = getaddrinfo(h->host, h->port, &hints, &res);
+	if (err) {
+		opkg_msg(ERROR, "Failed to resolve %s: %s.\n", h->host,
+			 gai_strerror(err));
+		return -1;
+	}
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		/* bounds connect() and send() */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+
+		err = errno;
+		close(fd);
+		fd = -1;
+		errno = err;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd == -1)
+		opkg_perror(ERROR, "Failed to connect to %s", h->key);
+
+	return fd;
+}
+
+static int http_send(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void http_reset(struct http_transfer *h)
+{
+	h->state = HTTP_STATUS;
+	h->status = 0;
+	h->keep_alive = 1;
+	h->chunked = 0;
+	h->discard = 0;
+	h->left = -1;
+	free(h->location);
+	h->location = NULL;
+}
+
+/*
+ * Sends the request for h->path, on an idle connection to the server if
+ * there is one and fresh is 0.
+ */
+static int http_request(struct http_transfer *h, int fresh)
+{
+	char *req;
+	int err;
+
+	http_reset(h);
+	h->len = 0;
+	h->got_data = 0;
+
+	h->t.fd = fresh ? -1 : http_conn_get(h->key);
+	h->reused = h->t.fd != -1;
+	if (!h->reused) {
+		h->t.fd = http_connect(h);
+		if (h->t.fd == -1)
+			return -1;
+	}
+
+	opkg_msg(DEBUG, "GET %s from %s%s.\n", h->path, h->key,
+		 h->reused ? " (reused connection)" : "");
+
+	sprintf_alloc(&req,
+		      "GET %s HTTP/1.1\r\n"
+		      "Host: %s%s%s%s%s\r\n"
+		      "User-Agent: opkg\r\n"
+		      "Accept: */*\r\n"
+		      "Connection: keep-alive\r\n"
+		      "\r\n", h->path,
+		      strchr(h->host, ':') ? "[" : "", h->host,
+		      strchr(h->host, ':') ? "]" : "",
+		      strcmp(h->port, "80") ? ":" : "",
+		      strcmp(h->port, "80") ? h->port : "");
+
+	err = http_send(h->t.fd, req, strlen(req));
+	free(req);
+
+	if (err) {
+		err = errno;
+		close(h->t.fd);
+		h->t.fd = -1;
+		if (h->reused)
+			return http_request(h, 1);
+		errno = err;
+		opkg_perror(ERROR, "Failed to send request to %s", h->key);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void http_fail(struct http_transfer *h, int res)
+{
+	if (h->t.fd != -1)
+		close(h->t.fd);
+	h->t.fd = -1;
+	h->state = HTTP_DONE;
+	h->done = 1;
+	h->res = res;
+}
+
+/* whether the comma separated list value has token in it */
+static int http_has_token(const char *value, const char *token)
+{
+	size_t len = strlen(token), n;
+
+	while (*value) {
+		value += strspn(value, " \t,");
+		n = strcspn(value, " \t,;");
+		if (n == len && !strncasecmp(value, token, len))
+			return 1;
+		value += strcspn(value, ",");
+	}
+
+	return 0;
+}
+
+/* Takes in a header line, -1 if its value is malformed. */
+static int http_header(struct http_transfer *h, char *line)
+{
+	char *value = strchr(line, ':'), *end;
+
+	if (!value)
+		return 0;
+
+	*value++ = '\0';
+	value += strspn(value, " \t");
+
+	if (!strcasecmp(line, "Content-Length")) {
+		errno = 0;
+		h->left = strtoll(value, &end, 10);
+		if (end == value || errno || h->left < 0)
+			return -1;
+	} else if (!strcasecmp(line, "Transfer-Encoding")) {
+		if (http_has_token(value, "chunked"))
+			h->chunked = 1;
+	} else if (!strcasecmp(line, "Connection")) {
+		if (http_has_token(value, "close"))
+			h->keep_alive = 0;
+	} else if (!strcasecmp(line, "Location")) {
+		free(h->location);
+		h->location = xstrdup(value);
+	}
+
+	return 0;
+}
+
+/* Decides what to do with the body once the headers are in. */
+static void http_headers_done(struct http_transfer *h)
+{
+	if (h->status >= 100 && h->status < 200) {
+		/* an interim response, the real one follows */
+		http_reset(h);
+		return;
+	}
+
+	if (h->status == 204 || h->status == 304) {
+		h->left = 0;
+		h->chunked = 0;
+	}
+
+	if (h->chunked) {
+		h->state = HTTP_CHUNK_SIZE;
+	} else {
+		h->state = HTTP_BODY;
+		if (h->left < 0)
+			h->keep_alive = 0;
+	}
+
+	if (h->status == 200)
+		return;
+
+	h->discard = 1;
+
+	if (h->status >= 300 && h->status < 400 && h->location) {
+		if (h->redirects < HTTP_MAX_REDIRECTS)
+			return;
+		opkg_msg(ERROR, "Too many redirects for %s.\n", h->url);
+	} else {
+		opkg_msg(ERROR, "Server returned %d for %s.\n", h->status,
+			 h->url);
+	}
+
+	free(h->location);
+	h->location = NULL;
+}
+
+/* Hands the connection on and follows a redirect, if any. */
+static void http_body_done(struct http_transfer *h)
+{
+	char *url;
+
+	h->state = HTTP_DONE;
+
+	if (h->keep_alive && h->len == 0)
+		http_conn_put(h->key, h->t.fd);
+	else
+		close(h->t.fd);
+	h->t.fd = -1;
+
+	if (!h->location) {
+		h->done = 1;
+		h->res = h->status == 200 ? 0 : 8;
+		return;
+	}
+
+	url = http_resolve(h, h->location);
+	h->redirects++;
+	opkg_msg(INFO, "Redirected to %s.\n", url);
+
+	if (strncmp(url, "http://", strlen("http://"))) {
+		h->delegate = opkg_transport_wget.start(url);
+		free(url);
+		if (!h->delegate) {
+			h->done = 1;
+			h->res = 1;
+			return;
+		}
+		h->t.fd = h->delegate->fd;
+		return;
+	}
+
+	if (http_parse_url(h, url) || http_request(h, 0))
+		http_fail(h, 4);
+	free(url);
+}
+
+/* the next line in buf from *pos, NULL if it is not complete yet */
+static char *http_line(struct http_transfer *h, size_t *pos)
+{
+	char *line = h->buf + *pos, *nl;
+
+	nl = memchr(line, '\n', h->len - *pos);
+	if (!nl)
+		return NULL;
+
+	*pos = nl + 1 - h->buf;
+	if (nl > line && nl[-1] == '\r')
+		nl--;
+	*nl = '\0';
+
+	return line;
+}
+
+/*
+ * Parses what is in buf, copying body data to out. Leaves an incomplete
+ * line in buf. Returns -1 on a malformed response.
+ */
+static int http_parse(struct http_transfer *h, char *out, size_t *n)
+{
+	size_t pos = 0, avail;
+	char *line, *end;
+	unsigned long long size;
+
+	while (h->state != HTTP_DONE) {
+		switch (h->state) {
+		case HTTP_STATUS:
+			line = http_line(h, &pos);
+			if (!line)
+				goto more;
+			if (strncmp(line, "HTTP/1.", 7) || !line[7] ||
+			    line[8] != ' ')
+				return -1;
+			if (line[7] == '0')
+				h->keep_alive = 0;
+			h->status = atoi(line + 9);
+			h->state = HTTP_HEADER;
+			break;
+		case HTTP_HEADER:
+			line = http_line(h, &pos);
+			if (!line)
+				goto more;
+			if (!*line)
+				http_headers_done(h);
+			else if (http_header(h, line))
+				return -1;
+			break;
+		case HTTP_BODY:
+		case HTTP_CHUNK_DATA:
+			avail = h->len - pos;
+			if (h->left >= 0 && (unsigned long long)h->left < avail)
+				avail = h->left;
+			if (!h->discard) {
+				memcpy(out + *n, h->buf + pos, avail);
+				*n += avail;
+			}
+			pos += avail;
+			if (h->left < 0)
+				goto more;
+			h->left -= avail;
+			if (h->left)
+				goto more;
+			if (h->state == HTTP_CHUNK_DATA) {
+				h->state = HTTP_CHUNK_END;
+				break;
+			}
+			h->len -= pos;
+			memmove(h->buf, h->buf + pos, h->len);
+			http_body_done(h);
+			return 0;
+		case HTTP_CHUNK_SIZE:
+			line = http_line(h, &pos);
+			if (!line)
+				goto more;
+			errno = 0;
+			size = strtoull(line, &end, 16);
+			if (end == line || errno)
+				return -1;
+			if (size == 0) {
+				h->state = HTTP_TRAILER;
+			} else {
+				h->left = size;
+				h->state = HTTP_CHUNK_DATA;
+			}
+			break;
+		case HTTP_CHUNK_END:
+			line = http_line(h, &pos);
+			if (!line)
+				goto more;
+			if (*line)
+				return -1;
+			h->state = HTTP_CHUNK_SIZE;
+			break;
+		case HTTP_TRAILER:
+			line = http_line(h, &pos);
+			if (!line)
+				goto more;
+			if (*line)
+				break;
+			h->len -= pos;
+			memmove(h->buf, h->buf + pos, h->len);
+			http_body_done(h);
+			return 0;
+		default:
+			return -1;
+		}
+	}
+
+more:
+	h->len -= pos;
+	memmove(h->buf, h->buf + pos, h->len);
+
+	if (h->len == sizeof(h->buf))
+		return -1;
+
+	return 0;
+}
+
+static struct opkg_transfer *http_start(const char *url)
+{
+	struct http_transfer *h = xcalloc(1, sizeof(*h));
+
+	h->t.transport = &opkg_transport_http;
+	h->t.fd = -1;
+
+	if (http_parse_url(h, url) || http_request(h, 0)) {
+		free(h->url);
+		free(h->host);
+		free(h->port);
+		free(h->path);
+		free(h->key);
+		free(h);
+		return NULL;
+	}
+
+	return &h->t;
+}
+
+/*
+ * Receives at most len bytes at a time, so the body data they carry
+ * always fits into buf and nothing is left behind for a poll() which
+ * would not report it.
+ */
+static int http_read(struct opkg_transfer *t, void *buf, size_t len,
+		     size_t *n)
+{
+	struct http_transfer *h = (struct http_transfer *)t;
+	size_t space = sizeof(h->buf) - h->len;
+	ssize_t ret;
+	int more;
+
+	*n = 0;
+
+	if (h->delegate) {
+		more = h->delegate->transport->read(h->delegate, buf, len, n);
+		t->fd = h->delegate->fd;
+		return more;
+	}
+
+	if (h->done)
+		return 0;
+
+	if (space > len)
+		space = len;
+
+	do {
+		ret = recv(t->fd, h->buf + h->len, space, 0);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 1;
+
+	if (ret <= 0 && !h->got_data && h->reused) {
+		/* the server dropped the idle connection, try once more */
+		close(t->fd);
+		t->fd = -1;
+		if (http_request(h, 1))
+			http_fail(h, 4);
+		return !h->done;
+	}
+
+	if (ret == -1) {
+		opkg_perror(ERROR, "Failed to receive %s", h->url);
+		http_fail(h, 4);
+		return 0;
+	}
+
+	if (ret == 0) {
+		if (h->state == HTTP_BODY && h->left < 0 && !h->len) {
+			h->keep_alive = 0;
+			http_body_done(h);
+		} else {
+			opkg_msg(ERROR, "Connection closed early by %s.\n",
+				 h->key);
+			http_fail(h, 4);
+		}
+		return !h->done;
+	}
+
+	h->got_data = 1;
+	h->len += ret;
+
+	if (http_parse(h, buf, n)) {
+		opkg_msg(ERROR, "Malformed response to %s.\n", h->url);
+		*n = 0;
+		http_fail(h, 8);
+		return 0;
+	}
+
+	return !h->done;
+}
+
+static void http_expire(struct opkg_transfer *t)
+{
+	struct http_transfer *h = (struct http_transfer *)t;
+
+	if (h->delegate || h->done)
+		return;
+
+	opkg_msg(ERROR, "Timed out waiting for %s.\n", h->url);
+	http_fail(h, 4);
+}
+
+static int http_finish(struct opkg_transfer *t)
+{
+	struct http_transfer *h = (struct http_transfer *)t;
+	int res;
+
+	if (h->delegate)
+		res = h->delegate->transport->finish(h->delegate);
+	else if (h->done)
+		res = h->res;
+	else
+		res = 1;
+
+	if (h->t.fd != -1 && !h->delegate)
+		close(h->t.fd);
+
+	free(h->url);
+	free(h->host);
+	free(h->port);
+	free(h->path);
+	free(h->key);
+	free(h->location);
+	free(h);
+
+	return res;
+}
+
+static void http_cleanup(void)
+{
+	struct http_conn *c;
+
+	while ((c = http_idle)) {
+		http_idle = c->next;
+		http_conn_close(c);
+	}
+	http_n_idle = 0;
+}
+
+const struct opkg_transport opkg_transport_http = {
+	.name = "http",
+	.start = http_start,
+	.read = http_read,
+	.expire = http_expire,
+	.finish = http_finish,
+	.cleanup = http_cleanup,
+};
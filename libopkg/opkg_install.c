@@ -40,16 +40,84 @@
 #include "xsystem.h"
 #include "libbb/libbb.h"
 
-static int satisfy_dependencies_for(pkg_t * pkg)
+struct transaction_item {
+	pkg_t *pkg;
+	char *name;		/* as requested, for error messages */
+	int from_upgrade;
+	int err;		/* its dependencies cannot be satisfied */
+	pkg_vec_t *depends;
+};
+
+struct opkg_transaction {
+	struct transaction_item *items;
+	int n_items;
+
+	/* the items sorted by package, while running */
+	struct transaction_item **by_pkg;
+
+	/* a package failed to install, so the dependencies resolved for
+	 * the others can no longer be relied on */
+	int replan;
+};
+
+/* the transaction being run, whose plan satisfy_dependencies_for() follows */
+static struct opkg_transaction *running;
+
+/*
+ * Download the packages about to be installed all at once. Failed
+ * downloads are retried and reported by opkg_install_pkg().
+ */
+static void prefetch_pkgs(pkg_vec_t * pkgs)
 {
-	int i, err;
-	pkg_vec_t *depends = pkg_vec_alloc();
-	pkg_t *dep;
+	const char *dir = conf->tmp_dir;
+	pkg_vec_t *fetch;
+	char cwd[4096];
+	int i;
+
+	if (conf->download_jobs <= 1)
+		return;
+
+	if (!conf->cache && conf->download_only) {
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+			return;
+		dir = cwd;
+	}
+
+	fetch = pkg_vec_alloc();
+
+	for (i = 0; i < pkgs->len; i++) {
+		pkg_t *pkg = pkgs->pkgs[i];
+
+		if (pkg->state_status != SS_INSTALLED
+		    && pkg->state_status != SS_UNPACKED
+		    && !pkg_get_string(pkg, PKG_LOCAL_FILENAME)
+		    && !(pkg->state_flag & SF_MARKED)) {
+			pkg->state_flag |= SF_MARKED;
+			pkg_vec_insert(fetch, pkg);
+		}
+	}
+
+	for (i = 0; i < fetch->len; i++)
+		fetch->pkgs[i]->state_flag &= ~SF_MARKED;
+
+	if (fetch->len > 1)
+		opkg_download_pkgs(fetch, dir);
+
+	pkg_vec_free(fetch);
+}
+
+/*
+ * Collects the packages to install for the dependencies of pkg, and marks
+ * them as to be installed. Returns -1 if some cannot be satisfied.
+ */
+static int resolve_dependencies_for(pkg_t * pkg, pkg_vec_t * depends)
+{
+	int i;
 	char **tmp, **unresolved = NULL, *prev = NULL;
 	int ndepends;
 
 	ndepends = pkg_hash_fetch_unsatisfied_dependencies(pkg, depends,
-							   &unresolved, 0);
+							   &unresolved);
 
 	if (unresolved) {
 		opkg_msg(ERROR,
@@ -73,13 +141,13 @@ static int satisfy_dependencies_for(pkg_t * pkg)
 				 "This could mean that your package list is out of date or that the packages\n"
 				 "mentioned above do not yet exist (try 'opkg update'). To proceed in spite\n"
 				 "of this problem try again with the '-force-depends' option.\n");
-			pkg_vec_free(depends);
+			depends->len = 0;
 			return -1;
 		}
 	}
 
 	if (ndepends <= 0) {
-		pkg_vec_free(depends);
+		depends->len = 0;
 		return 0;
 	}
 
@@ -92,6 +160,16 @@ static int satisfy_dependencies_for(pkg_t * pkg)
 		depends->pkgs[i]->state_want = SW_INSTALL;
 	}
 
+	return 0;
+}
+
+static int install_dependencies_for(pkg_vec_t * depends)
+{
+	int i, err;
+	pkg_t *dep;
+
+	prefetch_pkgs(depends);
+
 	for (i = 0; i < depends->len; i++) {
 		dep = depends->pkgs[i];
 		/* The package was uninstalled when we started, but another
@@ -104,16 +182,64 @@ static int satisfy_dependencies_for(pkg_t * pkg)
 			/* mark this package as having been automatically installed to
 			 * satisfy a dependancy */
 			dep->auto_installed = 1;
-			if (err) {
-				pkg_vec_free(depends);
+			if (err)
 				return err;
-			}
 		}
 	}
 
+	return 0;
+}
+
+static int transaction_item_cmp(const void *p1, const void *p2)
+{
+	const pkg_t *a = (*(struct transaction_item * const *)p1)->pkg;
+	const pkg_t *b = (*(struct transaction_item * const *)p2)->pkg;
+
+	return (a > b) - (a < b);
+}
+
+static struct transaction_item *transaction_find(struct opkg_transaction *t,
+						 pkg_t * pkg)
+{
+	struct transaction_item key = { .pkg = pkg }, *pkey = &key, **item;
+
+	item = bsearch(&pkey, t->by_pkg, t->n_items, sizeof(*t->by_pkg),
+		       transaction_item_cmp);
+
+	return item ? *item : NULL;
+}
+
+static int satisfy_dependencies_for(pkg_t * pkg)
+{
+	struct transaction_item *item = NULL;
+	pkg_vec_t *depends;
+	int err;
+
+	if (running && !running->replan)
+		item = transaction_find(running, pkg);
+
+	/* resolved up front, along with the rest of the transaction. The
+	 * plan is only followed once: a dependency cycle leads back here
+	 * while it is carried out, and then finds nothing left to resolve */
+	if (item && item->depends) {
+		if (item->err)
+			return -1;
+		depends = item->depends;
+		item->depends = NULL;
+	} else {
+		depends = pkg_vec_alloc();
+		err = resolve_dependencies_for(pkg, depends);
+		if (err) {
+			pkg_vec_free(depends);
+			return err;
+		}
+	}
+
+	err = install_dependencies_for(depends);
+
 	pkg_vec_free(depends);
 
-	return 0;
+	return err;
 }
 
 static int check_conflicts_for(pkg_t * pkg)
@@ -146,17 +272,16 @@ static int check_conflicts_for(pkg_t * pkg)
 
 static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
 {
-	str_list_t *new_list, *old_list;
-	str_list_elt_t *iter, *niter;
+	path_list_t *new_list, *old_list;
+	const char *new_file, *old_file;
+	size_t pos;
 
 	new_list = pkg_get_installed_files(new_pkg);
 	if (new_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(new_list), niter =
-	     str_list_next(new_list, iter); iter;
-	     iter = niter, niter = str_list_next(new_list, niter)) {
-		char *new_file = (char *)iter->data;
+	for (new_file = path_list_first(new_list, &pos); new_file;
+	     new_file = path_list_next(new_list, &pos)) {
 		pkg_t *owner = file_hash_get_file_owner(new_file);
 		pkg_t *obs = hash_table_get(&conf->obs_file_hash, new_file);
 
@@ -176,10 +301,8 @@ static int update_file_ownership(pkg_t * new_pkg, pkg_t * old_pkg)
 			return -1;
 		}
 
-		for (iter = str_list_first(old_list), niter =
-		     str_list_next(old_list, iter); iter;
-		     iter = niter, niter = str_list_next(old_list, niter)) {
-			char *old_file = (char *)iter->data;
+		for (old_file = path_list_first(old_list, &pos); old_file;
+		     old_file = path_list_next(old_list, &pos)) {
 			pkg_t *owner = file_hash_get_file_owner(old_file);
 			if (!owner || (owner == old_pkg)) {
 				/* obsolete */
@@ -789,19 +912,17 @@ static int check_data_file_clashes(pkg_t * pkg, pkg_t * old_pkg)
 	   packages involved in the clash has the potential to break the
 	   other package.
 	 */
-	str_list_t *files_list;
-	str_list_elt_t *iter, *niter;
-	char *filename;
+	path_list_t *files_list;
+	const char *filename;
+	size_t pos;
 	int clashes = 0;
 
 	files_list = pkg_get_installed_files(pkg);
 	if (files_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(files_list), niter =
-	     str_list_next(files_list, iter); iter;
-	     iter = niter, niter = str_list_next(files_list, iter)) {
-		filename = (char *)iter->data;
+	for (filename = path_list_first(files_list, &pos); filename;
+	     filename = path_list_next(files_list, &pos)) {
 		if (file_exists(filename) && (!file_is_dir(filename))) {
 			pkg_t *owner;
 			pkg_t *obs;
@@ -885,17 +1006,16 @@ static int check_data_file_clashes_change(pkg_t * pkg, pkg_t * old_pkg)
 	   Only the action that are needed to change name should be considered.
 	   @@@ To change after 1.0 release.
 	 */
-	str_list_t *files_list;
-	str_list_elt_t *iter, *niter;
+	path_list_t *files_list;
+	const char *filename;
+	size_t pos;
 
 	files_list = pkg_get_installed_files(pkg);
 	if (files_list == NULL)
 		return -1;
 
-	for (iter = str_list_first(files_list), niter =
-	     str_list_next(files_list, iter); iter;
-	     iter = niter, niter = str_list_next(files_list, niter)) {
-		char *filename = (char *)iter->data;
+	for (filename = path_list_first(files_list, &pos); filename;
+	     filename = path_list_next(files_list, &pos)) {
 		if (file_exists(filename) && (!file_is_dir(filename))) {
 			pkg_t *owner;
 
@@ -976,10 +1096,11 @@ static int postrm_upgrade_old_pkg_unwind(pkg_t * pkg, pkg_t * old_pkg)
 static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
 {
 	int err = 0;
-	str_list_t *old_files;
-	str_list_elt_t *of;
-	str_list_t *new_files;
-	str_list_elt_t *nf;
+	path_list_t *old_files;
+	const char *old;
+	path_list_t *new_files;
+	const char *new;
+	size_t pos;
 	hash_table_t new_files_table;
 
 	old_files = pkg_get_installed_files(old_pkg);
@@ -994,19 +1115,15 @@ static int remove_obsolesced_files(pkg_t * pkg, pkg_t * old_pkg)
 
 	new_files_table.entries = NULL;
 	hash_table_init("new_files", &new_files_table, 20);
-	for (nf = str_list_first(new_files); nf;
-	     nf = str_list_next(new_files, nf)) {
-		if (nf && nf->data)
-			hash_table_insert(&new_files_table, nf->data, nf->data);
-	}
+	for (new = path_list_first(new_files, &pos); new;
+	     new = path_list_next(new_files, &pos))
+		hash_table_insert(&new_files_table, new, pkg);
 
-	for (of = str_list_first(old_files); of;
-	     of = str_list_next(old_files, of)) {
+	for (old = path_list_first(old_files, &pos); old;
+	     old = path_list_next(old_files, &pos)) {
 		pkg_t *owner;
-		char *old, *new;
-		old = (char *)of->data;
-		new = (char *)hash_table_get(&new_files_table, old);
-		if (new)
+
+		if (hash_table_get(&new_files_table, old))
 			continue;
 
 		if (file_is_dir(old)) {
@@ -1083,10 +1200,14 @@ static int install_data_files(pkg_t * pkg)
 		return err;
 	}
 
-	opkg_msg(DEBUG, "Calling pkg_write_filelist.\n");
-	err = pkg_write_filelist(pkg);
-	if (err)
-		return err;
+	/* within a transaction, the filelists of everything it unpacked
+	 * are written once at the end by pkg_write_changed_filelists() */
+	if (!running) {
+		opkg_msg(DEBUG, "Calling pkg_write_filelist.\n");
+		err = pkg_write_filelist(pkg);
+		if (err)
+			return err;
+	}
 
 	/* XXX: FEATURE: opkg should identify any files which existed
 	   before installation and which were overwritten, (see
@@ -1173,12 +1294,18 @@ static int resolve_conffiles(pkg_t * pkg)
 	return 0;
 }
 
-int opkg_install_by_name(const char *pkg_name)
+/*
+ * Picks the package to install for pkg_name into *pnew, or NULL if the
+ * installed one is to be kept. Returns -1 if there is no such package.
+ */
+static int install_candidate(const char *pkg_name, pkg_t ** pnew)
 {
 	int cmp;
 	pkg_t *old, *new;
 	char *old_version, *new_version;
 
+	*pnew = NULL;
+
 	old = pkg_hash_fetch_installed_by_name(pkg_name);
 	if (old)
 		opkg_msg(DEBUG2, "Old versions from pkg_hash_fetch %s.\n",
@@ -1235,10 +1362,158 @@ int opkg_install_by_name(const char *pkg_name)
 		free(new_version);
 	}
 
+	*pnew = new;
+	return 0;
+}
+
+int opkg_install_by_name(const char *pkg_name)
+{
+	pkg_t *new;
+
+	if (install_candidate(pkg_name, &new))
+		return -1;
+
+	if (!new)
+		return 0;
+
 	opkg_msg(DEBUG2, "Calling opkg_install_pkg.\n");
 	return opkg_install_pkg(new, 0);
 }
 
+struct opkg_transaction *opkg_transaction_new(void)
+{
+	return xcalloc(1, sizeof(struct opkg_transaction));
+}
+
+void opkg_transaction_add(struct opkg_transaction *t, pkg_t * pkg,
+			  int from_upgrade)
+{
+	struct transaction_item *item;
+
+	t->items = xrealloc(t->items, (t->n_items + 1) * sizeof(*t->items));
+	item = &t->items[t->n_items++];
+
+	memset(item, 0, sizeof(*item));
+	item->pkg = pkg;
+	item->from_upgrade = from_upgrade;
+}
+
+int opkg_transaction_add_name(struct opkg_transaction *t, const char *pkg_name)
+{
+	pkg_t *new;
+
+	if (install_candidate(pkg_name, &new)) {
+		opkg_msg(ERROR, "Cannot install package %s.\n", pkg_name);
+		return -1;
+	}
+
+	if (new) {
+		opkg_transaction_add(t, new, 0);
+		t->items[t->n_items - 1].name = xstrdup(pkg_name);
+	}
+
+	return 0;
+}
+
+static void forget_dependencies_checked(void)
+{
+	pkg_vec_t *all = pkg_vec_alloc();
+	int i;
+
+	pkg_hash_fetch_available(all);
+	for (i = 0; i < all->len; i++)
+		all->pkgs[i]->parent->dependencies_checked = 0;
+
+	pkg_vec_free(all);
+}
+
+/*
+ * Resolves the dependencies of all packages of the transaction in one
+ * walk, downloads everything that is going to be installed at once and
+ * then unpacks the packages in the order they were added, each after its
+ * dependencies. Unpacking, with its clash checks and maintainer scripts,
+ * stays per package; the filelists, the status and configuring are left
+ * to the caller, to do once for everything.
+ */
+int opkg_transaction_run(struct opkg_transaction *t)
+{
+	struct transaction_item *item;
+	pkg_vec_t *all;
+	int i, j, err = 0;
+
+	/* so that greedy dependencies do not pull in what is requested */
+	t->by_pkg = xcalloc(t->n_items + 1, sizeof(*t->by_pkg));
+	for (i = 0; i < t->n_items; i++) {
+		t->by_pkg[i] = &t->items[i];
+		t->items[i].pkg->state_want = SW_INSTALL;
+	}
+	qsort(t->by_pkg, t->n_items, sizeof(*t->by_pkg), transaction_item_cmp);
+
+	all = pkg_vec_alloc();
+
+	for (i = 0; i < t->n_items; i++) {
+		item = &t->items[i];
+
+		pkg_vec_insert(all, item->pkg);
+
+		if (conf->nodeps || !pkg_arch_supported(item->pkg))
+			continue;
+
+		if (item->pkg->dest == NULL)
+			item->pkg->dest = conf->default_dest;
+
+		item->depends = pkg_vec_alloc();
+		item->err = resolve_dependencies_for(item->pkg, item->depends);
+
+		for (j = 0; j < item->depends->len; j++)
+			pkg_vec_insert(all, item->depends->pkgs[j]);
+	}
+
+	prefetch_pkgs(all);
+	pkg_vec_free(all);
+
+	running = t;
+
+	for (i = 0; i < t->n_items; i++) {
+		item = &t->items[i];
+
+		opkg_msg(DEBUG2, "Calling opkg_install_pkg.\n");
+		if (!opkg_install_pkg(item->pkg, item->from_upgrade))
+			continue;
+
+		if (item->name)
+			opkg_msg(ERROR, "Cannot install package %s.\n",
+				 item->name);
+		err = -1;
+
+		/* what was left out for depending on item->pkg as well is
+		 * not in the plan of the others */
+		if (!t->replan) {
+			t->replan = 1;
+			forget_dependencies_checked();
+		}
+	}
+
+	running = NULL;
+
+	return err;
+}
+
+void opkg_transaction_free(struct opkg_transaction *t)
+{
+	int i;
+
+	for (i = 0; i < t->n_items; i++) {
+		free(t->items[i].name);
+		if (t->items[i].depends)
+			pkg_vec_free(t->items[i].depends);
+	}
+
+	free(t->items);
+	free(t->by_pkg);
+	free(t);
+}
+
 /**
  *  @brief Really install a pkg_t
  */
@@ -1524,6 +1799,9 @@ int opkg_install_pkg(pkg_t * pkg, int from_upgrade)
 	if (ab_pkg)
 		ab_pkg->state_status = pkg->state_status;
 
+	/* the package file is not read again */
+	pkg_extract_close(pkg);
+
 	sigprocmask(SIG_UNBLOCK, &newset, &oldset);
 	pkg_vec_free(replacees);
 	return 0;
@@ -24,4 +24,17 @@
 int opkg_install_by_name(const char *pkg_name);
 int opkg_install_pkg(pkg_t * pkg, int from_upgrading);
 
+/*
+ * A set of packages installed together: their dependencies are resolved
+ * and downloaded for all of them before the first is unpacked.
+ */
+struct opkg_transaction;
+
+struct opkg_transaction *opkg_transaction_new(void);
+void opkg_transaction_add(struct opkg_transaction *t, pkg_t * pkg,
+			  int from_upgrade);
+int opkg_transaction_add_name(struct opkg_transaction *t, const char *pkg_name);
+int opkg_transaction_run(struct opkg_transaction *t);
+void opkg_transaction_free(struct opkg_transaction *t);
+
 #endif
@@ -23,52 +23,59 @@
 #include "opkg_remove.h"
 #include "opkg_cmd.h"
 #include "pkg_alternatives.h"
+#include "pkg_graph.h"
 #include "file_util.h"
 #include "sprintf_alloc.h"
 #include "libbb/libbb.h"
 
+static int is_installed_dependent(const struct pkg_graph *g,
+				  const struct pkg_graph_edge *e)
+{
+	if (e->type != PREDEPEND && e->type != DEPEND && e->type != RECOMMEND)
+		return 0;
+
+	return g->pkgs[e->from]->parent->state_status == SS_INSTALLED;
+}
+
 /*
  * Returns number of the number of packages depending on the packages provided by this package.
  * Every package implicitly provides itself.
  */
 int pkg_has_installed_dependents(pkg_t * pkg, abstract_pkg_t *** pdependents)
 {
-	abstract_pkg_t **provider, **provides = pkg_get_ptr(pkg, PKG_PROVIDES);
-	unsigned int i, n_installed_dependents = 0;
+	const struct pkg_graph *g = pkg_graph_get();
+	const struct pkg_graph_edge *e;
+	abstract_pkg_t *dep_ab_pkg;
+	unsigned int i, j, a, p = 0, n_installed_dependents = 0;
+	unsigned int provides = 0, provides_end = 0;
 
-	provider = provides;
+	if (pkg_graph_has_pkg(g, pkg)) {
+		provides = g->provides_idx[pkg->graph_id];
+		provides_end = g->provides_idx[pkg->graph_id + 1];
+	}
 
-	while (provider && *provider) {
-		abstract_pkg_t *providee = *provider++;
-		abstract_pkg_t **dependers = providee->depended_upon_by;
-		abstract_pkg_t *dep_ab_pkg;
-		if (dependers == NULL)
-			continue;
-		while ((dep_ab_pkg = *dependers++) != NULL) {
-			if (dep_ab_pkg->state_status == SS_INSTALLED) {
+	/* every version of a dependent counts */
+	for (i = provides; i < provides_end; i++) {
+		a = g->provides[i];
+		for (j = g->rdep_idx[a]; j < g->rdep_idx[a + 1]; j++)
+			if (is_installed_dependent(g, &g->edges[g->rdeps[j]]))
 				n_installed_dependents++;
-			}
-		}
 	}
 
 	/* if caller requested the set of installed dependents */
 	if (pdependents) {
-		int p = 0;
 		abstract_pkg_t **dependents =
 		    xcalloc((n_installed_dependents + 1),
 			    sizeof(abstract_pkg_t *));
 
-		provider = provides;
 		*pdependents = dependents;
 
-		while (provider && *provider) {
-			abstract_pkg_t *providee = *provider++;
-			abstract_pkg_t **dependers = providee->depended_upon_by;
-			abstract_pkg_t *dep_ab_pkg;
-			if (dependers == NULL)
-				continue;
-			while ((dep_ab_pkg = *dependers++) != NULL) {
-				if (dep_ab_pkg->state_status == SS_INSTALLED
+		for (i = provides; i < provides_end; i++) {
+			a = g->provides[i];
+			for (j = g->rdep_idx[a]; j < g->rdep_idx[a + 1]; j++) {
+				e = &g->edges[g->rdeps[j]];
+				dep_ab_pkg = g->pkgs[e->from]->parent;
+				if (is_installed_dependent(g, e)
 				    && !(dep_ab_pkg->state_flag & SF_MARKED)) {
 					dependents[p++] = dep_ab_pkg;
 					dep_ab_pkg->state_flag |= SF_MARKED;
@@ -78,7 +85,7 @@ int pkg_has_installed_dependents(pkg_t * pkg, abstract_pkg_t *** pdependents)
 		dependents[p] = NULL;
 		/* now clear the marks */
 		for (i = 0; i < p; i++) {
-			abstract_pkg_t *dep_ab_pkg = dependents[i];
+			dep_ab_pkg = dependents[i];
 			dep_ab_pkg->state_flag &= ~SF_MARKED;
 		}
 	}
@@ -338,9 +345,10 @@ int opkg_remove_pkg(pkg_t * pkg, int from_upgrade)
 void remove_data_files_and_list(pkg_t * pkg)
 {
 	str_list_t installed_dirs;
-	str_list_t *installed_files;
+	path_list_t *installed_files;
 	str_list_elt_t *iter;
-	char *file_name;
+	const char *file_name;
+	size_t pos;
 	conffile_t *conffile;
 	int removed_a_dir;
 	pkg_t *owner;
@@ -359,17 +367,15 @@ void remove_data_files_and_list(pkg_t * pkg)
 	if (conf->offline_root)
 		rootdirlen = strlen(conf->offline_root);
 
-	for (iter = str_list_first(installed_files); iter;
-	     iter = str_list_next(installed_files, iter)) {
-		file_name = (char *)iter->data;
-
+	for (file_name = path_list_first(installed_files, &pos); file_name;
+	     file_name = path_list_next(installed_files, &pos)) {
 		owner = file_hash_get_file_owner(file_name);
 		if (owner != pkg)
 			/* File may have been claimed by another package. */
 			continue;
 
 		if (file_is_dir(file_name)) {
-			str_list_append(&installed_dirs, file_name);
+			str_list_append(&installed_dirs, (char *)file_name);
 			continue;
 		}
 
@@ -0,0 +1,194 @@
+/* opkg_transport.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "opkg_transport.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "xsystem.h"
+#include "libbb/libbb.h"
+
+/* what wget does without --timeout */
+#define OPKG_TRANSPORT_DEFAULT_TIMEOUT	900
+
+void opkg_transport_setenv(void)
+{
+	if (conf->http_proxy) {
+		opkg_msg(DEBUG,
+			 "Setting environment variable: http_proxy = %s.\n",
+			 conf->http_proxy);
+		setenv("http_proxy", conf->http_proxy, 1);
+	}
+	if (conf->https_proxy) {
+		opkg_msg(DEBUG,
+			 "Setting environment variable: https_proxy = %s.\n",
+			 conf->https_proxy);
+		setenv("https_proxy", conf->https_proxy, 1);
+	}
+	if (conf->ftp_proxy) {
+		opkg_msg(DEBUG,
+			 "Setting environment variable: ftp_proxy = %s.\n",
+			 conf->ftp_proxy);
+		setenv("ftp_proxy", conf->ftp_proxy, 1);
+	}
+	if (conf->no_proxy) {
+		opkg_msg(DEBUG,
+			 "Setting environment variable: no_proxy = %s.\n",
+			 conf->no_proxy);
+		setenv("no_proxy", conf->no_proxy, 1);
+	}
+}
+
+int opkg_transport_timeout(void)
+{
+	int timeout = 0;
+
+	if (conf->http_timeout)
+		timeout = atoi(conf->http_timeout);
+
+	if (timeout <= 0)
+		timeout = OPKG_TRANSPORT_DEFAULT_TIMEOUT;
+
+	return timeout * 1000;
+}
+
+/*
+ * Plain http urls are fetched in process unless "option transport wget"
+ * is set, or a proxy or user name is involved. Everything else goes
+ * through wget.
+ */
+const struct opkg_transport *opkg_transport_for(const char *url)
+{
+	const char *host = url + strlen("http://");
+
+	if (conf->transport && !strcmp(conf->transport, "wget"))
+		return &opkg_transport_wget;
+
+	if (strncmp(url, "http://", strlen("http://")))
+		return &opkg_transport_wget;
+
+	if (conf->http_proxy || getenv("http_proxy"))
+		return &opkg_transport_wget;
+
+	if (memchr(host, '@', strcspn(host, "/?#")))
+		return &opkg_transport_wget;
+
+	return &opkg_transport_http;
+}
+
+void opkg_transport_cleanup(void)
+{
+	if (opkg_transport_wget.cleanup)
+		opkg_transport_wget.cleanup();
+	if (opkg_transport_http.cleanup)
+		opkg_transport_http.cleanup();
+}
+
+struct wget_transfer {
+	struct opkg_transfer t;
+	pid_t pid;
+	int err;
+};
+
+/* argv must have room for 11 entries */
+static void wget_argv(const char **argv, const char *url)
+{
+	int i = 0;
+
+	argv[i++] = "wget";
+	argv[i++] = "-q";
+	if (conf->no_check_certificate) {
+		argv[i++] = "--no-check-certificate";
+	}
+	if (conf->http_timeout) {
+		argv[i++] = "--timeout";
+		argv[i++] = conf->http_timeout;
+	}
+	if (conf->http_proxy || conf->https_proxy || conf->ftp_proxy) {
+		argv[i++] = "-Y";
+		argv[i++] = "on";
+	}
+	argv[i++] = "-O";
+	argv[i++] = "-";
+	argv[i++] = url;
+	argv[i++] = NULL;
+}
+
+static struct opkg_transfer *wget_start(const char *url)
+{
+	struct wget_transfer *w = xcalloc(1, sizeof(*w));
+	const char *argv[11];
+
+	opkg_transport_setenv();
+	wget_argv(argv, url);
+
+	w->pid = xsystem_start_pipe(argv, &w->t.fd);
+	if (w->pid == -1) {
+		free(w);
+		return NULL;
+	}
+
+	w->t.transport = &opkg_transport_wget;
+
+	return &w->t;
+}
+
+static int wget_read(struct opkg_transfer *t, void *buf, size_t len,
+		     size_t *n)
+{
+	struct wget_transfer *w = (struct wget_transfer *)t;
+	ssize_t ret;
+
+	*n = 0;
+
+	do {
+		ret = read(t->fd, buf, len);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		opkg_perror(ERROR, "Failed to read from wget");
+		w->err = -1;
+		return 0;
+	}
+
+	*n = ret;
+
+	return ret != 0;
+}
+
+static int wget_finish(struct opkg_transfer *t)
+{
+	struct wget_transfer *w = (struct wget_transfer *)t;
+	int res;
+
+	close(t->fd);
+	res = xsystem_wait("wget", w->pid);
+	if (!res && w->err)
+		res = -1;
+
+	free(w);
+
+	return res;
+}
+
+const struct opkg_transport opkg_transport_wget = {
+	.name = "wget",
+	.start = wget_start,
+	.read = wget_read,
+	.finish = wget_finish,
+};
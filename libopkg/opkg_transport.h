@@ -0,0 +1,69 @@
+/* opkg_transport.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_TRANSPORT_H
+#define OPKG_TRANSPORT_H
+
+#include <stddef.h>
+
+/*
+ * A transport fetches the body of a url and hands it over as it arrives,
+ * so several transfers can be driven from one poll() loop:
+ *
+ *   t = transport->start(url);
+ *   while (transport->read(t, buf, sizeof(buf), &n))
+ *           use n bytes of buf, poll() for t->fd to be readable;
+ *   res = transport->finish(t);
+ *
+ * read() does not block once t->fd is readable, and may hand over no
+ * data at all. t->fd can change during read(). finish() frees t and
+ * returns 0 if the whole body was received, else an error code in the
+ * manner of the exit status of wget, e.g. 4 for a network failure.
+ */
+
+struct opkg_transfer;
+
+struct opkg_transport {
+	const char *name;
+	/* NULL if the transfer could not be started, with the reason
+	   reported */
+	struct opkg_transfer *(*start) (const char *url);
+	/* returns 0 once the transfer is over */
+	int (*read) (struct opkg_transfer * t, void *buf, size_t len,
+		     size_t * n);
+	/* ends a transfer no data arrived for within the timeout, NULL if
+	   the transport keeps its own timeout */
+	void (*expire) (struct opkg_transfer * t);
+	int (*finish) (struct opkg_transfer * t);
+	/* drops what is kept between transfers, may be NULL */
+	void (*cleanup) (void);
+};
+
+struct opkg_transfer {
+	const struct opkg_transport *transport;
+	int fd;
+};
+
+/* runs wget with its output going to a pipe */
+extern const struct opkg_transport opkg_transport_wget;
+/* plain HTTP/1.1 in process, reusing connections to the same server */
+extern const struct opkg_transport opkg_transport_http;
+
+const struct opkg_transport *opkg_transport_for(const char *url);
+/* the poll() timeout for transfers, in milliseconds */
+int opkg_transport_timeout(void);
+/* sets the proxy environment of wget */
+void opkg_transport_setenv(void);
+void opkg_transport_cleanup(void);
+
+#endif
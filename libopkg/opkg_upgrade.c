@@ -23,7 +23,8 @@
 #include "opkg_upgrade.h"
 #include "opkg_message.h"
 
-int opkg_upgrade_pkg(pkg_t * old)
+/* the package to upgrade old to, or NULL if it is to be kept */
+pkg_t *opkg_upgrade_candidate(pkg_t * old)
 {
 	pkg_t *new;
 	int cmp;
@@ -32,7 +33,7 @@ int opkg_upgrade_pkg(pkg_t * old)
 	if (old->state_flag & SF_HOLD) {
 		opkg_msg(NOTICE, "Not upgrading package %s which is marked "
 			 "hold (flags=%#x).\n", old->name, old->state_flag);
-		return 0;
+		return NULL;
 	}
 
 	new = pkg_hash_fetch_best_installation_candidate_by_name(old->name);
@@ -41,7 +42,7 @@ int opkg_upgrade_pkg(pkg_t * old)
 		opkg_msg(NOTICE, "Assuming locally installed package %s (%s) "
 			 "is up to date.\n", old->name, old_version);
 		free(old_version);
-		return 0;
+		return NULL;
 	}
 
 	old_version = pkg_version_str_alloc(old);
@@ -59,14 +60,14 @@ int opkg_upgrade_pkg(pkg_t * old)
 			 old->name, old_version, old->dest->name);
 		free(old_version);
 		free(new_version);
-		return 0;
+		return NULL;
 	} else if (cmp > 0) {
 		opkg_msg(NOTICE,
 			 "Not downgrading package %s on %s from %s to %s.\n",
 			 old->name, old->dest->name, old_version, new_version);
 		free(old_version);
 		free(new_version);
-		return 0;
+		return NULL;
 	} else if (cmp < 0) {
 		new->dest = old->dest;
 		old->state_want = SW_DEINSTALL;
@@ -75,6 +76,16 @@ int opkg_upgrade_pkg(pkg_t * old)
 	free(old_version);
 	free(new_version);
 	new->state_flag |= SF_USER;
+	return new;
+}
+
+int opkg_upgrade_pkg(pkg_t * old)
+{
+	pkg_t *new = opkg_upgrade_candidate(old);
+
+	if (!new)
+		return 0;
+
 	return opkg_install_pkg(new, 1);
 }
 
@@ -16,6 +16,7 @@
 #define OPKG_UPGRADE_H
 
 #include "active_list.h"
+pkg_t *opkg_upgrade_candidate(pkg_t * old);
 int opkg_upgrade_pkg(pkg_t * old);
 struct active_list *prepare_upgrade_list(void);
 
@@ -0,0 +1,181 @@
+/* path_list.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <string.h>
+
+#include "path_list.h"
+#include "libbb/libbb.h"
+
+/*
+ * An entry is a header, then the NUL terminated rest of its name. The
+ * header is (shared << 1 | removed) in 7 bit groups, lowest first, with
+ * the top bit set on all but the last, so the removed flag is always the
+ * lowest bit of the first byte.
+ */
+#define ENTRY_REMOVED	1
+
+static void path_list_reserve(path_list_t *list, size_t len)
+{
+	if (list->len + len <= list->alloc)
+		return;
+
+	list->alloc = list->alloc ? list->alloc * 2 : 256;
+	if (list->alloc < list->len + len)
+		list->alloc = list->len + len;
+
+	list->buf = xrealloc(list->buf, list->alloc);
+}
+
+static size_t header_get(const unsigned char *buf, size_t *pos)
+{
+	size_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (size_t)(buf[*pos] & 0x7f) << shift;
+		shift += 7;
+	} while (buf[(*pos)++] & 0x80);
+
+	return v;
+}
+
+static void header_put(path_list_t *list, size_t v)
+{
+	path_list_reserve(list, sizeof(v) + 2);
+
+	while (v >= 0x80) {
+		list->buf[list->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	list->buf[list->len++] = v;
+}
+
+path_list_t *path_list_alloc(void)
+{
+	path_list_t *list = xcalloc(1, sizeof(*list));
+
+	path_list_init(list);
+
+	return list;
+}
+
+void path_list_init(path_list_t *list)
+{
+	memset(list, 0, sizeof(*list));
+}
+
+void path_list_deinit(path_list_t *list)
+{
+	free(list->buf);
+	free(list->last);
+	free(list->path);
+	path_list_init(list);
+}
+
+void path_list_purge(path_list_t *list)
+{
+	path_list_deinit(list);
+	free(list);
+}
+
+/* Appends the name dir followed by name, dir may be NULL. */
+void path_list_append(path_list_t *list, const char *dir, const char *name)
+{
+	size_t dir_len = dir ? strlen(dir) : 0;
+	size_t len = dir_len + strlen(name);
+	size_t shared = 0;
+
+	if (len > list->max_len || !list->last) {
+		list->max_len = len > list->max_len ? len : list->max_len;
+		list->last = xrealloc(list->last, list->max_len + 1);
+	}
+
+	while (shared < list->last_len && shared < len
+	       && list->last[shared] == (shared < dir_len ? dir[shared]
+					 : name[shared - dir_len]))
+		shared++;
+
+	if (shared < dir_len)
+		memcpy(list->last + shared, dir + shared, dir_len - shared);
+	strcpy(list->last + (shared > dir_len ? shared : dir_len),
+	       name + (shared > dir_len ? shared - dir_len : 0));
+	list->last_len = len;
+
+	header_put(list, shared << 1);
+	path_list_reserve(list, len - shared + 1);
+	memcpy(list->buf + list->len, list->last + shared, len - shared + 1);
+	list->len += len - shared + 1;
+}
+
+/*
+ * Removes the first entry that is name, without decoding into the walk
+ * buffer, so it can be called during a walk. The entry stays in place
+ * as the base of the next one. Returns -1 if there is no such entry.
+ */
+int path_list_remove(path_list_t *list, const char *name)
+{
+	size_t pos = 0, start, shared, match = 0, len = strlen(name);
+	const char *rest;
+	size_t v;
+
+	/* match is how much of name the name of the last entry starts with */
+	while (pos < list->len) {
+		start = pos;
+		v = header_get(list->buf, &pos);
+		shared = v >> 1;
+		rest = (const char *)list->buf + pos;
+		pos += strlen(rest) + 1;
+
+		/* differs from name where the last entry did */
+		if (shared > match)
+			continue;
+
+		match = shared;
+		while (match < len && rest[match - shared] == name[match])
+			match++;
+
+		if (match == len && rest[match - shared] == '\0'
+		    && !(v & ENTRY_REMOVED)) {
+			list->buf[start] |= ENTRY_REMOVED;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+const char *path_list_next(path_list_t *list, size_t *pos)
+{
+	size_t v, shared, n;
+
+	while (*pos < list->len) {
+		v = header_get(list->buf, pos);
+		shared = v >> 1;
+		n = strlen((const char *)list->buf + *pos);
+		memcpy(list->path + shared, list->buf + *pos, n + 1);
+		*pos += n + 1;
+
+		if (!(v & ENTRY_REMOVED))
+			return list->path;
+	}
+
+	return NULL;
+}
+
+const char *path_list_first(path_list_t *list, size_t *pos)
+{
+	*pos = 0;
+	list->path = xrealloc(list->path, list->max_len + 1);
+
+	return path_list_next(list, pos);
+}
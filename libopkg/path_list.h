@@ -0,0 +1,55 @@
+/* path_list.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PATH_LIST_H
+#define PATH_LIST_H
+
+#include <stddef.h>
+
+/*
+ * List of file names kept in the order they were appended, front coded:
+ * each entry is stored as the length of the prefix it shares with the
+ * entry before it, followed by the rest of the name. Names of the same
+ * directory mostly differ in their last component, so a list of them
+ * takes a fraction of the memory of separately allocated strings.
+ *
+ * The names are read back by walking the list from the start. The name
+ * returned by path_list_first() and path_list_next() is decoded into a
+ * buffer of the list and stays valid until the next step of the walk;
+ * there can be only one walk of a list at a time.
+ */
+
+typedef struct path_list path_list_t;
+
+struct path_list {
+	unsigned char *buf;	/* the encoded entries */
+	size_t len;
+	size_t alloc;
+	char *last;		/* the last name appended */
+	size_t last_len;
+	size_t max_len;		/* the length of the longest name */
+	char *path;		/* the name of the walk */
+};
+
+path_list_t *path_list_alloc(void);
+void path_list_init(path_list_t * list);
+void path_list_deinit(path_list_t * list);
+void path_list_purge(path_list_t * list);
+
+void path_list_append(path_list_t * list, const char *dir, const char *name);
+int path_list_remove(path_list_t * list, const char *name);
+
+const char *path_list_first(path_list_t * list, size_t * pos);
+const char *path_list_next(path_list_t * list, size_t * pos);
+
+#endif
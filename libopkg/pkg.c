@@ -33,6 +33,9 @@
 #include "file_util.h"
 #include "xsystem.h"
 #include "opkg_conf.h"
+#include "str_pool.h"
+#include "file_index.h"
+#include "pkg_hash.h"
 
 typedef struct enum_map enum_map_t;
 struct enum_map {
@@ -69,6 +72,12 @@ static const enum_map_t pkg_state_status_map[] = {
 	{SS_REMOVAL_FAILED, "removal-failed"}
 };
 
+/* package database objects, released in bulk by pkg_hash_deinit() */
+struct arena pkg_arena = ARENA_INIT("pkg", sizeof(pkg_t));
+struct arena abstract_pkg_arena = ARENA_INIT("abstract-pkg",
+					     sizeof(abstract_pkg_t));
+struct arena pkg_name_arena = ARENA_INIT("pkg-names", 0);
+
 static void pkg_init(pkg_t * pkg)
 {
 	pkg->name = NULL;
@@ -80,45 +89,65 @@ static void pkg_init(pkg_t * pkg)
 
 	pkg->installed_files = NULL;
 	pkg->installed_files_ref_cnt = 0;
+	INIT_LIST_HEAD(&pkg->owned_files);
 	pkg->essential = 0;
 	pkg->provided_by_hand = 0;
 
+	pkg->resolve_gen = 0;
+
 	pkg->arch_index = 0;
 
 	blob_buf_init(&pkg->blob, 0);
+	memset(pkg->blob_index, 0, sizeof(pkg->blob_index));
 }
 
 pkg_t *pkg_new(void)
 {
 	pkg_t *pkg;
 
-	pkg = xcalloc(1, sizeof(pkg_t));
+	pkg = arena_alloc(&pkg_arena);
 	pkg_init(pkg);
 
 	return pkg;
 }
 
+void pkg_free(pkg_t *pkg)
+{
+	pkg_deinit(pkg);
+	arena_free(&pkg_arena, pkg);
+}
+
 void *pkg_set_raw(pkg_t *pkg, int id, const void *val, size_t len)
 {
-	int rem;
 	struct blob_attr *cur;
-
-	blob_for_each_attr(cur, pkg->blob.head, rem) {
-		if (blob_id(cur) == id) {
-			if (blob_len(cur) < len) {
-				fprintf(stderr, "ERROR: truncating field %d <%p> to %zu byte",
-				        id, val, blob_len(cur));
-			}
-			memcpy(blob_data(cur), val, blob_len(cur));
-			return blob_data(cur);
+	char *p = pkg_get_raw(pkg, id);
+	size_t off;
+
+	if (p) {
+		cur = (struct blob_attr *)(p - sizeof(struct blob_attr));
+		if (blob_len(cur) < len) {
+			fprintf(stderr, "ERROR: truncating field %d <%p> to %zu byte",
+			        id, val, blob_len(cur));
 		}
+		memcpy(p, val, blob_len(cur));
+		return p;
 	}
 
 	cur = blob_put(&pkg->blob, id, val, len);
-	return cur ? blob_data(cur) : NULL;
+	if (!cur)
+		return NULL;
+
+	off = ((char *)blob_data(cur) - (char *)pkg->blob.head) / BLOB_ATTR_ALIGN;
+	pkg->blob_index[id] = off < PKG_BLOB_UNINDEXED ? off : PKG_BLOB_UNINDEXED;
+
+	return blob_data(cur);
 }
 
-void *pkg_get_raw(const pkg_t * pkg, int id)
+/*
+ * Linear lookup, only needed for fields whose offset does not fit into
+ * blob_index.
+ */
+void *pkg_find_raw(const pkg_t * pkg, int id)
 {
 	int rem;
 	struct blob_attr *cur;
@@ -130,6 +159,28 @@ void *pkg_get_raw(const pkg_t * pkg, int id)
 	return NULL;
 }
 
+/*
+ * Gives back the slack the blob buffer grew in while the package was
+ * being parsed. The blob still grows as usual if more fields are set.
+ */
+void pkg_shrink_blob(pkg_t *pkg)
+{
+	size_t len = blob_pad_len(pkg->blob.head);
+	void *buf;
+
+	if (!pkg->blob.buf || pkg->blob.head != pkg->blob.buf ||
+	    len >= (size_t)pkg->blob.buflen)
+		return;
+
+	buf = realloc(pkg->blob.buf, len);
+	if (!buf)
+		return;
+
+	pkg->blob.buf = buf;
+	pkg->blob.head = buf;
+	pkg->blob.buflen = len;
+}
+
 char *pkg_set_string(pkg_t *pkg, int id, const char *s)
 {
 	size_t len;
@@ -151,6 +202,9 @@ char *pkg_set_string(pkg_t *pkg, int id, const char *s)
 	if (!len)
 		return NULL;
 
+	if ((1 << id) & PKG_ATOM_FIELDS)
+		return pkg_set_ptr(pkg, id, (char *)str_pool_intern(s, len));
+
 	p = pkg_set_raw(pkg, id, s, len + 1);
 	p[len] = 0;
 
@@ -260,7 +314,7 @@ static void compound_depend_deinit(compound_depend_t * depends)
 		depend_t *d;
 		d = depends->possibilities[i];
 		free(d->version);
-		free(d);
+		arena_free(&depend_arena, d);
 	}
 	free(depends->possibilities);
 }
@@ -270,12 +324,17 @@ void pkg_deinit(pkg_t * pkg)
 	int rem;
 	struct blob_attr *cur;
 	compound_depend_t *deps, *dep;
+	struct list_head *pos, *n;
 	void *ptr;
 
 	if (pkg->name)
 		free(pkg->name);
 	pkg->name = NULL;
 
+	/* the files stay in conf->file_hash as they did before */
+	list_for_each_safe(pos, n, &pkg->owned_files)
+		list_del_init(pos);
+
 	/* owned by opkg_conf_t */
 	pkg->dest = NULL;
 	/* owned by opkg_conf_t */
@@ -303,6 +362,7 @@ void pkg_deinit(pkg_t * pkg)
 
 		case PKG_REPLACES:
 		case PKG_PROVIDES:
+		case PKG_LOCAL_DIGEST:
 			ptr = pkg_get_ptr(pkg, blob_id(cur));
 
 			if (ptr)
@@ -335,6 +395,10 @@ void pkg_deinit(pkg_t * pkg)
 
 			pkg_set_ptr(pkg, blob_id(cur), NULL);
 			break;
+
+		case PKG_IPK:
+			pkg_extract_close(pkg);
+			break;
 		}
 	}
 
@@ -348,6 +412,7 @@ void pkg_deinit(pkg_t * pkg)
 	pkg->essential = 0;
 
 	blob_buf_free(&pkg->blob);
+	memset(pkg->blob_index, 0, sizeof(pkg->blob_index));
 }
 
 int pkg_init_from_file(pkg_t * pkg, const char *filename)
@@ -514,7 +579,7 @@ abstract_pkg_t *abstract_pkg_new(void)
 {
 	abstract_pkg_t *ab_pkg;
 
-	ab_pkg = xcalloc(1, sizeof(abstract_pkg_t));
+	ab_pkg = arena_alloc(&abstract_pkg_arena);
 	abstract_pkg_init(ab_pkg);
 
 	return ab_pkg;
@@ -993,73 +1058,205 @@ void pkg_print_status(pkg_t * pkg, FILE * file)
 		: isalpha((x)) ? (x) \
 		: (x) + 256)
 
-static int verrevcmp(const char *val, const char *ref)
+/*
+ * Version keys encode epoch, version and revision once into a string
+ * whose strcmp() order is the order dpkg's verrevcmp() defines, so that
+ * comparing two versions neither parses nor allocates anything.
+ *
+ * A version is split into pairs of a non-digit and a digit run, the way
+ * verrevcmp() walks it:
+ *
+ *  - every non-digit c becomes order(c) + 2, in one byte below 0xf0 or
+ *    as two bytes 0xf0 + (v >> 7), (v & 0x7f) + 1 above it, and the run
+ *    ends with 2, the order of the digit or the end following it.
+ *  - a digit run loses its leading zeros and is prefixed with its length
+ *    + 1, in one byte below 254 or as 0xff and two base 255 digits + 1,
+ *    so longer numbers sort later and equally long ones by their digits.
+ *    Runs of more than 64K digits are cut short.
+ *
+ * Only the first pair can have an empty non-digit run, so the end of the
+ * version is marked with an empty pair followed by 2, which sorts after
+ * '~' and before anything else a pair can start with. A version of only
+ * zeros is the same as an empty one and just gets the end marker.
+ *
+ * The epoch is encoded as a digit run. None of this yields a 0 byte.
+ */
+#define VERSION_KEY_END		2
+#define VERSION_KEY_WIDE	0xf0
+#define VERSION_KEY_LONG_RUN	0xff
+
+/* isdigit() never matches anything else, whatever the locale */
+#define version_key_isdigit(c)	((unsigned char)((c) - '0') < 10)
+
+static unsigned char *version_key_digits(unsigned char *key, const char *s,
+					 size_t len)
+{
+	while (len && *s == '0') {
+		s++;
+		len--;
+	}
+
+	if (len > 254 * 255 + 254)
+		len = 254 * 255 + 254;
+
+	if (len < 254) {
+		*key++ = len + 1;
+	} else {
+		*key++ = VERSION_KEY_LONG_RUN;
+		*key++ = len / 255 + 1;
+		*key++ = len % 255 + 1;
+	}
+
+	memcpy(key, s, len);
+
+	return key + len;
+}
+
+/* encodes the version between s and end */
+static unsigned char *version_key_str(unsigned char *key, const char *s,
+				      const char *end)
 {
-	if (!val)
-		val = "";
-	if (!ref)
-		ref = "";
-
-	while (*val || *ref) {
-		int first_diff = 0;
-
-		while ((*val && !isdigit(*val)) || (*ref && !isdigit(*ref))) {
-			int vc = order(*val), rc = order(*ref);
-			if (vc != rc)
-				return vc - rc;
-			val++;
-			ref++;
+	const char *run, *digits, *p;
+	int v;
+
+	for (;;) {
+		for (run = s; s < end && !version_key_isdigit(*s); s++)
+			;
+		for (digits = s; s < end && version_key_isdigit(*s); s++)
+			;
+
+		if (run == digits && s == end) {
+			for (p = digits; p < s && *p == '0'; p++)
+				;
+			if (p == s)
+				break;
 		}
 
-		while (*val == '0')
-			val++;
-		while (*ref == '0')
-			ref++;
-		while (isdigit(*val) && isdigit(*ref)) {
-			if (!first_diff)
-				first_diff = *val - *ref;
-			val++;
-			ref++;
+		for (p = run; p < digits; p++) {
+			v = order(*p) + 2;
+			if (v < VERSION_KEY_WIDE) {
+				*key++ = v;
+			} else {
+				*key++ = VERSION_KEY_WIDE + (v >> 7);
+				*key++ = (v & 0x7f) + 1;
+			}
 		}
-		if (isdigit(*val))
-			return 1;
-		if (isdigit(*ref))
-			return -1;
-		if (first_diff)
-			return first_diff;
+		*key++ = VERSION_KEY_END;
+
+		key = version_key_digits(key, digits, s - digits);
 	}
-	return 0;
+
+	*key++ = VERSION_KEY_END;
+	*key++ = 1;
+	*key++ = VERSION_KEY_END;
+
+	return key;
 }
 
-int pkg_compare_versions(const pkg_t * pkg, const pkg_t * ref_pkg)
+static void version_key_write_n(unsigned char *key, unsigned int epoch,
+				const char *version, size_t version_len,
+				const char *revision, size_t revision_len)
 {
-	unsigned int epoch1 = (unsigned int) pkg_get_int(pkg, PKG_EPOCH);
-	unsigned int epoch2 = (unsigned int) pkg_get_int(ref_pkg, PKG_EPOCH);
-	char *revision1 = pkg_get_string(pkg, PKG_REVISION);
-	char *revision2 = pkg_get_string(ref_pkg, PKG_REVISION);
-	const char *version1 = pkg_get_string(pkg, PKG_VERSION);
-	const char *version2 = pkg_get_string(ref_pkg, PKG_VERSION);
-	int r;
+	char estr[16], *e = estr + sizeof(estr);
 
-	if (epoch1 > epoch2) {
-		return 1;
-	}
+	do
+		*--e = '0' + epoch % 10;
+	while (epoch /= 10);
 
-	if (epoch1 < epoch2) {
-		return -1;
+	key = version_key_digits(key, e, estr + sizeof(estr) - e);
+	key = version_key_str(key, version, version + version_len);
+	key = version_key_str(key, revision, revision + revision_len);
+	*key = '\0';
+}
+
+void version_key_write(char *key, unsigned int epoch, const char *version,
+		       const char *revision)
+{
+	version_key_write_n((unsigned char *)key, epoch, version,
+			    version ? strlen(version) : 0, revision,
+			    revision ? strlen(revision) : 0);
+}
+
+/* Splits vstr the way parse_version() does. */
+void version_str_key_write(char *key, const char *vstr)
+{
+	const char *colon, *rev, *end = vstr + strlen(vstr);
+	unsigned int epoch = 0;
+
+	colon = strchr(vstr, ':');
+	if (colon) {
+		epoch = strtoul(vstr, NULL, 10);
+		vstr = colon + 1;
 	}
 
-	r = verrevcmp(version1, version2);
-	if (r) {
-		return r;
+	rev = strrchr(vstr, '-');
+
+	version_key_write_n((unsigned char *)key, epoch, vstr,
+			    (rev ? rev : end) - vstr, rev ? rev + 1 : end,
+			    rev ? end - rev - 1 : 0);
+}
+
+/*
+ * Copies version to a malloc'ed string which also holds its key, stored
+ * in *key_copy, so that both go away with a single free(). The key is
+ * computed unless given.
+ */
+char *version_str_key_dup(const char *version, const char *key,
+			  char **key_copy)
+{
+	size_t len = strlen(version), key_len;
+	char buf[VERSION_KEY_SIZE(64)], *tmp = NULL, *res;
+
+	if (!key) {
+		if (VERSION_KEY_SIZE(len) > sizeof(buf))
+			tmp = xmalloc(VERSION_KEY_SIZE(len));
+		version_str_key_write(tmp ? tmp : buf, version);
+		key = tmp ? tmp : buf;
 	}
 
-	r = verrevcmp(revision1, revision2);
-	if (r) {
-		return r;
+	key_len = strlen(key);
+
+	res = xmalloc(len + 1 + key_len + 1);
+	memcpy(res, version, len + 1);
+	*key_copy = res + len + 1;
+	memcpy(*key_copy, key, key_len + 1);
+
+	free(tmp);
+
+	return res;
+}
+
+/* Not pkg_set_string(), key bytes may well look like white space. */
+char *pkg_set_version_key(pkg_t *pkg, const char *key)
+{
+	const char *version = pkg_get_string(pkg, PKG_VERSION);
+	const char *revision = pkg_get_string(pkg, PKG_REVISION);
+	char buf[VERSION_KEY_SIZE(64)], *tmp = NULL, *res;
+	size_t len;
+
+	if (!key) {
+		len = (version ? strlen(version) : 0) +
+		    (revision ? strlen(revision) : 0);
+		if (VERSION_KEY_SIZE(len) > sizeof(buf))
+			tmp = xmalloc(VERSION_KEY_SIZE(len));
+		version_key_write(tmp ? tmp : buf,
+				  (unsigned int) pkg_get_int(pkg, PKG_EPOCH),
+				  version, revision);
+		key = tmp ? tmp : buf;
 	}
 
-	return r;
+	res = pkg_set_raw(pkg, PKG_VERSION_KEY, key, strlen(key) + 1);
+
+	free(tmp);
+
+	return res;
+}
+
+int pkg_compare_versions(const pkg_t * pkg, const pkg_t * ref_pkg)
+{
+	int r = strcmp(pkg_get_version_key(pkg), pkg_get_version_key(ref_pkg));
+
+	return (r > 0) - (r < 0);
 }
 
 int pkg_version_satisfied(pkg_t * it, pkg_t * ref, const char *op)
@@ -1165,19 +1362,33 @@ char *pkg_version_str_alloc(pkg_t * pkg)
 	return version;
 }
 
+static void installed_files_append(pkg_t * pkg, const char *file_name)
+{
+	size_t rootdirlen;
+
+	if (conf->offline_root) {
+		rootdirlen = strlen(conf->offline_root);
+		if (strncmp(conf->offline_root, file_name, rootdirlen)) {
+			path_list_append(pkg->installed_files,
+					 conf->offline_root, file_name);
+			return;
+		}
+	}
+
+	// already contains root_dir as header -> ABSOLUTE
+	path_list_append(pkg->installed_files, NULL, file_name);
+}
+
 /*
  * XXX: this should be broken into two functions
  */
-str_list_t *pkg_get_installed_files(pkg_t * pkg)
+path_list_t *pkg_get_installed_files(pkg_t * pkg)
 {
-	int err, fd;
-	char *list_file_name = NULL;
-	FILE *list_file = NULL;
-	char *line;
-	char *installed_file_name;
-	unsigned int rootdirlen = 0;
+	struct file_owner *owner;
+	int err;
 	int list_from_package;
-	const char *local_filename;
+	const char *local_filename, *lines, *end;
+	size_t len, n;
 
 	pkg->installed_files_ref_cnt++;
 
@@ -1185,10 +1396,11 @@ str_list_t *pkg_get_installed_files(pkg_t * pkg)
 		return pkg->installed_files;
 	}
 
-	pkg->installed_files = str_list_alloc();
+	pkg->installed_files = path_list_alloc();
 
 	/*
-	 * For installed packages, look at the package.list file in the database.
+	 * For installed packages, look at the package.list file in the database,
+	 * as kept by the file index.
 	 * For uninstalled packages, get the file list directly from the package.
 	 */
 	if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL)
@@ -1202,95 +1414,45 @@ str_list_t *pkg_get_installed_files(pkg_t * pkg)
 		if (!local_filename) {
 			return pkg->installed_files;
 		}
-		/* XXX: CLEANUP: Maybe rewrite this to avoid using a temporary
-		   file. In other words, change deb_extract so that it can
-		   simply return the file list as a char *[] rather than
-		   insisting on writing it to a FILE * as it does now. */
-		sprintf_alloc(&list_file_name, "%s/%s.list.XXXXXX",
-			      conf->tmp_dir, pkg->name);
-		fd = mkstemp(list_file_name);
-		if (fd == -1) {
-			opkg_perror(ERROR, "Failed to make temp file %s.",
-				    list_file_name);
-			free(list_file_name);
-			return pkg->installed_files;
-		}
-		list_file = fdopen(fd, "r+");
-		if (list_file == NULL) {
-			opkg_perror(ERROR, "Failed to fdopen temp file %s.",
-				    list_file_name);
-			close(fd);
-			unlink(list_file_name);
-			free(list_file_name);
-			return pkg->installed_files;
-		}
-		err = pkg_extract_data_file_names_to_stream(pkg, list_file);
+		lines = pkg_extract_data_file_names(pkg, &len, &err);
 		if (err) {
 			opkg_msg(ERROR, "Error extracting file list from %s.\n",
 				 local_filename);
-			fclose(list_file);
-			unlink(list_file_name);
-			free(list_file_name);
-			str_list_deinit(pkg->installed_files);
+			path_list_purge(pkg->installed_files);
 			pkg->installed_files = NULL;
 			return NULL;
 		}
-		rewind(list_file);
+	} else if (pkg->state_flag & SF_FILELIST_CHANGED) {
+		/* the .list file is behind, it is only written when the
+		 * whole transaction is done */
+		list_for_each_entry(owner, &pkg->owned_files, list)
+			installed_files_append(pkg, owner->name);
+
+		return pkg->installed_files;
 	} else {
-		sprintf_alloc(&list_file_name, "%s/%s.list",
-			      pkg->dest->info_dir, pkg->name);
-		list_file = fopen(list_file_name, "r");
-		if (list_file == NULL) {
-			opkg_perror(ERROR, "Failed to open %s", list_file_name);
-			free(list_file_name);
-			return pkg->installed_files;
+		file_index_get_lines(pkg, &lines, &len);
+
+		for (end = lines + len; lines < end; lines += n + 1) {
+			n = strlen(lines);
+			installed_files_append(pkg, lines);
 		}
-		free(list_file_name);
+
+		return pkg->installed_files;
 	}
 
-	if (conf->offline_root)
-		rootdirlen = strlen(conf->offline_root);
+	for (end = lines + len; lines < end; lines += n + 1) {
+		const char *file_name = lines;
 
-	while (1) {
-		char *file_name;
+		n = strlen(lines);
 
-		line = file_read_line_alloc(list_file);
-		if (line == NULL) {
-			break;
+		if (*file_name == '.') {
+			file_name++;
 		}
-		file_name = line;
-
-		if (list_from_package) {
-			if (*file_name == '.') {
-				file_name++;
-			}
-			if (*file_name == '/') {
-				file_name++;
-			}
-			sprintf_alloc(&installed_file_name, "%s%s",
-				      pkg->dest->root_dir, file_name);
-		} else {
-			if (conf->offline_root &&
-			    strncmp(conf->offline_root, file_name,
-				    rootdirlen)) {
-				sprintf_alloc(&installed_file_name, "%s%s",
-					      conf->offline_root, file_name);
-			} else {
-				// already contains root_dir as header -> ABSOLUTE
-				sprintf_alloc(&installed_file_name, "%s",
-					      file_name);
-			}
+		if (*file_name == '/') {
+			file_name++;
 		}
-		str_list_append(pkg->installed_files, installed_file_name);
-		free(installed_file_name);
-		free(line);
-	}
-
-	fclose(list_file);
-
-	if (list_from_package) {
-		unlink(list_file_name);
-		free(list_file_name);
+		path_list_append(pkg->installed_files, pkg->dest->root_dir,
+				 file_name);
 	}
 
 	return pkg->installed_files;
@@ -1309,7 +1471,7 @@ void pkg_free_installed_files(pkg_t * pkg)
 		return;
 
 	if (pkg->installed_files) {
-		str_list_purge(pkg->installed_files);
+		path_list_purge(pkg->installed_files);
 	}
 
 	pkg->installed_files = NULL;
@@ -1322,8 +1484,10 @@ void pkg_remove_installed_files_list(pkg_t * pkg)
 	sprintf_alloc(&list_file_name, "%s/%s.list",
 		      pkg->dest->info_dir, pkg->name);
 
-	if (!conf->noaction)
+	if (!conf->noaction) {
 		(void)unlink(list_file_name);
+		file_index_remove(pkg);
+	}
 
 	free(list_file_name);
 }
@@ -1352,13 +1516,20 @@ conffile_t *pkg_get_conffile(pkg_t * pkg, const char *file_name)
 	return NULL;
 }
 
-int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
+/*
+ * Starts the maintainer script of pkg without waiting for it, setting *pid
+ * to 0 if there is nothing to run. The result of the script is then to be
+ * passed through pkg_finish_script().
+ */
+int pkg_start_script(pkg_t * pkg, const char *script, const char *args,
+		     pid_t * pid)
 {
-	int err;
 	char *path;
 	char *cmd;
 	char *tmp_unpack_dir;
 
+	*pid = 0;
+
 	if (conf->noaction)
 		return 0;
 
@@ -1413,10 +1584,21 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 	free(path);
 	{
 		const char *argv[] = { "/bin/sh", "-c", cmd, NULL };
-		err = xsystem(argv);
+		*pid = xsystem_start(argv);
 	}
 	free(cmd);
 
+	if (*pid == -1) {
+		*pid = 0;
+		return pkg_finish_script(pkg, script, -1);
+	}
+
+	return 0;
+}
+
+/* err is what xsystem_wait() returned for the script */
+int pkg_finish_script(pkg_t * pkg, const char *script, int err)
+{
 	if (err) {
 		opkg_msg(ERROR,
 			 "package \"%s\" %s script returned status %d.\n",
@@ -1427,6 +1609,18 @@ int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
 	return 0;
 }
 
+int pkg_run_script(pkg_t * pkg, const char *script, const char *args)
+{
+	pid_t pid;
+	int err;
+
+	err = pkg_start_script(pkg, script, args, &pid);
+	if (err || !pid)
+		return err;
+
+	return pkg_finish_script(pkg, script, xsystem_wait("/bin/sh", pid));
+}
+
 int pkg_arch_supported(pkg_t * pkg)
 {
 	nv_pair_list_elt_t *l;
@@ -1460,44 +1654,36 @@ void pkg_info_preinstall_check(void)
 	pkg_hash_fetch_all_installed(installed_pkgs);
 	for (i = 0; i < installed_pkgs->len; i++) {
 		pkg_t *pkg = installed_pkgs->pkgs[i];
-		str_list_t *installed_files = pkg_get_installed_files(pkg);	/* this causes installed_files to be cached */
-		str_list_elt_t *iter, *niter;
+		path_list_t *installed_files;
+		const char *installed_file;
+		size_t pos;
+
+		if (!file_index_set_file_owners(pkg))
+			continue;
+
+		installed_files = pkg_get_installed_files(pkg);	/* this causes installed_files to be cached */
 		if (installed_files == NULL) {
 			opkg_msg(ERROR, "Failed to determine installed "
 				 "files for pkg %s.\n", pkg->name);
 			break;
 		}
-		for (iter = str_list_first(installed_files), niter =
-		     str_list_next(installed_files, iter); iter;
-		     iter = niter, niter =
-		     str_list_next(installed_files, iter)) {
-			char *installed_file = (char *)iter->data;
+		for (installed_file = path_list_first(installed_files, &pos);
+		     installed_file;
+		     installed_file = path_list_next(installed_files, &pos))
 			file_hash_set_file_owner(installed_file, pkg);
-		}
 		pkg_free_installed_files(pkg);
 	}
 	pkg_vec_free(installed_pkgs);
-}
-
-struct pkg_write_filelist_data {
-	pkg_t *pkg;
-	FILE *stream;
-};
 
-static void
-pkg_write_filelist_helper(const char *key, void *entry_, void *data_)
-{
-	struct pkg_write_filelist_data *data = data_;
-	pkg_t *entry = entry_;
-	if (entry == data->pkg) {
-		fprintf(data->stream, "%s\n", key);
-	}
+	file_index_save();
 }
 
 int pkg_write_filelist(pkg_t * pkg)
 {
-	struct pkg_write_filelist_data data;
-	char *list_file_name;
+	struct file_owner *owner;
+	char *list_file_name, *text = NULL;
+	size_t len = 0, alloc = 0, n;
+	FILE *stream;
 
 	sprintf_alloc(&list_file_name, "%s/%s.list",
 		      pkg->dest->info_dir, pkg->name);
@@ -1505,18 +1691,31 @@ int pkg_write_filelist(pkg_t * pkg)
 	opkg_msg(INFO, "Creating %s file for pkg %s.\n",
 		 list_file_name, pkg->name);
 
-	data.stream = fopen(list_file_name, "w");
-	if (!data.stream) {
+	stream = fopen(list_file_name, "w");
+	if (!stream) {
 		opkg_perror(ERROR, "Failed to open %s", list_file_name);
 		free(list_file_name);
 		return -1;
 	}
 
-	data.pkg = pkg;
-	hash_table_foreach(&conf->file_hash, pkg_write_filelist_helper, &data);
-	fclose(data.stream);
+	list_for_each_entry(owner, &pkg->owned_files, list) {
+		n = strlen(owner->name);
+		if (len + n + 1 > alloc) {
+			alloc = 2 * (len + n + 1);
+			text = xrealloc(text, alloc);
+		}
+		memcpy(text + len, owner->name, n);
+		text[len + n] = '\n';
+		len += n + 1;
+	}
+
+	fwrite(text, 1, len, stream);
+	fclose(stream);
 	free(list_file_name);
 
+	file_index_update(pkg, text, len);
+	free(text);
+
 	pkg->state_flag &= ~SF_FILELIST_CHANGED;
 
 	return 0;
@@ -1544,5 +1743,8 @@ int pkg_write_changed_filelists(void)
 
 	pkg_vec_free(installed_pkgs);
 
+	if (file_index_save())
+		ret = -1;
+
 	return ret;
 }
@@ -23,11 +23,13 @@
 
 #include "pkg_vec.h"
 #include "str_list.h"
+#include "path_list.h"
 #include "active_list.h"
 #include "pkg_src.h"
 #include "pkg_dest.h"
 #include "opkg_conf.h"
 #include "conffile_list.h"
+#include "arena.h"
 
 struct opkg_conf;
 
@@ -88,6 +90,7 @@ enum pkg_fields {
 	PKG_LOCAL_FILENAME,
 	PKG_VERSION,
 	PKG_REVISION,
+	PKG_VERSION_KEY,
 	PKG_DESCRIPTION,
 	PKG_MD5SUM,
 	PKG_SHA256SUM,
@@ -102,20 +105,30 @@ enum pkg_fields {
 	PKG_CONFFILES,
 	PKG_ALTERNATIVES,
 	PKG_ABIVERSION,
+	PKG_IPK,
+	PKG_LOCAL_DIGEST,
+	__PKG_FIELD_MAX
 };
 
+/* low cardinality fields stored as a pointer to an atom of the str_pool */
+#define PKG_ATOM_FIELDS	((1 << PKG_MAINTAINER) | (1 << PKG_PRIORITY) | \
+			 (1 << PKG_SOURCE) | (1 << PKG_TAGS) | \
+			 (1 << PKG_SECTION))
+
+/* blob_index value of fields stored beyond the reach of the index */
+#define PKG_BLOB_UNINDEXED	0xffff
+
 struct abstract_pkg {
 	char *name;
 	pkg_vec_t *pkgs;
 
-	/* XXX: This should be abstract_pkg_vec_t for consistency. */
-	struct abstract_pkg **depended_upon_by;
-
 	abstract_pkg_vec_t *provided_by;
 	abstract_pkg_vec_t *replaced_by;
 
+	/* index in the package graph, see pkg_graph.h */
+	unsigned int graph_id;
+
 	char dependencies_checked;
-	char pre_dependencies_checked;
 	pkg_state_status_t state_status:4;
 	pkg_state_flag_t state_flag:11;
 };
@@ -171,12 +184,14 @@ struct pkg {
 	abstract_pkg_t *parent;
 
 	/* As pointer for lazy evaluation */
-	str_list_t *installed_files;
+	path_list_t *installed_files;
 	/* XXX: CLEANUP: I'd like to perhaps come up with a better
 	   mechanism to avoid the problem here, (which is that the
 	   installed_files list was being freed from an inner loop while
 	   still being used within an outer loop. */
 	int installed_files_ref_cnt;
+	/* struct file_owner entries of conf->file_hash owned by it */
+	struct list_head owned_files;
 
 	unsigned int essential:1;
 /* Adding this flag, to "force" opkg to choose a "provided_by_hand" package, if there are multiple choice */
@@ -187,17 +202,46 @@ struct pkg {
 	unsigned int auto_installed:1;
 	unsigned int is_upgrade:1;
 
+	/* memoized pkg_hash_check_unresolved() result, valid for resolve_gen */
+	unsigned int resolve_state:2;
+	unsigned int resolve_gen;
+
+	/* index in the package graph, see pkg_graph.h */
+	unsigned int graph_id;
+
 	unsigned int arch_index:3;
 
 	struct blob_buf blob;
+
+	/* offset of each field in blob in 4 byte units, 0 if unset */
+	uint16_t blob_index[__PKG_FIELD_MAX];
 };
 
+extern struct arena pkg_arena;
+extern struct arena abstract_pkg_arena;
+extern struct arena pkg_name_arena;
+
 pkg_t *pkg_new(void);
+void pkg_free(pkg_t *pkg);
 void pkg_deinit(pkg_t * pkg);
 int pkg_init_from_file(pkg_t * pkg, const char *filename);
 
 void *pkg_set_raw(pkg_t *pkg, int id, const void *val, size_t len);
-void *pkg_get_raw(const pkg_t *pkg, int id);
+void *pkg_find_raw(const pkg_t *pkg, int id);
+void pkg_shrink_blob(pkg_t *pkg);
+
+static inline void *pkg_get_raw(const pkg_t *pkg, int id)
+{
+	unsigned int off = pkg->blob_index[id];
+
+	if (off == 0)
+		return NULL;
+
+	if (off == PKG_BLOB_UNINDEXED)
+		return pkg_find_raw(pkg, id);
+
+	return (char *)pkg->blob.head + off * BLOB_ATTR_ALIGN;
+}
 
 static inline int pkg_set_int(pkg_t *pkg, int id, int val)
 {
@@ -213,11 +257,6 @@ static inline int pkg_get_int(const pkg_t *pkg, int id)
 
 char *pkg_set_string(pkg_t *pkg, int id, const char *s);
 
-static inline char *pkg_get_string(const pkg_t *pkg, int id)
-{
-	return (char *) pkg_get_raw(pkg, id);
-}
-
 static inline void * pkg_set_ptr(pkg_t *pkg, int id, void *ptr)
 {
 	void **res = pkg_set_raw(pkg, id, &ptr, sizeof(ptr));
@@ -230,6 +269,14 @@ static inline void * pkg_get_ptr(const pkg_t *pkg, int id)
 	return ptr ? *ptr : NULL;
 }
 
+static inline char *pkg_get_string(const pkg_t *pkg, int id)
+{
+	if ((1 << id) & PKG_ATOM_FIELDS)
+		return (char *) pkg_get_ptr(pkg, id);
+
+	return (char *) pkg_get_raw(pkg, id);
+}
+
 char *pkg_set_architecture(pkg_t *pkg, const char *architecture, ssize_t len);
 char *pkg_get_architecture(const pkg_t *pkg);
 int pkg_get_arch_priority(const pkg_t *pkg);
@@ -250,6 +297,36 @@ int pkg_merge(pkg_t * oldpkg, pkg_t * newpkg);
 
 char *pkg_version_str_alloc(pkg_t * pkg);
 
+/*
+ * Version keys compare like the versions they encode when using strcmp(),
+ * see pkg.c. A key takes at most VERSION_KEY_SIZE(strlen(version) +
+ * strlen(revision)) bytes: a pair of a wide non-digit and a one digit run
+ * like ".1" takes 5, the epoch and the end markers less than 32.
+ */
+#define VERSION_KEY_SIZE(len)	(3 * (len) + 32)
+
+void version_key_write(char *key, unsigned int epoch, const char *version,
+		       const char *revision);
+void version_str_key_write(char *key, const char *vstr);
+char *version_str_key_dup(const char *version, const char *key,
+			  char **key_copy);
+
+/* key of a package without a version, i.e. 0:- */
+#define PKG_VERSION_KEY_EMPTY	"\x01\x02\x01\x02\x02\x01\x02"
+
+/*
+ * Has to be called whenever epoch, version or revision change, key is
+ * computed from them unless given.
+ */
+char *pkg_set_version_key(pkg_t *pkg, const char *key);
+
+static inline const char *pkg_get_version_key(const pkg_t *pkg)
+{
+	const char *key = pkg_get_string(pkg, PKG_VERSION_KEY);
+
+	return key ? key : PKG_VERSION_KEY_EMPTY;
+}
+
 int pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg);
 int pkg_name_version_and_architecture_compare(const void *a, const void *b);
 int abstract_pkg_name_compare(const void *a, const void *b);
@@ -258,11 +335,14 @@ void pkg_formatted_info(FILE * fp, pkg_t * pkg);
 void pkg_formatted_field(FILE * fp, pkg_t * pkg, const char *field);
 
 void pkg_print_status(pkg_t * pkg, FILE * file);
-str_list_t *pkg_get_installed_files(pkg_t * pkg);
+path_list_t *pkg_get_installed_files(pkg_t * pkg);
 void pkg_free_installed_files(pkg_t * pkg);
 void pkg_remove_installed_files_list(pkg_t * pkg);
 conffile_t *pkg_get_conffile(pkg_t * pkg, const char *file_name);
 int pkg_run_script(pkg_t * pkg, const char *script, const char *args);
+int pkg_start_script(pkg_t * pkg, const char *script, const char *args,
+		     pid_t * pid);
+int pkg_finish_script(pkg_t * pkg, const char *script, int err);
 
 /* enum mappings */
 pkg_state_want_t pkg_state_want_from_str(char *str);
@@ -42,8 +42,9 @@ static const struct alternative_provider providers[] = {
 static const char *pkg_alternatives_check_providers(const char *path)
 {
 	pkg_t *pkg;
-	str_list_t *files;
-	str_list_elt_t *iter;
+	path_list_t *files;
+	const char *file;
+	size_t pos;
 	int i;
 
 	for (i = 0; i < ARRAY_SIZE(providers); i++) {
@@ -52,8 +53,8 @@ static const char *pkg_alternatives_check_providers(const char *path)
 			continue;
 		}
 		files = pkg_get_installed_files(pkg);
-		for (iter = str_list_first(files); iter; iter = str_list_next(files, iter)) {
-			if (!strcmp(path, (char *)(iter->data))) {
+		for (file = path_list_first(files, &pos); file; file = path_list_next(files, &pos)) {
+			if (!strcmp(path, file)) {
 				pkg_free_installed_files(pkg);
 				return providers[i].altpath;
 			}
@@ -20,6 +20,7 @@
 
 #include "pkg.h"
 #include "opkg_utils.h"
+#include "pkg_graph.h"
 #include "pkg_hash.h"
 #include "opkg_message.h"
 #include "pkg_parse.h"
@@ -28,6 +29,8 @@
 
 static int parseDepends(compound_depend_t * compound_depend, char *depend_str, enum depend_type type);
 static depend_t *depend_init(void);
+
+struct arena depend_arena = ARENA_INIT("depend", sizeof(depend_t));
 static char **add_unresolved_dep(pkg_t * pkg, char **the_lost, int ref_ndx);
 static char **merge_unresolved(char **oldstuff, char **newstuff);
 static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg);
@@ -55,7 +58,7 @@ static int pkg_constraint_satisfied(pkg_t * pkg, void *cdata)
 /* returns ndependencies or negative error value */
 int
 pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
-					char ***unresolved, int pre_check)
+					char ***unresolved)
 {
 	pkg_t *satisfier_entry_pkg;
 	int i, j, k;
@@ -63,7 +66,6 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 	char **the_lost;
 	abstract_pkg_t *ab_pkg;
 	compound_depend_t *compound_depend;
-	char *check;
 
 	/*
 	 * this is a setup to check for redundant/cyclic dependency checks,
@@ -75,18 +77,12 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 		return 0;
 	}
 
-	if(pre_check) {
-		check = &ab_pkg->pre_dependencies_checked;
-	} else {
-		check = &ab_pkg->dependencies_checked;
-	}
-
-	if (*check) {	/* avoid duplicate or cyclic checks */
+	if (ab_pkg->dependencies_checked) {	/* avoid duplicate or cyclic checks */
 		*unresolved = NULL;
 		return 0;
 	} else {
 		/* mark it for subsequent visits */
-		*check = 1;
+		ab_pkg->dependencies_checked = 1;
 	}
 
 	compound_depend = pkg_get_ptr(pkg, PKG_DEPENDS);
@@ -126,14 +122,14 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 						pkg_t *pkg_scout = test_vec->pkgs[k];
 						/* not installed, and not already known about? */
 						if ((pkg_scout->state_want != SW_INSTALL)
-						    && !(pre_check ? pkg_scout->parent->pre_dependencies_checked : pkg_scout->parent->dependencies_checked)
+						    && !pkg_scout->parent->dependencies_checked
 						    && !is_pkg_in_pkg_vec(unsatisfied, pkg_scout)) {
 							char **newstuff = NULL;
 							int rc;
 							pkg_vec_t *tmp_vec = pkg_vec_alloc();
 							/* check for not-already-installed dependencies */
 							rc = pkg_hash_fetch_unsatisfied_dependencies(
-								pkg_scout, tmp_vec, &newstuff, pre_check);
+								pkg_scout, tmp_vec, &newstuff);
 							if (newstuff == NULL) {
 								int m;
 								int ok = 1;
@@ -260,7 +256,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * unsatisfied,
 					    !is_pkg_in_pkg_vec(unsatisfied, satisfier_entry_pkg))
 					{
 						pkg_hash_fetch_unsatisfied_dependencies(
-							satisfier_entry_pkg, unsatisfied, &newstuff, pre_check);
+							satisfier_entry_pkg, unsatisfied, &newstuff);
 						pkg_vec_insert(unsatisfied, satisfier_entry_pkg);
 						the_lost = merge_unresolved(the_lost, newstuff);
 						if (newstuff)
@@ -375,20 +371,13 @@ pkg_vec_t *pkg_hash_fetch_conflicts(pkg_t * pkg)
 
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg)
 {
-	pkg_t *temp;
 	int comparison;
 
 	if (depends->constraint == NONE)
 		return 1;
 
-	temp = pkg_new();
-
-	parse_version(temp, depends->version);
-
-	comparison = pkg_compare_versions(pkg, temp);
-
-	pkg_deinit(temp);
-	free(temp);
+	comparison = strcmp(pkg_get_version_key(pkg), depends->version_key ?
+			    depends->version_key : PKG_VERSION_KEY_EMPTY);
 
 	if ((depends->constraint == EARLIER) && (comparison < 0))
 		return 1;
@@ -431,6 +420,32 @@ int pkg_dependence_satisfiable(depend_t * depend)
 	return 0;
 }
 
+/*
+ * Whether pkg_hash_fetch_best_installation_candidate() can come up with a
+ * package satisfying depend, i.e. whether any of the packages it considers
+ * satisfies it, has a usable architecture and can be resolved itself.
+ */
+int pkg_dependence_resolvable(depend_t * depend)
+{
+	const struct pkg_graph *g = pkg_graph_get();
+	unsigned int i, id = depend->pkg->graph_id;
+	pkg_t *pkg;
+
+	if (id >= g->n_apkgs || g->apkgs[id] != depend->pkg)
+		return 0;
+
+	for (i = g->cand_idx[id]; i < g->cand_idx[id + 1]; i++) {
+		pkg = g->pkgs[g->cands[i]];
+
+		if (pkg_get_arch_priority(pkg) > 0
+		    && version_constraints_satisfied(depend, pkg)
+		    && !pkg_hash_check_unresolved(pkg))
+			return 1;
+	}
+
+	return 0;
+}
+
 static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg)
 {
 	int i;
@@ -621,11 +636,40 @@ abstract_pkg_t **init_providelist(pkg_t *pkg, int *count)
 	return provides;
 }
 
+static abstract_pkg_t **providelist_append(abstract_pkg_t *ab_pkg,
+					   abstract_pkg_t **provides,
+					   int count, const char *name)
+{
+	abstract_pkg_t *provided_abpkg, **tmp;
+
+	tmp = realloc(provides, sizeof(abstract_pkg_t *) * (count + 1));
+
+	if (!tmp)
+		return NULL;
+
+	provided_abpkg = ensure_abstract_pkg_by_name(name);
+
+	if (provided_abpkg->state_flag & SF_NEED_DETAIL) {
+		if (!(ab_pkg->state_flag & SF_NEED_DETAIL)) {
+			opkg_msg(DEBUG, "propagating provided abpkg flag to "
+			                "provider abpkg %s\n", ab_pkg->name);
+			ab_pkg->state_flag |= SF_NEED_DETAIL;
+		}
+	}
+
+	if (!abstract_pkg_vec_contains(provided_abpkg->provided_by, ab_pkg))
+		abstract_pkg_vec_insert(provided_abpkg->provided_by, ab_pkg);
+
+	tmp[count - 1] = provided_abpkg;
+
+	return tmp;
+}
+
 void parse_providelist(pkg_t *pkg, char *list)
 {
 	int count = 0;
 	char *item, *tok;
-	abstract_pkg_t *ab_pkg, *provided_abpkg, **tmp, **provides;
+	abstract_pkg_t *ab_pkg, **tmp, **provides;
 
 	provides = init_providelist(pkg, &count);
 	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
@@ -635,26 +679,41 @@ void parse_providelist(pkg_t *pkg, char *list)
 
 	for (item = strtok_r(list, ", ", &tok); item;
 	     count++, item = strtok_r(NULL, ", ", &tok)) {
-		tmp = realloc(provides, sizeof(abstract_pkg_t *) * (count + 1));
+		tmp = providelist_append(ab_pkg, provides, count, item);
 
 		if (!tmp)
 			break;
 
-		provided_abpkg = ensure_abstract_pkg_by_name(item);
+		provides = tmp;
+	}
 
-		if (provided_abpkg->state_flag & SF_NEED_DETAIL) {
-			if (!(ab_pkg->state_flag & SF_NEED_DETAIL)) {
-				opkg_msg(DEBUG, "propagating provided abpkg flag to "
-				                "provider abpkg %s\n", ab_pkg->name);
-				ab_pkg->state_flag |= SF_NEED_DETAIL;
-			}
-		}
+	provides[count - 1] = NULL;
+
+	pkg_set_ptr(pkg, PKG_PROVIDES, provides);
+}
+
+/*
+ * Like parse_providelist() but takes the provided names already split,
+ * as stored in a binary feed index.
+ */
+void pkg_add_provides(pkg_t *pkg, const char **names, int n)
+{
+	int i, count = 0;
+	abstract_pkg_t *ab_pkg, **tmp, **provides;
+
+	provides = init_providelist(pkg, &count);
+	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
+
+	if (!provides || !ab_pkg)
+		return;
+
+	for (i = 0; i < n; i++, count++) {
+		tmp = providelist_append(ab_pkg, provides, count, names[i]);
 
-		if (!abstract_pkg_vec_contains(provided_abpkg->provided_by, ab_pkg))
-			abstract_pkg_vec_insert(provided_abpkg->provided_by, ab_pkg);
+		if (!tmp)
+			break;
 
 		provides = tmp;
-		provides[count - 1] = provided_abpkg;
 	}
 
 	provides[count - 1] = NULL;
@@ -662,49 +721,98 @@ void parse_providelist(pkg_t *pkg, char *list)
 	pkg_set_ptr(pkg, PKG_PROVIDES, provides);
 }
 
-void parse_replacelist(pkg_t *pkg, char *list)
+static abstract_pkg_t **replacelist_append(pkg_t *pkg, abstract_pkg_t *ab_pkg,
+					   abstract_pkg_t **replaces,
+					   int count, const char *name)
 {
-	int count;
-	char *item, *tok;
-	abstract_pkg_t *ab_pkg, *old_abpkg, **tmp, **replaces = NULL;
+	abstract_pkg_t *old_abpkg, **tmp;
 
-	ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
+	tmp = realloc(replaces, sizeof(abstract_pkg_t *) * (count + 1));
+
+	if (!tmp)
+		return NULL;
+
+	old_abpkg = ensure_abstract_pkg_by_name(name);
+
+	if (pkg->state_flag & SF_NEED_DETAIL) {
+		if (!(old_abpkg->state_flag & SF_NEED_DETAIL)) {
+			opkg_msg(DEBUG, "propagating pkg flag to replaced abpkg %s\n",
+			         old_abpkg->name);
+			old_abpkg->state_flag |= SF_NEED_DETAIL;
+		}
+	}
+
+	if (!old_abpkg->replaced_by)
+		old_abpkg->replaced_by = abstract_pkg_vec_alloc();
+
+	/* if a package pkg both replaces and conflicts old_abpkg,
+	 * then add it to the replaced_by vector so that old_abpkg
+	 * will be upgraded to ab_pkg automatically */
+	if (pkg_conflicts_abstract(pkg, old_abpkg)) {
+		if (!abstract_pkg_vec_contains(old_abpkg->replaced_by, ab_pkg))
+			abstract_pkg_vec_insert(old_abpkg->replaced_by, ab_pkg);
+	}
+
+	tmp[count - 1] = old_abpkg;
+
+	return tmp;
+}
+
+static abstract_pkg_t *init_replacelist(pkg_t *pkg)
+{
+	abstract_pkg_t *ab_pkg = ensure_abstract_pkg_by_name(pkg->name);
 
 	if (!ab_pkg->pkgs)
 		ab_pkg->pkgs = pkg_vec_alloc();
 
 	abstract_pkg_vec_insert(ab_pkg->provided_by, ab_pkg);
 
+	return ab_pkg;
+}
+
+void parse_replacelist(pkg_t *pkg, char *list)
+{
+	int count;
+	char *item, *tok;
+	abstract_pkg_t *ab_pkg, **tmp, **replaces = NULL;
+
+	ab_pkg = init_replacelist(pkg);
+
 	for (count = 1, item = strtok_r(list, ", ", &tok); item;
 	     count++, item = strtok_r(NULL, ", ", &tok)) {
-		tmp = realloc(replaces, sizeof(abstract_pkg_t *) * (count + 1));
+		tmp = replacelist_append(pkg, ab_pkg, replaces, count, item);
 
 		if (!tmp)
 			break;
 
-		old_abpkg = ensure_abstract_pkg_by_name(item);
+		replaces = tmp;
+	}
 
-		if (pkg->state_flag & SF_NEED_DETAIL) {
-			if (!(old_abpkg->state_flag & SF_NEED_DETAIL)) {
-				opkg_msg(DEBUG, "propagating pkg flag to replaced abpkg %s\n",
-				         old_abpkg->name);
-				old_abpkg->state_flag |= SF_NEED_DETAIL;
-			}
-		}
+	if (!replaces)
+		return;
 
-		if (!old_abpkg->replaced_by)
-			old_abpkg->replaced_by = abstract_pkg_vec_alloc();
+	replaces[count - 1] = NULL;
 
-		/* if a package pkg both replaces and conflicts old_abpkg,
-		 * then add it to the replaced_by vector so that old_abpkg
-		 * will be upgraded to ab_pkg automatically */
-		if (pkg_conflicts_abstract(pkg, old_abpkg)) {
-			if (!abstract_pkg_vec_contains(old_abpkg->replaced_by, ab_pkg))
-				abstract_pkg_vec_insert(old_abpkg->replaced_by, ab_pkg);
-		}
+	pkg_set_ptr(pkg, PKG_REPLACES, replaces);
+}
+
+/*
+ * Like parse_replacelist() but takes the replaced names already split.
+ */
+void pkg_add_replaces(pkg_t *pkg, const char **names, int n)
+{
+	int i, count;
+	abstract_pkg_t *ab_pkg, **tmp, **replaces = NULL;
+
+	ab_pkg = init_replacelist(pkg);
+
+	for (i = 0, count = 1; i < n; i++, count++) {
+		tmp = replacelist_append(pkg, ab_pkg, replaces, count, names[i]);
+
+		if (!tmp)
+			break;
 
 		replaces = tmp;
-		replaces[count - 1] = old_abpkg;
 	}
 
 	if (!replaces)
@@ -792,12 +900,8 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
 #endif
 }
 
-void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
+static int depend_type_field(enum depend_type type)
 {
-	int id, count;
-	char *item, *tok;
-	compound_depend_t *tmp, *deps;
-
 	switch (type)
 	{
 	case DEPEND:
@@ -805,16 +909,26 @@ void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
 	case RECOMMEND:
 	case SUGGEST:
 	case GREEDY_DEPEND:
-		id = PKG_DEPENDS;
-		break;
+		return PKG_DEPENDS;
 
 	case CONFLICTS:
-		id = PKG_CONFLICTS;
-		break;
+		return PKG_CONFLICTS;
 
 	default:
-		return;
+		return -1;
 	}
+}
+
+void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
+{
+	int id, count;
+	char *item, *tok;
+	compound_depend_t *tmp, *deps;
+
+	id = depend_type_field(type);
+
+	if (id < 0)
+		return;
 
 	deps = pkg_get_ptr(pkg, id);
 
@@ -840,6 +954,41 @@ void parse_deplist(pkg_t *pkg, enum depend_type type, char *list)
 	pkg_set_ptr(pkg, id, deps);
 }
 
+/*
+ * Appends an empty compound dependency of the given type with n
+ * possibilities to pkg. The caller fills in the possibilities; this
+ * is used to rebuild dependencies that were split ahead of time.
+ */
+compound_depend_t *pkg_add_compound_depend(pkg_t *pkg, enum depend_type type, int n)
+{
+	int i, id, count;
+	compound_depend_t *tmp, *deps;
+
+	id = depend_type_field(type);
+
+	if (id < 0)
+		return NULL;
+
+	deps = pkg_get_ptr(pkg, id);
+
+	for (tmp = deps, count = 1; tmp && tmp->type; tmp++)
+		count++;
+
+	deps = xrealloc(deps, sizeof(compound_depend_t) * (count + 1));
+	memset(deps + count, 0, sizeof(compound_depend_t));
+	pkg_set_ptr(pkg, id, deps);
+
+	tmp = deps + count - 1;
+	tmp->type = type;
+	tmp->possibility_count = n;
+	tmp->possibilities = xcalloc(n, sizeof(depend_t *));
+
+	for (i = 0; i < n; i++)
+		tmp->possibilities[i] = depend_init();
+
+	return tmp;
+}
+
 void buildDepends(pkg_t * pkg)
 {
 #if 0
@@ -975,66 +1124,101 @@ char *pkg_depend_str(pkg_t * pkg, int idx)
 	return str;
 }
 
-void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
+static depend_t *depend_init(void)
 {
-	compound_depend_t *depends;
-	int othercount;
-	int j;
-	abstract_pkg_t *ab_depend;
-	abstract_pkg_t **temp;
-
-	for (depends = pkg_get_ptr(pkg, PKG_DEPENDS); depends && depends->type; depends++) {
-		if (depends->type != PREDEPEND
-		    && depends->type != DEPEND && depends->type != RECOMMEND)
-			continue;
-		for (j = 0; j < depends->possibility_count; j++) {
-			ab_depend = depends->possibilities[j]->pkg;
-			if (!ab_depend->depended_upon_by) {
-				ab_depend->depended_upon_by =
-				    xcalloc(1, sizeof(abstract_pkg_t *));
-			}
+	depend_t *d = arena_alloc(&depend_arena);
+	d->constraint = NONE;
+	d->version = NULL;
+	d->version_key = NULL;
+	d->pkg = NULL;
 
-			temp = ab_depend->depended_upon_by;
-			othercount = 1;
-			while (*temp) {
-				temp++;
-				othercount++;
-			}
-			*temp = ab_pkg;
+	return d;
+}
 
-			ab_depend->depended_upon_by =
-			    xrealloc(ab_depend->depended_upon_by,
-				     (othercount +
-				      1) * sizeof(abstract_pkg_t *));
+void depend_set_version(depend_t *d, const char *version, const char *key)
+{
+	d->version = version_str_key_dup(version, key, &d->version_key);
+}
 
-			/* the array may have been moved by realloc */
-			temp = ab_depend->depended_upon_by + othercount;
-			*temp = NULL;
+/*
+ * Splits a single alternative of a dependency, e.g. "foo (>= 1.0) *", in
+ * place. Returns the package name, stores the version constraint and the
+ * trimmed version string (NULL if there is none) and sets *greedy if the
+ * alternative carries the greedy "*" marker.
+ */
+char *parse_depend_possibility(char *depend, version_constraint_t *constraint,
+			       char **version, int *greedy)
+{
+	char *name, *vstr, *rest, *end;
+
+	*constraint = NONE;
+	*version = NULL;
+
+	name = strtok(depend, " ");
+	rest = strtok(NULL, "\n");
+
+	if (rest && *rest == '(') {
+		vstr = strtok(rest + 1, ")");
+
+		if (!strncmp(vstr, "<<", 2)) {
+			*constraint = EARLIER;
+			vstr += 2;
+		} else if (!strncmp(vstr, "<=", 2)) {
+			*constraint = EARLIER_EQUAL;
+			vstr += 2;
+		} else if (!strncmp(vstr, ">=", 2)) {
+			*constraint = LATER_EQUAL;
+			vstr += 2;
+		} else if (!strncmp(vstr, ">>", 2)) {
+			*constraint = LATER;
+			vstr += 2;
+		} else if (!strncmp(vstr, "=", 1)) {
+			*constraint = EQUAL;
+			vstr++;
 		}
+		/* should these be here to support deprecated designations; dpkg does */
+		else if (!strncmp(vstr, "<", 1)) {
+			*constraint = EARLIER_EQUAL;
+			vstr++;
+		} else if (!strncmp(vstr, ">", 1)) {
+			*constraint = LATER_EQUAL;
+			vstr++;
+		}
+
+		while (isspace(*vstr))
+			vstr++;
+
+		end = vstr + strlen(vstr);
+
+		while (end > vstr && isspace(end[-1]))
+			end--;
+
+		*end = '\0';
+		*version = vstr;
+
+		rest = strtok(NULL, " ");
+	}
+	else {
+		rest = strtok(rest, " ");
 	}
-}
 
-static depend_t *depend_init(void)
-{
-	depend_t *d = xcalloc(1, sizeof(depend_t));
-	d->constraint = NONE;
-	d->version = NULL;
-	d->pkg = NULL;
+	if (rest && *rest == '*')
+		*greedy = 1;
 
-	return d;
+	return name;
 }
 
 static int parseDepends(compound_depend_t * compound_depend, char *depend_str, enum depend_type type)
 {
-	int i;
-	char *depend, *name, *vstr, *rest, *tok = NULL;
+	int i, greedy = 0;
+	char *depend, *name, *vstr, *tok = NULL;
+	version_constraint_t constraint;
 	depend_t **possibilities = NULL, **tmp;
 
 	compound_depend->type = type;
 
 	for (i = 0, depend = strtok_r(depend_str, "|", &tok); depend; i++, depend = strtok_r(NULL, "|", &tok)) {
-		name = strtok(depend, " ");
-		rest = strtok(NULL, "\n");
+		name = parse_depend_possibility(depend, &constraint, &vstr, &greedy);
 
 		tmp = realloc(possibilities, sizeof(tmp) * (i + 1));
 
@@ -1044,46 +1228,15 @@ static int parseDepends(compound_depend_t * compound_depend, char *depend_str, e
 		possibilities = tmp;
 		possibilities[i] = depend_init();
 		possibilities[i]->pkg = ensure_abstract_pkg_by_name(name);
+		possibilities[i]->constraint = constraint;
 
-		if (rest && *rest == '(') {
-			vstr = strtok(rest + 1, ")");
-
-			if (!strncmp(vstr, "<<", 2)) {
-				possibilities[i]->constraint = EARLIER;
-				vstr += 2;
-			} else if (!strncmp(vstr, "<=", 2)) {
-				possibilities[i]->constraint = EARLIER_EQUAL;
-				vstr += 2;
-			} else if (!strncmp(vstr, ">=", 2)) {
-				possibilities[i]->constraint = LATER_EQUAL;
-				vstr += 2;
-			} else if (!strncmp(vstr, ">>", 2)) {
-				possibilities[i]->constraint = LATER;
-				vstr += 2;
-			} else if (!strncmp(vstr, "=", 1)) {
-				possibilities[i]->constraint = EQUAL;
-				vstr++;
-			}
-			/* should these be here to support deprecated designations; dpkg does */
-			else if (!strncmp(vstr, "<", 1)) {
-				possibilities[i]->constraint = EARLIER_EQUAL;
-				vstr++;
-			} else if (!strncmp(vstr, ">", 1)) {
-				possibilities[i]->constraint = LATER_EQUAL;
-				vstr++;
-			}
-
-			possibilities[i]->version = trim_xstrdup(vstr);
-			rest = strtok(NULL, " ");
-		}
-		else {
-			rest = strtok(rest, " ");
-		}
-
-		if (rest && *rest == '*')
-			compound_depend->type = GREEDY_DEPEND;
+		if (vstr)
+			depend_set_version(possibilities[i], vstr, NULL);
 	}
 
+	if (greedy)
+		compound_depend->type = GREEDY_DEPEND;
+
 	compound_depend->possibility_count = i;
 	compound_depend->possibilities = possibilities;
 
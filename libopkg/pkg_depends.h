@@ -45,10 +45,13 @@ typedef enum version_constraint version_constraint_t;
 struct depend {
 	version_constraint_t constraint;
 	char *version;
+	char *version_key;	/* allocated along with version */
 	abstract_pkg_t *pkg;
 };
 typedef struct depend depend_t;
 
+extern struct arena depend_arena;
+
 struct compound_depend {
 	depend_type_t type;
 	int possibility_count;
@@ -62,10 +65,16 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg);
 void buildDepends(pkg_t * pkg);
 
 void parse_deplist(pkg_t *pkg, enum depend_type type, char *list);
+void depend_set_version(depend_t *d, const char *version, const char *key);
+char *parse_depend_possibility(char *depend, version_constraint_t *constraint,
+			       char **version, int *greedy);
+compound_depend_t *pkg_add_compound_depend(pkg_t *pkg, enum depend_type type, int n);
 
 abstract_pkg_t **init_providelist(pkg_t *pkg, int *count);
 void parse_providelist(pkg_t *pkg, char *list);
 void parse_replacelist(pkg_t *pkg, char *list);
+void pkg_add_provides(pkg_t *pkg, const char **names, int n);
+void pkg_add_replaces(pkg_t *pkg, const char **names, int n);
 
 /**
  * pkg_replaces returns 1 if pkg->replaces contains one of replacee's provides and 0
@@ -86,12 +95,12 @@ int pkg_conflicts_abstract(pkg_t * pkg, abstract_pkg_t * conflicts);
 int pkg_conflicts(pkg_t * pkg, pkg_t * conflicts);
 
 char *pkg_depend_str(pkg_t * pkg, int index);
-void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg);
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg);
 int pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t * depends,
-					    char ***unresolved, int pre_check);
+					    char ***unresolved);
 pkg_vec_t *pkg_hash_fetch_conflicts(pkg_t * pkg);
 int pkg_dependence_satisfiable(depend_t * depend);
+int pkg_dependence_resolvable(depend_t * depend);
 const char *constraint_to_str(enum version_constraint c);
 
 compound_depend_t *pkg_get_depends(pkg_t *pkg, enum depend_type type);
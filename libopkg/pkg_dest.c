@@ -23,6 +23,8 @@
 #include "opkg_conf.h"
 #include "opkg_cmd.h"
 #include "opkg_defines.h"
+#include "status_journal.h"
+#include "file_index.h"
 #include "libbb/libbb.h"
 
 int pkg_dest_init(pkg_dest_t * dest, const char *name, const char *root_dir,
@@ -76,6 +78,9 @@ void pkg_dest_deinit(pkg_dest_t * dest)
 	free(dest->info_dir);
 	dest->info_dir = NULL;
 
+	status_journal_free(dest);
+	file_index_free(dest);
+
 	free(dest->status_file_name);
 	dest->status_file_name = NULL;
 
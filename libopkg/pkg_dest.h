@@ -29,6 +29,10 @@ struct pkg_dest {
 	char *info_dir;
 	char *status_file_name;
 	FILE *status_fp;
+	/* status stanzas as last written, see status_journal.c */
+	struct hash_table *status_stanzas;
+	/* installed file lists, see file_index.c */
+	struct file_index *file_index;
 };
 
 int pkg_dest_init(pkg_dest_t * dest, const char *name, const char *root_dir,
@@ -16,16 +16,67 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "pkg_extract.h"
 #include "libbb/libbb.h"
 #include "file_util.h"
 #include "sprintf_alloc.h"
 
+/*
+ * The package file is opened once and its handle kept with pkg, so
+ * extracting the control and the data files again does not walk the
+ * outer archive again.
+ */
+static struct ipk *pkg_ipk(pkg_t * pkg)
+{
+	const char *filename = pkg_get_string(pkg, PKG_LOCAL_FILENAME);
+	struct ipk *ipk = pkg_get_ptr(pkg, PKG_IPK);
+
+	if (ipk && filename && !strcmp(ipk->filename, filename))
+		return ipk;
+
+	pkg_extract_close(pkg);
+
+	if (!filename)
+		return NULL;
+
+	ipk = ipk_open(filename);
+	if (ipk)
+		pkg_set_ptr(pkg, PKG_IPK, ipk);
+
+	return ipk;
+}
+
+static char *pkg_extract(pkg_t * pkg, FILE * out_stream,
+			 const int extract_function, const char *prefix,
+			 const char *filename, int *err)
+{
+	struct ipk *ipk = pkg_ipk(pkg);
+
+	if (!ipk) {
+		*err = -1;
+		return NULL;
+	}
+
+	return ipk_extract(ipk, out_stream, extract_function, prefix,
+			   filename, err);
+}
+
+void pkg_extract_close(pkg_t * pkg)
+{
+	struct ipk *ipk = pkg_get_ptr(pkg, PKG_IPK);
+
+	if (ipk) {
+		ipk_close(ipk);
+		pkg_set_ptr(pkg, PKG_IPK, NULL);
+	}
+}
+
 int pkg_extract_control_file_to_stream(pkg_t * pkg, FILE * stream)
 {
 	int err;
-	deb_extract(pkg_get_string(pkg, PKG_LOCAL_FILENAME), stream,
+	pkg_extract(pkg, stream,
 		    extract_control_tar_gz
 		    | extract_to_stream, NULL, "control", &err);
 	return err;
@@ -40,7 +91,7 @@ pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg, const char *dir,
 
 	sprintf_alloc(&dir_with_prefix, "%s/%s", dir, prefix);
 
-	deb_extract(pkg_get_string(pkg, PKG_LOCAL_FILENAME), stderr,
+	pkg_extract(pkg, stderr,
 		    extract_control_tar_gz
 		    | extract_all_to_fs | extract_preserve_date
 		    | extract_unconditional, dir_with_prefix, NULL, &err);
@@ -58,7 +109,7 @@ int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir)
 {
 	int err;
 
-	deb_extract(pkg_get_string(pkg, PKG_LOCAL_FILENAME), stderr,
+	pkg_extract(pkg, stderr,
 		    extract_data_tar_gz
 		    | extract_all_to_fs | extract_preserve_date
 		    | extract_unconditional, dir, NULL, &err);
@@ -66,26 +117,21 @@ int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir)
 	return err;
 }
 
-int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * stream)
+/*
+ * Returns the names of the data files, as a run of len bytes of NUL
+ * terminated strings, valid until pkg_extract_close().
+ */
+const char *pkg_extract_data_file_names(pkg_t * pkg, size_t * len, int *err)
 {
-	int err;
-
-	/* XXX: DPKG_INCOMPATIBILITY: deb_extract will extract all of the
-	   data file names with a '.' as the first character. I've taught
-	   opkg how to cope with the presence or absence of the '.', but
-	   this may trip up dpkg.
+	struct ipk *ipk = pkg_ipk(pkg);
 
-	   For all I know, this could actually be a bug in opkg-build. So,
-	   I'll have to try installing some .debs and comparing the *.list
-	   files.
+	/* XXX: DPKG_INCOMPATIBILITY: the data file names start with a
+	   '.', which opkg copes with, but this may trip up dpkg. */
 
-	   If we wanted to, we could workaround the deb_extract behavior
-	   right here, by writing to a tmpfile, then munging things as we
-	   wrote to the actual stream. */
+	if (!ipk) {
+		*err = -1;
+		return NULL;
+	}
 
-	deb_extract(pkg_get_string(pkg, PKG_LOCAL_FILENAME), stream,
-		    extract_quiet | extract_data_tar_gz | extract_list,
-		    NULL, NULL, &err);
-
-	return err;
+	return ipk_data_names(ipk, len, err);
 }
@@ -26,6 +26,7 @@ int pkg_extract_control_files_to_dir_with_prefix(pkg_t * pkg,
 						 const char *dir,
 						 const char *prefix);
 int pkg_extract_data_files_to_dir(pkg_t * pkg, const char *dir);
-int pkg_extract_data_file_names_to_stream(pkg_t * pkg, FILE * file);
+const char *pkg_extract_data_file_names(pkg_t * pkg, size_t * len, int *err);
+void pkg_extract_close(pkg_t * pkg);
 
 #endif
@@ -0,0 +1,251 @@
+/* pkg_graph.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdlib.h>
+
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "pkg_depends.h"
+#include "pkg_graph.h"
+#include "pkg_vec.h"
+#include "libbb/libbb.h"
+
+static struct pkg_graph *graph;
+static int graph_stale;
+
+/* numbers packages in the order they are added until the graph is built */
+static unsigned int next_id;
+
+/* numbers the abstract packages and collects the packages, counting only
+ * if the arrays are not allocated yet */
+static void number_pkgs(const char *key, void *entry, void *data)
+{
+	struct pkg_graph *g = data;
+	abstract_pkg_t *ab_pkg = entry;
+	int i;
+
+	if (g->apkgs) {
+		ab_pkg->graph_id = g->n_apkgs;
+		g->apkgs[g->n_apkgs] = ab_pkg;
+	}
+	g->n_apkgs++;
+
+	if (!ab_pkg->pkgs)
+		return;
+
+	for (i = 0; i < ab_pkg->pkgs->len; i++) {
+		if (g->pkgs)
+			g->pkgs[g->n_pkgs] = ab_pkg->pkgs->pkgs[i];
+		g->n_pkgs++;
+	}
+}
+
+static int pkg_compare_graph_id(const void *p1, const void *p2)
+{
+	const pkg_t *a = *(const pkg_t **)p1;
+	const pkg_t *b = *(const pkg_t **)p2;
+
+	return (a->graph_id > b->graph_id) - (a->graph_id < b->graph_id);
+}
+
+/* numbers the compound dependencies from *group on */
+static unsigned int add_edges(struct pkg_graph_edge *e, unsigned int from,
+			      compound_depend_t *cdep, unsigned short *group)
+{
+	unsigned int n = 0;
+	int j;
+
+	for (; cdep && cdep->type; cdep++, (*group)++)
+		for (j = 0; j < cdep->possibility_count; j++, n++) {
+			if (!e)
+				continue;
+			e[n].depend = cdep->possibilities[j];
+			e[n].from = from;
+			e[n].to = cdep->possibilities[j]->pkg->graph_id;
+			e[n].group = *group;
+			e[n].type = cdep->type;
+		}
+
+	return n;
+}
+
+static unsigned int add_apkgs(unsigned int *ids, abstract_pkg_t **list)
+{
+	unsigned int n;
+
+	for (n = 0; list && list[n]; n++)
+		if (ids)
+			ids[n] = list[n]->graph_id;
+
+	return n;
+}
+
+/* the packages of apkg's providers, each replaced provider substituted by
+ * what replaces it unless that is a provider already */
+static unsigned int add_candidates(unsigned int *ids, abstract_pkg_t *apkg)
+{
+	abstract_pkg_vec_t *providers = apkg->provided_by;
+	abstract_pkg_t *papkg, *replacement;
+	unsigned int n = 0;
+	int i, j;
+
+	for (i = 0; providers && i < providers->len; i++) {
+		papkg = providers->pkgs[i];
+
+		if (papkg->replaced_by && papkg->replaced_by->len) {
+			replacement = papkg->replaced_by->pkgs[0];
+			if (replacement != papkg) {
+				if (abstract_pkg_vec_contains(providers, replacement))
+					continue;
+				papkg = replacement;
+			}
+		}
+
+		if (!papkg->pkgs)
+			continue;
+
+		for (j = 0; j < papkg->pkgs->len; j++, n++)
+			if (ids)
+				ids[n] = papkg->pkgs->pkgs[j]->graph_id;
+	}
+
+	return n;
+}
+
+static struct pkg_graph *pkg_graph_build(void)
+{
+	struct pkg_graph *g = xcalloc(1, sizeof(*g));
+	struct pkg_graph_edge *e;
+	unsigned int i, *fill;
+	unsigned short group;
+	pkg_t *pkg;
+
+	hash_table_foreach(&conf->pkg_hash, number_pkgs, g);
+	g->apkgs = xcalloc(g->n_apkgs + 1, sizeof(*g->apkgs));
+	g->pkgs = xcalloc(g->n_pkgs + 1, sizeof(*g->pkgs));
+	g->n_apkgs = g->n_pkgs = 0;
+	hash_table_foreach(&conf->pkg_hash, number_pkgs, g);
+
+	qsort(g->pkgs, g->n_pkgs, sizeof(*g->pkgs), pkg_compare_graph_id);
+	for (i = 0; i < g->n_pkgs; i++)
+		g->pkgs[i]->graph_id = i;
+	next_id = g->n_pkgs;
+
+	/* per package rows: count them, then fill them in */
+	g->edge_idx = xcalloc(g->n_pkgs + 1, sizeof(unsigned int));
+	g->provides_idx = xcalloc(g->n_pkgs + 1, sizeof(unsigned int));
+	g->replaces_idx = xcalloc(g->n_pkgs + 1, sizeof(unsigned int));
+
+	for (i = 0; i < g->n_pkgs; i++) {
+		pkg = g->pkgs[i];
+		group = 0;
+		g->edge_idx[i + 1] = g->edge_idx[i] +
+		    add_edges(NULL, i, pkg_get_ptr(pkg, PKG_DEPENDS), &group) +
+		    add_edges(NULL, i, pkg_get_ptr(pkg, PKG_CONFLICTS), &group);
+		g->provides_idx[i + 1] = g->provides_idx[i] +
+		    add_apkgs(NULL, pkg_get_ptr(pkg, PKG_PROVIDES));
+		g->replaces_idx[i + 1] = g->replaces_idx[i] +
+		    add_apkgs(NULL, pkg_get_ptr(pkg, PKG_REPLACES));
+	}
+
+	g->edges = xcalloc(g->edge_idx[g->n_pkgs] + 1, sizeof(*g->edges));
+	g->provides = xcalloc(g->provides_idx[g->n_pkgs] + 1, sizeof(unsigned int));
+	g->replaces = xcalloc(g->replaces_idx[g->n_pkgs] + 1, sizeof(unsigned int));
+
+	for (i = 0; i < g->n_pkgs; i++) {
+		pkg = g->pkgs[i];
+		group = 0;
+
+		/* conflicts are numbered after the depends */
+		e = g->edges + g->edge_idx[i];
+		e += add_edges(e, i, pkg_get_ptr(pkg, PKG_DEPENDS), &group);
+		add_edges(e, i, pkg_get_ptr(pkg, PKG_CONFLICTS), &group);
+		add_apkgs(g->provides + g->provides_idx[i],
+			  pkg_get_ptr(pkg, PKG_PROVIDES));
+		add_apkgs(g->replaces + g->replaces_idx[i],
+			  pkg_get_ptr(pkg, PKG_REPLACES));
+	}
+
+	/* reverse edges, by counting sort on the abstract package named */
+	g->rdep_idx = xcalloc(g->n_apkgs + 1, sizeof(unsigned int));
+	g->rdeps = xcalloc(g->edge_idx[g->n_pkgs] + 1, sizeof(unsigned int));
+	fill = xcalloc(g->n_apkgs + 1, sizeof(unsigned int));
+
+	for (i = 0; i < g->edge_idx[g->n_pkgs]; i++)
+		g->rdep_idx[g->edges[i].to + 1]++;
+	for (i = 0; i < g->n_apkgs; i++) {
+		g->rdep_idx[i + 1] += g->rdep_idx[i];
+		fill[i] = g->rdep_idx[i];
+	}
+	for (i = 0; i < g->edge_idx[g->n_pkgs]; i++)
+		g->rdeps[fill[g->edges[i].to]++] = i;
+
+	free(fill);
+
+	g->cand_idx = xcalloc(g->n_apkgs + 1, sizeof(unsigned int));
+	for (i = 0; i < g->n_apkgs; i++)
+		g->cand_idx[i + 1] = g->cand_idx[i] +
+		    add_candidates(NULL, g->apkgs[i]);
+
+	g->cands = xcalloc(g->cand_idx[g->n_apkgs] + 1, sizeof(unsigned int));
+	for (i = 0; i < g->n_apkgs; i++)
+		add_candidates(g->cands + g->cand_idx[i], g->apkgs[i]);
+
+	opkg_msg(DEBUG2, "%u packages, %u abstract packages, %u edges.\n",
+		 g->n_pkgs, g->n_apkgs, g->edge_idx[g->n_pkgs]);
+
+	return g;
+}
+
+const struct pkg_graph *pkg_graph_get(void)
+{
+	if (graph && graph_stale)
+		pkg_graph_free();
+
+	if (!graph) {
+		graph = pkg_graph_build();
+		graph_stale = 0;
+	}
+
+	return graph;
+}
+
+/* called for every package added to the hash, before it replaces a
+ * package of the same version */
+void pkg_graph_add(pkg_t *pkg)
+{
+	pkg->graph_id = next_id++;
+	graph_stale = 1;
+}
+
+void pkg_graph_free(void)
+{
+	if (!graph)
+		return;
+
+	free(graph->pkgs);
+	free(graph->apkgs);
+	free(graph->edge_idx);
+	free(graph->edges);
+	free(graph->provides_idx);
+	free(graph->provides);
+	free(graph->replaces_idx);
+	free(graph->replaces);
+	free(graph->rdep_idx);
+	free(graph->rdeps);
+	free(graph->cand_idx);
+	free(graph->cands);
+	free(graph);
+
+	graph = NULL;
+}
@@ -0,0 +1,74 @@
+/* pkg_graph.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_GRAPH_H
+#define PKG_GRAPH_H
+
+#include "pkg.h"
+
+/*
+ * The relations between all known packages in compressed sparse row
+ * form. Packages and abstract packages are numbered by their graph_id,
+ * and the relations of number i are the slice [idx[i], idx[i + 1]) of
+ * one array shared by all of them.
+ *
+ * The graph is built from the package hash on first use and rebuilt
+ * after packages were added to it, so it must not be held on to across
+ * hash_insert_pkg(). Packages are numbered in the order they were added,
+ * which is the order their relations are listed in.
+ */
+
+struct pkg_graph_edge {
+	depend_t *depend;
+	unsigned int from;	/* package */
+	unsigned int to;	/* abstract package */
+	unsigned short group;	/* compound dependency of from */
+	unsigned char type;	/* enum depend_type */
+};
+
+struct pkg_graph {
+	unsigned int n_pkgs;
+	unsigned int n_apkgs;
+	pkg_t **pkgs;
+	abstract_pkg_t **apkgs;
+
+	/* by package: depends in PKG_DEPENDS order, then conflicts */
+	unsigned int *edge_idx;
+	struct pkg_graph_edge *edges;
+
+	/* by package: abstract packages provided, itself included */
+	unsigned int *provides_idx;
+	unsigned int *provides;
+
+	/* by package: abstract packages replaced */
+	unsigned int *replaces_idx;
+	unsigned int *replaces;
+
+	/* by abstract package: edges naming it, in package order */
+	unsigned int *rdep_idx;
+	unsigned int *rdeps;
+
+	/* by abstract package: packages that can satisfy a dependency on
+	 * it, with providers that were replaced substituted */
+	unsigned int *cand_idx;
+	unsigned int *cands;
+};
+
+#define pkg_graph_has_pkg(g, pkg) \
+	((pkg)->graph_id < (g)->n_pkgs && (g)->pkgs[(pkg)->graph_id] == (pkg))
+
+const struct pkg_graph *pkg_graph_get(void);
+void pkg_graph_add(pkg_t *pkg);
+void pkg_graph_free(void);
+
+#endif
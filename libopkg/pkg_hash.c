@@ -16,13 +16,17 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "hash_table.h"
 #include "pkg.h"
 #include "opkg_message.h"
 #include "pkg_depends.h"
+#include "pkg_graph.h"
 #include "pkg_vec.h"
 #include "pkg_hash.h"
+#include "pkg_index.h"
+#include "status_journal.h"
 #include "parse_util.h"
 #include "pkg_parse.h"
 #include "opkg_utils.h"
@@ -32,6 +36,27 @@
 #include "libbb/libbb.h"
 #include "libbb/gzip.h"
 
+enum resolve_state {
+	RESOLVE_BUSY,
+	RESOLVE_OK,
+	RESOLVE_FAILED,
+};
+
+/* memoized results are those of pkgs whose resolve_gen matches */
+static unsigned int resolve_gen = 1;
+
+/*
+ * The packages being checked, outermost first, and the position of the
+ * outermost of them the current check relied on being resolvable. Like
+ * in Tarjan's algorithm, checked packages stay here as long as the cycle
+ * they are part of is still being checked.
+ */
+static struct {
+	pkg_t **pkgs;
+	unsigned int n, alloc;
+	unsigned int low;
+} resolve_stack;
+
 void pkg_hash_init(void)
 {
 	hash_table_init("pkg-hash", &conf->pkg_hash,
@@ -49,50 +74,225 @@ static void free_pkgs(const char *key, void *entry, void *data)
 
 	ab_pkg = (abstract_pkg_t *) entry;
 
+	/* the pkg_t and abstract_pkg_t structs themselves and the names
+	 * are released with their arenas */
 	if (ab_pkg->pkgs) {
-		for (i = 0; i < ab_pkg->pkgs->len; i++) {
+		for (i = 0; i < ab_pkg->pkgs->len; i++)
 			pkg_deinit(ab_pkg->pkgs->pkgs[i]);
-			free(ab_pkg->pkgs->pkgs[i]);
-		}
 	}
 
 	abstract_pkg_vec_free(ab_pkg->provided_by);
 	abstract_pkg_vec_free(ab_pkg->replaced_by);
 	pkg_vec_free(ab_pkg->pkgs);
-	free(ab_pkg->depended_upon_by);
-	free(ab_pkg->name);
-	free(ab_pkg);
 }
 
 void pkg_hash_deinit(void)
 {
+	pkg_graph_free();
 	hash_table_foreach(&conf->pkg_hash, free_pkgs, NULL);
 	hash_table_deinit(&conf->pkg_hash);
+
+	arena_destroy(&pkg_arena);
+	arena_destroy(&abstract_pkg_arena);
+	arena_destroy(&pkg_name_arena);
+	arena_destroy(&depend_arena);
+
+	free(resolve_stack.pkgs);
+	memset(&resolve_stack, 0, sizeof(resolve_stack));
 }
 
-int
-pkg_hash_add_from_file(const char *file_name,
-		       pkg_src_t * src, pkg_dest_t * dest, int is_status_file, int state_flags,
-		       void (*cb)(pkg_t *, void *), void *priv)
+void pkg_hash_print_stats(void)
+{
+	hash_print_stats(&conf->pkg_hash);
+	arena_print_stats(&pkg_arena);
+	arena_print_stats(&abstract_pkg_arena);
+	arena_print_stats(&pkg_name_arena);
+	arena_print_stats(&depend_arena);
+}
+
+/*
+ * Hands a freshly loaded package to cb, or inserts it into the hash,
+ * unless it is unrelated or has no usable architecture.
+ */
+void pkg_hash_add_pkg(pkg_t *pkg, int is_status_file,
+		      void (*cb)(pkg_t *, void *), void *priv)
+{
+	if (!(pkg->state_flag & SF_NEED_DETAIL)) {
+		//opkg_msg(DEBUG, "Package %s is unrelated, ignoring.\n", pkg->name);
+		pkg_free(pkg);
+		return;
+	}
+
+	if (!pkg_get_architecture(pkg) || !pkg_get_arch_priority(pkg)) {
+		char *version_str = pkg_version_str_alloc(pkg);
+		opkg_msg(NOTICE, "Package %s version %s has no "
+			 "valid architecture, ignoring.\n",
+			 pkg->name, version_str);
+		free(version_str);
+		return;
+	}
+
+	pkg_shrink_blob(pkg);
+
+	if (cb)
+		cb(pkg, priv);
+	else
+		hash_insert_pkg(pkg, is_status_file);
+}
+
+static FILE *open_list(const char *file_name, pkg_src_t *src,
+		       struct gzip_handle *zh)
 {
-	pkg_t *pkg;
 	FILE *fp;
-	char *buf;
-	const size_t len = 4096;
-	int ret = 0;
-	struct gzip_handle zh;
 
 	if (src && src->gzip) {
-		fp = gzip_fdopen(&zh, file_name);
+		fp = gzip_fdopen(zh, file_name);
 	} else {
 		fp = fopen(file_name, "r");
 	}
 
-	if (fp == NULL) {
+	if (fp == NULL)
 		opkg_perror(ERROR, "Failed to open %s", file_name);
-		return -1;
+
+	return fp;
+}
+
+static void close_list(FILE *fp, pkg_src_t *src, struct gzip_handle *zh)
+{
+	fclose(fp);
+
+	if (src && src->gzip)
+		gzip_close(zh);
+}
+
+/*
+ * Where the package stanzas of the feeds are, recorded while
+ * pkg_hash_load_package_details() parses the feeds, so the packages
+ * flagged as needing detail afterwards can be loaded from their own
+ * stanzas instead of parsing every feed again.
+ */
+struct detail_feed {
+	pkg_src_t *src;
+	char *list_file;
+	struct pkg_index *idx;	/* NULL if the text list is parsed */
+
+	/* the text list, kept open from one round to the next */
+	FILE *fp;
+	struct gzip_handle zh;
+	unsigned int lines;	/* read from fp so far */
+	int broken;		/* fp could not be opened */
+};
+
+struct detail_stanza {
+	const char *name;
+	abstract_pkg_t **provides;	/* other than name, NULL terminated */
+	off_t offset;		/* of the text stanza, -1 if not seekable */
+	unsigned int line;	/* of the text stanza, or index record */
+	unsigned int feed;
+	int loaded;
+};
+
+struct details {
+	struct detail_feed *feeds;
+	unsigned int n_feeds;
+	struct detail_stanza *stanzas;
+	unsigned int n_stanzas;
+	unsigned int alloc;
+	struct arena names;
+};
+
+static void details_add_feed(struct details *d, pkg_src_t *src,
+			     const char *list_file)
+{
+	struct detail_feed *feed;
+
+	d->feeds = xrealloc(d->feeds, (d->n_feeds + 1) * sizeof(*d->feeds));
+	feed = &d->feeds[d->n_feeds++];
+	feed->src = src;
+	feed->list_file = xstrdup(list_file);
+	feed->idx = NULL;
+	feed->fp = NULL;
+	feed->lines = 0;
+	feed->broken = 0;
+}
+
+static void details_record(struct details *d, pkg_t *pkg,
+			   unsigned int line, off_t offset)
+{
+	abstract_pkg_t **provides = pkg_get_ptr(pkg, PKG_PROVIDES);
+	struct detail_stanza *s;
+	size_t n = 0;
+
+	if (d->n_stanzas == d->alloc) {
+		d->alloc = d->alloc ? d->alloc * 2 : 256;
+		d->stanzas = xrealloc(d->stanzas, d->alloc * sizeof(*d->stanzas));
 	}
 
+	s = &d->stanzas[d->n_stanzas++];
+	s->name = arena_strdup(&d->names, pkg->name);
+	s->provides = NULL;
+	s->offset = offset;
+	s->line = line;
+	s->feed = d->n_feeds - 1;
+	s->loaded = !!(pkg->state_flag & SF_NEED_DETAIL);
+
+	/* the first provided package is the package itself */
+	if (provides && provides[0] && provides[1]) {
+		while (provides[n + 1])
+			n++;
+
+		s->provides = xcalloc(n + 1, sizeof(*s->provides));
+		memcpy(s->provides, provides + 1, n * sizeof(*s->provides));
+	}
+}
+
+static void details_free(struct details *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->n_feeds; i++) {
+		if (d->feeds[i].fp)
+			close_list(d->feeds[i].fp, d->feeds[i].src,
+				   &d->feeds[i].zh);
+		pkg_index_close(d->feeds[i].idx);
+		free(d->feeds[i].list_file);
+	}
+
+	for (i = 0; i < d->n_stanzas; i++)
+		free(d->stanzas[i].provides);
+
+	free(d->feeds);
+	free(d->stanzas);
+	arena_destroy(&d->names);
+}
+
+struct stanza_parse {
+	pkg_t *pkg;
+	unsigned int lines;
+};
+
+static int stanza_parse_line(void *ptr, char *line, uint mask)
+{
+	struct stanza_parse *sp = ptr;
+
+	sp->lines++;
+
+	return pkg_parse_line(sp->pkg, line, mask);
+}
+
+static int
+load_from_stream(FILE *fp, pkg_src_t * src, pkg_dest_t * dest,
+		 int is_status_file, int state_flags,
+		 void (*cb)(pkg_t *, void *), void *priv, struct details *d)
+{
+	struct stanza_parse sp = { NULL, 0 };
+	unsigned int line;
+	pkg_t *pkg;
+	char *buf;
+	const size_t len = 4096;
+	off_t offset = -1;
+	int ret = 0;
+
 	buf = xmalloc(len);
 
 	do {
@@ -101,7 +301,12 @@ pkg_hash_add_from_file(const char *file_name,
 		pkg->dest = dest;
 		pkg->state_flag |= state_flags;
 
-		ret = parse_from_stream_nomalloc(pkg_parse_line, pkg, fp, 0,
+		sp.pkg = pkg;
+		line = sp.lines;
+		if (d)
+			offset = ftello(fp);
+
+		ret = parse_from_stream_nomalloc(stanza_parse_line, &sp, fp, 0,
 						 &buf, len);
 
 		if (pkg->name == NULL) {
@@ -110,8 +315,7 @@ pkg_hash_add_from_file(const char *file_name,
 		}
 
 		if (ret) {
-			pkg_deinit(pkg);
-			free(pkg);
+			pkg_free(pkg);
 			if (ret == -1)
 				break;
 			if (ret == 1)
@@ -120,46 +324,85 @@ pkg_hash_add_from_file(const char *file_name,
 			continue;
 		}
 
-		if (!(pkg->state_flag & SF_NEED_DETAIL)) {
-			//opkg_msg(DEBUG, "Package %s is unrelated, ignoring.\n", pkg->name);
-			pkg_deinit(pkg);
-			free(pkg);
-			continue;
-		}
+		if (d)
+			details_record(d, pkg, line, offset);
 
-		if (!pkg_get_architecture(pkg) || !pkg_get_arch_priority(pkg)) {
-			char *version_str = pkg_version_str_alloc(pkg);
-			opkg_msg(NOTICE, "Package %s version %s has no "
-				 "valid architecture, ignoring.\n",
-				 pkg->name, version_str);
-			free(version_str);
-			continue;
-		}
-
-		if (cb)
-			cb(pkg, priv);
-		else
-			hash_insert_pkg(pkg, is_status_file);
+		pkg_hash_add_pkg(pkg, is_status_file, cb, priv);
 
 	} while (!feof(fp));
 
 	free(buf);
-	fclose(fp);
 
-	if (src && src->gzip)
-		gzip_close(&zh);
+	return ret;
+}
+
+int
+pkg_hash_add_from_stream(FILE *fp, pkg_src_t * src, pkg_dest_t * dest,
+			 int is_status_file, int state_flags,
+			 void (*cb)(pkg_t *, void *), void *priv)
+{
+	return load_from_stream(fp, src, dest, is_status_file, state_flags,
+				cb, priv, NULL);
+}
+
+static int
+load_from_file(const char *file_name,
+	       pkg_src_t * src, pkg_dest_t * dest, int is_status_file,
+	       int state_flags, void (*cb)(pkg_t *, void *), void *priv,
+	       struct details *d)
+{
+	FILE *fp;
+	int ret;
+	struct gzip_handle zh;
+
+	fp = open_list(file_name, src, &zh);
+	if (fp == NULL)
+		return -1;
+
+	ret = load_from_stream(fp, src, dest, is_status_file,
+			       state_flags, cb, priv, d);
+
+	close_list(fp, src, &zh);
 
 	return ret;
 }
 
-/*
- * Load in feed files from the cached "src" and/or "src/gz" locations.
- */
-int pkg_hash_load_feeds(int state_flags, void (*cb)(pkg_t *, void *), void *priv)
+int
+pkg_hash_add_from_file(const char *file_name,
+		       pkg_src_t * src, pkg_dest_t * dest, int is_status_file, int state_flags,
+		       void (*cb)(pkg_t *, void *), void *priv)
+{
+	return load_from_file(file_name, src, dest, is_status_file,
+			      state_flags, cb, priv, NULL);
+}
+
+static void
+load_from_index(struct pkg_index *idx, pkg_src_t *src, int state_flags,
+		void (*cb)(pkg_t *, void *), void *priv, struct details *d)
+{
+	uint32_t i;
+	pkg_t *pkg;
+
+	for (i = 0; i < pkg_index_count(idx); i++) {
+		pkg = pkg_index_get(idx, i, src, state_flags);
+		if (!pkg)
+			continue;
+
+		if (d)
+			details_record(d, pkg, i, -1);
+
+		pkg_hash_add_pkg(pkg, 0, cb, priv);
+	}
+}
+
+static int
+load_feeds(int state_flags, void (*cb)(pkg_t *, void *), void *priv,
+	   struct details *d)
 {
 	pkg_src_list_elt_t *iter;
 	pkg_src_t *src;
-	char *list_file, *lists_dir;
+	struct pkg_index *idx;
+	char *list_file, *index_file, *lists_dir;
 
 	opkg_msg(INFO, "\n");
 
@@ -174,7 +417,23 @@ int pkg_hash_load_feeds(int state_flags, void (*cb)(pkg_t *, void *), void *priv
 		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
 
 		if (file_exists(list_file)) {
-			if (pkg_hash_add_from_file(list_file, src, NULL, 0, state_flags, cb, priv)) {
+			index_file = pkg_index_file_name(list_file);
+			idx = pkg_index_open(index_file, list_file);
+			free(index_file);
+
+			if (d)
+				details_add_feed(d, src, list_file);
+
+			if (idx) {
+				load_from_index(idx, src, state_flags, cb, priv, d);
+
+				/* kept for loading the stanzas flagged later */
+				if (d)
+					d->feeds[d->n_feeds - 1].idx = idx;
+				else
+					pkg_index_close(idx);
+			} else if (load_from_file(list_file, src, NULL, 0,
+						  state_flags, cb, priv, d)) {
 				free(list_file);
 				return -1;
 			}
@@ -185,6 +444,14 @@ int pkg_hash_load_feeds(int state_flags, void (*cb)(pkg_t *, void *), void *priv
 	return 0;
 }
 
+/*
+ * Load in feed files from the cached "src" and/or "src/gz" locations.
+ */
+int pkg_hash_load_feeds(int state_flags, void (*cb)(pkg_t *, void *), void *priv)
+{
+	return load_feeds(state_flags, cb, priv, NULL);
+}
+
 /*
  * Load in status files from the configured "dest"s.
  */
@@ -192,6 +459,8 @@ int pkg_hash_load_status_files(void (*cb)(pkg_t *, void *), void *priv)
 {
 	pkg_dest_list_elt_t *iter;
 	pkg_dest_t *dest;
+	char *journal_file;
+	int journaled;
 
 	opkg_msg(INFO, "\n");
 
@@ -200,7 +469,14 @@ int pkg_hash_load_status_files(void (*cb)(pkg_t *, void *), void *priv)
 
 		dest = (pkg_dest_t *) iter->data;
 
-		if (file_exists(dest->status_file_name)) {
+		journal_file = status_journal_file_name(dest);
+		journaled = conf->status_journal || file_exists(journal_file);
+		free(journal_file);
+
+		if (journaled) {
+			if (status_journal_load(dest, cb, priv))
+				return -1;
+		} else if (file_exists(dest->status_file_name)) {
 			if (pkg_hash_add_from_file
 			    (dest->status_file_name, NULL, dest, 1, SF_NEED_DETAIL, cb, priv))
 				return -1;
@@ -231,46 +507,271 @@ pkg_hash_load_package_details_helper(const char *pkg_name, void *entry, void *da
 	}
 }
 
+static int details_wanted(const struct detail_stanza *s)
+{
+	abstract_pkg_t *ab_pkg, **provides;
+
+	ab_pkg = abstract_pkg_fetch_by_name(s->name);
+	if (ab_pkg && (ab_pkg->state_flag & SF_NEED_DETAIL))
+		return 1;
+
+	/* parsing it flags the provider, to be loaded the next round */
+	for (provides = s->provides; provides && *provides; provides++)
+		if ((*provides)->state_flag & SF_NEED_DETAIL)
+			return 1;
+
+	return 0;
+}
+
+static int skip_lines(FILE *fp, unsigned int n, char *buf, size_t len)
+{
+	while (n) {
+		if (fgets(buf, (int)len, fp) == NULL)
+			return -1;
+		if (strchr(buf, '\n'))
+			n--;
+	}
+
+	return 0;
+}
+
+static void details_close_feed(struct detail_feed *feed)
+{
+	close_list(feed->fp, feed->src, &feed->zh);
+	feed->fp = NULL;
+	feed->lines = 0;
+	feed->broken = 0;
+}
+
+/*
+ * Parses the wanted stanzas not loaded yet, in feed order, as a full
+ * pass over the feeds would. Text lists are read from the recorded
+ * offsets, or, where the stream cannot seek, by skipping whole lines up
+ * to the recorded line. Such a stream, a gzipped list, stays open from
+ * one round to the next and is only started again from the top when a
+ * round wants a stanza it has already read past, so a round inflates
+ * each feed at most once.
+ */
+static void details_load(struct details *d)
+{
+	struct detail_feed *feed;
+	struct detail_stanza *s;
+	struct stanza_parse sp = { NULL, 0 };
+	const size_t len = 4096;
+	unsigned int i;
+	pkg_t *pkg;
+	char *buf;
+	int ret;
+
+	buf = xmalloc(len);
+
+	for (i = 0; i < d->n_stanzas; i++) {
+		s = &d->stanzas[i];
+
+		if (s->loaded || !details_wanted(s))
+			continue;
+
+		feed = &d->feeds[s->feed];
+
+		if (feed->idx) {
+			pkg = pkg_index_get(feed->idx, s->line, feed->src, 0);
+			if (!pkg)
+				continue;
+		} else {
+			if (feed->fp && s->offset < 0 && s->line < feed->lines)
+				details_close_feed(feed);
+
+			if (!feed->fp && !feed->broken) {
+				feed->fp = open_list(feed->list_file, feed->src,
+						     &feed->zh);
+				feed->broken = !feed->fp;
+			}
+			if (!feed->fp)
+				continue;
+
+			if (s->offset >= 0) {
+				if (fseeko(feed->fp, s->offset, SEEK_SET))
+					continue;
+			} else if (skip_lines(feed->fp, s->line - feed->lines,
+					      buf, len)) {
+				details_close_feed(feed);
+				continue;
+			}
+			sp.lines = s->line;
+
+			pkg = pkg_new();
+			pkg->src = feed->src;
+			sp.pkg = pkg;
+
+			ret = parse_from_stream_nomalloc(stanza_parse_line, &sp,
+							 feed->fp, 0, &buf, len);
+			feed->lines = sp.lines;
+			if (ret || pkg->name == NULL) {
+				pkg_free(pkg);
+				if (s->offset < 0)
+					details_close_feed(feed);
+				continue;
+			}
+		}
+
+		if (pkg->state_flag & SF_NEED_DETAIL)
+			s->loaded = 1;
+
+		pkg_hash_add_pkg(pkg, 0, NULL, NULL);
+	}
+
+	free(buf);
+}
+
+/*
+ * Loads the feed packages flagged as needing detail. The feeds are only
+ * parsed once; the packages flagged by what has been loaded are then
+ * loaded from their own stanzas, until no more get flagged.
+ */
 int pkg_hash_load_package_details(void)
 {
+	struct details d = { .names = ARENA_INIT("detail-names", 0) };
 	int n_need_detail;
 
-	while (1) {
-		pkg_hash_load_feeds(0, NULL, NULL);
+	load_feeds(0, NULL, NULL, &d);
 
+	while (1) {
 		n_need_detail = 0;
 		hash_table_foreach(&conf->pkg_hash, pkg_hash_load_package_details_helper, &n_need_detail);
 
 		if (n_need_detail > 0)
-			opkg_msg(DEBUG, "Found %d packages requiring details, reloading feeds\n", n_need_detail);
+			opkg_msg(DEBUG, "Found %d packages requiring details, loading their stanzas\n", n_need_detail);
 		else
 			break;
+
+		details_load(&d);
 	}
 
+	details_free(&d);
+
 	return 0;
 }
 
-static int
-pkg_hash_check_unresolved(pkg_t *maybe)
-{
-	char **unresolved = NULL;
-	char **tmp;
-	pkg_vec_t *depends;
-	int res = 0;
-
-	depends = pkg_vec_alloc();
-	pkg_hash_fetch_unsatisfied_dependencies(maybe, depends, &unresolved, 1);
-
-	if (unresolved) {
-		res = 1;
-		tmp = unresolved;
-		while (*tmp) {
-			opkg_msg(ERROR, "cannot find dependency %s for %s\n", *tmp, maybe->name);
-			free(*(tmp++));
+void pkg_hash_forget_resolved(void)
+{
+	resolve_gen++;
+}
+
+/* notes that the current check relies on pkg, which is still being checked */
+static void resolve_rely_on(pkg_t *pkg)
+{
+	unsigned int i;
+
+	for (i = 0; i < resolve_stack.low; i++) {
+		if (resolve_stack.pkgs[i] == pkg) {
+			resolve_stack.low = i;
+			break;
 		}
-		free(unresolved);
 	}
-	pkg_vec_free(depends);
+}
+
+/*
+ * Returns 1 if maybe has dependencies that nothing installable satisfies.
+ * The result is remembered until pkg_hash_forget_resolved(), so shared
+ * dependencies are only looked at once. Dependency cycles are taken to be
+ * resolvable: a package met again while it is still being checked counts
+ * as resolvable.
+ *
+ * That assumption only holds once the whole cycle turned out resolvable,
+ * so a package found resolvable thanks to a package still being checked
+ * is left on resolve_stack. When the first package of its cycle is done,
+ * all of them are remembered as resolvable, or, if any of them failed,
+ * forgotten, to be looked at again when asked next. Failures do not
+ * depend on the assumption and are always remembered.
+ */
+int pkg_hash_check_unresolved(pkg_t *maybe)
+{
+	const struct pkg_graph *g;
+	const struct pkg_graph_edge *e, *end;
+	unsigned int i, pos, outer_low;
+	char *dep_str;
+	int res = 0, resolvable = 0, failed;
+
+	if (maybe->resolve_gen == resolve_gen) {
+		if (maybe->resolve_state == RESOLVE_BUSY)
+			resolve_rely_on(maybe);
+		return maybe->resolve_state == RESOLVE_FAILED;
+	}
+
+	g = pkg_graph_get();
+	if (!pkg_graph_has_pkg(g, maybe)) {
+		maybe->resolve_gen = resolve_gen;
+		maybe->resolve_state = RESOLVE_OK;
+		return 0;
+	}
+
+	maybe->resolve_gen = resolve_gen;
+	maybe->resolve_state = RESOLVE_BUSY;
+
+	if (resolve_stack.n == resolve_stack.alloc) {
+		resolve_stack.alloc = resolve_stack.alloc ?
+		    resolve_stack.alloc * 2 : 16;
+		resolve_stack.pkgs = xrealloc(resolve_stack.pkgs,
+					      resolve_stack.alloc *
+					      sizeof(*resolve_stack.pkgs));
+	}
+	pos = resolve_stack.n++;
+	resolve_stack.pkgs[pos] = maybe;
+	outer_low = resolve_stack.low;
+	resolve_stack.low = pos;
+
+	e = g->edges + g->edge_idx[maybe->graph_id];
+	end = g->edges + g->edge_idx[maybe->graph_id + 1];
+
+	/* the possibilities of a compound dependency are adjacent */
+	for (; e < end; e++) {
+		/* the others are fine to leave unsatisfied */
+		if (e->type != DEPEND && e->type != PREDEPEND)
+			continue;
+
+		if (!resolvable)
+			resolvable = pkg_dependence_resolvable(e->depend);
+
+		if (e + 1 < end && e[1].group == e->group)
+			continue;
+
+		if (!resolvable) {
+			dep_str = pkg_depend_str(maybe, e->group);
+			opkg_msg(ERROR, "cannot find dependency %s for %s\n",
+				 dep_str, maybe->name);
+			free(dep_str);
+			res = 1;
+		}
+		resolvable = 0;
+	}
+
+	if (res)
+		maybe->resolve_state = RESOLVE_FAILED;
+
+	/* maybe is the first of its cycle, which is now done */
+	if (resolve_stack.low >= pos) {
+		failed = 0;
+		for (i = pos; i < resolve_stack.n; i++)
+			if (resolve_stack.pkgs[i]->resolve_state ==
+			    RESOLVE_FAILED)
+				failed = 1;
+
+		for (i = pos; i < resolve_stack.n; i++) {
+			pkg_t *pkg = resolve_stack.pkgs[i];
+
+			if (pkg->resolve_state != RESOLVE_BUSY)
+				continue;
+			if (failed)
+				pkg->resolve_gen = 0;
+			else
+				pkg->resolve_state = RESOLVE_OK;
+		}
+
+		resolve_stack.n = pos;
+	}
+
+	if (resolve_stack.low > outer_low)
+		resolve_stack.low = outer_low;
 
 	return res;
 }
@@ -686,7 +1187,7 @@ static abstract_pkg_t *add_new_abstract_pkg_by_name(const char *pkg_name)
 
 	ab_pkg = abstract_pkg_new();
 
-	ab_pkg->name = xstrdup(pkg_name);
+	ab_pkg->name = arena_strdup(&pkg_name_arena, pkg_name);
 	hash_table_insert(&conf->pkg_hash, pkg_name, ab_pkg);
 
 	return ab_pkg;
@@ -729,10 +1230,11 @@ void hash_insert_pkg(pkg_t * pkg, int set_status)
 
 	buildReplaces(ab_pkg, pkg);
 
-	buildDependedUponBy(pkg, ab_pkg);
-
+	pkg_graph_add(pkg);
 	pkg_vec_insert_merge(ab_pkg->pkgs, pkg, set_status);
 	pkg->parent = ab_pkg;
+
+	pkg_hash_forget_resolved();
 }
 
 static const char *strip_offline_root(const char *file_name)
@@ -748,21 +1250,46 @@ static const char *strip_offline_root(const char *file_name)
 	return file_name;
 }
 
+static struct arena file_owner_arena =
+    ARENA_INIT("file-owner", sizeof(struct file_owner));
+static struct arena file_name_arena = ARENA_INIT("file-names", 0);
+
+void file_hash_deinit(void)
+{
+	hash_table_deinit(&conf->file_hash);
+	arena_destroy(&file_owner_arena);
+	arena_destroy(&file_name_arena);
+}
+
 void file_hash_remove(const char *file_name)
 {
+	struct file_owner *owner;
+
 	file_name = strip_offline_root(file_name);
+
+	owner = hash_table_get(&conf->file_hash, file_name);
+	if (!owner)
+		return;
+
+	list_del(&owner->list);
 	hash_table_remove(&conf->file_hash, file_name);
+	arena_free(&file_owner_arena, owner);
 }
 
 pkg_t *file_hash_get_file_owner(const char *file_name)
 {
+	struct file_owner *owner;
+
 	file_name = strip_offline_root(file_name);
-	return hash_table_get(&conf->file_hash, file_name);
+	owner = hash_table_get(&conf->file_hash, file_name);
+
+	return owner ? owner->pkg : NULL;
 }
 
 void file_hash_set_file_owner(const char *file_name, pkg_t * owning_pkg)
 {
-	pkg_t *old_owning_pkg;
+	struct file_owner *owner;
+	pkg_t *old_owning_pkg = NULL;
 	int file_name_len = strlen(file_name);
 
 	if (file_name[file_name_len - 1] == '/')
@@ -770,12 +1297,24 @@ void file_hash_set_file_owner(const char *file_name, pkg_t * owning_pkg)
 
 	file_name = strip_offline_root(file_name);
 
-	old_owning_pkg = hash_table_get(&conf->file_hash, file_name);
-	hash_table_insert(&conf->file_hash, file_name, owning_pkg);
+	owner = hash_table_get(&conf->file_hash, file_name);
+	if (owner) {
+		old_owning_pkg = owner->pkg;
+		if (old_owning_pkg != owning_pkg) {
+			list_del(&owner->list);
+			list_add_tail(&owner->list, &owning_pkg->owned_files);
+		}
+	} else {
+		owner = arena_alloc(&file_owner_arena);
+		owner->name = arena_strdup(&file_name_arena, file_name);
+		list_add_tail(&owner->list, &owning_pkg->owned_files);
+		hash_table_insert(&conf->file_hash, file_name, owner);
+	}
+	owner->pkg = owning_pkg;
 
 	if (old_owning_pkg) {
 		pkg_get_installed_files(old_owning_pkg);
-		str_list_remove_elt(old_owning_pkg->installed_files, file_name);
+		path_list_remove(old_owning_pkg->installed_files, file_name);
 		pkg_free_installed_files(old_owning_pkg);
 
 		/* mark this package to have its filelist written */
@@ -25,9 +25,15 @@
 
 void pkg_hash_init(void);
 void pkg_hash_deinit(void);
+void pkg_hash_print_stats(void);
 
 void pkg_hash_fetch_available(pkg_vec_t * available);
 
+void pkg_hash_add_pkg(pkg_t *pkg, int is_status_file,
+		      void (*cb)(pkg_t *, void *), void *priv);
+int pkg_hash_add_from_stream(FILE *fp, pkg_src_t * src, pkg_dest_t * dest,
+			     int is_status_file, int state_flags,
+			     void (*cb)(pkg_t *, void *), void *priv);
 int pkg_hash_add_from_file(const char *file_name, pkg_src_t * src,
 			   pkg_dest_t * dest, int is_status_file, int state_flags,
 			   void (*cb)(pkg_t *, void *), void *priv);
@@ -53,10 +59,29 @@ pkg_t *pkg_hash_fetch_best_installation_candidate(abstract_pkg_t * apkg,
 									 *data),
 						  void *cdata, int quiet);
 pkg_t *pkg_hash_fetch_best_installation_candidate_by_name(const char *name);
+
+/*
+ * Whether a package can be resolved only depends on the packages known,
+ * not on their state. It is memoized per package until more are added.
+ */
+int pkg_hash_check_unresolved(pkg_t *maybe);
+void pkg_hash_forget_resolved(void);
 pkg_t *pkg_hash_fetch_installed_by_name(const char *pkg_name);
 pkg_t *pkg_hash_fetch_installed_by_name_dest(const char *pkg_name,
 					     pkg_dest_t * dest);
 
+/*
+ * The entries of conf->file_hash, also linked into the owned_files list
+ * of their owner so the files of a package are found without going
+ * through all of them.
+ */
+struct file_owner {
+	struct list_head list;
+	pkg_t *pkg;
+	const char *name;
+};
+
+void file_hash_deinit(void);
 void file_hash_remove(const char *file_name);
 pkg_t *file_hash_get_file_owner(const char *file_name);
 void file_hash_set_file_owner(const char *file_name, pkg_t * pkg);
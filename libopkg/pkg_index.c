@@ -0,0 +1,1025 @@
+/* pkg_index.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pkg_index.h"
+#include "pkg_hash.h"
+#include "pkg_depends.h"
+#include "pkg_parse.h"
+#include "parse_util.h"
+#include "hash_table.h"
+#include "opkg_message.h"
+#include "opkg_utils.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+#include "libbb/gzip.h"
+
+/* set in pkg_index_edge.constraint when the edge carries a version */
+#define PIE_HAS_VERSION	0x100
+
+static const uint pit_mask[__PIT_MAX] = {
+	[PIT_PACKAGE] = PFM_PACKAGE,
+	[PIT_ABIVERSION] = PFM_ABIVERSION,
+	[PIT_ALTERNATIVES] = PFM_ALTERNATIVES,
+	[PIT_ARCHITECTURE] = PFM_ARCHITECTURE,
+	[PIT_CONFLICTS] = PFM_CONFLICTS,
+	[PIT_DEPENDS] = PFM_DEPENDS,
+	[PIT_DESCRIPTION] = PFM_DESCRIPTION,
+	[PIT_ESSENTIAL] = PFM_ESSENTIAL,
+	[PIT_FILENAME] = PFM_FILENAME,
+	[PIT_INSTALLED_SIZE] = PFM_INSTALLED_SIZE,
+	[PIT_MD5SUM] = PFM_MD5SUM,
+	[PIT_MAINTAINER] = PFM_MAINTAINER,
+	[PIT_PRIORITY] = PFM_PRIORITY,
+	[PIT_PROVIDES] = PFM_PROVIDES,
+	[PIT_PRE_DEPENDS] = PFM_PRE_DEPENDS,
+	[PIT_RECOMMENDS] = PFM_RECOMMENDS,
+	[PIT_REPLACES] = PFM_REPLACES,
+	[PIT_SECTION] = PFM_SECTION,
+	[PIT_SHA256SUM] = PFM_SHA256SUM,
+	[PIT_SIZE] = PFM_SIZE,
+	[PIT_SOURCE] = PFM_SOURCE,
+	[PIT_SUGGESTS] = PFM_SUGGESTS,
+	[PIT_TAGS] = PFM_TAGS,
+	[PIT_VERSION] = PFM_VERSION,
+	[PIT_VERSION_KEY] = PFM_VERSION,
+};
+
+struct index_builder {
+	struct pkg_index_record *recs;
+	struct pkg_index_field *fields;
+	struct pkg_index_edge *edges;
+	char *strtab;
+
+	uint32_t n_recs, n_fields, n_edges, strtab_len;
+	uint32_t a_recs, a_fields, a_edges, a_strtab;
+
+	/* string -> strtab offset, for strings worth sharing */
+	hash_table_t strings;
+
+	char *description;
+	int reading_description;
+	int unsupported;
+};
+
+char *pkg_index_file_name(const char *list_file)
+{
+	char *index_file;
+
+	sprintf_alloc(&index_file, "%s.idx", list_file);
+
+	return index_file;
+}
+
+/* FNV-1a over the raw (possibly compressed) list file */
+static int index_file_hash(const char *file_name, uint64_t *hash)
+{
+	struct stat st;
+	unsigned char *map;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	off_t i;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+
+		for (i = 0; i < st.st_size; i++) {
+			h ^= map[i];
+			h *= 0x100000001b3ULL;
+		}
+
+		munmap(map, st.st_size);
+	}
+
+	close(fd);
+	*hash = h;
+
+	return 0;
+}
+
+static uint32_t index_add_string(struct index_builder *b, const char *s,
+				 int shared)
+{
+	size_t len;
+	uint32_t off;
+	void *p;
+
+	if (!s || !*s)
+		return 0;
+
+	if (shared) {
+		p = hash_table_get(&b->strings, s);
+		if (p)
+			return (uint32_t)(uintptr_t)p;
+	}
+
+	len = strlen(s) + 1;
+
+	while (b->strtab_len + len > b->a_strtab) {
+		b->a_strtab *= 2;
+		b->strtab = xrealloc(b->strtab, b->a_strtab);
+	}
+
+	off = b->strtab_len;
+	memcpy(b->strtab + off, s, len);
+	b->strtab_len += len;
+
+	if (shared)
+		hash_table_insert(&b->strings, s, (void *)(uintptr_t)off);
+
+	return off;
+}
+
+static struct pkg_index_field *index_add_field(struct index_builder *b,
+					       enum pkg_index_tag tag)
+{
+	struct pkg_index_field *f;
+
+	if (b->n_fields == b->a_fields) {
+		b->a_fields = b->a_fields ? b->a_fields * 2 : 1024;
+		b->fields = xrealloc(b->fields,
+				     b->a_fields * sizeof(*b->fields));
+	}
+
+	f = &b->fields[b->n_fields++];
+	memset(f, 0, sizeof(*f));
+	f->tag = tag;
+
+	b->recs[b->n_recs - 1].n_fields++;
+
+	return f;
+}
+
+static uint32_t index_add_edge(struct index_builder *b, const char *name,
+			       const char *version, int constraint)
+{
+	struct pkg_index_edge *e;
+
+	if (b->n_edges == b->a_edges) {
+		b->a_edges = b->a_edges ? b->a_edges * 2 : 1024;
+		b->edges = xrealloc(b->edges, b->a_edges * sizeof(*b->edges));
+	}
+
+	e = &b->edges[b->n_edges];
+	e->name = index_add_string(b, name, 1);
+	e->version = index_add_string(b, version, 1);
+	e->key = 0;
+	e->constraint = constraint | (version ? PIE_HAS_VERSION : 0);
+
+	if (version) {
+		char *key = xmalloc(VERSION_KEY_SIZE(strlen(version)));
+
+		version_str_key_write(key, version);
+		e->key = index_add_string(b, key, 1);
+		free(key);
+	}
+
+	return b->n_edges++;
+}
+
+static void index_add_str_field(struct index_builder *b,
+				enum pkg_index_tag tag, const char *s,
+				int shared)
+{
+	index_add_field(b, tag)->a = index_add_string(b, s, shared);
+}
+
+static void index_add_deplist(struct index_builder *b, enum pkg_index_tag tag,
+			      enum depend_type type, char *list)
+{
+	struct pkg_index_field *f;
+	version_constraint_t constraint;
+	char *item, *tok, *depend, *tok1, *name, *vstr;
+	uint32_t first, count;
+	int greedy;
+
+	for (item = strtok_r(list, ",", &tok); item;
+	     item = strtok_r(NULL, ",", &tok)) {
+		first = b->n_edges;
+		count = 0;
+		greedy = 0;
+
+		for (depend = strtok_r(item, "|", &tok1); depend;
+		     depend = strtok_r(NULL, "|", &tok1), count++) {
+			name = parse_depend_possibility(depend, &constraint,
+							&vstr, &greedy);
+			if (!name) {
+				b->unsupported = 1;
+				return;
+			}
+
+			index_add_edge(b, name, vstr, constraint);
+		}
+
+		if (count > UINT16_MAX) {
+			b->unsupported = 1;
+			return;
+		}
+
+		f = index_add_field(b, tag);
+		f->type = greedy ? GREEDY_DEPEND : type;
+		f->count = count;
+		f->a = first;
+	}
+}
+
+static void index_add_namelist(struct index_builder *b, enum pkg_index_tag tag,
+			       char *list)
+{
+	struct pkg_index_field *f;
+	char *item, *tok;
+	uint32_t first, count;
+
+	first = b->n_edges;
+
+	for (count = 0, item = strtok_r(list, ", ", &tok); item;
+	     count++, item = strtok_r(NULL, ", ", &tok))
+		index_add_edge(b, item, NULL, NONE);
+
+	if (count > UINT16_MAX) {
+		b->unsupported = 1;
+		return;
+	}
+
+	f = index_add_field(b, tag);
+	f->count = count;
+	f->a = first;
+}
+
+/* Trims s the way pkg_set_string() does, NULL if nothing is left. */
+static char *index_trim(char *s)
+{
+	char *end;
+
+	if (!s)
+		return NULL;
+
+	while (isspace(*s))
+		s++;
+
+	for (end = s + strlen(s); end > s && isspace(end[-1]); end--)
+		;
+	*end = '\0';
+
+	return *s ? s : NULL;
+}
+
+/*
+ * Mirrors parse_version(), but keeps the pieces instead of a pkg_t,
+ * followed by the key pkg_set_version_key() would compute from them.
+ */
+static void index_add_version(struct index_builder *b, const char *vstr)
+{
+	struct pkg_index_field *f;
+	unsigned int epoch = 0;
+	char *colon, *dup, *rev, *version, *key;
+
+	f = index_add_field(b, PIT_VERSION);
+
+	vstr += strlen("Version:");
+
+	while (*vstr && isspace(*vstr))
+		vstr++;
+
+	colon = strchr(vstr, ':');
+	if (colon) {
+		f->type = 1;
+		f->c = epoch = strtoul(vstr, NULL, 10);
+		vstr = ++colon;
+	}
+
+	dup = xstrdup(vstr);
+	rev = strrchr(dup, '-');
+
+	if (rev)
+		*rev++ = '\0';
+
+	/* no realloc of b->fields happens below */
+	f->a = index_add_string(b, dup, 1);
+	f->b = index_add_string(b, rev, 1);
+
+	version = index_trim(dup);
+	rev = index_trim(rev);
+
+	key = xmalloc(VERSION_KEY_SIZE(strlen(vstr)));
+	version_key_write(key, epoch, version, rev);
+	index_add_str_field(b, PIT_VERSION_KEY, key, 1);
+
+	free(key);
+	free(dup);
+}
+
+/*
+ * Line callback for parse_from_stream_nomalloc(). This follows the field
+ * matching in pkg_parse_line() exactly, including its prefix matching,
+ * so that a package loaded from the index is identical to one parsed from
+ * the text list. Fields that only occur in status files make the whole
+ * index unsupported and the text list is used instead.
+ */
+static int index_parse_line(void *ptr, char *line, uint mask)
+{
+	struct index_builder *b = ptr;
+	struct pkg_index_record *rec = &b->recs[b->n_recs - 1];
+	const char *s;
+	char *tmp;
+	int ret = 0;
+
+	switch (*line) {
+	case 'A':
+		if (is_field("ABIVersion", line))
+			index_add_str_field(b, PIT_ABIVERSION, line + strlen("ABIVersion") + 1, 1);
+		else if (is_field("Alternatives", line))
+			index_add_str_field(b, PIT_ALTERNATIVES, line + strlen("Alternatives") + 1, 1);
+		else if (is_field("Architecture", line)) {
+			s = line + strlen("Architecture") + 1;
+			while (isspace(*s))
+				s++;
+			index_add_str_field(b, PIT_ARCHITECTURE, s, 1);
+		} else if (is_field("Auto-Installed", line))
+			b->unsupported = 1;
+		break;
+
+	case 'C':
+		if (is_field("Conffiles", line))
+			b->unsupported = 1;
+		else if (is_field("Conflicts", line))
+			index_add_deplist(b, PIT_CONFLICTS, CONFLICTS, line + strlen("Conflicts") + 1);
+		break;
+
+	case 'D':
+		if (is_field("Description", line)) {
+			free(b->description);
+			b->description = parse_simple("Description", line);
+			b->reading_description = 1;
+			return 0;
+		} else if (is_field("Depends", line))
+			index_add_deplist(b, PIT_DEPENDS, DEPEND, line + strlen("Depends") + 1);
+		break;
+
+	case 'E':
+		if (is_field("Essential", line)) {
+			tmp = parse_simple("Essential", line);
+			if (tmp && strcmp(tmp, "yes") == 0)
+				index_add_field(b, PIT_ESSENTIAL)->a = 1;
+			free(tmp);
+		}
+		break;
+
+	case 'F':
+		if (is_field("Filename", line))
+			index_add_str_field(b, PIT_FILENAME, line + strlen("Filename") + 1, 0);
+		break;
+
+	case 'I':
+		if (is_field("Installed-Size", line))
+			index_add_field(b, PIT_INSTALLED_SIZE)->a = strtoul(line + strlen("Installed-Size") + 1, NULL, 0);
+		else if (is_field("Installed-Time", line))
+			b->unsupported = 1;
+		break;
+
+	case 'M':
+		if (is_field("MD5sum:", line) || is_field("MD5Sum:", line))
+			index_add_str_field(b, PIT_MD5SUM, line + strlen("MD5sum") + 1, 0);
+		else if (is_field("Maintainer", line))
+			index_add_str_field(b, PIT_MAINTAINER, line + strlen("Maintainer") + 1, 1);
+		break;
+
+	case 'P':
+		if (is_field("Package", line)) {
+			tmp = parse_simple("Package", line);
+			rec->name = index_add_string(b, tmp, 1);
+			if (rec->name)
+				index_add_field(b, PIT_PACKAGE)->a = rec->name;
+			free(tmp);
+		} else if (is_field("Priority", line))
+			index_add_str_field(b, PIT_PRIORITY, line + strlen("Priority") + 1, 1);
+		else if (is_field("Provides", line))
+			index_add_namelist(b, PIT_PROVIDES, line + strlen("Provides") + 1);
+		else if (is_field("Pre-Depends", line))
+			index_add_deplist(b, PIT_PRE_DEPENDS, PREDEPEND, line + strlen("Pre-Depends") + 1);
+		break;
+
+	case 'R':
+		if (is_field("Recommends", line))
+			index_add_deplist(b, PIT_RECOMMENDS, RECOMMEND, line + strlen("Recommends") + 1);
+		else if (is_field("Replaces", line))
+			index_add_namelist(b, PIT_REPLACES, line + strlen("Replaces") + 1);
+		break;
+
+	case 'S':
+		if (is_field("Section", line))
+			index_add_str_field(b, PIT_SECTION, line + strlen("Section") + 1, 1);
+		else if (is_field("SHA256sum", line))
+			index_add_str_field(b, PIT_SHA256SUM, line + strlen("SHA256sum") + 1, 0);
+		else if (is_field("Size", line))
+			index_add_field(b, PIT_SIZE)->a = strtoul(line + strlen("Size") + 1, NULL, 0);
+		else if (is_field("Source", line))
+			index_add_str_field(b, PIT_SOURCE, line + strlen("Source") + 1, 1);
+		else if (is_field("Status", line))
+			b->unsupported = 1;
+		else if (is_field("Suggests", line))
+			index_add_deplist(b, PIT_SUGGESTS, SUGGEST, line + strlen("Suggests") + 1);
+		break;
+
+	case 'T':
+		if (is_field("Tags", line))
+			index_add_str_field(b, PIT_TAGS, line + strlen("Tags") + 1, 1);
+		break;
+
+	case 'V':
+		if (is_field("Version", line))
+			index_add_version(b, line);
+		break;
+
+	case ' ':
+		if (b->reading_description) {
+			/* joined with '\n', which the loader drops unless
+			 * stdout is a tty, as pkg_parse_line() does */
+			sprintf_alloc(&tmp, "%s\n%s",
+				      b->description ? b->description : "",
+				      line);
+			free(b->description);
+			b->description = tmp;
+			return 0;
+		}
+
+		/* FALLTHROUGH */
+	default:
+		if (line_is_blank(line))
+			ret = 1;
+		break;
+	}
+
+	if (b->reading_description && b->description) {
+		index_add_str_field(b, PIT_DESCRIPTION, b->description, 0);
+		free(b->description);
+		b->reading_description = 0;
+		b->description = NULL;
+	}
+
+	return ret;
+}
+
+static void index_begin_record(struct index_builder *b)
+{
+	struct pkg_index_record *rec;
+
+	if (b->n_recs == b->a_recs) {
+		b->a_recs = b->a_recs ? b->a_recs * 2 : 256;
+		b->recs = xrealloc(b->recs, b->a_recs * sizeof(*b->recs));
+	}
+
+	rec = &b->recs[b->n_recs++];
+	memset(rec, 0, sizeof(*rec));
+	rec->first_field = b->n_fields;
+}
+
+static void index_end_record(struct index_builder *b)
+{
+	struct pkg_index_record *rec = &b->recs[b->n_recs - 1];
+
+	/* stanzas without a name are dropped by the text parser as well */
+	if (!rec->name) {
+		b->n_fields = rec->first_field;
+		b->n_recs--;
+	}
+}
+
+static int index_save(struct index_builder *b, struct pkg_index_header *hdr,
+		      const char *index_file)
+{
+	char *tmp_file;
+	FILE *fp;
+	int ret = 0;
+
+	sprintf_alloc(&tmp_file, "%s.tmp", index_file);
+
+	fp = fopen(tmp_file, "w");
+	if (!fp) {
+		opkg_perror(ERROR, "Failed to open %s", tmp_file);
+		free(tmp_file);
+		return -1;
+	}
+
+	if (fwrite(hdr, sizeof(*hdr), 1, fp) != 1
+	    || fwrite(b->recs, sizeof(*b->recs), b->n_recs, fp) != b->n_recs
+	    || fwrite(b->fields, sizeof(*b->fields), b->n_fields, fp) != b->n_fields
+	    || fwrite(b->edges, sizeof(*b->edges), b->n_edges, fp) != b->n_edges
+	    || fwrite(b->strtab, 1, b->strtab_len, fp) != b->strtab_len) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		ret = -1;
+	}
+
+	if (fclose(fp) && !ret) {
+		opkg_perror(ERROR, "Failed to write %s", tmp_file);
+		ret = -1;
+	}
+
+	if (!ret && rename(tmp_file, index_file)) {
+		opkg_perror(ERROR, "Failed to rename %s to %s",
+			    tmp_file, index_file);
+		ret = -1;
+	}
+
+	if (ret)
+		unlink(tmp_file);
+
+	free(tmp_file);
+
+	return ret;
+}
+
+/*
+ * Builds the binary index for list_file, as downloaded by "opkg update".
+ * On failure no index is left behind and the text list is used as before.
+ * Returns 1 if the list has fields the index does not cover.
+ */
+int pkg_index_write(const char *list_file, const char *index_file, int gzip)
+{
+	struct index_builder b;
+	struct pkg_index_header hdr;
+	struct gzip_handle zh;
+	struct stat st;
+	const size_t len = 4096;
+	char *buf;
+	FILE *fp;
+	int ret = 0;
+
+	unlink(index_file);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PKG_INDEX_MAGIC, sizeof(PKG_INDEX_MAGIC));
+	hdr.version = PKG_INDEX_VERSION;
+	hdr.byte_order = PKG_INDEX_BYTE_ORDER;
+
+	if (stat(list_file, &st) || index_file_hash(list_file, &hdr.src_hash)) {
+		opkg_perror(ERROR, "Failed to read %s", list_file);
+		return -1;
+	}
+
+	hdr.src_size = st.st_size;
+	hdr.src_mtime = st.st_mtime;
+
+	if (gzip)
+		fp = gzip_fdopen(&zh, list_file);
+	else
+		fp = fopen(list_file, "r");
+
+	if (fp == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", list_file);
+		return -1;
+	}
+
+	memset(&b, 0, sizeof(b));
+	hash_table_init("index-strings", &b.strings,
+			OPKG_CONF_DEFAULT_HASH_LEN);
+	b.a_strtab = 4096;
+	b.strtab = xmalloc(b.a_strtab);
+	b.strtab[0] = '\0';
+	b.strtab_len = 1;
+
+	buf = xmalloc(len);
+
+	do {
+		index_begin_record(&b);
+		ret = parse_from_stream_nomalloc(index_parse_line, &b, fp, 0,
+						 &buf, len);
+		index_end_record(&b);
+	} while (!ret && !b.unsupported && !feof(fp));
+
+	free(buf);
+	fclose(fp);
+
+	if (gzip && gzip_close(&zh))
+		ret = -1;
+
+	if (!ret && b.unsupported) {
+		ret = 1;
+	} else if (!ret) {
+		hdr.n_records = b.n_recs;
+		hdr.n_fields = b.n_fields;
+		hdr.n_edges = b.n_edges;
+		hdr.strtab_len = b.strtab_len;
+
+		ret = index_save(&b, &hdr, index_file);
+	} else {
+		ret = -1;
+	}
+
+	free(b.description);
+	free(b.recs);
+	free(b.fields);
+	free(b.edges);
+	free(b.strtab);
+	hash_table_deinit(&b.strings);
+
+	return ret;
+}
+
+/*
+ * Indexes the list fetched for src, once it passed the signature check
+ * or is kept anyway. On failure the list is parsed as text.
+ */
+int pkg_index_update(const char *list_file, const pkg_src_t *src)
+{
+	char *index_file = pkg_index_file_name(list_file);
+	int ret;
+
+	/* lists with the fields of installed packages are not indexed */
+	ret = pkg_index_write(list_file, index_file, src->gzip);
+	if (ret == 1)
+		opkg_msg(INFO, "%s has fields not covered by the package "
+			 "index, it will be parsed as text.\n", src->name);
+	else if (ret)
+		opkg_msg(NOTICE, "Failed to build package index for %s, "
+			 "it will be parsed as text.\n", src->name);
+
+	free(index_file);
+
+	return ret;
+}
+
+static int index_is_list_tag(int tag)
+{
+	switch (tag) {
+	case PIT_CONFLICTS:
+	case PIT_DEPENDS:
+	case PIT_PRE_DEPENDS:
+	case PIT_RECOMMENDS:
+	case PIT_SUGGESTS:
+	case PIT_PROVIDES:
+	case PIT_REPLACES:
+		return 1;
+	}
+
+	return 0;
+}
+
+static int index_is_int_tag(int tag)
+{
+	switch (tag) {
+	case PIT_ESSENTIAL:
+	case PIT_INSTALLED_SIZE:
+	case PIT_SIZE:
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Checks that every string offset and field or edge range in the mapping
+ * is in bounds and that the index still describes list_file, so that
+ * pkg_index_get() can follow them as they are.
+ */
+static int index_validate(const void *map, size_t size, const char *list_file)
+{
+	const struct pkg_index_header *hdr = map;
+	const struct pkg_index_record *recs;
+	const struct pkg_index_field *fields;
+	const struct pkg_index_edge *edges;
+	const char *strtab;
+	struct stat st;
+	uint64_t expect, hash;
+	uint32_t i;
+
+	if (size < sizeof(*hdr)
+	    || memcmp(hdr->magic, PKG_INDEX_MAGIC, sizeof(PKG_INDEX_MAGIC))
+	    || hdr->version != PKG_INDEX_VERSION
+	    || hdr->byte_order != PKG_INDEX_BYTE_ORDER)
+		return -1;
+
+	expect = sizeof(*hdr)
+	    + (uint64_t)hdr->n_records * sizeof(*recs)
+	    + (uint64_t)hdr->n_fields * sizeof(*fields)
+	    + (uint64_t)hdr->n_edges * sizeof(*edges)
+	    + hdr->strtab_len;
+
+	if (expect != size || hdr->strtab_len == 0)
+		return -1;
+
+	if (stat(list_file, &st)
+	    || (uint64_t)st.st_size != hdr->src_size
+	    || (int64_t)st.st_mtime != hdr->src_mtime)
+		return -1;
+
+	recs = (const void *)(hdr + 1);
+	fields = (const void *)(recs + hdr->n_records);
+	edges = (const void *)(fields + hdr->n_fields);
+	strtab = (const char *)(edges + hdr->n_edges);
+
+	if (strtab[0] != '\0' || strtab[hdr->strtab_len - 1] != '\0')
+		return -1;
+
+	for (i = 0; i < hdr->n_records; i++)
+		if ((uint64_t)recs[i].first_field + recs[i].n_fields > hdr->n_fields
+		    || recs[i].name >= hdr->strtab_len)
+			return -1;
+
+	for (i = 0; i < hdr->n_fields; i++) {
+		const struct pkg_index_field *f = &fields[i];
+
+		if (f->tag == 0 || f->tag >= __PIT_MAX)
+			return -1;
+
+		if (index_is_list_tag(f->tag)) {
+			if ((uint64_t)f->a + f->count > hdr->n_edges)
+				return -1;
+		} else if (!index_is_int_tag(f->tag)) {
+			if (f->a >= hdr->strtab_len || f->b >= hdr->strtab_len)
+				return -1;
+		}
+	}
+
+	for (i = 0; i < hdr->n_edges; i++)
+		if (edges[i].name >= hdr->strtab_len
+		    || edges[i].version >= hdr->strtab_len
+		    || edges[i].key >= hdr->strtab_len)
+			return -1;
+
+	if (index_file_hash(list_file, &hash) || hash != hdr->src_hash)
+		return -1;
+
+	return 0;
+}
+
+struct pkg_index {
+	void *map;
+	size_t size;
+	const struct pkg_index_header *hdr;
+	const struct pkg_index_record *recs;
+	const struct pkg_index_field *fields;
+	const struct pkg_index_edge *edges;
+	const char *strtab;
+	const char **names;
+	uint32_t n_names;
+};
+
+/*
+ * Maps the binary index of a feed. Returns NULL if the index is missing
+ * or stale, in which case the caller parses the text list instead.
+ */
+struct pkg_index *pkg_index_open(const char *index_file, const char *list_file)
+{
+	struct pkg_index *idx;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(index_file, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	if (index_validate(map, st.st_size, list_file)) {
+		opkg_msg(DEBUG, "Index %s is stale, parsing %s.\n",
+			 index_file, list_file);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->map = map;
+	idx->size = st.st_size;
+	idx->hdr = map;
+	idx->recs = (const void *)(idx->hdr + 1);
+	idx->fields = (const void *)(idx->recs + idx->hdr->n_records);
+	idx->edges = (const void *)(idx->fields + idx->hdr->n_fields);
+	idx->strtab = (const char *)(idx->edges + idx->hdr->n_edges);
+
+	return idx;
+}
+
+void pkg_index_close(struct pkg_index *idx)
+{
+	if (!idx)
+		return;
+
+	munmap(idx->map, idx->size);
+	free(idx->names);
+	free(idx);
+}
+
+uint32_t pkg_index_count(const struct pkg_index *idx)
+{
+	return idx->hdr->n_records;
+}
+
+/*
+ * Replays record i of the index into a new package, with the same side
+ * effects as parsing its stanza. Returns NULL if the record has no name.
+ */
+pkg_t *pkg_index_get(struct pkg_index *idx, uint32_t i, pkg_src_t *src,
+		     int state_flags)
+{
+	const struct pkg_index_record *rec = &idx->recs[i];
+	const struct pkg_index_field *f;
+	const struct pkg_index_edge *edges = idx->edges, *e;
+	const char *strtab = idx->strtab;
+	compound_depend_t *cdep;
+	abstract_pkg_t *ab_pkg;
+	char *tmp, *p, *q;
+	uint32_t j;
+	uint mask;
+	pkg_t *pkg;
+
+	mask = conf->pfm ^ PFM_ALL;
+
+	pkg = pkg_new();
+	pkg->src = src;
+	pkg->dest = NULL;
+	pkg->state_flag |= state_flags;
+
+	for (j = 0; j < rec->n_fields; j++) {
+		f = &idx->fields[rec->first_field + j];
+
+		if (!(mask & pit_mask[f->tag]))
+			continue;
+
+		switch (f->tag) {
+		case PIT_PACKAGE:
+			free(pkg->name);
+			pkg->name = xstrdup(strtab + f->a);
+			ab_pkg = abstract_pkg_fetch_by_name(pkg->name);
+
+			if (ab_pkg && (ab_pkg->state_flag & SF_NEED_DETAIL)) {
+				if (!(pkg->state_flag & SF_NEED_DETAIL)) {
+					opkg_msg(DEBUG, "propagating abpkg flag to pkg %s\n", pkg->name);
+					pkg->state_flag |= SF_NEED_DETAIL;
+				}
+			}
+			break;
+
+		case PIT_ABIVERSION:
+			pkg_set_string(pkg, PKG_ABIVERSION, strtab + f->a);
+			break;
+
+		case PIT_ALTERNATIVES:
+			tmp = xstrdup(strtab + f->a);
+			parse_alternatives(pkg, tmp);
+			free(tmp);
+			break;
+
+		case PIT_ARCHITECTURE:
+			pkg_set_architecture(pkg, strtab + f->a,
+					     strlen(strtab + f->a));
+			break;
+
+		case PIT_CONFLICTS:
+		case PIT_DEPENDS:
+		case PIT_PRE_DEPENDS:
+		case PIT_RECOMMENDS:
+		case PIT_SUGGESTS:
+			cdep = pkg_add_compound_depend(pkg, f->type, f->count);
+			if (!cdep)
+				break;
+
+			for (e = edges + f->a; e < edges + f->a + f->count; e++) {
+				depend_t *d = cdep->possibilities[e - edges - f->a];
+
+				d->pkg = ensure_abstract_pkg_by_name(strtab + e->name);
+				d->constraint = e->constraint & ~PIE_HAS_VERSION;
+
+				if (e->constraint & PIE_HAS_VERSION)
+					depend_set_version(d, strtab + e->version,
+							   strtab + e->key);
+			}
+			break;
+
+		case PIT_PROVIDES:
+		case PIT_REPLACES:
+			if (f->count > idx->n_names) {
+				idx->n_names = f->count;
+				idx->names = xrealloc(idx->names,
+						      idx->n_names * sizeof(*idx->names));
+			}
+
+			for (e = edges + f->a; e < edges + f->a + f->count; e++)
+				idx->names[e - edges - f->a] = strtab + e->name;
+
+			if (f->tag == PIT_PROVIDES)
+				pkg_add_provides(pkg, idx->names, f->count);
+			else
+				pkg_add_replaces(pkg, idx->names, f->count);
+			break;
+
+		case PIT_DESCRIPTION:
+			if (isatty(1)) {
+				pkg_set_string(pkg, PKG_DESCRIPTION, strtab + f->a);
+				break;
+			}
+
+			tmp = xstrdup(strtab + f->a);
+			for (p = q = tmp; *p; p++)
+				if (*p != '\n')
+					*q++ = *p;
+			*q = '\0';
+			pkg_set_string(pkg, PKG_DESCRIPTION, tmp);
+			free(tmp);
+			break;
+
+		case PIT_ESSENTIAL:
+			pkg->essential = 1;
+			break;
+
+		case PIT_FILENAME:
+			pkg_set_string(pkg, PKG_FILENAME, strtab + f->a);
+			break;
+
+		case PIT_INSTALLED_SIZE:
+			pkg_set_int(pkg, PKG_INSTALLED_SIZE, f->a);
+			break;
+
+		case PIT_MD5SUM:
+			pkg_set_md5(pkg, strtab + f->a);
+			break;
+
+		case PIT_MAINTAINER:
+			pkg_set_string(pkg, PKG_MAINTAINER, strtab + f->a);
+			break;
+
+		case PIT_PRIORITY:
+			pkg_set_string(pkg, PKG_PRIORITY, strtab + f->a);
+			break;
+
+		case PIT_SECTION:
+			pkg_set_string(pkg, PKG_SECTION, strtab + f->a);
+			break;
+
+		case PIT_SHA256SUM:
+			pkg_set_sha256(pkg, strtab + f->a);
+			break;
+
+		case PIT_SIZE:
+			pkg_set_int(pkg, PKG_SIZE, f->a);
+			break;
+
+		case PIT_SOURCE:
+			pkg_set_string(pkg, PKG_SOURCE, strtab + f->a);
+			break;
+
+		case PIT_TAGS:
+			pkg_set_string(pkg, PKG_TAGS, strtab + f->a);
+			break;
+
+		case PIT_VERSION:
+			if (f->type)
+				pkg_set_int(pkg, PKG_EPOCH, f->c);
+			if (f->b)
+				pkg_set_string(pkg, PKG_REVISION, strtab + f->b);
+			pkg_set_string(pkg, PKG_VERSION, strtab + f->a);
+			break;
+
+		case PIT_VERSION_KEY:
+			pkg_set_version_key(pkg, strtab + f->a);
+			break;
+		}
+	}
+
+	if (pkg->name == NULL) {
+		pkg_free(pkg);
+		return NULL;
+	}
+
+	return pkg;
+}
@@ -0,0 +1,129 @@
+/* pkg_index.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_INDEX_H
+#define PKG_INDEX_H
+
+#include <stdint.h>
+
+#include "pkg.h"
+#include "pkg_src.h"
+
+/*
+ * Binary feed index, written next to each lists_dir/<src> file by
+ * "opkg update" and mmapped by pkg_hash_load_feeds(). Records can be
+ * replayed in any order, for loading single packages of a feed.
+ *
+ * Layout: header, records[n_records], fields[n_fields], edges[n_edges],
+ * strtab[strtab_len]. All integers are in host byte order; an index
+ * written on a host of different byte order is treated as stale.
+ *
+ * Every record describes one package stanza as a run of fields kept in
+ * their original order, so replaying them has the same side effects as
+ * parsing the text stanza. Dependency style fields reference runs of
+ * pre-split edges. Strings are offsets into the NUL terminated string
+ * table, where offset 0 is the empty string. Versions, of packages and
+ * of edges, come with their version key so loading needs not encode it.
+ */
+
+#define PKG_INDEX_MAGIC		"OPKGIDX"
+#define PKG_INDEX_VERSION	2
+#define PKG_INDEX_BYTE_ORDER	0x01020304
+
+struct pkg_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t src_size;
+	int64_t src_mtime;
+	uint64_t src_hash;
+	uint32_t n_records;
+	uint32_t n_fields;
+	uint32_t n_edges;
+	uint32_t strtab_len;
+};
+
+struct pkg_index_record {
+	uint32_t name;
+	uint32_t first_field;
+	uint32_t n_fields;
+	uint32_t reserved;
+};
+
+enum pkg_index_tag {
+	PIT_PACKAGE = 1,
+	PIT_ABIVERSION,
+	PIT_ALTERNATIVES,
+	PIT_ARCHITECTURE,
+	PIT_CONFLICTS,
+	PIT_DEPENDS,
+	PIT_DESCRIPTION,
+	PIT_ESSENTIAL,
+	PIT_FILENAME,
+	PIT_INSTALLED_SIZE,
+	PIT_MD5SUM,
+	PIT_MAINTAINER,
+	PIT_PRIORITY,
+	PIT_PROVIDES,
+	PIT_PRE_DEPENDS,
+	PIT_RECOMMENDS,
+	PIT_REPLACES,
+	PIT_SECTION,
+	PIT_SHA256SUM,
+	PIT_SIZE,
+	PIT_SOURCE,
+	PIT_SUGGESTS,
+	PIT_TAGS,
+	PIT_VERSION,
+	PIT_VERSION_KEY,
+	__PIT_MAX
+};
+
+/*
+ * tag       type          count     a          b          c
+ * strings   -             -         string     -          -
+ * integers  -             -         value      -          -
+ * depends   depend_type   #edges    1st edge   -          -
+ * provides  -             #edges    1st edge   -          -
+ * version   has epoch     -         version    revision   epoch
+ * key       -             -         key        -          -
+ */
+struct pkg_index_field {
+	uint8_t tag;
+	uint8_t type;
+	uint16_t count;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+};
+
+struct pkg_index_edge {
+	uint32_t name;
+	uint32_t version;
+	uint32_t key;
+	uint32_t constraint;
+};
+
+struct pkg_index;
+
+char *pkg_index_file_name(const char *list_file);
+int pkg_index_write(const char *list_file, const char *index_file, int gzip);
+int pkg_index_update(const char *list_file, const pkg_src_t *src);
+
+struct pkg_index *pkg_index_open(const char *index_file, const char *list_file);
+void pkg_index_close(struct pkg_index *idx);
+uint32_t pkg_index_count(const struct pkg_index *idx);
+pkg_t *pkg_index_get(struct pkg_index *idx, uint32_t i, pkg_src_t *src,
+		     int state_flags);
+
+#endif
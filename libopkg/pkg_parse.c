@@ -93,6 +93,8 @@ int parse_version(pkg_t * pkg, const char *vstr)
 	pkg_set_string(pkg, PKG_VERSION, dup);
 	free(dup);
 
+	pkg_set_version_key(pkg, NULL);
+
 	return 0;
 }
 
@@ -112,7 +114,7 @@ static char *parse_architecture(pkg_t *pkg, const char *str)
 	return pkg_set_architecture(pkg, s, e - s);
 }
 
-static void parse_alternatives(pkg_t *pkg, char *list)
+void parse_alternatives(pkg_t *pkg, char *list)
 {
 	char *item, *tok;
 	struct pkg_alternatives *pkg_alts;
@@ -21,6 +21,7 @@
 #include "pkg.h"
 
 int parse_version(pkg_t * pkg, const char *raw);
+void parse_alternatives(pkg_t *pkg, char *list);
 int pkg_parse_from_stream(pkg_t * pkg, FILE * fp, uint mask);
 int pkg_parse_line(void *ptr, char *line, uint mask);
 
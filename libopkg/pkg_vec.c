@@ -22,6 +22,18 @@
 #include "opkg_message.h"
 #include "libbb/libbb.h"
 
+/*
+ * Vectors only ever grow, so their arrays are kept at a power of two
+ * and only need reallocating when len reaches one.
+ */
+static void *vec_grow(void *pkgs, unsigned int len, size_t size)
+{
+	if (len & (len - 1))
+		return pkgs;
+
+	return xrealloc(pkgs, (len ? 2 * len : 1) * size);
+}
+
 pkg_vec_t *pkg_vec_alloc(void)
 {
 	pkg_vec_t *vec = xcalloc(1, sizeof(pkg_vec_t));
@@ -65,12 +77,13 @@ void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status)
 			 vec->pkgs[i]->name, pkg_get_string(vec->pkgs[i], PKG_VERSION),
 			 vec_architecture);
 		/* if the name,ver,arch matches, or the name matches and the
-		 * package is marked deinstall/hold  */
+		 * package is marked deinstall/hold; architecture strings are
+		 * shared from conf->arch_list and compare by pointer */
 		if ((!strcmp(pkg->name, vec->pkgs[i]->name))
 		    && ((pkg->state_want == SW_DEINSTALL
 			 && (pkg->state_flag & SF_HOLD))
 			|| ((pkg_compare_versions(pkg, vec->pkgs[i]) == 0)
-			    && (!strcmp(pkg_architecture, vec_architecture))))) {
+			    && (pkg_architecture == vec_architecture)))) {
 			found = 1;
 			opkg_msg(DEBUG2,
 				 "Duplicate for pkg=%s version=%s arch=%s.\n",
@@ -96,15 +109,15 @@ void pkg_vec_insert_merge(pkg_vec_t * vec, pkg_t * pkg, int set_status)
 		pkg_merge(pkg, vec->pkgs[i]);
 	}
 
-	/* overwrite the old one */
-	pkg_deinit(vec->pkgs[i]);
-	free(vec->pkgs[i]);
+	/* overwrite the old one, taking its place in the package graph */
+	pkg->graph_id = vec->pkgs[i]->graph_id;
+	pkg_free(vec->pkgs[i]);
 	vec->pkgs[i] = pkg;
 }
 
 void pkg_vec_insert(pkg_vec_t * vec, const pkg_t * pkg)
 {
-	vec->pkgs = xrealloc(vec->pkgs, (vec->len + 1) * sizeof(pkg_t *));
+	vec->pkgs = vec_grow(vec->pkgs, vec->len, sizeof(pkg_t *));
 	vec->pkgs[vec->len] = (pkg_t *) pkg;
 	vec->len++;
 }
@@ -185,8 +198,7 @@ void abstract_pkg_vec_free(abstract_pkg_vec_t * vec)
  */
 void abstract_pkg_vec_insert(abstract_pkg_vec_t * vec, abstract_pkg_t * pkg)
 {
-	vec->pkgs =
-	    xrealloc(vec->pkgs, (vec->len + 1) * sizeof(abstract_pkg_t *));
+	vec->pkgs = vec_grow(vec->pkgs, vec->len, sizeof(abstract_pkg_t *));
 	vec->pkgs[vec->len] = pkg;
 	vec->len++;
 }
@@ -326,25 +326,12 @@ sha256_process_bytes(const void *buffer, size_t len, struct sha256_ctx *ctx)
 		len -= add;
 	}
 
-	/* Process available complete blocks.  */
+	/* Process available complete blocks, the back ends all read the
+	   words of unaligned buffers themselves.  */
 	if (len >= 64) {
-#if !_STRING_ARCH_unaligned
-#define alignof(type) offsetof (struct { char c; type x; }, x)
-#define UNALIGNED_P(p) (((size_t) p) % alignof (uint32_t) != 0)
-		if (UNALIGNED_P(buffer))
-			while (len > 64) {
-				sha256_process_block(memcpy
-						     (ctx->buffer, buffer, 64),
-						     64, ctx);
-				buffer = (const char *)buffer + 64;
-				len -= 64;
-		} else
-#endif
-		{
-			sha256_process_block(buffer, len & ~63, ctx);
-			buffer = (const char *)buffer + (len & ~63);
-			len &= 63;
-		}
+		sha256_process_block(buffer, len & ~63, ctx);
+		buffer = (const char *)buffer + (len & ~63);
+		len &= 63;
 	}
 
 	/* Move remaining bytes in internal buffer.  */
@@ -393,12 +380,12 @@ static const uint32_t sha256_round_constants[64] = {
    It is assumed that LEN % 64 == 0.
    Most of this code comes from GnuPG's cipher/sha1.c.  */
 
-void
-sha256_process_block(const void *buffer, size_t len, struct sha256_ctx *ctx)
+static void
+sha256_process_block_generic(const void *buffer, size_t len,
+			     struct sha256_ctx *ctx)
 {
-	const uint32_t *words = buffer;
-	size_t nwords = len / sizeof(uint32_t);
-	const uint32_t *endp = words + nwords;
+	const unsigned char *words = buffer;
+	const unsigned char *endp = words + len;
 	uint32_t x[16];
 	uint32_t a = ctx->state[0];
 	uint32_t b = ctx->state[1];
@@ -440,8 +427,9 @@ sha256_process_block(const void *buffer, size_t len, struct sha256_ctx *ctx)
 		int t;
 		/* FIXME: see sha1.c for a better implementation.  */
 		for (t = 0; t < 16; t++) {
-			x[t] = SWAP(*words);
-			words++;
+			memcpy(&x[t], words, sizeof(x[t]));
+			x[t] = SWAP(x[t]);
+			words += sizeof(x[t]);
 		}
 
 		R(a, b, c, d, e, f, g, h, K(0), x[0]);
@@ -519,3 +507,239 @@ sha256_process_block(const void *buffer, size_t len, struct sha256_ctx *ctx)
 		h = ctx->state[7] += h;
 	}
 }
+
+/* The round loops of the back ends below only keep the message words in
+   registers once unrolled, which -Os does not do by itself.  */
+#if defined(__GNUC__) && __GNUC__ >= 8
+#define SHA256_UNROLL _Pragma("GCC unroll 16")
+#else
+#define SHA256_UNROLL
+#endif
+
+/* Increment the byte count of CTX like sha256_process_block_generic().  */
+static void sha256_count(size_t len, struct sha256_ctx *ctx)
+{
+	ctx->total[0] += len;
+	if (ctx->total[0] < len)
+		++ctx->total[1];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* The SHA extensions, with SSSE3 and SSE4.1 for shuffling the state.  */
+static int sha256_shani_supported(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3)
+	    || !(c & bit_SSE4_1))
+		return 0;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return (b >> 29) & 1;
+}
+
+__attribute__ ((target("sha,ssse3,sse4.1")))
+static void
+sha256_process_block_shani(const void *buffer, size_t len,
+			   struct sha256_ctx *ctx)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	const unsigned char *p = buffer;
+	__m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+	int i;
+
+	sha256_count(len, ctx);
+
+	/* the instructions keep the state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) & ctx->state[0]),
+				0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) & ctx->state[4]),
+				   0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; len >= 64; len -= 64, p += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		/* four rounds at a time, w[i & 3] holds words 4i to 4i + 3 */
+		SHA256_UNROLL
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128
+							((__m128i *) (p + i * 16)),
+							mask);
+			} else {
+				tmp = _mm_alignr_epi8(w[(i - 1) & 3],
+						      w[(i - 2) & 3], 4);
+				w[i & 3] = _mm_sha256msg1_epu32(w[i & 3],
+								w[(i - 3) & 3]);
+				w[i & 3] = _mm_add_epi32(w[i & 3], tmp);
+				w[i & 3] = _mm_sha256msg2_epu32(w[i & 3],
+								w[(i - 1) & 3]);
+			}
+
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128
+					    ((__m128i *) & K(i * 4)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *) & ctx->state[0], state0);
+	_mm_storeu_si128((__m128i *) & ctx->state[4], state1);
+}
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) \
+	|| (defined(__GNUC__) && !defined(__clang__)))
+#define SHA256_ARMV8 1
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+#ifndef __ARM_FEATURE_CRYPTO
+#pragma GCC push_options
+#pragma GCC target ("+crypto")
+#endif
+#include <arm_neon.h>
+
+static void
+sha256_process_block_armv8(const void *buffer, size_t len,
+			   struct sha256_ctx *ctx)
+{
+	const unsigned char *p = buffer;
+	uint32x4_t state0, state1, abcd, efgh, msg, tmp, w[4];
+	int i;
+
+	sha256_count(len, ctx);
+
+	state0 = vld1q_u32(&ctx->state[0]);
+	state1 = vld1q_u32(&ctx->state[4]);
+
+	for (; len >= 64; len -= 64, p += 64) {
+		abcd = state0;
+		efgh = state1;
+
+		/* four rounds at a time, w[i & 3] holds words 4i to 4i + 3 */
+		SHA256_UNROLL
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				w[i] = vreinterpretq_u32_u8(vrev32q_u8
+							    (vld1q_u8(p + i * 16)));
+			else
+				w[i & 3] = vsha256su1q_u32(vsha256su0q_u32
+							   (w[i & 3],
+							    w[(i - 3) & 3]),
+							   w[(i - 2) & 3],
+							   w[(i - 1) & 3]);
+
+			msg = vaddq_u32(w[i & 3], vld1q_u32(&K(i * 4)));
+			tmp = state0;
+			state0 = vsha256hq_u32(state0, state1, msg);
+			state1 = vsha256h2q_u32(state1, tmp, msg);
+		}
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+	}
+
+	vst1q_u32(&ctx->state[0], state0);
+	vst1q_u32(&ctx->state[4], state1);
+}
+
+#ifndef __ARM_FEATURE_CRYPTO
+#pragma GCC pop_options
+#endif
+
+static int sha256_armv8_supported(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+#endif
+
+static int sha256_generic_supported(void)
+{
+	return 1;
+}
+
+/* Back ends of sha256_process_block(), the fastest first.  */
+static const struct sha256_backend {
+	const char *name;
+	int (*supported) (void);
+	void (*process_block) (const void *buffer, size_t len,
+			       struct sha256_ctx * ctx);
+} sha256_backends_all[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "shani", sha256_shani_supported, sha256_process_block_shani },
+#endif
+#ifdef SHA256_ARMV8
+	{ "armv8", sha256_armv8_supported, sha256_process_block_armv8 },
+#endif
+	{ "generic", sha256_generic_supported, sha256_process_block_generic },
+};
+
+#define SHA256_N_BACKENDS \
+	(sizeof(sha256_backends_all) / sizeof(sha256_backends_all[0]))
+
+static const struct sha256_backend *sha256_backend;
+
+int sha256_set_backend(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < SHA256_N_BACKENDS; i++) {
+		const struct sha256_backend *b = &sha256_backends_all[i];
+
+		if ((!name || !strcmp(name, b->name)) && b->supported()) {
+			sha256_backend = b;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+const char *sha256_get_backend(void)
+{
+	if (!sha256_backend)
+		sha256_set_backend(NULL);
+
+	return sha256_backend->name;
+}
+
+const char *sha256_backend_name(int i)
+{
+	if (i < 0 || (size_t)i >= SHA256_N_BACKENDS)
+		return NULL;
+
+	return sha256_backends_all[i].name;
+}
+
+void
+sha256_process_block(const void *buffer, size_t len, struct sha256_ctx *ctx)
+{
+	if (!sha256_backend)
+		sha256_set_backend(NULL);
+
+	sha256_backend->process_block(buffer, len, ctx);
+}
@@ -42,6 +42,16 @@ extern void sha224_init_ctx(struct sha256_ctx *ctx);
 extern void sha256_process_block(const void *buffer, size_t len,
 				 struct sha256_ctx *ctx);
 
+/* sha256_process_block() runs on the fastest back end the CPU supports:
+   "shani" (x86 SHA extensions), "armv8" (ARMv8 crypto extensions) or the
+   portable "generic" one.  sha256_set_backend() selects one by name, or
+   the default one if NAME is NULL, and returns -1 if it is not supported.
+   sha256_backend_name() enumerates the back ends built in, whether
+   supported or not, returning NULL after the last.  */
+extern int sha256_set_backend(const char *name);
+extern const char *sha256_get_backend(void);
+extern const char *sha256_backend_name(int i);
+
 /* Starting with the result of former calls of this function (or the
    initialization function update the context for the next LEN bytes
    starting at BUFFER.
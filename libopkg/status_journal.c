@@ -0,0 +1,569 @@
+/* status_journal.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "status_journal.h"
+#include "pkg_hash.h"
+#include "pkg_parse.h"
+#include "parse_util.h"
+#include "hash_table.h"
+#include "opkg_message.h"
+#include "opkg_utils.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/* the packages of a status file with its journal replayed on top */
+struct status_list {
+	pkg_t **pkgs;
+	char **stanzas;		/* as pkg_status_stanza() prints them */
+	char **keys;
+	int len;
+	/* key -> index + 1 */
+	hash_table_t index;
+};
+
+/* We don't need most uninstalled packages in the status file */
+int pkg_status_is_recorded(pkg_t *pkg)
+{
+	return !(pkg->state_status == SS_NOT_INSTALLED
+		 && (pkg->state_want == SW_UNKNOWN
+		     || (pkg->state_want == SW_DEINSTALL
+			 && pkg->state_flag != SF_HOLD)
+		     || pkg->state_want == SW_PURGE));
+}
+
+char *status_journal_file_name(pkg_dest_t *dest)
+{
+	char *file_name;
+
+	sprintf_alloc(&file_name, "%s.journal", dest->status_file_name);
+
+	return file_name;
+}
+
+static char *read_whole_file(const char *file_name, size_t *len)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t n, alloc = 0;
+
+	*len = 0;
+
+	fp = fopen(file_name, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			opkg_perror(ERROR, "Failed to open %s", file_name);
+		return NULL;
+	}
+
+	do {
+		if (*len + 4096 + 1 > alloc) {
+			alloc = alloc ? alloc * 2 : 16384;
+			buf = xrealloc(buf, alloc);
+		}
+
+		n = fread(buf + *len, 1, alloc - *len - 1, fp);
+		*len += n;
+	} while (n > 0);
+
+	if (ferror(fp))
+		opkg_perror(ERROR, "Failed to read %s", file_name);
+
+	fclose(fp);
+	buf[*len] = '\0';
+
+	return buf;
+}
+
+/*
+ * A stanza is identified by its Package, Version and Architecture lines,
+ * matching what pkg_vec_insert_merge() considers the same package.
+ */
+static char *stanza_key(const char *stanza)
+{
+	static const char *const fields[] = {
+		"Package:", "Version:", "Architecture:"
+	};
+	const char *line, *nl;
+	char *key = NULL, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fields); i++) {
+		for (line = stanza; *line; line = nl + 1) {
+			nl = strchr(line, '\n');
+			if (!nl)
+				nl = line + strlen(line);
+
+			if (!strncmp(line, fields[i], strlen(fields[i]))) {
+				sprintf_alloc(&tmp, "%s%s%.*s",
+					      key ? key : "", key ? "\n" : "",
+					      (int)(nl - line), line);
+				free(key);
+				key = tmp;
+				break;
+			}
+
+			if (!*nl)
+				break;
+		}
+
+		/* no Package line, nothing to identify the stanza by */
+		if (i == 0 && !key)
+			return NULL;
+	}
+
+	return key;
+}
+
+static char *pkg_status_stanza(pkg_t *pkg)
+{
+	char *stanza;
+	size_t len;
+	FILE *fp;
+
+	fp = open_memstream(&stanza, &len);
+	pkg_print_status(pkg, fp);
+	fclose(fp);
+
+	/* drop the blank separator line */
+	if (len > 0 && stanza[len - 1] == '\n')
+		stanza[len - 1] = '\0';
+
+	return stanza;
+}
+
+static void status_list_free_entry(struct status_list *list, int i)
+{
+	pkg_free(list->pkgs[i]);
+	free(list->stanzas[i]);
+	free(list->keys[i]);
+	list->pkgs[i] = NULL;
+}
+
+/* Replaces or drops the package with the same key as pkg, or adds it. */
+static void status_list_apply(struct status_list *list, pkg_t *pkg,
+			      int removed)
+{
+	char *stanza, *key;
+	int idx;
+
+	stanza = pkg_status_stanza(pkg);
+	key = stanza_key(stanza);
+	if (!key) {
+		pkg_free(pkg);
+		free(stanza);
+		return;
+	}
+
+	idx = (int)(uintptr_t)hash_table_get(&list->index, key);
+
+	if (removed) {
+		if (idx) {
+			status_list_free_entry(list, idx - 1);
+			hash_table_remove(&list->index, key);
+		}
+		pkg_free(pkg);
+		free(stanza);
+		free(key);
+		return;
+	}
+
+	if (idx) {
+		status_list_free_entry(list, idx - 1);
+	} else {
+		list->pkgs = xrealloc(list->pkgs,
+				      (list->len + 1) * sizeof(pkg_t *));
+		list->stanzas = xrealloc(list->stanzas,
+					 (list->len + 1) * sizeof(char *));
+		list->keys = xrealloc(list->keys,
+				      (list->len + 1) * sizeof(char *));
+		idx = ++list->len;
+		hash_table_insert(&list->index, key, (void *)(uintptr_t)idx);
+	}
+
+	list->pkgs[idx - 1] = pkg;
+	list->stanzas[idx - 1] = stanza;
+	list->keys[idx - 1] = key;
+}
+
+struct status_parse {
+	pkg_t *pkg;
+	int removed;
+};
+
+static int status_parse_line(void *ptr, char *line, uint mask)
+{
+	struct status_parse *sp = ptr;
+
+	if (is_field("Removed:", line)) {
+		sp->removed = 1;
+		return 0;
+	}
+
+	return pkg_parse_line(sp->pkg, line, mask);
+}
+
+/* Parses the stanzas of fp into list, each replacing the one before. */
+static int status_list_add_all(struct status_list *list, FILE *fp,
+			       pkg_dest_t *dest)
+{
+	struct status_parse sp;
+	const size_t len = 4096;
+	char *buf;
+	int ret = 0;
+
+	buf = xmalloc(len);
+
+	do {
+		sp.pkg = pkg_new();
+		sp.pkg->dest = dest;
+		sp.pkg->state_flag |= SF_NEED_DETAIL;
+		sp.removed = 0;
+
+		ret = parse_from_stream_nomalloc(status_parse_line, &sp, fp, 0,
+						 &buf, len);
+
+		if (ret || sp.pkg->name == NULL) {
+			pkg_free(sp.pkg);
+			if (ret == -1)
+				break;
+			/* probably just a blank line */
+			ret = 0;
+			continue;
+		}
+
+		status_list_apply(list, sp.pkg, sp.removed);
+	} while (!feof(fp));
+
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Returns the length of the complete stanzas at the start of buf. What
+ * follows the last blank line is a torn append.
+ */
+static size_t journal_complete_len(const char *buf, size_t len)
+{
+	while (len > 0 && !(buf[len - 1] == '\n' &&
+			    (len == 1 || buf[len - 2] == '\n')))
+		len--;
+
+	return len;
+}
+
+static void free_stanza(const char *key, void *entry, void *data)
+{
+	free(entry);
+}
+
+void status_journal_free(pkg_dest_t *dest)
+{
+	if (!dest->status_stanzas)
+		return;
+
+	hash_table_foreach(dest->status_stanzas, free_stanza, NULL);
+	hash_table_deinit(dest->status_stanzas);
+	free(dest->status_stanzas);
+	dest->status_stanzas = NULL;
+}
+
+static hash_table_t *status_stanzas_new(void)
+{
+	hash_table_t *stanzas = xcalloc(1, sizeof(*stanzas));
+
+	hash_table_init("status-stanzas", stanzas, OPKG_CONF_DEFAULT_HASH_LEN);
+
+	return stanzas;
+}
+
+/*
+ * Loads the status file of dest with its journal replayed on top and
+ * remembers every stanza so that status_journal_write() only needs to
+ * append the ones that changed. A torn append at the end of the journal
+ * is ignored and cut off, so the next append starts on a clean stanza.
+ */
+int status_journal_load(pkg_dest_t *dest, void (*cb)(pkg_t *, void *),
+			void *priv)
+{
+	struct status_list list;
+	char *journal_file, *buf;
+	size_t len, complete;
+	FILE *fp;
+	int i, ret = 0;
+
+	memset(&list, 0, sizeof(list));
+	hash_table_init("status-merge", &list.index, OPKG_CONF_DEFAULT_HASH_LEN);
+
+	fp = fopen(dest->status_file_name, "r");
+	if (fp) {
+		ret = status_list_add_all(&list, fp, dest);
+		fclose(fp);
+	} else if (errno != ENOENT) {
+		opkg_perror(ERROR, "Failed to open %s",
+			    dest->status_file_name);
+	}
+
+	journal_file = status_journal_file_name(dest);
+	buf = read_whole_file(journal_file, &len);
+	complete = buf ? journal_complete_len(buf, len) : 0;
+
+	if (complete > 0 && !ret) {
+		opkg_msg(DEBUG, "Replaying %zu bytes of %s.\n", complete,
+			 journal_file);
+		fp = fmemopen(buf, complete, "r");
+		if (fp == NULL) {
+			opkg_perror(ERROR, "Failed to read %s", journal_file);
+			ret = -1;
+		} else {
+			ret = status_list_add_all(&list, fp, dest);
+			fclose(fp);
+		}
+	}
+
+	if (complete < len && !conf->noaction) {
+		opkg_msg(NOTICE, "Dropping the incomplete last stanza of %s.\n",
+			 journal_file);
+		if (truncate(journal_file, complete) && errno != EACCES
+		    && errno != EROFS)
+			opkg_perror(ERROR, "Failed to truncate %s",
+				    journal_file);
+	}
+
+	free(buf);
+	free(journal_file);
+
+	hash_table_deinit(&list.index);
+
+	status_journal_free(dest);
+	dest->status_stanzas = status_stanzas_new();
+
+	for (i = 0; i < list.len; i++) {
+		if (!list.pkgs[i])
+			continue;
+
+		hash_table_insert(dest->status_stanzas, list.keys[i],
+				  list.stanzas[i]);
+		free(list.keys[i]);
+		pkg_hash_add_pkg(list.pkgs[i], 1, cb, priv);
+	}
+
+	free(list.pkgs);
+	free(list.stanzas);
+	free(list.keys);
+
+	return ret;
+}
+
+static int dest_index(pkg_dest_t *dest)
+{
+	pkg_dest_list_elt_t *iter;
+	int i = 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		if (iter->data == dest)
+			break;
+		i++;
+	}
+
+	return i;
+}
+
+struct journal_state {
+	pkg_dest_t *dest;
+	hash_table_t *current;
+};
+
+static void journal_write_removed(const char *key, void *entry, void *data)
+{
+	struct journal_state *state = data;
+
+	if (!hash_table_get(state->current, key))
+		fprintf(state->dest->status_fp, "Removed: yes\n%s\n\n", key);
+}
+
+/*
+ * Appends the status of every package that changed since the status was
+ * loaded or last written to the journal of its dest. Returns 1 if the
+ * journal has grown enough that the status files should be rewritten.
+ */
+int status_journal_write(void)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_dest_t *dest;
+	pkg_vec_t *all;
+	pkg_t *pkg;
+	hash_table_t **current;
+	struct journal_state state;
+	struct stat st_journal, st_status;
+	char *journal_file, *stanza, *key, *old;
+	int i, n_dests = 0, ret = 0, compact = 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node)
+		n_dests++;
+
+	current = xcalloc(n_dests, sizeof(*current));
+
+	i = 0;
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+
+		if (!dest->status_stanzas)
+			dest->status_stanzas = status_stanzas_new();
+
+		current[i++] = status_stanzas_new();
+
+		journal_file = status_journal_file_name(dest);
+		dest->status_fp = fopen(journal_file, "a");
+		if (dest->status_fp == NULL && errno != EROFS) {
+			opkg_perror(ERROR, "Can't open status journal %s",
+				    journal_file);
+			ret = -1;
+		}
+		free(journal_file);
+	}
+
+	all = pkg_vec_alloc();
+	pkg_hash_fetch_available(all);
+
+	for (i = 0; i < all->len; i++) {
+		pkg = all->pkgs[i];
+
+		if (!pkg_status_is_recorded(pkg))
+			continue;
+
+		if (pkg->dest == NULL) {
+			opkg_msg(ERROR,
+				 "Internal error: package %s has a NULL dest\n",
+				 pkg->name);
+			continue;
+		}
+
+		if (!pkg->dest->status_fp)
+			continue;
+
+		stanza = pkg_status_stanza(pkg);
+		key = stanza_key(stanza);
+
+		old = hash_table_get(pkg->dest->status_stanzas, key);
+		if (!old || strcmp(old, stanza))
+			fprintf(pkg->dest->status_fp, "%s\n", stanza);
+
+		if (hash_table_get(current[dest_index(pkg->dest)], key))
+			free(stanza);
+		else
+			hash_table_insert(current[dest_index(pkg->dest)], key,
+					  stanza);
+
+		free(key);
+	}
+
+	pkg_vec_free(all);
+
+	i = 0;
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+
+		if (!dest->status_fp) {
+			hash_table_foreach(current[i], free_stanza, NULL);
+			hash_table_deinit(current[i]);
+			free(current[i++]);
+			continue;
+		}
+
+		state.dest = dest;
+		state.current = current[i];
+		hash_table_foreach(dest->status_stanzas, journal_write_removed,
+				   &state);
+
+		status_journal_free(dest);
+		dest->status_stanzas = current[i++];
+
+		if (fclose(dest->status_fp) == EOF) {
+			opkg_perror(ERROR, "Couldn't close journal of %s",
+				    dest->status_file_name);
+			ret = -1;
+		}
+		dest->status_fp = NULL;
+
+		journal_file = status_journal_file_name(dest);
+		if (!stat(journal_file, &st_journal)
+		    && (stat(dest->status_file_name, &st_status)
+			|| st_journal.st_size > st_status.st_size))
+			compact = 1;
+		free(journal_file);
+	}
+
+	free(current);
+
+	return ret ? ret : compact;
+}
+
+/*
+ * Called once the status files have been rewritten in full: the journals
+ * are obsolete and the remembered stanzas are taken from the packages.
+ */
+void status_journal_reset(void)
+{
+	pkg_dest_list_elt_t *iter;
+	pkg_dest_t *dest;
+	pkg_vec_t *all;
+	pkg_t *pkg;
+	char *journal_file, *stanza, *key;
+	int i;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		dest = (pkg_dest_t *) iter->data;
+
+		journal_file = status_journal_file_name(dest);
+		if (unlink(journal_file) && errno != ENOENT)
+			opkg_perror(ERROR, "Failed to remove %s", journal_file);
+		free(journal_file);
+
+		status_journal_free(dest);
+
+		if (conf->status_journal)
+			dest->status_stanzas = status_stanzas_new();
+	}
+
+	if (!conf->status_journal)
+		return;
+
+	all = pkg_vec_alloc();
+	pkg_hash_fetch_available(all);
+
+	for (i = 0; i < all->len; i++) {
+		pkg = all->pkgs[i];
+
+		if (!pkg_status_is_recorded(pkg) || !pkg->dest)
+			continue;
+
+		stanza = pkg_status_stanza(pkg);
+		key = stanza_key(stanza);
+
+		if (hash_table_get(pkg->dest->status_stanzas, key))
+			free(stanza);
+		else
+			hash_table_insert(pkg->dest->status_stanzas, key, stanza);
+
+		free(key);
+	}
+
+	pkg_vec_free(all);
+}
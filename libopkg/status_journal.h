@@ -0,0 +1,38 @@
+/* status_journal.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef STATUS_JOURNAL_H
+#define STATUS_JOURNAL_H
+
+#include "pkg.h"
+#include "pkg_dest.h"
+
+/*
+ * With "option status_journal 1", status changes are appended to
+ * <status>.journal as complete status stanzas instead of rewriting the
+ * status file. A stanza starting with "Removed: yes" drops the package
+ * with the same Package, Version and Architecture. The journal is
+ * replayed on top of the status file when loading and merged back into
+ * it once it grows larger than the status file itself.
+ */
+
+int pkg_status_is_recorded(pkg_t *pkg);
+
+char *status_journal_file_name(pkg_dest_t *dest);
+int status_journal_load(pkg_dest_t *dest, void (*cb)(pkg_t *, void *),
+			void *priv);
+int status_journal_write(void);
+void status_journal_reset(void);
+void status_journal_free(pkg_dest_t *dest);
+
+#endif
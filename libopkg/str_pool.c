@@ -0,0 +1,89 @@
+/* str_pool.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <libubox/blob.h>
+
+#include "str_pool.h"
+#include "hash_table.h"
+#include "libbb/libbb.h"
+
+static hash_table_t pool;
+
+static struct {
+	unsigned int n_atoms;
+	unsigned int n_refs;
+	unsigned long atom_bytes;
+	unsigned long ref_bytes;
+} stats;
+
+const char *str_pool_intern(const char *s, size_t len)
+{
+	char buf[256], *key, *atom;
+
+	if (len < sizeof(buf)) {
+		memcpy(buf, s, len);
+		buf[len] = '\0';
+		key = buf;
+	} else {
+		key = xstrndup(s, len);
+	}
+
+	if (!pool.entries)
+		hash_table_init("str-pool", &pool, 256);
+
+	atom = hash_table_get(&pool, key);
+	if (!atom) {
+		atom = xstrndup(s, len);
+		hash_table_insert(&pool, atom, atom);
+		stats.n_atoms++;
+		/* the atom itself and the key copy held by the table */
+		stats.atom_bytes += 2 * (len + 1);
+	}
+
+	/* what a copy of the string in a package blob would have cost */
+	stats.n_refs++;
+	stats.ref_bytes += (len + 1 + BLOB_ATTR_ALIGN - 1) & ~(BLOB_ATTR_ALIGN - 1);
+
+	if (key != buf)
+		free(key);
+
+	return atom;
+}
+
+void str_pool_print_stats(void)
+{
+	unsigned long pointer_bytes = stats.n_refs * sizeof(char *);
+	long saved = stats.ref_bytes - pointer_bytes - stats.atom_bytes;
+
+	printf("str_pool: %u atoms, %u references\n"
+	       "\tatom_bytes=%lu, copies_bytes=%lu, saved_bytes=%ld\n",
+	       stats.n_atoms, stats.n_refs, stats.atom_bytes,
+	       stats.ref_bytes, saved);
+}
+
+static void free_atom(const char *key, void *entry, void *data)
+{
+	free(entry);
+}
+
+void str_pool_deinit(void)
+{
+	if (!pool.entries)
+		return;
+
+	hash_table_foreach(&pool, free_atom, NULL);
+	hash_table_deinit(&pool);
+	memset(&stats, 0, sizeof(stats));
+}
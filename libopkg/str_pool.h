@@ -0,0 +1,29 @@
+/* str_pool.h - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef STR_POOL_H
+#define STR_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Global pool of shared, immutable strings. Equal strings interned into
+ * the pool yield the same pointer, which stays valid until
+ * str_pool_deinit().
+ */
+
+const char *str_pool_intern(const char *s, size_t len);
+void str_pool_print_stats(void);
+void str_pool_deinit(void);
+
+#endif
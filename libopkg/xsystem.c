@@ -17,22 +17,18 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "xsystem.h"
 #include "libbb/libbb.h"
 
-/* Like system(3), but with error messages printed if the fork fails
-   or if the child process dies due to an uncaught signal. Also, the
-   return value is a bit simpler:
-
-   -1 if there was any problem
-   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
-   as defined in <sys/wait.h>.
+/* Start argv[0] with the given arguments without waiting for it.
+   Returns the pid of the child or -1 if the fork failed.
 */
-int xsystem(const char *argv[])
+pid_t xsystem_start(const char *argv[])
 {
-	int status;
 	pid_t pid;
 
 	pid = vfork();
@@ -50,23 +46,129 @@ int xsystem(const char *argv[])
 		break;
 	}
 
-	if (waitpid(pid, &status, 0) == -1) {
-		opkg_perror(ERROR, "%s: waitpid", argv[0]);
+	return pid;
+}
+
+/* Start argv[0] like xsystem_start(), with its standard output going to
+   a pipe. The reading end is returned in *fd; it is not inherited by
+   children started later, so the end of the output is seen as soon as
+   this child exits.
+*/
+pid_t xsystem_start_pipe(const char *argv[], int *fd)
+{
+	int p[2];
+	pid_t pid;
+
+	if (pipe(p) == -1) {
+		opkg_perror(ERROR, "%s: pipe", argv[0]);
+		return -1;
+	}
+
+	fcntl(p[0], F_SETFD, FD_CLOEXEC);
+	fcntl(p[1], F_SETFD, FD_CLOEXEC);
+
+	pid = vfork();
+
+	switch (pid) {
+	case -1:
+		opkg_perror(ERROR, "%s: vfork", argv[0]);
+		close(p[0]);
+		close(p[1]);
 		return -1;
+	case 0:
+		/* child */
+		if (dup2(p[1], STDOUT_FILENO) == -1)
+			_exit(-1);
+		execvp(argv[0], (char *const *)argv);
+		_exit(-1);
+	default:
+		/* parent */
+		break;
 	}
 
+	close(p[1]);
+	*fd = p[0];
+
+	return pid;
+}
+
+static int xsystem_status(const char *name, int status)
+{
 	if (WIFSIGNALED(status)) {
 		opkg_msg(ERROR, "%s: Child killed by signal %d.\n",
-			 argv[0], WTERMSIG(status));
+			 name, WTERMSIG(status));
 		return -1;
 	}
 
 	if (!WIFEXITED(status)) {
 		/* shouldn't happen */
 		opkg_msg(ERROR, "%s: Your system is broken: got status %d "
-			 "from waitpid.\n", argv[0], status);
+			 "from waitpid.\n", name, status);
 		return -1;
 	}
 
 	return WEXITSTATUS(status);
 }
+
+/* Wait for a child started by xsystem_start(). Returns like xsystem().
+*/
+int xsystem_wait(const char *name, pid_t pid)
+{
+	int status;
+	pid_t ret;
+
+	do {
+		ret = waitpid(pid, &status, 0);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1) {
+		opkg_perror(ERROR, "%s: waitpid", name);
+		return -1;
+	}
+
+	return xsystem_status(name, status);
+}
+
+/* xsystem_wait() without blocking. Returns 0 while the child is still
+   running, otherwise 1 with what xsystem_wait() would return in *res.
+*/
+int xsystem_reap(const char *name, pid_t pid, int *res)
+{
+	int status;
+	pid_t ret;
+
+	do {
+		ret = waitpid(pid, &status, WNOHANG);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == 0)
+		return 0;
+
+	if (ret == -1) {
+		opkg_perror(ERROR, "%s: waitpid", name);
+		*res = -1;
+	} else {
+		*res = xsystem_status(name, status);
+	}
+
+	return 1;
+}
+
+/* Like system(3), but with error messages printed if the fork fails
+   or if the child process dies due to an uncaught signal. Also, the
+   return value is a bit simpler:
+
+   -1 if there was any problem
+   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
+   as defined in <sys/wait.h>.
+*/
+int xsystem(const char *argv[])
+{
+	pid_t pid;
+
+	pid = xsystem_start(argv);
+	if (pid == -1)
+		return -1;
+
+	return xsystem_wait(argv[0], pid);
+}
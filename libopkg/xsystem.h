@@ -18,6 +18,8 @@
 #ifndef XSYSTEM_H
 #define XSYSTEM_H
 
+#include <sys/types.h>
+
 /* Like system(3), but with error messages printed if the fork fails
    or if the child process dies due to an uncaught signal. Also, the
    return value is a bit simpler:
@@ -28,4 +30,12 @@
 */
 int xsystem(const char *argv[]);
 
+/* xsystem() in two steps, so several programs can run at once */
+pid_t xsystem_start(const char *argv[]);
+int xsystem_wait(const char *name, pid_t pid);
+int xsystem_reap(const char *name, pid_t pid, int *res);
+/* xsystem_start() with the standard output of the child going to the
+   pipe whose reading end is returned in *fd */
+pid_t xsystem_start_pipe(const char *argv[], int *fd);
+
 #endif
@@ -279,6 +279,8 @@ static void usage()
 	printf("\tflag <flag> <pkgs>	Flag package(s)\n");
 	printf
 	    ("\t <flag>=hold|noprune|user|ok|installed|unpacked (one per invocation)\n");
+	printf
+	    ("\tcompact-status		Merge the status journal into the status file\n");
 
 	printf("\nInformational Commands:\n");
 	printf("\tlist			List available packages\n");
@@ -431,6 +433,7 @@ int main(int argc, char *argv[])
 	    !strcmp(cmd_name, "list_changed_conffiles") ||
 	    !strcmp(cmd_name, "list-changed-conffiles") ||
 	    !strcmp(cmd_name, "status") ||
+	    !strcmp(cmd_name, "compact-status") ||
 	    !strcmp(cmd_name, "update"))
 		noreadfeedsfile = 1;
 
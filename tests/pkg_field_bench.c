@@ -0,0 +1,121 @@
+/* pkg_field_bench.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Compares the cost of pkg_get_*() through blob_index with the linear
+ * blob scan every field access used to do.
+ *
+ * Usage: pkg_field_bench [n_pkgs] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <libopkg/pkg.h>
+#include "bench.h"
+
+/* the fields hot paths like pkg_compare_versions() look at */
+static const int hot_fields[] = {
+	PKG_EPOCH, PKG_VERSION, PKG_REVISION, PKG_DEPENDS, PKG_PROVIDES
+};
+
+#define N_HOT_FIELDS (sizeof(hot_fields) / sizeof(hot_fields[0]))
+
+static pkg_t *bench_pkg_new(int i)
+{
+	pkg_t *pkg = pkg_new();
+	char buf[64];
+
+	/* roughly the order fields appear in a Packages stanza */
+	snprintf(buf, sizeof(buf), "1.%d.%d", i % 97, i % 13);
+	pkg_set_string(pkg, PKG_VERSION, buf);
+	pkg_set_ptr(pkg, PKG_DEPENDS, NULL);
+	pkg_set_string(pkg, PKG_SOURCE, "package/utils/bench");
+	pkg_set_string(pkg, PKG_SECTION, "utils");
+	pkg_set_string(pkg, PKG_MAINTAINER, "Bench <bench@example.org>");
+	pkg_set_int(pkg, PKG_SIZE, 1000 + i);
+	pkg_set_int(pkg, PKG_INSTALLED_SIZE, 4000 + i);
+	snprintf(buf, sizeof(buf), "bench%d_1.0-1_all.ipk", i);
+	pkg_set_string(pkg, PKG_FILENAME, buf);
+	pkg_set_string(pkg, PKG_DESCRIPTION,
+		       "A package description long enough to resemble the "
+		       "ones found in real feeds.");
+	pkg_set_ptr(pkg, PKG_PROVIDES, NULL);
+	pkg_set_int(pkg, PKG_EPOCH, i % 3);
+	pkg_set_string(pkg, PKG_REVISION, "1");
+
+	return pkg;
+}
+
+static double bench(pkg_t **pkgs, int n_pkgs, int rounds,
+		    void *(*get)(const pkg_t *, int), unsigned long *sum)
+{
+	double start = now();
+	int r, i, j;
+
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n_pkgs; i++)
+			for (j = 0; j < N_HOT_FIELDS; j++)
+				*sum += (unsigned long)get(pkgs[i],
+							   hot_fields[j]);
+
+	return now() - start;
+}
+
+static void *indexed_get(const pkg_t *pkg, int id)
+{
+	return pkg_get_raw(pkg, id);
+}
+
+int main(int argc, char *argv[])
+{
+	int n_pkgs = argc > 1 ? atoi(argv[1]) : 10000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 100;
+	unsigned long sum_scan = 0, sum_index = 0;
+	size_t grown = 0, shrunk = 0;
+	double t_scan, t_index, n_get;
+	pkg_t **pkgs;
+	int i;
+
+	if (n_pkgs <= 0 || rounds <= 0) {
+		fprintf(stderr, "Usage: %s [n_pkgs] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	pkgs = calloc(n_pkgs, sizeof(*pkgs));
+
+	for (i = 0; i < n_pkgs; i++) {
+		pkgs[i] = bench_pkg_new(i);
+		grown += pkgs[i]->blob.buflen;
+		pkg_shrink_blob(pkgs[i]);
+		shrunk += pkgs[i]->blob.buflen;
+	}
+
+	t_scan = bench(pkgs, n_pkgs, rounds, pkg_find_raw, &sum_scan);
+	t_index = bench(pkgs, n_pkgs, rounds, indexed_get, &sum_index);
+
+	if (sum_scan != sum_index) {
+		fprintf(stderr, "Indexed and scanned lookups disagree.\n");
+		return 1;
+	}
+
+	n_get = (double)n_pkgs * rounds * N_HOT_FIELDS;
+
+	printf("%d packages, %d rounds, %.0f lookups\n", n_pkgs, rounds, n_get);
+	printf("blob scan: %8.2f ns/lookup\n", t_scan * 1e9 / n_get);
+	printf("indexed:   %8.2f ns/lookup\n", t_index * 1e9 / n_get);
+	printf("blob bytes/pkg: %zu grown, %zu shrunk + %zu index\n",
+	       grown / n_pkgs, shrunk / n_pkgs,
+	       sizeof(pkgs[0]->blob_index));
+
+	return 0;
+}
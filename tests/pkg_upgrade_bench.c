@@ -0,0 +1,185 @@
+/* pkg_upgrade_bench.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Resolves the plan of upgrading every installed package of an offline
+ * root, as "opkg upgrade <all installed>" does before touching anything:
+ * the best candidate of each package, and the dependencies it would pull
+ * in. Also times sorting the available packages by name and version, and
+ * checking every versioned dependency against every package it names.
+ *
+ * Usage: pkg_upgrade_bench [-r rounds] offline_root
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <opkg.h>
+#include <libopkg/opkg_conf.h>
+#include <libopkg/pkg.h>
+#include <libopkg/pkg_hash.h>
+#include <libopkg/sprintf_alloc.h>
+#include "bench.h"
+
+static int plan(pkg_vec_t *installed, pkg_vec_t *available, int *n_deps)
+{
+	pkg_vec_t *deps = pkg_vec_alloc();
+	char **unresolved, **u;
+	pkg_t *old, *new;
+	int i, n_upgrades = 0;
+
+	for (i = 0; i < available->len; i++)
+		available->pkgs[i]->parent->dependencies_checked = 0;
+
+	*n_deps = 0;
+
+	for (i = 0; i < installed->len; i++) {
+		old = installed->pkgs[i];
+		new = pkg_hash_fetch_best_installation_candidate_by_name(old->name);
+		if (!new || pkg_compare_versions(old, new) >= 0)
+			continue;
+
+		n_upgrades++;
+
+		unresolved = NULL;
+		pkg_hash_fetch_unsatisfied_dependencies(new, deps, &unresolved);
+		*n_deps += deps->len;
+		deps->len = 0;
+
+		for (u = unresolved; u && *u; u++)
+			free(*u);
+		free(unresolved);
+	}
+
+	pkg_vec_free(deps);
+
+	return n_upgrades;
+}
+
+static int check_constraints(pkg_vec_t *available)
+{
+	compound_depend_t *cdep;
+	depend_t *d;
+	pkg_vec_t *pkgs;
+	int i, j, k, n_satisfied = 0;
+
+	for (i = 0; i < available->len; i++)
+		for (cdep = pkg_get_ptr(available->pkgs[i], PKG_DEPENDS);
+		     cdep && cdep->type; cdep++)
+			for (j = 0; j < cdep->possibility_count; j++) {
+				d = cdep->possibilities[j];
+				pkgs = d->pkg->pkgs;
+				for (k = 0; pkgs && k < pkgs->len; k++)
+					n_satisfied += version_constraints_satisfied(d, pkgs->pkgs[k]);
+			}
+
+	return n_satisfied;
+}
+
+static int count_checks(pkg_vec_t *available)
+{
+	compound_depend_t *cdep;
+	int i, j, n = 0;
+
+	for (i = 0; i < available->len; i++)
+		for (cdep = pkg_get_ptr(available->pkgs[i], PKG_DEPENDS);
+		     cdep && cdep->type; cdep++)
+			for (j = 0; j < cdep->possibility_count; j++)
+				if (cdep->possibilities[j]->pkg->pkgs)
+					n += cdep->possibilities[j]->pkg->pkgs->len;
+
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	double t, t_load, t_plan, t_sort, t_check;
+	int rounds = 10, opt, i, r, n_upgrades = 0, n_deps = 0, n_sat = 0;
+	pkg_vec_t *installed, *available, *sorted;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || rounds <= 0)
+		goto usage;
+
+	conf->offline_root = strdup(argv[optind]);
+	sprintf_alloc(&conf->conf_file, "%s/etc/opkg/opkg.conf",
+		      conf->offline_root);
+
+	t = now();
+	if (opkg_new()) {
+		fprintf(stderr, "Failed to load %s.\n", conf->offline_root);
+		return 1;
+	}
+	t_load = now() - t;
+
+	installed = pkg_vec_alloc();
+	available = pkg_vec_alloc();
+	sorted = pkg_vec_alloc();
+	pkg_hash_fetch_all_installed(installed);
+	pkg_hash_fetch_available(available);
+
+	/*
+	 * Resolving leaves marks on packages that later rounds see, just
+	 * like the rest of an opkg run would: time the rounds after that.
+	 */
+	plan(installed, available, &n_deps);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		n_upgrades = plan(installed, available, &n_deps);
+	t_plan = now() - t;
+
+	t = now();
+	for (r = 0; r < rounds; r++) {
+		sorted->len = 0;
+		for (i = 0; i < available->len; i++)
+			pkg_vec_insert(sorted, available->pkgs[i]);
+		pkg_vec_sort(sorted, pkg_name_version_and_architecture_compare);
+	}
+	t_sort = now() - t;
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		n_sat = check_constraints(available);
+	t_check = now() - t;
+
+	printf("%d installed, %d available, loaded in %.1f ms\n",
+	       installed->len, available->len, t_load * 1e3);
+	printf("upgrade plan: %8.2f ms (%d upgrades, %d dependencies)\n",
+	       t_plan * 1e3 / rounds, n_upgrades, n_deps);
+	printf("sort:         %8.2f ms\n", t_sort * 1e3 / rounds);
+	printf("constraints:  %8.2f ns/check (%d checks, %d satisfied)\n",
+	       t_check * 1e9 / rounds / count_checks(available),
+	       count_checks(available), n_sat);
+
+	pkg_vec_free(sorted);
+	pkg_vec_free(available);
+	pkg_vec_free(installed);
+	opkg_free();
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-r rounds] offline_root\n", argv[0]);
+	return 1;
+}
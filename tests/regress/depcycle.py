@@ -0,0 +1,54 @@
+#!/usr/bin/python3
+
+import os, time
+import opk, cfg, opkgcl
+
+opk.regress_init()
+
+# b 2.0 is only resolvable through a, which lacks x. Whether a or b is
+# looked at first, b 1.0 must be picked.
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Architecture="all", Depends="b, x")
+o.add(Package="b", Version="2.0", Architecture="all", Depends="a")
+o.add(Package="b", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+
+for args in ["a b", "b a"]:
+	opkgcl.install(args)
+
+	if opkgcl.is_installed("a"):
+		print(__file__, ": Package 'a' installed without 'x'.")
+		exit(False)
+
+	if not opkgcl.is_installed("b", "1.0"):
+		print(__file__, ": Package 'b' 1.0 not installed by "
+			"'install {}'.".format(args))
+		exit(False)
+
+	opkgcl.remove("b")
+
+# every package of a large cycle is only checked once
+o = opk.OpkGroup()
+for i in range(40):
+	o.add(Package="c{}".format(i), Version="1.0", Architecture="all",
+		Depends=", ".join("c{}".format((i + j) % 40) for j in [1, 7, 13]))
+o.write_opk()
+o.write_list()
+
+opkgcl.update()
+
+start = time.time()
+opkgcl.install("c0")
+
+if time.time() - start > 10:
+	print(__file__, ": Checking a cycle of 40 packages took {:.1f}s.".format(
+		time.time() - start))
+	exit(False)
+
+for i in range(40):
+	if not opkgcl.is_installed("c{}".format(i)):
+		print(__file__, ": Package 'c{}' not installed.".format(i))
+		exit(False)
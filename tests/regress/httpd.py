@@ -0,0 +1,60 @@
+#!/usr/bin/python3
+
+import functools, http.server, os, threading
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+	disable_nagle_algorithm = True
+
+	def setup(self):
+		super().setup()
+		self.server.connections += 1
+
+	def handle_one_request(self):
+		super().handle_one_request()
+		# close without saying so, as servers do with idle connections
+		if self.server.drop:
+			self.close_connection = True
+
+	def do_GET(self):
+		self.server.requests += 1
+		if not self.server.chunked:
+			return super().do_GET()
+
+		path = self.translate_path(self.path)
+		if not os.path.isfile(path):
+			return self.send_error(404)
+		data = open(path, "rb").read()
+		self.send_response(200)
+		self.send_header("Transfer-Encoding", "chunked")
+		self.end_headers()
+		for i in range(0, len(data), 1000):
+			chunk = data[i:i + 1000]
+			self.wfile.write(b"%x\r\n%s\r\n" % (len(chunk), chunk))
+		self.wfile.write(b"0\r\n\r\n")
+
+	def log_message(self, *args):
+		pass
+
+class Server(http.server.ThreadingHTTPServer):
+	"""
+	Serves directory over HTTP/1.1 with keep-alive on 127.0.0.1, counting
+	the connections and requests it gets.
+	"""
+
+	daemon_threads = True
+
+	def __init__(self, directory):
+		super().__init__(("127.0.0.1", 0),
+			functools.partial(Handler, directory=directory))
+		self.drop = False
+		self.chunked = False
+		self.reset()
+		threading.Thread(target=self.serve_forever, daemon=True).start()
+
+	def url(self):
+		return "http://127.0.0.1:{}".format(self.server_address[1])
+
+	def reset(self):
+		self.connections = 0
+		self.requests = 0
@@ -0,0 +1,87 @@
+#!/usr/bin/python3
+
+import os
+import opk, cfg, opkgcl, httpd
+
+opk.regress_init()
+
+o = opk.OpkGroup()
+o.add(Package="a", Version="1.0", Architecture="all", Depends="b, c")
+o.add(Package="b", Version="1.0", Architecture="all")
+o.add(Package="c", Version="1.0", Architecture="all")
+o.write_opk()
+o.write_list()
+
+server = httpd.Server(cfg.opkdir)
+
+conf_file = "{}/etc/opkg/opkg.conf".format(cfg.offline_root)
+conf = open(conf_file).read()
+conf = conf.replace("file:{}".format(cfg.opkdir), server.url())
+open(conf_file, "w").write(conf + "option download_jobs 1\n")
+
+if opkgcl.update() != 0:
+	print(__file__, ": Update over http failed.")
+	exit(False)
+
+server.reset()
+opkgcl.install("a")
+
+for p in ["a", "b", "c"]:
+	if not opkgcl.is_installed(p):
+		print(__file__, ": Package '{}' not installed.".format(p))
+		exit(False)
+
+if server.requests != 3 or server.connections != 1:
+	print(__file__, ": {} packages took {} connections.".format(
+		server.requests, server.connections))
+	exit(False)
+
+opkgcl.remove("a")
+opkgcl.remove("b")
+opkgcl.remove("c")
+
+# a missing package must not spoil the connection for the next one
+os.rename("c_1.0_all.opk", "c.opk")
+server.reset()
+opkgcl.install("a")
+
+if opkgcl.is_installed("c") or not opkgcl.is_installed("b"):
+	print(__file__, ": Missing package 'c' went unnoticed.")
+	exit(False)
+
+if server.connections != 1:
+	print(__file__, ": Connection not reused after an error.")
+	exit(False)
+
+os.rename("c.opk", "c_1.0_all.opk")
+opkgcl.remove("b")
+
+# connections closed by the server while idle are opened again
+server.drop = True
+opkgcl.install("a")
+
+for p in ["a", "b", "c"]:
+	if not opkgcl.is_installed(p):
+		print(__file__, ": Package '{}' not installed after the server "
+			"closed the connection.".format(p))
+		exit(False)
+
+opkgcl.remove("a")
+opkgcl.remove("b")
+opkgcl.remove("c")
+
+server.drop = False
+server.chunked = True
+opkgcl.install("a")
+
+for p in ["a", "b", "c"]:
+	if not opkgcl.is_installed(p):
+		print(__file__, ": Package '{}' not installed from a chunked "
+			"response.".format(p))
+		exit(False)
+
+opkgcl.remove("a")
+opkgcl.remove("b")
+opkgcl.remove("c")
+
+server.shutdown()
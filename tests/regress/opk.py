@@ -16,7 +16,7 @@ class Opk:
 						"{}".format(k))
 		self.control = control
 
-	def write(self, tar_not_ar=False, data_files=None):
+	def write(self, tar_not_ar=True, data_files=None):
 		filename = "{Package}_{Version}_{Architecture}.opk"\
 						.format(**self.control)
 		if os.path.exists(filename):
@@ -33,11 +33,13 @@ class Opk:
 			f.write("{}: {}\n".format(k, self.control[k]))
 		f.close()
 
-		tar = tarfile.open("control.tar.gz", "w:gz")
+		tar = tarfile.open("control.tar.gz", "w:gz",
+				   format=tarfile.GNU_FORMAT)
 		tar.add("control")
 		tar.close()
 
-		tar = tarfile.open("data.tar.gz", "w:gz")
+		tar = tarfile.open("data.tar.gz", "w:gz",
+				   format=tarfile.GNU_FORMAT)
 		if data_files:
 			for df in data_files:
 				tar.add(df)
@@ -45,7 +47,8 @@ class Opk:
 
 
 		if tar_not_ar:
-			tar = tarfile.open(filename, "w:gz")
+			tar = tarfile.open(filename, "w:gz",
+					   format=tarfile.GNU_FORMAT)
 			tar.add("control.tar.gz")
 			tar.add("data.tar.gz")
 			tar.close()
@@ -64,7 +67,7 @@ class OpkGroup:
 	def add(self, **control):
 		self.opk_list.append(Opk(**control))
 	
-	def write_opk(self, tar_not_ar=False):
+	def write_opk(self, tar_not_ar=True):
 		for o in self.opk_list:
 			o.write(tar_not_ar)
 
@@ -0,0 +1,148 @@
+/* sha256_bench.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Checks every SHA-256 back end the CPU supports against known digests
+ * and against the generic one on buffers of every length up to a few
+ * blocks, then reports the throughput of each on a larger buffer.
+ *
+ * Usage: sha256_bench [-s megabytes] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sha256.h"
+#include "bench.h"
+
+static const struct {
+	const char *msg;
+	const char *digest;
+} vectors[] = {
+	{ "",
+	  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ "abc",
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+};
+
+static void hex(char *out, const unsigned char *bin)
+{
+	int i;
+
+	for (i = 0; i < 32; i++)
+		sprintf(out + i * 2, "%02x", bin[i]);
+}
+
+static int check(const char *name, const unsigned char *ref_data,
+		 unsigned char (*ref)[32], size_t max_len)
+{
+	uint32_t bin[8];
+	char out[65];
+	size_t i;
+	int bad = 0;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		sha256_buffer(vectors[i].msg, strlen(vectors[i].msg), bin);
+		hex(out, (unsigned char *)bin);
+		if (strcmp(out, vectors[i].digest)) {
+			fprintf(stderr, "%s: wrong digest of \"%s\"\n", name,
+				vectors[i].msg);
+			bad++;
+		}
+	}
+
+	for (i = 0; i <= max_len; i++) {
+		sha256_buffer((const char *)ref_data, i, bin);
+		if (memcmp(bin, ref[i], 32)) {
+			fprintf(stderr, "%s: wrong digest of %zu bytes\n",
+				name, i);
+			bad++;
+		}
+	}
+
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = 64, max_len = 320, i;
+	int rounds = 5, opt, r, bad = 0;
+	unsigned char (*ref)[32];
+	unsigned char *data;
+	const char *name;
+	uint32_t bin[8];
+	double t;
+
+	while ((opt = getopt(argc, argv, "s:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s megabytes] [-r rounds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	size <<= 20;
+	data = malloc(size + max_len);
+	ref = malloc((max_len + 1) * sizeof(*ref));
+	if (!data || !ref)
+		return 1;
+
+	srand(1);
+	for (i = 0; i < size + max_len; i++)
+		data[i] = rand();
+
+	sha256_set_backend("generic");
+	for (i = 0; i <= max_len; i++)
+		sha256_buffer((const char *)data, i, ref[i]);
+
+	sha256_set_backend(NULL);
+	printf("default back end: %s\n", sha256_get_backend());
+
+	for (i = 0; (name = sha256_backend_name(i)); i++) {
+		if (sha256_set_backend(name)) {
+			printf("%-8s  not supported\n", name);
+			continue;
+		}
+
+		bad += check(name, data, ref, max_len);
+
+		/* hashed unaligned, as a buffer read from a file may be */
+		t = now();
+		for (r = 0; r < rounds; r++)
+			sha256_buffer((const char *)data + 1, size, bin);
+		t = now() - t;
+
+		printf("%-8s  %8.1f MB/s\n", name,
+		       (double)size * rounds / t / 1e6);
+	}
+
+	free(ref);
+	free(data);
+
+	if (bad)
+		fprintf(stderr, "%d wrong digests\n", bad);
+
+	return bad ? 1 : 0;
+}
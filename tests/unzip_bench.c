@@ -0,0 +1,403 @@
+/* unzip_bench.c - the opkg package management system
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Measures the inflater on real package payloads: pulled through
+ * unzip_read(), pushed through unzip_feed(), decoded by several threads
+ * at once, and piped through an external gzip as opkg used to. For .ipk
+ * files the data.tar.gz and control.tar.gz members are measured as well.
+ * Also compares the slice-by-8 crc32 with the bytewise one.
+ *
+ * Usage: unzip_bench [-r rounds] [-t threads] file.ipk|file.gz ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libbb/unzip.h>
+#include "bench.h"
+
+struct payload {
+	char name[128];
+	unsigned char *data;
+	size_t len;
+	size_t out_len;
+	uint32_t out_crc;
+};
+
+struct mem_src {
+	const unsigned char *data;
+	size_t len, pos;
+};
+
+struct sink {
+	size_t len;
+};
+
+static struct payload *payloads;
+static int n_payloads;
+static int rounds = 10;
+
+static ssize_t mem_read(void *priv, void *buf, size_t len)
+{
+	struct mem_src *src = priv;
+
+	if (len > src->len - src->pos)
+		len = src->len - src->pos;
+
+	memcpy(buf, src->data + src->pos, len);
+	src->pos += len;
+
+	return len;
+}
+
+static ssize_t sink_write(void *priv, const void *buf, size_t len)
+{
+	struct sink *sink = priv;
+
+	sink->len += len;
+
+	return len;
+}
+
+/* decode through the pull interface, returns the output length or -1 */
+static ssize_t pull_decode(const struct payload *p, uint32_t *crc)
+{
+	struct mem_src src = { p->data, p->len, 0 };
+	struct unzip_ctx *ctx = unzip_open(mem_read, &src);
+	unsigned char buf[4096];
+	ssize_t n, total = 0;
+
+	while ((n = unzip_read(ctx, buf, sizeof(buf))) > 0) {
+		if (crc)
+			*crc = unzip_crc32(*crc, buf, n);
+		total += n;
+	}
+
+	if (unzip_close(ctx) || n < 0)
+		return -1;
+
+	return total;
+}
+
+static ssize_t push_decode(const struct payload *p)
+{
+	struct sink sink = { 0 };
+	struct unzip_ctx *ctx = unzip_init(sink_write, &sink);
+	size_t off, n;
+
+	for (off = 0; off < p->len; off += n) {
+		n = p->len - off < 4096 ? p->len - off : 4096;
+		if (unzip_feed(ctx, p->data + off, n))
+			break;
+	}
+
+	if (unzip_finish(ctx))
+		return -1;
+
+	return sink.len;
+}
+
+static ssize_t gunzip_decode(const struct payload *p)
+{
+	char path[] = "/tmp/unzip_bench.XXXXXX";
+	char cmd[64], buf[4096];
+	ssize_t n, total = 0;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, p->data, p->len) != p->len) {
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	close(fd);
+
+	snprintf(cmd, sizeof(cmd), "gzip -dc %s", path);
+	fp = popen(cmd, "r");
+	if (fp) {
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			total += n;
+		if (pclose(fp))
+			total = -1;
+	}
+
+	unlink(path);
+
+	return fp ? total : -1;
+}
+
+static uint32_t crc32_bytewise(uint32_t crc, const unsigned char *p,
+			       size_t len)
+{
+	static uint32_t table[256];
+	uint32_t c;
+	int i, j;
+
+	if (!table[1])
+		for (i = 0; i < 256; i++) {
+			for (c = i, j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+			table[i] = c;
+		}
+
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static void *thread_decode(void *arg)
+{
+	int i, r, failed = 0;
+	uint32_t crc;
+
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n_payloads; i++) {
+			crc = 0;
+			if (pull_decode(&payloads[i], &crc) !=
+			    payloads[i].out_len || crc != payloads[i].out_crc)
+				failed = 1;
+		}
+
+	return failed ? payloads : NULL;
+}
+
+static void add_payload(const char *name, const unsigned char *data,
+			size_t len)
+{
+	struct payload *p;
+
+	payloads = realloc(payloads, (n_payloads + 1) * sizeof(*payloads));
+	p = &payloads[n_payloads++];
+
+	snprintf(p->name, sizeof(p->name), "%s", name);
+	p->data = malloc(len);
+	memcpy(p->data, data, len);
+	p->len = len;
+}
+
+/* the whole decoded stream in a malloc'ed buffer */
+static unsigned char *decode_all(const struct payload *p, size_t *len)
+{
+	struct mem_src src = { p->data, p->len, 0 };
+	struct unzip_ctx *ctx = unzip_open(mem_read, &src);
+	unsigned char *buf = NULL;
+	ssize_t n;
+
+	*len = 0;
+	do {
+		buf = realloc(buf, *len + 65536);
+		n = unzip_read(ctx, buf + *len, 65536);
+		*len += n > 0 ? n : 0;
+	} while (n > 0);
+	unzip_close(ctx);
+
+	return buf;
+}
+
+/* the compressed tar members of an .ipk, which is a gzipped tar itself */
+static void add_ipk_members(const char *name, const struct payload *outer)
+{
+	unsigned char *tar, hdr[512];
+	size_t tar_len, off, size;
+	char member[256];
+
+	tar = decode_all(outer, &tar_len);
+
+	for (off = 0; off + sizeof(hdr) <= tar_len;) {
+		memcpy(hdr, tar + off, sizeof(hdr));
+		if (!hdr[0])
+			break;
+
+		hdr[135] = 0;
+		size = strtoul((char *)hdr + 124, NULL, 8);
+		off += sizeof(hdr);
+
+		if (off + size <= tar_len && size > 18 &&
+		    tar[off] == 0x1f && tar[off + 1] == 0x8b) {
+			hdr[99] = 0;
+			snprintf(member, sizeof(member), "%s:%s", name,
+				 (char *)hdr + (strncmp((char *)hdr, "./", 2) ? 0 : 2));
+			add_payload(member, tar + off, size);
+		}
+
+		off += (size + 511) & ~511;
+	}
+
+	free(tar);
+}
+
+static int load(const char *name)
+{
+	FILE *fp = fopen(name, "r");
+	struct payload file;
+	unsigned char *data = NULL;
+	size_t len = 0, n;
+
+	if (!fp) {
+		perror(name);
+		return -1;
+	}
+
+	do {
+		data = realloc(data, len + 65536);
+		n = fread(data + len, 1, 65536, fp);
+		len += n;
+	} while (n > 0);
+	fclose(fp);
+
+	add_payload(name, data, len);
+
+	file.data = data;
+	file.len = len;
+	if (len > 4 && !strcmp(name + strlen(name) - 4, ".ipk"))
+		add_ipk_members(name, &file);
+
+	free(data);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	double t, t_pull, t_push, t_gunzip, t_crc, t_crc8, mb;
+	size_t in_total = 0, out_total = 0, out_len;
+	int n_threads = 4, opt, i, r;
+	uint32_t crc, c1 = 0, c8 = 0;
+	pthread_t *threads;
+	unsigned char *out;
+	void *failed;
+
+	while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind >= argc || rounds <= 0 || n_threads <= 0)
+		goto usage;
+
+	for (i = optind; i < argc; i++)
+		if (load(argv[i]))
+			return 1;
+
+	printf("%-40s %9s %9s %8s %8s %8s\n", "payload", "in", "out",
+	       "pull", "push", "gzip -d");
+
+	for (i = 0; i < n_payloads; i++) {
+		struct payload *p = &payloads[i];
+
+		crc = 0;
+		if (pull_decode(p, &crc) < 0) {
+			fprintf(stderr, "%s: not a valid gzip stream\n", p->name);
+			return 1;
+		}
+		p->out_crc = crc;
+		p->out_len = pull_decode(p, NULL);
+
+		t = now();
+		for (r = 0; r < rounds; r++)
+			pull_decode(p, NULL);
+		t_pull = now() - t;
+
+		t = now();
+		for (r = 0; r < rounds; r++)
+			if (push_decode(p) != p->out_len) {
+				fprintf(stderr, "%s: push and pull disagree\n",
+					p->name);
+				return 1;
+			}
+		t_push = now() - t;
+
+		t = now();
+		for (r = 0; r < rounds; r++)
+			if (gunzip_decode(p) != p->out_len)
+				break;
+		t_gunzip = (r == rounds) ? now() - t : 0;
+
+		mb = (double)p->out_len * rounds / 1e6;
+		printf("%-40.40s %9zu %9zu %5.1f MB/s %5.1f MB/s ", p->name,
+		       p->len, p->out_len, mb / t_pull, mb / t_push);
+		if (t_gunzip)
+			printf("%5.1f MB/s\n", mb / t_gunzip);
+		else
+			printf("%10s\n", "-");
+
+		in_total += p->len;
+		out_total += p->out_len;
+	}
+
+	/* every thread decodes every payload with a context of its own */
+	threads = calloc(n_threads, sizeof(*threads));
+
+	t = now();
+	for (i = 0; i < n_threads; i++)
+		pthread_create(&threads[i], NULL, thread_decode, NULL);
+	for (i = 0; i < n_threads; i++) {
+		pthread_join(threads[i], &failed);
+		if (failed) {
+			fprintf(stderr, "Concurrent decoding went wrong.\n");
+			return 1;
+		}
+	}
+	t = now() - t;
+
+	printf("%d threads: %.1f MB/s total, %zu bytes in, %zu out\n",
+	       n_threads, (double)out_total * rounds * n_threads / 1e6 / t,
+	       in_total, out_total);
+
+	/* crc32 over decoded data, which is what unzip spends it on */
+	out = decode_all(&payloads[0], &out_len);
+
+	t = now();
+	for (r = 0; r < rounds * 10; r++)
+		c1 = crc32_bytewise(c1, out, out_len);
+	t_crc = now() - t;
+
+	t = now();
+	for (r = 0; r < rounds * 10; r++)
+		c8 = unzip_crc32(c8, out, out_len);
+	t_crc8 = now() - t;
+
+	if (c1 != c8) {
+		fprintf(stderr, "crc32 implementations disagree\n");
+		return 1;
+	}
+
+	mb = (double)out_len * rounds * 10 / 1e6;
+	printf("crc32: bytewise %.1f MB/s, slice-by-8 %.1f MB/s\n",
+	       mb / t_crc, mb / t_crc8);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-r rounds] [-t threads] file.ipk|file.gz ...\n",
+		argv[0]);
+	return 1;
+}